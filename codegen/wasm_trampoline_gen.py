@@ -65,10 +65,10 @@ def gen_trampoline(return_type, arguments, _freq):
     blah = ", ".join([f"{c_types[arg]} arg{i}" for i, arg in enumerate(old_args)])
 
     print(f"static {c_types[return_type]} interpreter_tramp_{name}(vm_thread *thread, cp_method *method{the_args} {blah}) {{")
-    print(f"  stack_value values[{len(old_args)}];")
+    print(f"  stack_value values[{max(len(old_args), 1)}];")
     for i, arg in enumerate(old_args):
         print(f"  values[{i}].{union_types[arg]} = arg{i};")
-    print(f"  [[maybe_unused]] stack_value result = call_interpreter_synchronous(thread, method, values);")
+    print(f"  [[maybe_unused]] stack_value result = jit_call_interpreter(thread, method, values);")
     if return_type != "V":
         print(f"  return result.{union_types[return_type]};")
     print("}")
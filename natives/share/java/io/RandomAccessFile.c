@@ -2,13 +2,12 @@
 
 DECLARE_NATIVE("java/io", RandomAccessFile, initIDs, "()V") { return value_null(); }
 
-static obj_header **get_fd(obj_header *obj) {
-  cp_field *field = field_lookup(obj->descriptor, STR("fd"), STR("Ljava/io/FileDescriptor;"));
-  return (void *)obj + field->byte_offset;
+static obj_header *get_fd(obj_header *obj) {
+  return LoadFieldObject(obj, "java/io/FileDescriptor", "fd");
 }
 
 static s64 *get_native_handle(obj_header *obj) {
-  cp_field *native_fd_field = field_lookup(obj->descriptor, STR("handle"), STR("J"));
+  cp_field *native_fd_field = field_lookup(obj_class(obj), STR("handle"), STR("J"));
   return (void *)obj + native_fd_field->byte_offset;
 }
 
@@ -16,7 +15,7 @@ DECLARE_NATIVE("java/io", RandomAccessFile, open0, "(Ljava/lang/String;I)V") {
   if (!args[0].handle->obj)
     return value_null();
   heap_string filename = AsHeapString(args[0].handle->obj, on_oom);
-  obj_header *fd = *get_fd(obj->obj);
+  obj_header *fd = get_fd(obj->obj);
   DCHECK(fd);
   FILE *file = fopen(filename.chars, "r");
   if (!file) {
@@ -31,7 +30,7 @@ on_oom:
 }
 
 DECLARE_NATIVE("java/io", RandomAccessFile, read0, "()I") {
-  obj_header *fd = *get_fd(obj->obj);
+  obj_header *fd = get_fd(obj->obj);
   DCHECK(fd);
   FILE *file = (FILE *)*get_native_handle(fd);
   if (!file) {
@@ -43,7 +42,7 @@ DECLARE_NATIVE("java/io", RandomAccessFile, read0, "()I") {
 }
 
 DECLARE_NATIVE("java/io", RandomAccessFile, seek0, "(J)V") {
-  obj_header *fd = *get_fd(obj->obj);
+  obj_header *fd = get_fd(obj->obj);
   DCHECK(fd);
   FILE *file = (FILE *)*get_native_handle(fd);
   if (!file) {
@@ -56,7 +55,7 @@ DECLARE_NATIVE("java/io", RandomAccessFile, seek0, "(J)V") {
 }
 
 DECLARE_NATIVE("java/io", RandomAccessFile, getFilePointer, "()J") {
-  obj_header *fd = *get_fd(obj->obj);
+  obj_header *fd = get_fd(obj->obj);
   DCHECK(fd);
   FILE *file = (FILE *)*get_native_handle(fd);
   if (!file) {
@@ -68,7 +67,7 @@ DECLARE_NATIVE("java/io", RandomAccessFile, getFilePointer, "()J") {
 }
 
 DECLARE_NATIVE("java/io", RandomAccessFile, close0, "()V") {
-  obj_header *fd = *get_fd(obj->obj);
+  obj_header *fd = get_fd(obj->obj);
   DCHECK(fd);
   FILE *file = (FILE *)*get_native_handle(fd);
   if (file) {
@@ -79,7 +78,7 @@ DECLARE_NATIVE("java/io", RandomAccessFile, close0, "()V") {
 }
 
 DECLARE_NATIVE("java/io", RandomAccessFile, length0, "()J") {
-  obj_header *fd = *get_fd(obj->obj);
+  obj_header *fd = get_fd(obj->obj);
   DCHECK(fd);
   FILE *file = (FILE *)*get_native_handle(fd);
   if (!file) {
@@ -92,7 +91,7 @@ DECLARE_NATIVE("java/io", RandomAccessFile, length0, "()J") {
 }
 
 DECLARE_NATIVE("java/io", RandomAccessFile, readBytes0, "([BII)I") {
-  object fd = *get_fd(obj->obj);
+  object fd = get_fd(obj->obj);
   assert(fd);
   FILE *file = (FILE *)*get_native_handle(fd);
   if (!file) {
@@ -66,18 +66,16 @@ DECLARE_NATIVE("java/lang", Class, getEnclosingMethod0, "()[Ljava/lang/Object;")
     return value_null();
   }
   handle *array = make_handle(thread, CreateObjectArray1D(thread, cached_classes(thread->vm)->object, 3));
-#define data ((obj_header **)ArrayData(array->obj))
 
   int error = resolve_class(thread, enclosing_method.class_info);
   CHECK(!error);
-  data[0] = (void *)enclosing_method.class_info->classdesc->mirror;
+  ReferenceArrayStore(array->obj, 0, (void *)enclosing_method.class_info->classdesc->mirror);
   if (enclosing_method.nat != nullptr) {
     object name = MakeJStringFromModifiedUTF8(thread, enclosing_method.nat->name, true); // todo oom
-    data[1] = name;
+    ReferenceArrayStore(array->obj, 1, name);
     name = MakeJStringFromModifiedUTF8(thread, enclosing_method.nat->descriptor, true);
-    data[2] = name;
+    ReferenceArrayStore(array->obj, 2, name);
   }
-#undef data
   stack_value result = (stack_value){.obj = array->obj};
   drop_handle(thread, array);
   return result;
@@ -148,7 +146,7 @@ DECLARE_NATIVE("java/lang", Class, getPermittedSubclasses0, "()[Ljava/lang/Class
     return value_null();
   for (int i = 0; i < permitted->entries_count; ++i) {
     cp_class_info *info = permitted->entries[i];
-    ((object *)ArrayData(array->obj))[i] = (void *)get_class_mirror(thread, info->classdesc);
+    ReferenceArrayStore(array->obj, i, (void *)get_class_mirror(thread, info->classdesc));
   }
   return (stack_value){.obj = array->obj};
 }
@@ -185,7 +183,7 @@ DECLARE_NATIVE("java/lang", Class, forName0,
     }
   } else {
     // Invoke findClass on the classloader
-    cp_method *find_class = method_lookup(classloader->descriptor, STR("loadClass"),
+    cp_method *find_class = method_lookup(obj_class(classloader), STR("loadClass"),
                                           STR("(Ljava/lang/String;)Ljava/lang/Class;"), true, false);
     CHECK(find_class);
     stack_value loadClass_args[2] = {{.obj = classloader}, {.obj = name_obj}};
@@ -255,11 +253,10 @@ DECLARE_NATIVE("java/lang", Class, getDeclaredFields0, "(Z)[Ljava/lang/reflect/F
   obj_header *result = CreateObjectArray1D(thread, Field, fields);
   if (!result)
     return value_null();
-  struct native_Field **data = ArrayData(result);
   for (int i = 0, j = 0; i < class->fields_count; ++i) {
     cp_field *field = class->fields + i;
     if (include_field(field, public_only))
-      data[j++] = field->reflection_field;
+      ReferenceArrayStore(result, j++, (void *)field->reflection_field);
   }
   return (stack_value){.obj = result};
 }
@@ -289,12 +286,11 @@ DECLARE_NATIVE("java/lang", Class, getDeclaredConstructors0, "(Z)[Ljava/lang/ref
   // Then create the array
   classdesc *Ctor = cached_classes(thread->vm)->constructor;
   obj_header *result = CreateObjectArray1D(thread, Ctor, ctors);
-  struct native_Constructor **data = ArrayData(result);
   int j = 0;
   for (int i = 0; i < class->methods_count; ++i) {
     cp_method *method = class->methods + i;
     if (include_ctor(method, public_only)) {
-      data[j++] = method->reflection_ctor;
+      ReferenceArrayStore(result, j++, (void *)method->reflection_ctor);
     }
   }
   return (stack_value){.obj = result};
@@ -326,11 +322,10 @@ DECLARE_NATIVE("java/lang", Class, getDeclaredMethods0, "(Z)[Ljava/lang/reflect/
   classdesc *Method = cached_classes(thread->vm)->method;
   link_class(thread, Method);
   obj_header *result = CreateObjectArray1D(thread, Method, methods);
-  struct native_Method **data = ArrayData(result);
   for (int i = 0, j = 0; i < class->methods_count; ++i) {
     cp_method *method = class->methods + i;
     if (include_method(method, public_only))
-      data[j++] = method->reflection_method;
+      ReferenceArrayStore(result, j++, (void *)method->reflection_method);
   }
   return (stack_value){.obj = result};
 }
@@ -350,7 +345,7 @@ DECLARE_NATIVE("java/lang", Class, getDeclaredClasses0, "()[Ljava/lang/Class;")
       if (!info->classdesc)
         continue;
       obj_header *mirror = (void *)get_class_mirror(thread, info->classdesc);
-      *((obj_header **)ArrayData(ret->obj) + i) = mirror;
+      ReferenceArrayStore(ret->obj, i, mirror);
     }
   }
   object result = ret->obj;
@@ -391,7 +386,7 @@ DECLARE_NATIVE("java/lang", Class, isInstance, "(Ljava/lang/Object;)Z") {
   int result = 0;
   object arg = args[0].handle->obj;
   if (arg && this_desc->kind != CD_KIND_PRIMITIVE) {
-    result = instanceof(arg->descriptor, this_desc);
+    result = instanceof(obj_class(arg), this_desc);
   }
   return (stack_value){.i = result};
 }
@@ -454,7 +449,7 @@ DECLARE_NATIVE("java/lang", Class, getInterfaces0, "()[Ljava/lang/Class;") {
     cp_class_info *info = desc->interfaces[i];
     classdesc *iface = info->classdesc;
     obj_header *mirror = (void *)get_class_mirror(thread, iface);
-    *((obj_header **)ArrayData(array->obj) + i) = mirror;
+    ReferenceArrayStore(array->obj, i, mirror);
   }
 
   stack_value result = (stack_value){.obj = array->obj};
@@ -10,35 +10,35 @@ DECLARE_NATIVE("java/lang", Object, hashCode, "()I") {
 static bool cloneable(vm *vm, classdesc *cd) { return instanceof(cd, cached_classes(vm)->cloneable); }
 
 DECLARE_NATIVE("java/lang", Object, clone, "()Ljava/lang/Object;") {
-  switch (obj->obj->descriptor->kind) {
+  switch (obj_class(obj->obj)->kind) {
   case CD_KIND_ORDINARY_ARRAY: {
-    obj_header *new_array = CreateObjectArray1D(thread, obj->obj->descriptor->one_fewer_dim, ArrayLength(obj->obj));
+    obj_header *new_array = CreateObjectArray1D(thread, obj_class(obj->obj)->one_fewer_dim, ArrayLength(obj->obj));
     if (new_array) {
-      memcpy(ArrayData(new_array), ArrayData(obj->obj), ArrayLength(obj->obj) * sizeof(void *));
+      memcpy(ArrayData(new_array), ArrayData(obj->obj), ArrayLength(obj->obj) * sizeof(heap_ref));
     }
     return (stack_value){.obj = new_array};
   }
   case CD_KIND_ORDINARY: {
     // Check if the object is Cloneable
-    if (!cloneable(thread->vm, obj->obj->descriptor)) {
+    if (!cloneable(thread->vm, obj_class(obj->obj))) {
       raise_vm_exception_no_msg(thread, STR("java/lang/CloneNotSupportedException"));
       return value_null();
     }
 
-    obj_header *new_obj = new_object(thread, obj->obj->descriptor);
+    obj_header *new_obj = new_object(thread, obj_class(obj->obj));
     if (new_obj) {
-      memcpy(new_obj + 1, obj->obj + 1, obj->obj->descriptor->instance_bytes - sizeof(obj_header));
+      memcpy(new_obj + 1, obj->obj + 1, obj_class(obj->obj)->instance_bytes - sizeof(obj_header));
     }
     return (stack_value){.obj = new_obj};
   }
   case CD_KIND_PRIMITIVE_ARRAY: {
     obj_header *new_array =
-        CreatePrimitiveArray1D(thread, obj->obj->descriptor->primitive_component, ArrayLength(obj->obj));
+        CreatePrimitiveArray1D(thread, obj_class(obj->obj)->primitive_component, ArrayLength(obj->obj));
     if (!new_array) {
       return value_null();
     }
     memcpy(ArrayData(new_array), ArrayData(obj->obj),
-           ArrayLength(obj->obj) * sizeof_type_kind(obj->obj->descriptor->primitive_component));
+           ArrayLength(obj->obj) * sizeof_type_kind(obj_class(obj->obj)->primitive_component));
     return (stack_value){.obj = new_array};
   }
   default:
@@ -47,7 +47,7 @@ DECLARE_NATIVE("java/lang", Object, clone, "()Ljava/lang/Object;") {
 }
 
 DECLARE_NATIVE("java/lang", Object, getClass, "()Ljava/lang/Class;") {
-  return (stack_value){.obj = (void *)get_class_mirror(thread, obj->obj->descriptor)};
+  return (stack_value){.obj = (void *)get_class_mirror(thread, obj_class(obj->obj))};
 }
 
 DECLARE_NATIVE("java/lang", Object, notifyAll, "()V") {
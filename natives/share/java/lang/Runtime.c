@@ -2,7 +2,14 @@
 
 DECLARE_NATIVE("java/lang", Runtime, availableProcessors, "()I") { return (stack_value){.i = 1}; }
 
-DECLARE_NATIVE("java/lang", Runtime, maxMemory, "()J") { return (stack_value){.l = LLONG_MAX}; }
+DECLARE_NATIVE("java/lang", Runtime, maxMemory, "()J") { return (stack_value){.l = (s64)thread->vm->heap_max_capacity}; }
+
+DECLARE_NATIVE("java/lang", Runtime, totalMemory, "()J") { return (stack_value){.l = (s64)thread->vm->heap_capacity}; }
+
+DECLARE_NATIVE("java/lang", Runtime, freeMemory, "()J") {
+  vm *vm = thread->vm;
+  return (stack_value){.l = (s64)(vm->heap_capacity - vm->heap_used - vm->large_object_bytes)};
+}
 
 DECLARE_NATIVE("java/lang", Runtime, gc, "()V") {
   major_gc(thread->vm);
@@ -40,17 +40,17 @@ DECLARE_NATIVE("java/lang", System, arraycopy, "(Ljava/lang/Object;ILjava/lang/O
     raise_null_pointer_exception(thread);
     return value_null();
   }
-  if (src->descriptor->kind == CD_KIND_ORDINARY) {
+  if (obj_class(src)->kind == CD_KIND_ORDINARY) {
     raise_array_store_exception(thread, STR("source is not an array"));
     return value_null();
   }
-  if (dest->descriptor->kind == CD_KIND_ORDINARY) {
+  if (obj_class(dest)->kind == CD_KIND_ORDINARY) {
     raise_array_store_exception(thread, STR("destination is not an array"));
     return value_null();
   }
   bool src_is_1d_primitive = Is1DPrimitiveArray(src), dst_is_1d_primitive = Is1DPrimitiveArray(dest);
   if (src_is_1d_primitive != dst_is_1d_primitive ||
-      (src_is_1d_primitive && src->descriptor->primitive_component != dest->descriptor->primitive_component)) {
+      (src_is_1d_primitive && obj_class(src)->primitive_component != obj_class(dest)->primitive_component)) {
     raise_array_store_exception(thread, STR("source and destination are not compatible"));
     return value_null();
   }
@@ -73,11 +73,11 @@ DECLARE_NATIVE("java/lang", System, arraycopy, "(Ljava/lang/Object;ILjava/lang/O
   // instanceof the destination class, then we don't need to perform any checks.
   // Otherwise, we need to perform an instanceof check on each element and raise
   // an ArrayStoreException as appropriate.
-  if (src_is_1d_primitive || instanceof(src->descriptor->one_fewer_dim, dest->descriptor->one_fewer_dim)) {
-    size_t element_size = sizeof(void *);
+  if (src_is_1d_primitive || instanceof(obj_class(src)->one_fewer_dim, obj_class(dest)->one_fewer_dim)) {
+    size_t element_size = sizeof(heap_ref);
 
     if (src_is_1d_primitive) {
-      switch (src->descriptor->primitive_component) {
+      switch (obj_class(src)->primitive_component) {
 #define CASE(type, underlying)                                                                                         \
   case TYPE_KIND_##type:                                                                                               \
     element_size = sizeof(underlying);                                                                                 \
@@ -99,18 +99,22 @@ DECLARE_NATIVE("java/lang", System, arraycopy, "(Ljava/lang/Object;ILjava/lang/O
 
     memmove((char *)ArrayData(dest) + dest_pos * element_size, (char *)ArrayData(src) + src_pos * element_size,
             length * element_size);
+    if (!src_is_1d_primitive) {
+      gc_write_barrier(thread->vm, dest);
+    }
 
     return value_null();
   }
 
+  gc_write_barrier(thread->vm, dest);
   for (int i = 0; i < length; ++i) {
     // may-alias case handled above
-    obj_header *src_elem = ((obj_header **)ArrayData(src))[src_pos + i];
-    if (src_elem && !instanceof(src_elem->descriptor, dest->descriptor->one_fewer_dim)) {
+    obj_header *src_elem = ReferenceArrayLoad(src, src_pos + i);
+    if (src_elem && !instanceof(obj_class(src_elem), obj_class(dest)->one_fewer_dim)) {
       raise_array_store_exception(thread, STR("source and destination are not compatible"));
       return value_null();
     }
-    ((obj_header **)ArrayData(dest))[dest_pos + i] = src_elem;
+    ReferenceArrayStore(dest, dest_pos + i, src_elem);
   }
 
   return value_null();
@@ -17,11 +17,45 @@ static bool is_frame_part_of_throwable_construction(stack_frame *frame, object o
 // Implementation-dependent field where we can store the stack trace
 obj_header **backtrace_object(obj_header *throwable) { return &((struct native_Throwable *)throwable)->backtrace; }
 
+// The backtrace is an Object[n + 1] for a stack of n frames, innermost first. Element 0 is a long[2n] of (method,
+// program counter) pairs, with a program counter of -1 for native frames; element i + 1 is the mirror of frame i's
+// class, which keeps the method alive as long as the backtrace. StackTraceElements are only created on request,
+// so throwing and catching an exception that's never printed costs little more than walking the stack.
+
+static int backtrace_depth(obj_header *backtrace) { return backtrace ? ArrayLength(backtrace) - 1 : 0; }
+
+// Fill in the StackTraceElement for frame i of the backtrace. Returns -1 on OOM.
+static int fill_stack_trace_element(vm_thread *thread, handle *backtrace, int i, handle *e) {
+  obj_header *frames = ReferenceArrayLoad(backtrace->obj, 0);
+  cp_method *method = (cp_method *)LongArrayLoad(frames, 2 * i);
+  int pc = (int)LongArrayLoad(frames, 2 * i + 1);
+
+#define E ((struct native_StackTraceElement *)e->obj)
+  E->declaringClassObject = ReferenceArrayLoad(backtrace->obj, i + 1);
+  object o = MakeJStringFromModifiedUTF8(thread, method->my_class->name, true);
+  if (!o)
+    return -1;
+  E->declaringClass = o;
+  o = MakeJStringFromModifiedUTF8(thread, method->name, true);
+  if (!o)
+    return -1;
+  E->methodName = o;
+  attribute_source_file *sf = method->my_class->source_file;
+  if (sf) {
+    o = MakeJStringFromModifiedUTF8(thread, sf->name, true);
+    if (!o)
+      return -1;
+    E->fileName = o;
+  }
+  E->lineNumber = pc < 0 ? -1 : get_line_number(method->code, pc);
+#undef E
+  return 0;
+}
+
 DECLARE_NATIVE("java/lang", Throwable, fillInStackTrace, "(I)Ljava/lang/Throwable;") {
   // Called in the constructor of Throwable. We therefore need to ignore
   // frames which are constructing the current object, which we can do by
   // inspecting the stack.
-  classdesc *StackTraceElement = cached_classes(thread->vm)->stack_trace_element;
 
   // Find the first frame which is not an initializer of the current exception
   stack_frame *frame = thread->stack.top;
@@ -42,91 +76,81 @@ DECLARE_NATIVE("java/lang", Throwable, fillInStackTrace, "(I)Ljava/lang/Throwabl
 
   // Now n_frames is the number of frames in [ frame, frame->prev, ..., first frame ]
 
-  // Create stack trace of the appropriate height
-  handle *stack_trace = make_handle(thread, CreateObjectArray1D(thread, StackTraceElement, n_frames));
-  if (!stack_trace->obj) // Failed to allocate
-    return value_null();
-
-  ((struct native_Throwable *)obj->obj)->depth = n_frames;
+  handle *backtrace = make_handle(thread, CreateObjectArray1D(thread, cached_classes(thread->vm)->object, n_frames + 1));
+  if (!backtrace->obj) // Failed to allocate
+    goto oom;
+  object frames = CreatePrimitiveArray1D(thread, TYPE_KIND_LONG, 2 * n_frames);
+  if (!frames)
+    goto oom;
+  ReferenceArrayStore(backtrace->obj, 0, frames);
 
-  for (int j = 0; n_frames > 0; --n_frames, ++j) {
+  for (int j = 0; j < n_frames; ++j, frame = frame->prev) {
     DCHECK(frame);
-
-    // Create the stack trace element
-    handle *e = make_handle(thread, new_object(thread, StackTraceElement));
-    if (!e->obj) // Failed to allocate StackTraceElement
-      goto cleanup;
-
     cp_method *method = frame->method;
-
-#define E ((struct native_StackTraceElement *)e->obj)
-    int line = is_frame_native(frame) ? -1 : get_line_number(method->code, frame->program_counter);
-    object o = (void *)get_class_mirror(thread, method->my_class);
-    if (!o)
-      goto oom;
-    E->declaringClassObject = o;
-    o = MakeJStringFromModifiedUTF8(thread, method->my_class->name, true);
-    if (!o)
-      goto oom;
-    E->declaringClass = o;
-    o = MakeJStringFromModifiedUTF8(thread, method->name, true);
-    if (!o)
+    object mirror = (void *)get_class_mirror(thread, method->my_class);
+    if (!mirror)
       goto oom;
-    E->methodName = o;
-    attribute_source_file *sf = method->my_class->source_file;
-    if (sf) {
-      o = MakeJStringFromModifiedUTF8(thread, sf->name, true);
-      if (!o)
-        goto oom;
-    }
-
-    E->fileName = o;
-    E->lineNumber = line;
-    *((void **)ArrayData(stack_trace->obj) + j) = e->obj;
+    ReferenceArrayStore(backtrace->obj, j + 1, mirror);
 
-#if 0
-    fprintf(stderr, "Stack trace element %d: %.*s.%.*s (%s:%d)\n", j, fmt_slice(method->my_class->name), fmt_slice(method->name),
-            sf ? sf->name.chars : "unknown", line);
-#endif
-#undef E
-    drop_handle(thread, e);
-    frame = frame->prev;
+    frames = ReferenceArrayLoad(backtrace->obj, 0); // may have moved
+    LongArrayStore(frames, 2 * j, (s64)(uintptr_t)method);
+    LongArrayStore(frames, 2 * j + 1, is_frame_native(frame) ? -1 : frame->program_counter);
   }
 
-cleanup:
-  *backtrace_object(obj->obj) = stack_trace->obj;
+  ((struct native_Throwable *)obj->obj)->depth = n_frames;
+  *backtrace_object(obj->obj) = backtrace->obj;
 oom:
-  drop_handle(thread, stack_trace);
+  drop_handle(thread, backtrace);
   return (stack_value){.obj = obj->obj};
 }
 
 DECLARE_NATIVE("java/lang", Throwable, getStackTraceDepth, "()I") {
   DCHECK(argc == 0);
-  return (stack_value){.i = ArrayLength(*backtrace_object(obj->obj))};
+  return (stack_value){.i = backtrace_depth(*backtrace_object(obj->obj))};
 }
 
 DECLARE_NATIVE("java/lang", Throwable, getStackTraceElement, "(I)Ljava/lang/StackTraceElement;") {
   DCHECK(argc == 1);
-  obj_header *stack_trace = *backtrace_object(obj->obj);
   int index = args[0].i;
-  if (index < 0 || index >= ArrayLength(stack_trace)) {
+  if (index < 0 || index >= backtrace_depth(*backtrace_object(obj->obj))) {
     return value_null();
   }
-  obj_header *element = *((obj_header **)ArrayData(stack_trace) + index);
-  return (stack_value){.obj = element};
+  handle *e = make_handle(thread, new_object(thread, cached_classes(thread->vm)->stack_trace_element));
+  handle *backtrace = make_handle(thread, *backtrace_object(obj->obj));
+  object result = nullptr;
+  if (e->obj && fill_stack_trace_element(thread, backtrace, index, e) == 0)
+    result = e->obj;
+  drop_handle(thread, backtrace);
+  drop_handle(thread, e);
+  return (stack_value){.obj = result};
 }
 
 DECLARE_NATIVE("java/lang", StackTraceElement, initStackTraceElements,
                "([Ljava/lang/StackTraceElement;Ljava/lang/Object;I)V") {
-  handle *stack_trace = args[1].handle;
-  int depth = ArrayLength(stack_trace->obj);
-  int array_length = ArrayLength(args[0].handle->obj);
+  DCHECK(argc == 3);
+  handle *elements = args[0].handle, *backtrace = args[1].handle;
+  int depth = backtrace_depth(backtrace->obj);
+  if (args[2].i < depth) {
+    depth = args[2].i;
+  }
+  int array_length = ArrayLength(elements->obj);
   if (array_length < depth) {
     depth = array_length;
   }
   for (int i = 0; i < depth; ++i) {
-    obj_header *element = *((obj_header **)ArrayData(stack_trace->obj) + i);
-    ReferenceArrayStore(args[0].handle->obj, i, element);
+    handle *e = make_handle(thread, ReferenceArrayLoad(elements->obj, i));
+    if (!e->obj) {
+      e->obj = new_object(thread, cached_classes(thread->vm)->stack_trace_element);
+      if (!e->obj) {
+        drop_handle(thread, e);
+        break;
+      }
+      ReferenceArrayStore(elements->obj, i, e->obj);
+    }
+    int err = fill_stack_trace_element(thread, backtrace, i, e);
+    drop_handle(thread, e);
+    if (err)
+      break;
   }
   return value_null();
-}
\ No newline at end of file
+}
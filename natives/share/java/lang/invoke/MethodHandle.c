@@ -21,7 +21,7 @@ DECLARE_ASYNC_NATIVE("java/lang/invoke", MethodHandle, linkToVirtual, "([Ljava/l
         kind == TYPE_KIND_REFERENCE ? (stack_value){.obj = args[i].handle->obj} : load_stack_value(&args[i], kind);
   }
 
-  method = vtable_lookup(args[0].handle->obj->descriptor, method->vtable_index);
+  method = vtable_lookup(obj_class(args[0].handle->obj), method->vtable_index);
   DCHECK(method);
 
   AWAIT(call_interpreter, thread, method, self->unhandled);
@@ -50,7 +50,7 @@ DECLARE_ASYNC_NATIVE("java/lang/invoke", MethodHandle, linkToInterface, "([Ljava
         kind == TYPE_KIND_REFERENCE ? (stack_value){.obj = args[i].handle->obj} : load_stack_value(&args[i], kind);
   }
 
-  method = itable_lookup(args[0].handle->obj->descriptor, method->my_class, method->itable_index);
+  method = itable_lookup(obj_class(args[0].handle->obj), method->my_class, method->itable_index);
   DCHECK(method);
 
   AWAIT(call_interpreter, thread, method, self->unhandled);
@@ -102,7 +102,7 @@ heap_string unparse_method_type(const struct native_MethodType *mt) {
   slice write = desc;
   write = subslice(write, bprintf(write, "(").len);
   for (int i = 0; i < ArrayLength(mt->ptypes); ++i) {
-    struct native_Class *class = *((struct native_Class **)ArrayData(mt->ptypes) + i);
+    struct native_Class *class = (void *)ReferenceArrayLoad(mt->ptypes, i);
     write = subslice(write, unparse_classdesc_to_field_descriptor(write, class->reflected_class).len);
   }
   write = subslice(write, bprintf(write, ")").len);
@@ -234,19 +234,18 @@ DECLARE_ASYNC_NATIVE("java/lang/invoke", MethodHandleNatives, getMemberVMInfo,
   obj_header *array = CreateObjectArray1D(thread, cached_classes(thread->vm)->klass, 2);
   // todo check exception (out of memory error)
 
-  obj_header **data = ArrayData(array);
-  data[0] = vmindex_long->obj;
+  ReferenceArrayStore(array, 0, vmindex_long->obj);
   drop_handle(thread, vmindex_long);
 
   // either mn->type or mn itself depending on the kind
   method_handle_kind unpacked = unpack_mn_kind(mn);
   if (unpacked == MH_KIND_GET_STATIC || unpacked == MH_KIND_PUT_STATIC || unpacked == MH_KIND_GET_FIELD ||
       unpacked == MH_KIND_PUT_FIELD) {
-    data[1] = mn->type;
+    ReferenceArrayStore(array, 1, mn->type);
   } else if (unpacked == MH_KIND_INVOKE_STATIC || unpacked == MH_KIND_INVOKE_SPECIAL ||
              unpacked == MH_KIND_NEW_INVOKE_SPECIAL || unpacked == MH_KIND_INVOKE_VIRTUAL ||
              unpacked == MH_KIND_INVOKE_INTERFACE) {
-    data[1] = (void *)mn;
+    ReferenceArrayStore(array, 1, (void *)mn);
   } else {
     UNREACHABLE();
   }
@@ -261,7 +260,7 @@ DECLARE_ASYNC_NATIVE("java/lang/invoke", MethodHandleNatives, init,
   self->mn = args[0].handle;
   obj_header *target = args[1].handle->obj;
 
-  slice s = target->descriptor->name;
+  slice s = obj_class(target)->name;
   if (utf8_equals(s, "java/lang/reflect/Method")) {
     cp_method *m = unmirror_method(target);
     AWAIT(fill_mn_with_method, thread, self->mn, m, true);
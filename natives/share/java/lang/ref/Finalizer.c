@@ -7,11 +7,20 @@ DECLARE_NATIVE("java/lang/ref", Finalizer, isFinalizationEnabled, "()Z") { retur
 
 DECLARE_NATIVE("java/lang/ref", Reference, refersTo0, "(Ljava/lang/Object;)Z") {
   DCHECK(argc == 1);
-  struct native_Reference *ref = (void *)obj;
+  struct native_Reference *ref = (void *)obj->obj;
   return (stack_value){.i = ref->referent == args[0].handle->obj};
 }
 
-DECLARE_NATIVE("java/lang/ref", Reference, clear0, "()V") { return value_null(); }
+DECLARE_NATIVE("java/lang/ref", PhantomReference, refersTo0, "(Ljava/lang/Object;)Z") {
+  DCHECK(argc == 1);
+  struct native_Reference *ref = (void *)obj->obj;
+  return (stack_value){.i = ref->referent == args[0].handle->obj};
+}
+
+DECLARE_NATIVE("java/lang/ref", Reference, clear0, "()V") {
+  ((struct native_Reference *)obj->obj)->referent = nullptr;
+  return value_null();
+}
 
 DECLARE_ASYNC_NATIVE("java/lang/ref", Reference, waitForReferencePendingList, "()V",
                      locals(rr_wakeup_info wakeup_info;), invoked_methods()) {
@@ -29,7 +29,7 @@ DECLARE_NATIVE("java/lang/reflect", Array, get, "(Ljava/lang/Object;I)Ljava/lang
   DCHECK(argc == 2);
 
   object array = args[0].handle->obj;
-  if (array->descriptor->kind == CD_KIND_ORDINARY) {
+  if (obj_class(array)->kind == CD_KIND_ORDINARY) {
     raise_vm_exception(thread, STR("java/lang/IllegalArgumentException"), STR("Argument is not an array"));
     return value_null();
   }
@@ -38,7 +38,7 @@ DECLARE_NATIVE("java/lang/reflect", Array, get, "(Ljava/lang/Object;I)Ljava/lang
     raise_vm_exception(thread, STR("java/lang/ArrayIndexOutOfBoundsException"), STR(""));
     return value_null();
   }
-  switch (array->descriptor->kind) {
+  switch (obj_class(array)->kind) {
   case CD_KIND_ORDINARY:
   case CD_KIND_PRIMITIVE:
   default:
@@ -48,7 +48,7 @@ DECLARE_NATIVE("java/lang/reflect", Array, get, "(Ljava/lang/Object;I)Ljava/lang
   case CD_KIND_PRIMITIVE_ARRAY:
     stack_value val;
     cp_method *fromPrimitive;
-    switch (array->descriptor->primitive_component) {
+    switch (obj_class(array)->primitive_component) {
     case TYPE_KIND_BOOLEAN:
       val.i = BooleanArrayLoad(array, args[1].i);
       fromPrimitive = method_lookup(cached_classes(thread->vm)->boolean, STR("valueOf"), STR("(Z)Ljava/lang/Boolean;"),
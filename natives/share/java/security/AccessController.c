@@ -7,7 +7,7 @@
     vm_thread *thread__ = thread_;                                                                                     \
     obj_header *target__ = target_;                                                                                    \
     obj_header *context__ = context_;                                                                                  \
-    classdesc *classdesc__ = target_->descriptor;                                                                      \
+    classdesc *classdesc__ = obj_class(target_);                                                                      \
     (void)context__; /* stop the compiler complaining */                                                               \
                                                                                                                        \
     DCHECK(classdesc__->kind == CD_KIND_ORDINARY);                                                                     \
@@ -9,6 +9,59 @@
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, registerNatives, "()V") { return value_null(); }
 
+// Reference-typed accesses at (base, offset) are to a full pointer, unless they are to an element of a reference array
+// or to a compressed instance field (see heap_ref). base may also be null (an absolute address) or a class's
+// static_fields.
+static bool is_compressed(vm_thread *thread, obj_header *base, s64 offset) {
+#if COMPRESSED_REFS
+  if (!base || !in_heap(thread->vm, base))
+    return false;
+  classdesc *desc = obj_class(base);
+  if (desc->kind != CD_KIND_ORDINARY)
+    return is_reference_array(desc);
+  reference_list *refs = desc->compressed_references;
+  for (u32 i = 0; i < refs->count; ++i) {
+    if (refs->slots_unscaled[i] * (s64)sizeof(heap_ref) == offset)
+      return true;
+  }
+#endif
+  return false;
+}
+
+static object load_reference(vm_thread *thread, obj_header *base, s64 offset) {
+  void *p = (void *)((uintptr_t)base + offset);
+  return is_compressed(thread, base, offset) ? decode_heap_ref(*(heap_ref volatile *)p) : *(void *volatile *)p;
+}
+
+static void store_reference(vm_thread *thread, obj_header *base, s64 offset, object value) {
+  void *p = (void *)((uintptr_t)base + offset);
+  if (is_compressed(thread, base, offset)) {
+    *(heap_ref volatile *)p = encode_heap_ref(value);
+  } else {
+    *(void *volatile *)p = value;
+  }
+  if (base) {
+    gc_write_barrier(thread->vm, base);
+  }
+}
+
+// Atomically replace the reference at (base, offset) with update if it is expected, returning the old reference
+static object compare_and_exchange_reference(vm_thread *thread, obj_header *base, s64 offset, object expected,
+                                             object update) {
+  void *p = (void *)((uintptr_t)base + offset);
+  object old;
+  if (is_compressed(thread, base, offset)) {
+    old = decode_heap_ref(
+        __sync_val_compare_and_swap((heap_ref *)p, encode_heap_ref(expected), encode_heap_ref(update)));
+  } else {
+    old = (object)__sync_val_compare_and_swap((uintptr_t *)p, (uintptr_t)expected, (uintptr_t)update);
+  }
+  if (base) {
+    gc_write_barrier(thread->vm, base);
+  }
+  return old;
+}
+
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, arrayBaseOffset0, "(Ljava/lang/Class;)I") {
   return (stack_value){.i = kArrayDataOffset};
 }
@@ -73,7 +126,7 @@ DECLARE_NATIVE("jdk/internal/misc", Unsafe, arrayIndexScale0, "(Ljava/lang/Class
   classdesc *desc = unmirror_class(args[0].handle->obj);
   switch (desc->kind) {
   case CD_KIND_ORDINARY_ARRAY:
-    return (stack_value){.i = sizeof(void *)};
+    return (stack_value){.i = sizeof(heap_ref)};
   case CD_KIND_PRIMITIVE_ARRAY:
     return (stack_value){.i = sizeof_type_kind(desc->primitive_component)};
   case CD_KIND_ORDINARY:
@@ -94,13 +147,13 @@ DECLARE_NATIVE("jdk/internal/misc", Unsafe, getLongVolatile, "(Ljava/lang/Object
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, putReferenceVolatile, "(Ljava/lang/Object;JLjava/lang/Object;)V") {
   DCHECK(argc == 3);
-  *(void *volatile *)((uintptr_t)args[0].handle->obj + args[1].l) = args[2].handle->obj;
+  store_reference(thread, args[0].handle->obj, args[1].l, args[2].handle->obj);
   return value_null();
 }
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, putOrderedReference, "(Ljava/lang/Object;JLjava/lang/Object;)V") {
   DCHECK(argc == 3);
-  *(void **)((void *)args[0].handle->obj + args[1].l) = args[2].handle->obj;
+  store_reference(thread, args[0].handle->obj, args[1].l, args[2].handle->obj);
   return value_null();
 }
 
@@ -112,7 +165,7 @@ DECLARE_NATIVE("jdk/internal/misc", Unsafe, putOrderedLong, "(Ljava/lang/Object;
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, putReference, "(Ljava/lang/Object;JLjava/lang/Object;)V") {
   DCHECK(argc == 3);
-  *(void **)((uintptr_t)args[0].handle->obj + args[1].l) = args[2].handle->obj;
+  store_reference(thread, args[0].handle->obj, args[1].l, args[2].handle->obj);
   return value_null();
 }
 
@@ -137,21 +190,17 @@ DECLARE_NATIVE("jdk/internal/misc", Unsafe, compareAndSetLong, "(Ljava/lang/Obje
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, compareAndSetReference,
                "(Ljava/lang/Object;JLjava/lang/Object;Ljava/lang/Object;)Z") {
   DCHECK(argc == 4);
-  obj_header *target = args[0].handle->obj;
-  s64 offset = args[1].l;
-  uintptr_t expected = (uintptr_t)args[2].handle->obj, update = (uintptr_t)args[3].handle->obj;
-  int ret = __sync_bool_compare_and_swap((uintptr_t *)((uintptr_t)target + offset), expected, update);
-  return (stack_value){.l = ret};
+  object expected = args[2].handle->obj;
+  object old = compare_and_exchange_reference(thread, args[0].handle->obj, args[1].l, expected, args[3].handle->obj);
+  return (stack_value){.l = old == expected};
 }
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, compareAndExchangeReference,
                "(Ljava/lang/Object;JLjava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;") {
   DCHECK(argc == 4);
-  obj_header *target = args[0].handle->obj;
-  s64 offset = args[1].l;
-  uintptr_t expected = (uintptr_t)args[2].handle->obj, update = (uintptr_t)args[3].handle->obj;
-  uintptr_t ret = __sync_val_compare_and_swap((uintptr_t *)((uintptr_t)target + offset), expected, update);
-  return (stack_value){.obj = (void *)ret};
+  object old = compare_and_exchange_reference(thread, args[0].handle->obj, args[1].l, args[2].handle->obj,
+                                              args[3].handle->obj);
+  return (stack_value){.obj = old};
 }
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, addressSize, "()I") { return (stack_value){.i = sizeof(void *)}; }
@@ -303,7 +352,7 @@ DECLARE_NATIVE("jdk/internal/misc", Unsafe, putBoolean, "(Ljava/lang/Object;JZ)V
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, getReference, "(Ljava/lang/Object;J)Ljava/lang/Object;") {
   DCHECK(argc == 2);
-  return (stack_value){.obj = *(void **)((uintptr_t)args[0].handle->obj + args[1].l)};
+  return (stack_value){.obj = load_reference(thread, args[0].handle->obj, args[1].l)};
 }
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, getInt, "(Ljava/lang/Object;J)I") {
@@ -338,7 +387,7 @@ DECLARE_NATIVE_OVERLOADED("jdk/internal/misc", Unsafe, getByte, "(J)B", 1) {
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, getReferenceVolatile, "(Ljava/lang/Object;J)Ljava/lang/Object;") {
   DCHECK(argc == 2);
-  return (stack_value){.obj = *(void **)((uintptr_t)args[0].handle->obj + args[1].l)};
+  return (stack_value){.obj = load_reference(thread, args[0].handle->obj, args[1].l)};
 }
 
 DECLARE_NATIVE("jdk/internal/misc", Unsafe, defineClass,
@@ -0,0 +1,24 @@
+#include <gc.h>
+#include <natives-dsl.h>
+#include <objects.h>
+
+// The kind of collection a GarbageCollectorImpl (created by MemoryImpl.getMemoryManagers0) stands for
+static gc_kind collector_kind(vm_thread *thread, obj_header *collector) {
+  heap_string name = AsHeapString(LoadFieldObject(collector, "java/lang/String", "name"), on_oom);
+  bool minor = utf8_equals(hslc(name), gc_kind_name(GC_KIND_MINOR));
+  free_heap_str(name);
+  return minor ? GC_KIND_MINOR : GC_KIND_MAJOR;
+
+on_oom:
+  return GC_KIND_COUNT;
+}
+
+DECLARE_NATIVE("sun/management", GarbageCollectorImpl, getCollectionCount, "()J") {
+  gc_kind kind = collector_kind(thread, obj->obj);
+  return (stack_value){.l = kind == GC_KIND_COUNT ? -1 : (s64)thread->vm->gc_collections[kind]};
+}
+
+DECLARE_NATIVE("sun/management", GarbageCollectorImpl, getCollectionTime, "()J") {
+  gc_kind kind = collector_kind(thread, obj->obj);
+  return (stack_value){.l = kind == GC_KIND_COUNT ? -1 : (s64)(thread->vm->gc_pause_us[kind] / 1000)};
+}
@@ -0,0 +1,53 @@
+#include <arrays.h>
+#include <gc.h>
+#include <natives-dsl.h>
+#include <objects.h>
+
+DECLARE_NATIVE("sun/management", MemoryImpl, getMemoryPools0, "()[Ljava/lang/management/MemoryPoolMXBean;") {
+  // The heap isn't divided into separately sized pools
+  classdesc *MemoryPoolMXBean = bootstrap_lookup_class(thread, STR("java/lang/management/MemoryPoolMXBean"));
+  if (!MemoryPoolMXBean)
+    return value_null();
+  return (stack_value){.obj = CreateObjectArray1D(thread, MemoryPoolMXBean, 0)};
+}
+
+// One GarbageCollectorMXBean per kind of collection, named after it (see gc_kind_name)
+DECLARE_NATIVE("sun/management", MemoryImpl, getMemoryManagers0, "()[Ljava/lang/management/MemoryManagerMXBean;") {
+  classdesc *GarbageCollectorImpl = bootstrap_lookup_class(thread, STR("sun/management/GarbageCollectorImpl"));
+  classdesc *MemoryManagerMXBean = bootstrap_lookup_class(thread, STR("java/lang/management/MemoryManagerMXBean"));
+  if (!GarbageCollectorImpl || !MemoryManagerMXBean)
+    return value_null();
+  initialize_class_t pox = {.args = {thread, GarbageCollectorImpl}};
+  future_t f = initialize_class(&pox);
+  CHECK(f.status == FUTURE_READY);
+  if (thread->current_exception)
+    return value_null();
+  cp_method *init = method_lookup(GarbageCollectorImpl, STR("<init>"), STR("(Ljava/lang/String;)V"), false, false);
+  CHECK(init);
+
+  stack_value result = value_null();
+  handle *managers = make_handle(thread, CreateObjectArray1D(thread, MemoryManagerMXBean, GC_KIND_COUNT));
+  if (!managers->obj)
+    goto done;
+  for (int kind = 0; kind < GC_KIND_COUNT; ++kind) {
+    handle *manager = make_handle(thread, new_object(thread, GarbageCollectorImpl));
+    object name = manager->obj ? MakeJStringFromCString(thread, gc_kind_name(kind), true) : nullptr;
+    if (name) {
+      call_interpreter_synchronous(thread, init, (stack_value[]){{.obj = manager->obj}, {.obj = name}});
+      ReferenceArrayStore(managers->obj, kind, manager->obj);
+    }
+    drop_handle(thread, manager);
+    if (!name || thread->current_exception)
+      goto done;
+  }
+  result.obj = managers->obj;
+
+done:
+  drop_handle(thread, managers);
+  return result;
+}
+
+DECLARE_NATIVE("sun/management", MemoryImpl, setVerboseGC, "(Z)V") {
+  thread->vm->gc_log = args[0].i;
+  return value_null();
+}
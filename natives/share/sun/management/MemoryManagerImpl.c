@@ -0,0 +1,9 @@
+#include <arrays.h>
+#include <natives-dsl.h>
+
+DECLARE_NATIVE("sun/management", MemoryManagerImpl, getMemoryPools0, "()[Ljava/lang/management/MemoryPoolMXBean;") {
+  classdesc *MemoryPoolMXBean = bootstrap_lookup_class(thread, STR("java/lang/management/MemoryPoolMXBean"));
+  if (!MemoryPoolMXBean)
+    return value_null();
+  return (stack_value){.obj = CreateObjectArray1D(thread, MemoryPoolMXBean, 0)};
+}
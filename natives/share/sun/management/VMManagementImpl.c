@@ -0,0 +1,21 @@
+#include <natives-dsl.h>
+#include <objects.h>
+
+DECLARE_NATIVE("sun/management", VMManagementImpl, getVersion0, "()Ljava/lang/String;") {
+  return (stack_value){.obj = MakeJStringFromCString(thread, "4.0", true)};
+}
+
+// Leaves every optional feature (thread CPU time, contention monitoring, ...) unsupported
+DECLARE_NATIVE("sun/management", VMManagementImpl, initOptionalSupportFields, "()V") { return value_null(); }
+
+DECLARE_NATIVE("sun/management", VMManagementImpl, getVerboseGC, "()Z") {
+  return (stack_value){.i = thread->vm->gc_log};
+}
+
+DECLARE_NATIVE("sun/management", VMManagementImpl, getStartupTime, "()J") {
+  return (stack_value){.l = (s64)(thread->vm->start_us / 1000)};
+}
+
+DECLARE_NATIVE("sun/management", VMManagementImpl, getUptime0, "()J") {
+  return (stack_value){.l = (s64)((get_unix_us() - thread->vm->start_us) / 1000)};
+}
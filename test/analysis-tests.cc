@@ -3,6 +3,9 @@
 #include "doctest/doctest.h"
 #include "tests-common.h"
 #include <analysis.h>
+#include <classpath.h>
+#include <iostream>
+#include <ssa.h>
 
 using namespace Bjvm::Tests;
 
@@ -47,6 +50,95 @@ TEST_CASE("Analysis passes on valid bytecode") {
   }
 }
 
+TEST_CASE("SSA form of the test programs is well formed") {
+  for (const auto &file : ListDirectory("test_files", true)) {
+    if (!EndsWith(file, ".class"))
+      continue;
+    auto contents = ReadFile(file).value();
+    classdesc cls;
+    heap_string error;
+    REQUIRE(parse_classfile(contents.data(), contents.size(), &cls, &error) == 0);
+
+    for (int i = 0; i < cls.methods_count; ++i) {
+      auto *method = cls.methods + i;
+      if (!method->code || analyze_method_code(method, &error) != 0)
+        continue;
+      ssa_function *fn = ssa_build(method);
+      if (!fn) // e.g. methods with exception handlers
+        continue;
+      const char *problem = ssa_verify(fn);
+      if (!problem && ssa_optimize(fn))
+        problem = ssa_verify(fn);
+      if (problem) {
+        FAIL("Malformed SSA for " << to_string_view(cls.name) << "#" << to_string_view(method->name) << ": " << problem);
+      }
+      ssa_free(fn);
+    }
+
+    free_classfile(cls);
+  }
+}
+
+// Compares the memory held for the stack and locals at each instruction of the JSON libraries with what one
+// stack_summary per instruction (and a pointer to it) used to take, and with the GC maps which are all that a VM
+// without a JIT keeps.
+TEST_CASE("Stack states are shared between instructions") {
+  classpath cp;
+  char *error = init_classpath(&cp, STR("test_files/json/gson-2.11.0.jar:test_files/json/jackson-core-2.18.2.jar:"
+                                        "test_files/json/jackson-annotations-2.18.2.jar:"
+                                        "test_files/json/jackson-databind-2.18.2.jar"));
+  REQUIRE(error == nullptr);
+
+  auto summary_bytes = [](const stack_summary *ss) {
+    return sizeof(stack_summary) + (ss->stack + ss->locals) * sizeof(type_kind);
+  };
+  auto map_bytes = [](const gc_map *map) {
+    return sizeof(gc_map) + (map->stack + map->locals + 63) / 64 * sizeof(u64);
+  };
+  size_t per_insn_bytes = 0, shared_bytes = 0, gc_map_bytes = 0;
+  for (int e = 0; e < arrlen(cp.entries); ++e) {
+    hash_table_iterator iter = hash_table_get_iterator(&cp.entries[e].jar->entries);
+    char *name;
+    size_t name_len;
+    for (; hash_table_iterator_has_next(iter, &name, &name_len, nullptr); hash_table_iterator_next(&iter)) {
+      if (!EndsWith(std::string(name, name_len), ".class"))
+        continue;
+      u8 *bytes;
+      size_t len;
+      REQUIRE(lookup_classpath(&cp, {name, (u32)name_len}, &bytes, &len) == 0);
+      classdesc cls;
+      heap_string parse_error;
+      REQUIRE(parse_classfile(bytes, len, &cls, &parse_error) == 0);
+
+      for (int i = 0; i < cls.methods_count; ++i) {
+        auto *method = cls.methods + i;
+        if (!method->code || analyze_method_code(method, &parse_error) != 0)
+          continue;
+        auto *analy = static_cast<code_analysis *>(method->code_analysis);
+        int insns = method->code->insn_count;
+        per_insn_bytes += insns * sizeof(stack_summary *);
+        for (int j = 0; j < insns; ++j)
+          per_insn_bytes += summary_bytes(insn_stack_state(analy, j));
+        shared_bytes += insns * sizeof(u16) + arrlen(analy->states) * sizeof(stack_summary *);
+        for (int j = 0; j < arrlen(analy->states); ++j)
+          shared_bytes += summary_bytes(analy->states[j]);
+        gc_map_bytes += insns * sizeof(u16) + arrlen(analy->gc_maps) * sizeof(gc_map *);
+        for (int j = 0; j < arrlen(analy->gc_maps); ++j)
+          gc_map_bytes += map_bytes(analy->gc_maps[j]);
+      }
+      free_classfile(cls);
+      free(bytes);
+    }
+  }
+  free_classpath(&cp);
+
+  // 11.0 MiB per instruction, 4.5 MiB shared and 2.2 MiB of GC maps, for the 13,351 methods with code
+  std::cout << "Stack states: " << per_insn_bytes << " bytes per instruction, " << shared_bytes << " bytes shared, "
+            << gc_map_bytes << " bytes of GC maps\n";
+  REQUIRE(shared_bytes * 2 < per_insn_bytes);
+  REQUIRE(gc_map_bytes < shared_bytes);
+}
+
 TEST_CASE("Analysis fuzzing") {
   // Ensure the analysis system doesn't hit UB/rejects things before passing
   // broken things on TODO
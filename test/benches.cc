@@ -1,6 +1,13 @@
 // Benchmarks. We'll use this to track the VM performance over time.
 
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
 #include "tests-common.h"
+#include <arrays.h>
+#include <config.h>
+#include <gc.h>
 
 #include "doctest/doctest.h"
 
@@ -9,20 +16,162 @@ using namespace Bjvm::Tests;
 // until we figure out how to benchmark
 #define BENCHMARK(x) if (0)
 
+static const char *json_classpath = "test_files/json:test_files/json/gson-2.11.0.jar:test_files/"
+                                    "json/jackson-core-2.18.2.jar:test_files/json/"
+                                    "jackson-annotations-2.18.2.jar:test_files/json/"
+                                    "jackson-databind-2.18.2.jar";
+
+struct PauseTimes {
+  int young = 0, full = 0;
+  double total_ms = 0, max_ms = 0;
+};
+
+// Sums the pauses in -Xlog:gc style output, i.e. lines like "[0.153s][info][gc] GC(2) Pause Young 24M->3M(64M) 1.402ms"
+static PauseTimes parse_pause_times(const std::string &log) {
+  PauseTimes times;
+  std::istringstream lines(log);
+  for (std::string line; std::getline(lines, line);) {
+    size_t pause = line.find(") Pause ");
+    if (line.find("][info][gc] GC(") == std::string::npos || pause == std::string::npos)
+      continue;
+    (line.compare(pause + 8, 4, "Full") == 0 ? times.full : times.young)++;
+    double ms = std::stod(line.substr(line.rfind(' ') + 1));
+    times.total_ms += ms;
+    times.max_ms = std::max(times.max_ms, ms);
+  }
+  return times;
+}
+
+// Not run by default: tests -tc="GC pause times" --no-skip
+TEST_CASE("GC pause times" * doctest::skip()) {
+  std::pair<const char *, const char *> programs[] = {{"test_files/tricky_gc/", "AttemptGcCrash"},
+                                                      {json_classpath, "GsonExample"}};
+  for (auto [classpath, main_class] : programs) {
+    vm_options options = default_vm_options();
+    options.gc_log = true;
+    auto result = run_test_case(classpath, true, main_class, "", {}, options);
+    PauseTimes times = parse_pause_times(result.stdout_);
+    std::cout << main_class << ": " << times.young << " young and " << times.full << " full pauses, " << times.total_ms
+              << "ms in total, " << times.max_ms << "ms at most" << std::endl;
+    REQUIRE(times.young + times.full > 0);
+  }
+}
+
+// Major GC pauses over a heap where one object in three is live, with the survivors scattered among garbage which
+// points at them. Not run by default: tests -tc="GC pause on a fragmented heap" --no-skip
+TEST_CASE("GC pause on a fragmented heap" * doctest::skip()) {
+  vm_options options = default_vm_options();
+  options.heap_size = 1 << 30;
+  auto vm = CreateTestVM(options);
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+  classdesc *Object = cached_classes(vm.get())->object;
+
+  // Each node is an Object[2] of {next, link to another list}; the live ones are chained into LISTS lists
+  constexpr int NODES = 3000000, LISTS = 64;
+  handle *heads[LISTS], *tails[LISTS];
+  for (int i = 0; i < LISTS; ++i)
+    heads[i] = make_handle(thread, nullptr), tails[i] = make_handle(thread, nullptr);
+  srand(1);
+  for (int i = 0; i < NODES; ++i) {
+    obj_header *node = CreateObjectArray1D(thread, Object, 2);
+    REQUIRE(node);
+    handle *other = tails[rand() % LISTS];
+    if (other->obj)
+      ReferenceArrayStore(node, 1, other->obj);
+    if (i % 3 == 0) {
+      handle *tail = tails[i / 3 % LISTS];
+      if (tail->obj)
+        ReferenceArrayStore(tail->obj, 0, node);
+      else
+        heads[i / 3 % LISTS]->obj = node;
+      tail->obj = node;
+    }
+  }
+
+  auto pause = [&] {
+    auto start = std::chrono::steady_clock::now();
+    major_gc(vm.get());
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  };
+  double first = pause(), steady = 0;
+  constexpr int ROUNDS = 5;
+  for (int i = 0; i < ROUNDS; ++i)
+    steady += pause();
+
+  int live = 0;
+  for (handle *head : heads)
+    for (obj_header *node = head->obj; node; node = ReferenceArrayLoad(node, 0))
+      ++live;
+  REQUIRE(live == (NODES + 2) / 3);
+  std::cout << live << " of " << NODES << " nodes live: first major GC " << first << "ms, then " << steady / ROUNDS
+            << "ms each" << std::endl;
+
+  for (int i = 0; i < LISTS; ++i)
+    drop_handle(thread, heads[i]), drop_handle(thread, tails[i]);
+  free_thread(thread);
+}
+
+// The allocations of test_files/bench_allocation as the interpreter's new, newarray and anewarray handlers make them,
+// minus the interpretation. Not run by default: tests -tc="Allocation throughput" --no-skip
+TEST_CASE("Allocation throughput" * doctest::skip()) {
+  auto vm = CreateTestVM(default_vm_options());
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+  classdesc *Object = cached_classes(vm.get())->object;
+  NewPrimitiveArray1D(thread, TYPE_KIND_INT, 0); // create the array classes up front
+  NewObjectArray1D(thread, Object, 0);
+
+  constexpr int ITERATIONS = 20000000, ROUNDS = 5;
+  double best = 1e30;
+  for (int round = 0; round < ROUNDS; ++round) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; ++i) {
+      obj_header *object = AllocateObject(thread, Object, Object->instance_bytes);
+      obj_header *ints = NewPrimitiveArray1D(thread, TYPE_KIND_INT, 4);
+      obj_header *objects = NewObjectArray1D(thread, Object, 2);
+      if (!object || !ints || !objects)
+        FAIL("out of memory"); // not REQUIRE, whose bookkeeping would dominate the loop
+      ReferenceArrayStore(objects, i & 1, object);
+    }
+    best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+  }
+  std::cout << ITERATIONS << " iterations of 3 allocations: " << best << "ms, " << best * 1e6 / ITERATIONS
+            << "ns per iteration" << std::endl;
+  free_thread(thread);
+}
+
+// Compare a build with COMPRESSED_REFS on with one with it off. Not run by default:
+// tests -tc="Reference-heavy programs" --no-skip
+TEST_CASE("Reference-heavy programs" * doctest::skip()) {
+  std::pair<const char *, const char *> programs[] = {{json_classpath, "GsonExample"},
+                                                      {"test_files/n_body_problem/", "NBodyProblem"}};
+  for (auto [classpath, main_class] : programs) {
+    vm_options options = default_vm_options();
+    options.gc_log = true;
+    auto start = std::chrono::steady_clock::now();
+    auto result = run_test_case(classpath, true, main_class, "", {}, options);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    PauseTimes times = parse_pause_times(result.stdout_);
+    std::cout << main_class << " (COMPRESSED_REFS=" << COMPRESSED_REFS << "): " << elapsed.count()
+              << "ms, " << times.young + times.full << " collections taking " << times.total_ms << "ms" << std::endl;
+  }
+}
+
 TEST_CASE("Benchmarks") {
   BENCHMARK("Big decimal") { auto result = run_test_case("test_files/bench_big_decimal/", true); };
 
   BENCHMARK("Stack trace") { auto result = run_test_case("test_files/bench_stack_trace/", true); };
 
+  BENCHMARK("Allocation") { auto result = run_test_case("test_files/bench_allocation/", true); };
+
   BENCHMARK("JSON startup") {
-    auto result = run_test_case("test_files/json:test_files/json/gson-2.11.0.jar:test_files/"
-                                "json/jackson-core-2.18.2.jar:test_files/json/"
-                                "jackson-annotations-2.18.2.jar:test_files/json/"
-                                "jackson-databind-2.18.2.jar",
-                                true, "GsonExample");
+    auto result = run_test_case(json_classpath, true, "GsonExample");
   };
 
+  BENCHMARK("N-body problem") { auto result = run_test_case("test_files/n_body_problem/", true, "NBodyProblem"); };
+
   BENCHMARK("Advanced lambda") { auto result = run_test_case("test_files/advanced_lambda", true); };
 
+  BENCHMARK("String switch") { auto result = run_test_case("test_files/bench_string_switch", true); };
+
   BENCHMARK("Cfg fuck") { auto result = run_test_case("test_files/cfg_fuck", true); };
 }
\ No newline at end of file
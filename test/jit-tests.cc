@@ -0,0 +1,82 @@
+// Run the test programs with the JIT tiers forced on, and compare their output with the interpreter's.
+
+#include "doctest/doctest.h"
+#include "tests-common.h"
+#include "x86_jit.h"
+#include <cstring>
+#include <map>
+
+using namespace Bjvm::Tests;
+
+TEST_SUITE_BEGIN("[jit]");
+
+#if defined(EMSCRIPTEN) || defined(X86_JIT_SUPPORTED)
+TEST_CASE("Test programs behave the same with the JIT forced on") {
+  // Programs whose output differs from run to run, or depends on how the method is compiled
+  const std::map<std::string, const char *> skipped = {
+      {"basic_multithreading", "sleeps for Math.random() times, and prints them in the order the threads wake"},
+      {"gc_log", "prints GC pause times"},
+      {"n_body_problem", "prints how long the simulation took"},
+      {"random", "prints numbers from an unseeded java.util.Random"},
+      {"random_uuid", "prints a random UUID"},
+      {"stack_overflow", "prints the depth at which the stack overflows, which inlining changes"},
+#ifdef EMSCRIPTEN
+      // WebAssembly code calls interpreted code synchronously, so these abort when a callee blocks
+      {"concurrent_initialisation", "sleeps in a static initializer"},
+      {"fannkuch_multithreaded", "joins its worker threads"},
+      {"indy_1", "joins a thread"},
+      {"park_unpark", "parks threads"},
+      {"single_thread_interrupt", "sleeps"},
+      {"sleep_interruption", "sleeps and joins a thread"},
+      {"sudoku", "joins its worker threads"},
+      {"synchronized_counter", "waits on contended monitors"},
+#endif
+  };
+
+  for (const std::string &dir : ListDirectory("test_files", false)) {
+    std::string name = dir.substr(dir.find_last_of('/') + 1);
+    if (skipped.contains(name))
+      continue;
+
+    // The main class is a compiled top-level class with a main method
+    std::string main_class;
+    for (const std::string &file : ListDirectory(dir, false)) {
+      if (!EndsWith(file, ".java"))
+        continue;
+      std::string class_name = file.substr(dir.size() + 1, file.size() - dir.size() - 1 - strlen(".java"));
+      if (ReadFileAsString(file).find("static void main") != std::string::npos &&
+          ReadFile(dir + "/" + class_name + ".class")) {
+        main_class = class_name;
+        break;
+      }
+    }
+    if (main_class.empty())
+      continue;
+
+    vm_options interpreted = default_vm_options(), compiled = default_vm_options();
+    compiled.jit_enabled = true;
+    compiled.jit_threshold = 1;
+    compiled.jit_compiler_threads = 0; // compile each method before its first call returns
+    // run_test_case prints the classpath, which identifies the program if this fails
+    auto expected = run_test_case(dir + "/", true, main_class, "", {}, interpreted);
+    auto result = run_test_case(dir + "/", true, main_class, "", {}, compiled);
+    REQUIRE(result.stdout_ == expected.stdout_);
+    REQUIRE(result.stderr_ == expected.stderr_);
+#ifdef X86_JIT_SUPPORTED
+    // And with every method that runs baseline code compiled again by the optimizing tier
+    compiled.opt_jit_enabled = true;
+    compiled.opt_jit_threshold = 1;
+    result = run_test_case(dir + "/", true, main_class, "", {}, compiled);
+    REQUIRE(result.stdout_ == expected.stdout_);
+    REQUIRE(result.stderr_ == expected.stderr_);
+    // And with both tiers compiling on background threads while the interpreter rewrites the instructions
+    compiled.jit_compiler_threads = 2;
+    result = run_test_case(dir + "/", true, main_class, "", {}, compiled);
+    REQUIRE(result.stdout_ == expected.stdout_);
+    REQUIRE(result.stderr_ == expected.stderr_);
+#endif
+  }
+}
+#endif
+
+TEST_SUITE_END;
@@ -0,0 +1,21 @@
+public class Main {
+    static Object sink;
+
+    static void allocateArrays() {
+        for (int i = 0; i < 100_000; i++) {
+            sink = new long[32];
+        }
+    }
+
+    static void allocateStrings() {
+        for (int i = 0; i < 100_000; i++) {
+            sink = new StringBuilder().append(i).toString();
+        }
+    }
+
+    public static void main(String[] args) {
+        allocateArrays();
+        allocateStrings();
+        System.out.println("done");
+    }
+}
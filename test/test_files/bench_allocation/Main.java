@@ -0,0 +1,26 @@
+public class Main {
+    private static final int ITERATIONS = 20_000_000;
+
+    static final class Point {
+        int x, y;
+
+        Point(int x, int y) {
+            this.x = x;
+            this.y = y;
+        }
+    }
+
+    public static void main(String[] args) {
+        // Short-lived objects and small arrays, so that the time is dominated by allocation (and the GCs it triggers)
+        long sum = 0;
+        for (int i = 0; i < ITERATIONS; i++) {
+            Point p = new Point(i, i + 1);
+            int[] ints = new int[4];
+            Object[] objects = new Object[2];
+            ints[i & 3] = p.x;
+            objects[i & 1] = p;
+            sum += ints[i & 3] + p.y + objects.length;
+        }
+        System.out.println(sum);
+    }
+}
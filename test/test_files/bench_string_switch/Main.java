@@ -0,0 +1,89 @@
+// A string switch over 64 cases, as in a hand-written parser or a command dispatcher
+public class Main {
+    static int dispatch(String s) {
+        switch (s) {
+        case "getName": return 0;
+        case "getValue": return 1;
+        case "getCount": return 2;
+        case "getSize": return 3;
+        case "getIndex": return 4;
+        case "getChild": return 5;
+        case "getParent": return 6;
+        case "getType": return 7;
+        case "setName": return 8;
+        case "setValue": return 9;
+        case "setCount": return 10;
+        case "setSize": return 11;
+        case "setIndex": return 12;
+        case "setChild": return 13;
+        case "setParent": return 14;
+        case "setType": return 15;
+        case "isName": return 16;
+        case "isValue": return 17;
+        case "isCount": return 18;
+        case "isSize": return 19;
+        case "isIndex": return 20;
+        case "isChild": return 21;
+        case "isParent": return 22;
+        case "isType": return 23;
+        case "hasName": return 24;
+        case "hasValue": return 25;
+        case "hasCount": return 26;
+        case "hasSize": return 27;
+        case "hasIndex": return 28;
+        case "hasChild": return 29;
+        case "hasParent": return 30;
+        case "hasType": return 31;
+        case "addName": return 32;
+        case "addValue": return 33;
+        case "addCount": return 34;
+        case "addSize": return 35;
+        case "addIndex": return 36;
+        case "addChild": return 37;
+        case "addParent": return 38;
+        case "addType": return 39;
+        case "removeName": return 40;
+        case "removeValue": return 41;
+        case "removeCount": return 42;
+        case "removeSize": return 43;
+        case "removeIndex": return 44;
+        case "removeChild": return 45;
+        case "removeParent": return 46;
+        case "removeType": return 47;
+        case "putName": return 48;
+        case "putValue": return 49;
+        case "putCount": return 50;
+        case "putSize": return 51;
+        case "putIndex": return 52;
+        case "putChild": return 53;
+        case "putParent": return 54;
+        case "putType": return 55;
+        case "findName": return 56;
+        case "findValue": return 57;
+        case "findCount": return 58;
+        case "findSize": return 59;
+        case "findIndex": return 60;
+        case "findChild": return 61;
+        case "findParent": return 62;
+        case "findType": return 63;
+        default: return -1;
+        }
+    }
+
+    public static void main(String[] args) {
+        String[] inputs = new String[128];
+        for (int i = 0; i < inputs.length; i++) {
+            // Half hit a case, half miss
+            inputs[i] = (i % 2 == 0 ? WORDS[i / 2] : WORDS[i / 2] + "X");
+        }
+        long total = 0;
+        for (int round = 0; round < 20000; round++) {
+            for (String input : inputs) {
+                total += dispatch(input);
+            }
+        }
+        System.out.println(total);
+    }
+
+    static final String[] WORDS = {"getName", "getValue", "getCount", "getSize", "getIndex", "getChild", "getParent", "getType", "setName", "setValue", "setCount", "setSize", "setIndex", "setChild", "setParent", "setType", "isName", "isValue", "isCount", "isSize", "isIndex", "isChild", "isParent", "isType", "hasName", "hasValue", "hasCount", "hasSize", "hasIndex", "hasChild", "hasParent", "hasType", "addName", "addValue", "addCount", "addSize", "addIndex", "addChild", "addParent", "addType", "removeName", "removeValue", "removeCount", "removeSize", "removeIndex", "removeChild", "removeParent", "removeType", "putName", "putValue", "putCount", "putSize", "putIndex", "putChild", "putParent", "putType", "findName", "findValue", "findCount", "findSize", "findIndex", "findChild", "findParent", "findType"};
+}
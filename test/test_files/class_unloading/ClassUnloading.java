@@ -0,0 +1,52 @@
+import java.lang.ref.WeakReference;
+import java.nio.file.Files;
+import java.nio.file.Path;
+
+public class ClassUnloading {
+    static int runs = 0;
+
+    static class PluginLoader extends ClassLoader {
+        PluginLoader() {
+            super(ClassUnloading.class.getClassLoader());
+        }
+
+        Class<?> definePlugin(byte[] bytes) {
+            return defineClass("Plugin", bytes, 0, bytes.length);
+        }
+    }
+
+    static WeakReference<ClassLoader> loadPlugin(byte[] bytes) throws Exception {
+        PluginLoader loader = new PluginLoader();
+        loader.definePlugin(bytes);
+        Class.forName("Plugin", true, loader);
+        return new WeakReference<>(loader);
+    }
+
+    static void loadPlugins(byte[] bytes) throws Exception {
+        WeakReference<?>[] loaders = new WeakReference<?>[20];
+        for (int i = 0; i < loaders.length; i++) {
+            loaders[i] = loadPlugin(bytes);
+        }
+        System.gc();
+
+        int unloaded = 0;
+        for (WeakReference<?> ref : loaders) {
+            if (ref.get() == null) {
+                unloaded++;
+            }
+        }
+        System.out.println("Unloaded " + unloaded + " of " + loaders.length + " after " + runs + " runs");
+    }
+
+    public static void main(String[] args) throws Exception {
+        byte[] bytes = Files.readAllBytes(Path.of("test_files/class_unloading/Plugin.class"));
+        loadPlugins(bytes);
+        loadPlugins(bytes); // the space of the unloaded classes gets reused
+
+        // A loader which is still referenced keeps its classes
+        PluginLoader kept = new PluginLoader();
+        Class<?> plugin = kept.definePlugin(bytes);
+        System.gc();
+        System.out.println(plugin.getClassLoader() == kept);
+    }
+}
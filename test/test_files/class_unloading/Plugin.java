@@ -0,0 +1,8 @@
+public class Plugin {
+    static Object[] state = new Object[1000];
+
+    static {
+        state[0] = new Plugin(); // an instance reachable only from the class itself
+        ClassUnloading.runs++;
+    }
+}
@@ -0,0 +1,67 @@
+// Exceptions used for control flow: handler selection in nested and overlapping try blocks, unwinding through many
+// frames, and stack traces that are only materialized when asked for.
+public class Main {
+    static class Stop extends RuntimeException {
+        final int value;
+
+        Stop(int value) {
+            super(null, null, false, false);
+            this.value = value;
+        }
+    }
+
+    static int classify(int i) {
+        try {
+            try {
+                if (i % 3 == 0) throw new IllegalStateException();
+                if (i % 3 == 1) throw new IllegalArgumentException();
+                return 0;
+            } catch (IllegalArgumentException e) {
+                return 1;
+            } finally {
+                if (i == 4) throw new Stop(40);
+            }
+        } catch (IllegalStateException e) {
+            return 2;
+        } catch (Stop s) {
+            return s.value;
+        }
+    }
+
+    static void find(int depth, int target) {
+        if (depth == target) throw new Stop(depth);
+        find(depth + 1, target);
+    }
+
+    static Exception capture(int depth) {
+        if (depth == 0) return new Exception("here");
+        return capture(depth - 1);
+    }
+
+    public static void main(String[] args) {
+        StringBuilder sb = new StringBuilder();
+        for (int i = 0; i < 6; i++) {
+            sb.append(classify(i)).append(' ');
+        }
+        System.out.println(sb.toString().trim());
+
+        int found = 0;
+        for (int i = 0; i < 10000; i++) {
+            try {
+                find(0, i % 50);
+            } catch (Stop s) {
+                found += s.value;
+            }
+        }
+        System.out.println(found + " " + new Stop(1).getStackTrace().length);
+
+        Exception e = capture(2);
+        StackTraceElement[] trace = e.getStackTrace();
+        System.out.println(trace.length);
+        for (StackTraceElement element : trace) {
+            System.out.println(element.getClassName() + "." + element.getMethodName() + " " + element.getFileName() + ":"
+                    + element.getLineNumber());
+        }
+        System.out.println(e.getStackTrace()[3].equals(trace[3]));
+    }
+}
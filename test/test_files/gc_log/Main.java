@@ -0,0 +1,15 @@
+import java.lang.management.GarbageCollectorMXBean;
+import java.lang.management.ManagementFactory;
+
+public class Main {
+    public static void main(String[] args) {
+        System.gc();
+        System.gc();
+        for (GarbageCollectorMXBean gc : ManagementFactory.getGarbageCollectorMXBeans()) {
+            if (gc.getName().equals("Full")) {
+                System.out.println("Full collections: " + (gc.getCollectionCount() >= 2));
+                System.out.println("Collection time: " + (gc.getCollectionTime() >= 0));
+            }
+        }
+    }
+}
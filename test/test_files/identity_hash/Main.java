@@ -0,0 +1,54 @@
+public class Main {
+    static class Node {
+        Node next;
+        int value;
+    }
+
+    static Node[] nodes = new Node[1000];
+    static int[] hashes = new int[nodes.length];
+
+    static boolean hashesUnchanged() {
+        boolean same = true;
+        for (int i = 0; i < nodes.length; ++i) {
+            same &= hashes[i] == System.identityHashCode(nodes[i]);
+        }
+        return same;
+    }
+
+    public static void main(String[] args) {
+        for (int i = 0; i < nodes.length; ++i) {
+            nodes[i] = new Node();
+            nodes[i].value = i;
+            if (i > 0) nodes[i - 1].next = nodes[i];
+        }
+
+        // Hash half of the objects before their monitors are inflated, and the other half while they're locked
+        boolean nonnegative = true;
+        for (int i = 0; i < nodes.length; i += 2) {
+            hashes[i] = nodes[i].hashCode();
+        }
+        boolean stableWhileLocked = true;
+        for (int i = 0; i < nodes.length; ++i) {
+            synchronized (nodes[i]) {
+                if (i % 2 == 1) hashes[i] = System.identityHashCode(nodes[i]);
+                stableWhileLocked &= hashes[i] == nodes[i].hashCode();
+            }
+            nonnegative &= hashes[i] >= 0;
+        }
+        System.out.println("Stable while locked: " + stableWhileLocked);
+        System.out.println("Nonnegative: " + nonnegative);
+
+        // Idle monitors are deflated by the collector, and objects move
+        System.gc();
+        System.out.println("Stable after deflation: " + hashesUnchanged());
+
+        synchronized (nodes[0]) {
+            System.gc();
+            System.out.println("Stable while held across GC: " + hashesUnchanged());
+        }
+
+        int sum = 0;
+        for (Node n = nodes[0]; n != null; n = n.next) sum += n.value;
+        System.out.println("Sum: " + sum);
+    }
+}
@@ -0,0 +1,69 @@
+public class Main {
+    interface Shape {
+        int sides();
+    }
+
+    static final class Square implements Shape {
+        public int sides() { return 4; }
+    }
+
+    static final class Triangle implements Shape {
+        public int sides() { return 3; }
+    }
+
+    static abstract class Animal {
+        abstract int legs();
+    }
+
+    static class Dog extends Animal { int legs() { return 4; } }
+    static class Bird extends Animal { int legs() { return 2; } }
+    static class Fish extends Animal { int legs() { return 0; } }
+    static class Snake extends Animal { int legs() { return 0; } }
+    static class Spider extends Animal { int legs() { return 8; } }
+    static class Ant extends Animal { int legs() { return 6; } }
+
+    static final int N = 1200;
+
+    static int bimorphicSides(Shape[] shapes) {
+        int total = 0;
+        for (Shape shape : shapes) total += shape.sides();
+        return total;
+    }
+
+    static int trimorphicLegs(Animal[] animals) {
+        int total = 0;
+        for (Animal animal : animals) total += animal.legs();
+        return total;
+    }
+
+    static int megamorphicLegs(Animal[] animals) {
+        int total = 0;
+        for (Animal animal : animals) total += animal.legs();
+        return total;
+    }
+
+    public static void main(String[] args) {
+        Shape[] shapes = new Shape[N];
+        Animal[] three = new Animal[N];
+        Animal[] six = new Animal[N];
+        for (int i = 0; i < N; ++i) {
+            shapes[i] = i % 2 == 0 ? new Square() : new Triangle();
+            switch (i % 3) {
+                case 0: three[i] = new Dog(); break;
+                case 1: three[i] = new Bird(); break;
+                default: three[i] = new Fish(); break;
+            }
+            switch (i % 6) {
+                case 0: six[i] = new Dog(); break;
+                case 1: six[i] = new Bird(); break;
+                case 2: six[i] = new Fish(); break;
+                case 3: six[i] = new Snake(); break;
+                case 4: six[i] = new Spider(); break;
+                default: six[i] = new Ant(); break;
+            }
+        }
+        System.out.println(bimorphicSides(shapes));
+        System.out.println(trimorphicLegs(three));
+        System.out.println(megamorphicLegs(six));
+    }
+}
@@ -0,0 +1,189 @@
+// Every lookupswitch strategy: a few keys (scanned), dense keys (table), scattered keys (perfect hash or binary
+// search), and a string switch, whose hash codes include a collision ("Aa" and "BB").
+public class Main {
+    static int linear(int k) {
+        switch (k) {
+        case -100: return 1;
+        case 0: return 2;
+        case 100: return 3;
+        default: return -1;
+        }
+    }
+    static int table(int k) {
+        switch (k) {
+        case -24: return 1;
+        case -18: return 2;
+        case -12: return 3;
+        case -6: return 4;
+        case 0: return 5;
+        case 6: return 6;
+        case 12: return 7;
+        case 18: return 8;
+        case 24: return 9;
+        default: return -1;
+        }
+    }
+    static int hashed(int k) {
+        switch (k) {
+        case Integer.MIN_VALUE: return 1;
+        case -1704037703: return 2;
+        case -1420010287: return 3;
+        case -776791444: return 4;
+        case -380005548: return 5;
+        case -1: return 6;
+        case 7: return 7;
+        case 1598287794: return 8;
+        case 1737813524: return 9;
+        case 1739228534: return 10;
+        case 2121018115: return 11;
+        case Integer.MAX_VALUE: return 12;
+        default: return -1;
+        }
+    }
+    static int binary(int k) {
+        switch (k) {
+        case -923616812: return 1;
+        case -826666538: return 2;
+        case -821887917: return 3;
+        case -803127368: return 4;
+        case -799361699: return 5;
+        case -750912484: return 6;
+        case -655459704: return 7;
+        case -599031498: return 8;
+        case -579213132: return 9;
+        case -575030717: return 10;
+        case -565565199: return 11;
+        case -560736728: return 12;
+        case -489669571: return 13;
+        case -467128398: return 14;
+        case -460103536: return 15;
+        case -404299452: return 16;
+        case -359155292: return 17;
+        case -334398785: return 18;
+        case -309648260: return 19;
+        case -295373214: return 20;
+        case -150341618: return 21;
+        case -135603964: return 22;
+        case -103425789: return 23;
+        case -57366383: return 24;
+        case 31939892: return 25;
+        case 85750973: return 26;
+        case 201501676: return 27;
+        case 217089771: return 28;
+        case 307606404: return 29;
+        case 310568491: return 30;
+        case 315398956: return 31;
+        case 427537528: return 32;
+        case 446215326: return 33;
+        case 452882265: return 34;
+        case 601316622: return 35;
+        case 687365698: return 36;
+        case 762758838: return 37;
+        case 896665908: return 38;
+        case 902830359: return 39;
+        case 989398872: return 40;
+        default: return -1;
+        }
+    }
+    static int string(String s) {
+        switch (s) {
+        case "alpha": return 1;
+        case "bravo": return 2;
+        case "charlie": return 3;
+        case "delta": return 4;
+        case "echo": return 5;
+        case "foxtrot": return 6;
+        case "golf": return 7;
+        case "hotel": return 8;
+        case "india": return 9;
+        case "juliett": return 10;
+        case "kilo": return 11;
+        case "lima": return 12;
+        case "mike": return 13;
+        case "november": return 14;
+        case "oscar": return 15;
+        case "papa": return 16;
+        case "quebec": return 17;
+        case "romeo": return 18;
+        case "sierra": return 19;
+        case "tango": return 20;
+        case "uniform": return 21;
+        case "victor": return 22;
+        case "whiskey": return 23;
+        case "xray": return 24;
+        case "yankee": return 25;
+        case "zulu": return 26;
+        case "Aa": return 27;
+        case "BB": return 28;
+        case "red": return 29;
+        case "orange": return 30;
+        case "yellow": return 31;
+        case "green": return 32;
+        case "blue": return 33;
+        case "indigo": return 34;
+        case "violet": return 35;
+        case "black": return 36;
+        case "white": return 37;
+        case "grey": return 38;
+        case "north": return 39;
+        case "south": return 40;
+        case "east": return 41;
+        case "west": return 42;
+        case "spring": return 43;
+        case "summer": return 44;
+        case "autumn": return 45;
+        case "winter": return 46;
+        case "sun": return 47;
+        case "moon": return 48;
+        default: return -1;
+        }
+    }
+
+    static final int[] LINEAR = {-100, 0, 100};
+    static final int[] TABLE = {-24, -18, -12, -6, 0, 6, 12, 18, 24};
+    static final int[] HASHED = {Integer.MIN_VALUE, -1704037703, -1420010287, -776791444, -380005548, -1, 7, 1598287794, 1737813524, 1739228534, 2121018115, Integer.MAX_VALUE};
+    static final int[] BINARY = {-923616812, -826666538, -821887917, -803127368, -799361699, -750912484, -655459704, -599031498, -579213132, -575030717, -565565199, -560736728, -489669571, -467128398, -460103536, -404299452, -359155292, -334398785, -309648260, -295373214, -150341618, -135603964, -103425789, -57366383, 31939892, 85750973, 201501676, 217089771, 307606404, 310568491, 315398956, 427537528, 446215326, 452882265, 601316622, 687365698, 762758838, 896665908, 902830359, 989398872};
+    static final String[] WORDS = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel", "india", "juliett", "kilo", "lima", "mike", "november", "oscar", "papa", "quebec", "romeo", "sierra", "tango", "uniform", "victor", "whiskey", "xray", "yankee", "zulu", "Aa", "BB", "red", "orange", "yellow", "green", "blue", "indigo", "violet", "black", "white", "grey", "north", "south", "east", "west", "spring", "summer", "autumn", "winter", "sun", "moon"};
+
+    static int lookup(int which, int k) {
+        switch (which) {
+        case 0: return linear(k);
+        case 1: return table(k);
+        case 2: return hashed(k);
+        default: return binary(k);
+        }
+    }
+
+    static boolean contains(int[] keys, int k) {
+        for (int key : keys) {
+            if (key == k) return true;
+        }
+        return false;
+    }
+
+    static void check(String name, int which, int[] keys) {
+        int mismatches = 0;
+        for (int i = 0; i < keys.length; i++) {
+            if (lookup(which, keys[i]) != i + 1) mismatches++;
+            for (int k = keys[i] - 2; k != keys[i] + 3; k++) { // wraps around at the extremes
+                if (!contains(keys, k) && lookup(which, k) != -1) mismatches++;
+            }
+        }
+        System.out.println(name + ": " + keys.length + " keys, " + mismatches + " mismatches");
+    }
+
+    public static void main(String[] args) {
+        check("linear", 0, LINEAR);
+        check("table", 1, TABLE);
+        check("hashed", 2, HASHED);
+        check("binary", 3, BINARY);
+
+        int mismatches = 0;
+        for (int i = 0; i < WORDS.length; i++) {
+            if (string(WORDS[i]) != i + 1) mismatches++;
+            if (string(WORDS[i] + "!") != -1) mismatches++;
+        }
+        if (string("C#") != -1) mismatches++; // same hash code as "Aa" and "BB"
+        System.out.println("string: " + WORDS.length + " keys, " + mismatches + " mismatches");
+    }
+}
@@ -0,0 +1,51 @@
+import java.util.ArrayList;
+import java.util.List;
+
+public class Main {
+    interface I0 { default int f0() { return 0; } }
+    interface I1 { default int f1() { return 1; } }
+    interface I2 { default int f2() { return 2; } }
+    interface I3 { default int f3() { return 3; } }
+    interface I4 { default int f4() { return 4; } }
+    interface I5 { default int f5() { return 5; } }
+    interface I6 { default int f6() { return 6; } }
+    interface I7 { default int f7() { return 7; } }
+    interface I8 extends I0, I1 { default int f8() { return 8; } }
+    interface I9 extends I8, I2 { default int f9() { return 9; } }
+    interface Unimplemented { }
+
+    static class Wide implements I3, I4, I5, I6, I7, I9, Comparable<Wide>, Runnable, Cloneable {
+        public int compareTo(Wide o) { return 0; }
+        public void run() { }
+        public int f5() { return 50; }
+    }
+
+    static class Narrow implements I4 { }
+
+    public static void main(String[] args) {
+        Object wide = new Wide(), narrow = new Narrow();
+        System.out.println((wide instanceof I0) + " " + (wide instanceof I2) + " " + (wide instanceof I8) + " "
+                + (wide instanceof Runnable) + " " + (wide instanceof Unimplemented) + " " + (narrow instanceof I5));
+
+        int sum = 0;
+        for (int i = 0; i < 1000; ++i) {
+            Object o = i % 2 == 0 ? wide : narrow;
+            if (o instanceof I5) sum += ((I5) o).f5();
+            if (o instanceof I4) sum += ((I4) o).f4();
+            if (o instanceof I9) sum += ((I9) o).f9() + ((I9) o).f0() + ((I9) o).f1() + ((I9) o).f2();
+        }
+        System.out.println(sum);
+
+        try {
+            I3 bad = (I3) narrow;
+            System.out.println(bad);
+        } catch (ClassCastException e) {
+            System.out.println("ClassCastException");
+        }
+
+        // A JDK class with many superinterfaces
+        List<Integer> list = new ArrayList<>(List.of(3, 1, 2));
+        list.sort(null);
+        System.out.println(list + " " + (list instanceof java.util.RandomAccess) + " " + (list instanceof java.util.Set));
+    }
+}
@@ -0,0 +1,29 @@
+import java.lang.ref.*;
+import java.util.ArrayList;
+import java.util.List;
+
+public class ReferenceStrength {
+    public static void main(String[] args) throws InterruptedException {
+        ReferenceQueue<Object> queue = new ReferenceQueue<>();
+        SoftReference<byte[]> soft = new SoftReference<>(new byte[1000]);
+        WeakReference<Object> weak = new WeakReference<>(new Object());
+        PhantomReference<Object> phantom = new PhantomReference<>(new Object(), queue);
+        System.gc();
+
+        // With plenty of free heap, a recently read soft reference is kept; weak and phantom ones are not
+        System.out.println(soft.get() != null);
+        System.out.println(weak.get() == null);
+        System.out.println(queue.remove(10000) == phantom);
+
+        // Softly reachable objects are cleared rather than running out of memory
+        List<SoftReference<byte[]>> cache = new ArrayList<>();
+        for (int i = 0; i < 64; i++) {
+            cache.add(new SoftReference<>(new byte[1 << 20]));
+        }
+        int cleared = 0;
+        for (SoftReference<byte[]> ref : cache) {
+            if (ref.get() == null) cleared++;
+        }
+        System.out.println(cleared > 0);
+    }
+}
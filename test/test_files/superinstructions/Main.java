@@ -0,0 +1,107 @@
+// Loops shaped like javac's output, which the interpreter runs with superinstructions, plus the corner cases: integer
+// overflow, every if_icmp<op>, and exceptions thrown partway through a fused sequence.
+public class Main {
+    int value;
+    Main next;
+
+    Main(int value, Main next) {
+        this.value = value;
+        this.next = next;
+    }
+
+    // iload; if_icmpge, iload; iload; iadd, and iinc; goto
+    static int sumTo(int n) {
+        int sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum = sum + i;
+        }
+        return sum;
+    }
+
+    static int countDown(int n) {
+        int steps = 0;
+        for (int i = n; i > 0; i -= 3) {
+            steps++;
+        }
+        return steps;
+    }
+
+    static int compare(int a, int b) {
+        int mask = 0;
+        if (a == b) mask |= 1;
+        if (a != b) mask |= 2;
+        if (a < b) mask |= 4;
+        if (a >= b) mask |= 8;
+        if (a > b) mask |= 16;
+        if (a <= b) mask |= 32;
+        return mask;
+    }
+
+    static int add(int a, int b) {
+        int c = a + b;
+        return c;
+    }
+
+    // aload; getfield
+    static int sumList(Main head) {
+        int sum = 0;
+        for (Main m = head; m != null; m = m.next) {
+            sum += m.value;
+        }
+        return sum;
+    }
+
+    static int readValue(Main m) {
+        return m.value;
+    }
+
+    // aload; arraylength
+    static long sumArray(int[] array) {
+        long total = 0;
+        for (int i = 0; i < array.length; i++) {
+            total += array[i];
+        }
+        return total;
+    }
+
+    static int length(int[] array) {
+        return array.length;
+    }
+
+    public static void main(String[] args) {
+        System.out.println(sumTo(100000) + " " + countDown(100));
+        System.out.println(compare(1, 2) + " " + compare(2, 2) + " " + compare(3, 2) + " "
+                + compare(Integer.MIN_VALUE, Integer.MAX_VALUE));
+        System.out.println(add(Integer.MAX_VALUE, 1) + " " + add(-5, 3));
+
+        Main list = null;
+        for (int i = 1; i <= 1000; i++) {
+            list = new Main(i, list);
+        }
+        System.out.println(sumList(list) + " " + sumList(null));
+
+        int[] array = new int[5000];
+        for (int i = 0; i < array.length; i++) {
+            array[i] = i * 3;
+        }
+        System.out.println(sumArray(array) + " " + sumArray(new int[0]));
+
+        // The exceptions must be attributed to the getfield/arraylength, not to the aload that begins the sequence
+        for (int i = 0; i < 3; i++) {
+            readValue(list);
+            length(array);
+        }
+        try {
+            readValue(null);
+        } catch (NullPointerException e) {
+            System.out.println(e.getMessage().startsWith("Cannot read field \"value\"") + " "
+                    + e.getStackTrace()[0].getLineNumber());
+        }
+        try {
+            length(null);
+        } catch (NullPointerException e) {
+            System.out.println(e.getMessage().startsWith("Cannot read the array length") + " "
+                    + e.getStackTrace()[0].getLineNumber());
+        }
+    }
+}
@@ -0,0 +1,21 @@
+public class WeakInterning {
+    public static void main(String[] args) {
+        String kept = ("key" + args.length).intern();
+
+        // Intern more distinct strings than the heap can hold at once; the ones we drop must be collectable
+        for (int i = 0; i < 400000; i++) {
+            String s = ("dynamic-key-" + i).intern();
+            if (s != ("dynamic-key-" + i).intern()) {
+                System.out.println("Not canonical: " + s);
+                return;
+            }
+        }
+        System.gc();
+
+        System.out.println(kept == new String("key0").intern());
+        System.out.println("key0" == kept);
+        System.out.println(("été" + args.length).intern() == "été0");
+        System.out.println(("中" + args.length).intern() == "中0");
+        System.out.println(("dynamic-key-" + 123).intern() == ("dynamic-key-" + 123).intern());
+    }
+}
@@ -301,7 +301,7 @@ ScheduledTestCaseResult run_scheduled_test_case(std::string classpath, bool capt
 
   if (thread->current_exception) {
     method =
-        method_lookup(thread->current_exception->descriptor, STR("toString"), STR("()Ljava/lang/String;"), true, false);
+        method_lookup(obj_class(thread->current_exception), STR("toString"), STR("()Ljava/lang/String;"), true, false);
     stack_value to_string_args[1] = {{.obj = thread->current_exception}};
     thread->current_exception = nullptr;
 
@@ -313,7 +313,7 @@ ScheduledTestCaseResult run_scheduled_test_case(std::string classpath, bool capt
     free_heap_str(read);
 
     // Then call printStackTrace ()V
-    method = method_lookup(to_string_args[0].obj->descriptor, STR("printStackTrace"), STR("()V"), true, false);
+    method = method_lookup(obj_class(to_string_args[0].obj), STR("printStackTrace"), STR("()V"), true, false);
     call_interpreter_synchronous(thread, method, to_string_args);
     if (capture_stdio)
       std::cerr << result.stderr_;
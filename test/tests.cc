@@ -10,16 +10,23 @@
 #include <iostream>
 #include <optional>
 #include <ranges>
+#include <tuple>
 #include <unordered_map>
 
 #include "tests-common.h"
 #include <adt.h>
+#include <alloc_sampler.h>
 #include <analysis.h>
+#include <arrays.h>
 #include <bjvm.h>
+#include <gc.h>
+#include <heap_dump.h>
+#include <jit_allocator.h>
 #include <numeric>
 #include <roundrobin_scheduler.h>
 #include <unistd.h>
 #include <util.h>
+#include <x86_jit.h>
 
 using namespace Bjvm::Tests;
 
@@ -340,6 +347,181 @@ TEST_CASE("Simple OutOfMemoryError") {
   REQUIRE(result.stderr_.find("OutOfMemoryError") != std::string::npos);
 }
 
+TEST_CASE("Heap dump on OutOfMemoryError") {
+  auto path = std::filesystem::temp_directory_path() / "bjvm_oom_test.hprof";
+  std::filesystem::remove(path);
+  vm_options options = default_vm_options();
+  std::string path_str = path.string();
+  options.heap_dump_path = path_str.c_str();
+
+  auto result = run_test_case("test_files/out_of_memory/", true, "Main", "", {}, options);
+  REQUIRE(result.stderr_.find("OutOfMemoryError") != std::string::npos);
+
+  std::ifstream dump(path, std::ios::binary);
+  std::string header(19, '\0');
+  dump.read(header.data(), header.size());
+  REQUIRE(header == std::string("JAVA PROFILE 1.0.2", 19));
+  REQUIRE(std::filesystem::file_size(path) > (1 << 20));
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Heap histogram") {
+  vm_options options = default_vm_options();
+  options.classpath = STR("test_files/json");
+  auto vm = CreateTestVM(options);
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+
+  classdesc *Person = bootstrap_lookup_class(thread, STR("Person"));
+  REQUIRE(Person);
+  initialize_class_t init = {.args = {thread, Person}};
+  REQUIRE(initialize_class(&init).status == FUTURE_READY);
+
+  constexpr size_t INSTANCES = 1234;
+  handle *people = make_handle(thread, CreateObjectArray1D(thread, Person, INSTANCES));
+  for (size_t i = 0; i < INSTANCES; ++i) {
+    obj_header *person = new_object(thread, Person);
+    REQUIRE(person);
+    ReferenceArrayStore(people->obj, i, person);
+  }
+  size_t bytes = align_up(size_of_object(ReferenceArrayLoad(people->obj, 0)), 8);
+
+  // e.g. "  12:           1234          19744  Person"
+  char *histogram = heap_histogram(vm.get());
+  std::string table = histogram;
+  free(histogram);
+  size_t end = table.find("  Person\n");
+  REQUIRE(end != std::string::npos);
+  size_t start = table.rfind('\n', end) + 1;
+  size_t instances = 0, total = 0;
+  REQUIRE(sscanf(table.c_str() + start, "%*d: %zu %zu", &instances, &total) == 2);
+  REQUIRE(instances == INSTANCES);
+  REQUIRE(total == INSTANCES * bytes);
+
+  drop_handle(thread, people);
+  free_thread(thread);
+}
+
+TEST_CASE("Allocation sampling") {
+  auto path = std::filesystem::temp_directory_path() / "bjvm_alloc_samples.txt";
+  std::filesystem::remove(path);
+  vm_options options = default_vm_options();
+  std::string path_str = path.string();
+  options.alloc_sample_path = path_str.c_str();
+  options.alloc_sample_interval = 64 << 10;
+
+  auto result = run_test_case("test_files/alloc_sampler/", true, "Main", "", {}, options);
+  REQUIRE(result.stdout_ == "done\n");
+
+  // ~26 MB of long[32]s should yield about 400 samples, all under Main.main
+  std::string samples = ReadFileAsString(path.string());
+  REQUIRE(samples.find("Main:main@") == 0);
+  REQUIRE(samples.find(";Main:allocateArrays@") != std::string::npos);
+  REQUIRE(samples.find(";Main:allocateStrings@") != std::string::npos);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Allocation samples outlive the VM") {
+  vm_options options = default_vm_options();
+  options.classpath = STR("test_files/alloc_sampler");
+  auto vm = CreateTestVM(options);
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+  alloc_sampler *sampler = start_allocation_sampler(vm.get(), 64 << 10, 16);
+
+  classdesc *Main = bootstrap_lookup_class(thread, STR("Main"));
+  REQUIRE(Main);
+  initialize_class_t init = {.args = {thread, Main}};
+  REQUIRE(initialize_class(&init).status == FUTURE_READY);
+  cp_method *method = method_lookup(Main, STR("allocateArrays"), STR("()V"), false, false);
+  REQUIRE(method);
+  stack_value args[1] = {};
+  call_interpreter_synchronous(thread, method, args);
+  REQUIRE(!thread->current_exception);
+
+  // Freeing the VM frees Main along with its methods, which the samples must no longer refer to
+  free_thread(thread);
+  vm.reset();
+
+  char *collapsed = allocation_samples_collapsed(sampler);
+  std::string samples = collapsed;
+  free(collapsed);
+  REQUIRE(samples.find("Main:allocateArrays@") == 0);
+
+  size_t length;
+  u8 *pprof = allocation_samples_pprof(sampler, &length);
+  std::string profile((char *)pprof, length);
+  free(pprof);
+  REQUIRE(profile.find("Main.allocateArrays") != std::string::npos);
+  REQUIRE(profile.find("Main.java") != std::string::npos);
+  free_allocation_sampler(sampler);
+}
+
+TEST_CASE("GC log and GarbageCollectorMXBean") {
+  vm_options options = default_vm_options();
+  options.gc_log = true;
+  auto result = run_test_case("test_files/gc_log/", true, "Main", "", {}, options);
+
+  size_t full_pauses = 0;
+  for (size_t pos = 0; (pos = result.stdout_.find("][info][gc] GC(", pos)) != std::string::npos; ++pos) {
+    full_pauses += result.stdout_.compare(result.stdout_.find(") ", pos), 13, ") Pause Full ") == 0;
+  }
+  REQUIRE(full_pauses >= 2);
+  REQUIRE(result.stdout_.find("[info][gc,stats]") != std::string::npos);
+  REQUIRE(result.stdout_.find("Full collections: true\nCollection time: true\n") != std::string::npos);
+}
+
+TEST_CASE("Interface dispatch and instanceof with many interfaces") {
+  auto result = run_test_case("test_files/many_interfaces/", true, "Main");
+  REQUIRE(result.stdout_ == R"(true true true true false false
+35000
+ClassCastException
+[1, 2, 3] true false
+)");
+}
+
+TEST_CASE("lookupswitch strategies") {
+  auto result = run_test_case("test_files/lookupswitch/", true, "Main");
+  REQUIRE(result.stdout_ == R"(linear: 3 keys, 0 mismatches
+table: 9 keys, 0 mismatches
+hashed: 12 keys, 0 mismatches
+binary: 40 keys, 0 mismatches
+string: 48 keys, 0 mismatches
+)");
+}
+
+TEST_CASE("Superinstructions") {
+  auto result = run_test_case("test_files/superinstructions/", true, "Main");
+  REQUIRE(result.stdout_ == R"(704982704 34
+38 41 26 38
+-2147483648 -2
+500500 0
+37492500 0
+true 55
+true 68
+)");
+}
+
+TEST_CASE("Polymorphic inline caches") {
+  vm_options options = default_vm_options();
+  options.print_inline_caches = true;
+  auto result = run_test_case("test_files/inline_caches/", true, "Main", "", {}, options);
+  REQUIRE(result.stdout_ == "4200\n2400\n4000\n");
+
+  // Each call site's line of the report: hits, misses, receivers (or "mega"), and the call site
+  auto site = [&](const char *method) {
+    size_t at = result.stderr_.find(std::string(" Main.") + method);
+    REQUIRE(at != std::string::npos);
+    size_t line = result.stderr_.rfind('\n', at) + 1;
+    unsigned long long hits, misses;
+    char receivers[16];
+    REQUIRE(sscanf(result.stderr_.c_str() + line, "%llu %llu %15s", &hits, &misses, receivers) == 3);
+    return std::make_tuple(hits, misses, std::string(receivers));
+  };
+  // The first call goes through the monomorphic cache, the second turns it into a polymorphic one
+  REQUIRE(site("bimorphicSides") == std::make_tuple(1198ULL, 1ULL, std::string("2")));
+  REQUIRE(site("trimorphicLegs") == std::make_tuple(1197ULL, 2ULL, std::string("3")));
+  REQUIRE(site("megamorphicLegs") == std::make_tuple(0ULL, 1199ULL, std::string("mega")));
+}
+
 TEST_CASE("Exceptions in <clinit>") {
   auto result = run_test_case("test_files/eiie/", true);
   REQUIRE(result.stdout_ == R"(Egg
@@ -670,6 +852,16 @@ caching correctly: true
 )");
 }
 
+TEST_CASE("Identity hash codes survive monitor inflation and GC") {
+  auto result = run_scheduled_test_case("test_files/identity_hash/", true, "Main");
+  REQUIRE(result.stdout_ == R"(Stable while locked: true
+Nonnegative: true
+Stable after deflation: true
+Stable while held across GC: true
+Sum: 499500
+)");
+}
+
 TEST_CASE("Single thread interruption") {
   auto result = run_scheduled_test_case("test_files/single_thread_interrupt/", true);
 
@@ -823,6 +1015,14 @@ TEST_CASE("URLClassLoader") {
   REQUIRE(result.stdout_ == "Hello, world!\n");
 }
 
+TEST_CASE("Class unloading") {
+  auto result = run_test_case("test_files/class_unloading/", true, "ClassUnloading");
+  REQUIRE(result.stdout_ == R"(Unloaded 20 of 20 after 20 runs
+Unloaded 20 of 20 after 40 runs
+true
+)");
+}
+
 TEST_CASE("Name of array class") {
   auto result = run_test_case("test_files/name_of_array_class/", true, "NameOfArrayClass");
   REQUIRE(result.stdout_ == "[Ljava.lang.String;\n");
@@ -842,6 +1042,19 @@ TEST_CASE("Manually thrown exception") {
                             "ManuallyThrown.main(ManuallyThrown.java:4)\n");
 }
 
+TEST_CASE("Exceptions as control flow") {
+  auto result = run_test_case("test_files/control_flow_exceptions/", true, "Main");
+  REQUIRE(result.stdout_ == R"(2 1 0 2 40 0
+245000 0
+4
+Main.capture Main.java:37
+Main.capture Main.java:38
+Main.capture Main.java:38
+Main.main Main.java:58
+true
+)");
+}
+
 TEST_CASE("Fannkuch redux multithreaded") {
   auto result = run_scheduled_test_case("test_files/fannkuch_multithreaded/", true, "fannkuchredux");
   REQUIRE(result.stdout_ == R"(73196
@@ -898,6 +1111,170 @@ null
 )");
 }
 
+TEST_CASE("Minor collections") {
+  vm_options options = default_vm_options();
+  options.young_generation_size = 1 << 20;
+
+  auto result = run_test_case("test_files/tricky_gc", true, "AttemptGcCrash", "", {}, options);
+  REQUIRE(result.stdout_ == "Out of memory!\n");
+
+  result = run_test_case("test_files/weak_references", true, "WeakReferences", "", {}, options);
+  REQUIRE(result.stdout_ == R"(Egg
+Egg
+null
+null
+Egg
+null
+null
+)");
+
+  result = run_scheduled_test_case("test_files/synchronized_counter/", true, "Main", "", {}, options);
+  REQUIRE(result.stdout_ == "Final count: 5000\n");
+}
+
+// Builds rows of int[]s, interleaved with garbage and spanning several 1 MiB chunks of the heap (the unit of work of a
+// parallel collection), then collects a few times and describes what survived: each row's sums, and whether the arrays
+// which rows share are still shared.
+static std::string collect_array_rows(int gc_threads) {
+  vm_options options = default_vm_options();
+  options.gc_threads = gc_threads;
+  auto vm = CreateTestVM(options);
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+  classdesc *Object = cached_classes(vm.get())->object;
+
+  constexpr int ROWS = 256, COLUMNS = 32, INTS = 256;
+  handle *rows = make_handle(thread, CreateObjectArray1D(thread, Object, ROWS));
+  for (int r = 0; r < ROWS; ++r) {
+    handle *row = make_handle(thread, CreateObjectArray1D(thread, Object, COLUMNS));
+    for (int c = 0; c < COLUMNS; ++c) {
+      CreatePrimitiveArray1D(thread, TYPE_KIND_INT, INTS); // garbage
+      obj_header *ints = CreatePrimitiveArray1D(thread, TYPE_KIND_INT, INTS);
+      for (int i = 0; i < INTS; ++i) {
+        ((int *)ArrayData(ints))[i] = r * COLUMNS + c + i;
+      }
+      ReferenceArrayStore(row->obj, c, ints);
+    }
+    if (r > 0) { // share an array with the previous row, which lies some way back in the heap
+      ReferenceArrayStore(row->obj, 0, ReferenceArrayLoad(ReferenceArrayLoad(rows->obj, r - 1), COLUMNS - 1));
+    }
+    ReferenceArrayStore(rows->obj, r, row->obj);
+    drop_handle(thread, row);
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    major_gc(vm.get());
+  }
+  REQUIRE(vm->heap_used > (6 << 20));
+
+  std::string result;
+  for (int r = 0; r < ROWS; ++r) {
+    obj_header *row = ReferenceArrayLoad(rows->obj, r);
+    long sum = 0;
+    for (int c = 0; c < COLUMNS; ++c) {
+      obj_header *ints = ReferenceArrayLoad(row, c);
+      sum = std::accumulate((int *)ArrayData(ints), (int *)ArrayData(ints) + ArrayLength(ints), sum);
+    }
+    bool shared =
+        r > 0 && ReferenceArrayLoad(row, 0) == ReferenceArrayLoad(ReferenceArrayLoad(rows->obj, r - 1), COLUMNS - 1);
+    result += std::to_string(sum) + (shared ? "s " : " ");
+  }
+  drop_handle(thread, rows);
+  free_thread(thread);
+  return result;
+}
+
+TEST_CASE("Parallel collections") {
+  std::string serial = collect_array_rows(1);
+  REQUIRE(collect_array_rows(4) == serial);
+  REQUIRE(collect_array_rows(2) == serial);
+}
+
+TEST_CASE("Growable heap") {
+  vm_options options = default_vm_options();
+  options.heap_size = 1 << 22;
+  options.max_heap_size = 1 << 26;
+  options.heap_policy = HEAP_POLICY_OCCUPANCY;
+  auto vm = CreateTestVM(options);
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+
+  // Runtime.totalMemory() is the capacity of the compacting heap
+  major_gc(vm.get());
+  size_t initial = vm->heap_capacity;
+
+  // Keep ~16 MiB alive, four times the initial capacity
+  constexpr int ARRAYS = 4096;
+  handle *arrays = make_handle(thread, CreateObjectArray1D(thread, cached_classes(vm.get())->object, ARRAYS));
+  for (int i = 0; i < ARRAYS; ++i) {
+    obj_header *ints = CreatePrimitiveArray1D(thread, TYPE_KIND_INT, 1024);
+    REQUIRE(ints);
+    ReferenceArrayStore(arrays->obj, i, ints);
+  }
+  major_gc(vm.get());
+  size_t grown = vm->heap_capacity;
+  REQUIRE(grown > initial + (16 << 20));
+  REQUIRE(grown <= options.max_heap_size);
+
+  drop_handle(thread, arrays);
+  major_gc(vm.get());
+  REQUIRE(vm->heap_capacity < grown / 2);
+
+  free_thread(thread);
+}
+
+TEST_CASE("Large-object space") {
+  vm_options options = default_vm_options();
+  options.large_object_threshold = 8192;
+  options.young_generation_size = 1 << 20;
+  auto vm = CreateTestVM(options);
+  vm_thread *thread = create_main_thread(vm.get(), default_thread_options());
+
+  major_gc(vm.get());
+  size_t large_bytes = vm->large_object_bytes;
+
+  handle *large = make_handle(thread, CreatePrimitiveArray1D(thread, TYPE_KIND_INT, 1 << 16));
+  obj_header *address = large->obj;
+  REQUIRE(find_large_object(vm.get(), address) == address);
+  REQUIRE(vm->large_object_bytes > large_bytes + (1 << 18));
+  s32 hash = get_object_hash_code(vm.get(), address);
+  ((int *)ArrayData(address))[12345] = 42;
+
+  // Neither minor nor major collections move it, and its identity hash stays the same
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 1024; ++j) {
+      CreatePrimitiveArray1D(thread, TYPE_KIND_INT, 1024); // garbage
+    }
+    major_gc(vm.get());
+    REQUIRE(large->obj == address);
+    REQUIRE(find_large_object(vm.get(), address) == address);
+    REQUIRE(get_object_hash_code(vm.get(), large->obj) == hash);
+    REQUIRE(((int *)ArrayData(large->obj))[12345] == 42);
+  }
+
+  // Once unreachable, the next major collection frees it
+  drop_handle(thread, large);
+  major_gc(vm.get());
+  REQUIRE(vm->large_object_bytes == large_bytes);
+  REQUIRE(find_large_object(vm.get(), address) == nullptr);
+
+  free_thread(thread);
+}
+
+TEST_CASE("Interned strings are weak") {
+  vm_options options = default_vm_options();
+  options.heap_size = 1 << 24;
+
+  auto result = run_test_case("test_files/weak_interning", true, "WeakInterning", "", {}, options);
+  REQUIRE(result.stdout_ == "true\ntrue\ntrue\ntrue\ntrue\n");
+}
+
+TEST_CASE("Soft, weak and phantom references") {
+  vm_options options = default_vm_options();
+  options.heap_size = 1 << 24;
+
+  auto result = run_test_case("test_files/reference_strength", true, "ReferenceStrength", "", {}, options);
+  REQUIRE(result.stdout_ == "true\ntrue\ntrue\ntrue\n");
+}
+
 TEST_CASE("Bad classloaders") {
   auto result = run_test_case("test_files/bad_classloaders", true, "BadClassloaders");
   REQUIRE(result.stdout_ == R"(Message:java/lang/String
@@ -922,6 +1299,36 @@ class C cannot implement sealed interface I
 )");
 }
 
+#ifdef X86_JIT_SUPPORTED
+TEST_CASE("JIT allocator installs executable code") {
+  const u8 return_42[] = {0xB8, 0x2A, 0x00, 0x00, 0x00, 0xC3}; // mov eax, 42; ret
+  std::vector<void *> installed;
+  for (int i = 0; i < 3; ++i) {
+    void *code = jit_install_code(return_42, sizeof(return_42));
+    REQUIRE(code != nullptr);
+    REQUIRE(((int (*)())code)() == 42);
+    for (void *other : installed)
+      REQUIRE(other != code);
+    installed.push_back(code);
+  }
+  for (void *code : installed)
+    jit_free_code(code, sizeof(return_42));
+
+  // Freed space can be used again
+  void *code = jit_install_code(return_42, sizeof(return_42));
+  REQUIRE(((int (*)())code)() == 42);
+  jit_free_code(code, sizeof(return_42));
+
+  // The arena grows for code bigger than its chunks
+  std::vector<u8> big(20 << 20, 0x90); // nops
+  memcpy(big.data() + big.size() - sizeof(return_42), return_42, sizeof(return_42));
+  code = jit_install_code(big.data(), big.size());
+  REQUIRE(code != nullptr);
+  REQUIRE(((int (*)())code)() == 42);
+  jit_free_code(code, big.size());
+}
+#endif
+
 #if 0
 TEST_CASE("Print useful trampolines") { print_method_sigs(); }
 #endif
\ No newline at end of file
@@ -128,7 +128,7 @@ bool hash_table_iterator_next(hash_table_iterator *iter) {
   return iter->current_base != iter->end;
 }
 
-static u32 fxhash_string(const char *key, size_t len) {
+u32 fxhash_string(const char *key, size_t len) {
   constexpr u64 FXHASH_CONST = 0x517cc1b727220a95ULL;
   u64 hash = 0;
   for (size_t i = 0; i + 7 < len; i += 8) {
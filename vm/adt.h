@@ -65,6 +65,8 @@ void string_builder_init(string_builder *builder);
 void string_builder_append(string_builder *builder, const char *fmt, ...);
 void string_builder_free(string_builder *builder);
 
+u32 fxhash_string(const char *key, size_t len);
+
 string_hash_table make_hash_table(void (*free_fn)(void *), double load_factor, size_t initial_capacity);
 
 hash_table_iterator hash_table_get_iterator(const string_hash_table *tbl);
@@ -0,0 +1,317 @@
+#include "alloc_sampler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A method which appears in samples. The sampler's results outlive the VM, and may outlive the method's class (which
+// is unloaded once its loader is unreachable), so what the exporters need is copied when the method is first seen.
+typedef struct {
+  heap_string class_name, name;
+  heap_string source_file; // empty if unknown
+} alloc_method;
+
+typedef struct {
+  int method; // index in the sampler's methods
+  int pc;     // 0 in native frames
+  int line;   // -1 if unknown
+} alloc_frame;
+
+typedef struct {
+  alloc_frame *frames; // innermost first
+  int depth;
+  size_t samples;
+  size_t sampled_bytes; // sum of the sizes of the sampled allocations
+} alloc_site;
+
+typedef struct alloc_sampler {
+  vm *vm;
+  size_t interval;
+  int max_depth;
+  alloc_site *sites;       // stb_ds array
+  string_hash_table index; // stack (the bytes of its alloc_frames) -> 1 + index in sites
+  alloc_method *methods;   // stb_ds array
+  // method (its class name, name, descriptor and source file, separated by newlines) -> 1 + index in methods
+  string_hash_table method_index;
+  heap_string key; // scratch space for method_index keys
+} alloc_sampler;
+
+// Lower the fast path's limit to the thread's next sample point, if it falls in the current TLAB
+static void limit_tlab(alloc_sampler *sampler, vm_thread *thread) {
+  thread->tlab_sample_base = thread->tlab_top;
+  thread->tlab_end = thread->tlab_hard_end;
+  if (sampler && thread->bytes_until_sample < thread->tlab_hard_end - thread->tlab_top) {
+    thread->tlab_end = thread->tlab_top + thread->bytes_until_sample;
+  }
+}
+
+alloc_sampler *start_allocation_sampler(vm *vm, size_t interval_bytes, int max_depth) {
+  if (vm->alloc_sampler) {
+    stop_allocation_sampler(vm->alloc_sampler);
+  }
+  alloc_sampler *sampler = calloc(1, sizeof(alloc_sampler));
+  sampler->vm = vm;
+  sampler->interval = interval_bytes > 0 ? interval_bytes : 1;
+  sampler->max_depth = max_depth > 0 ? max_depth : 1;
+  sampler->index = make_hash_table(nullptr, 0.75, 64);
+  sampler->method_index = make_hash_table(nullptr, 0.75, 64);
+  sampler->key = make_heap_str(64);
+  vm->alloc_sampler = sampler;
+  for (int i = 0; i < arrlen(vm->active_threads); ++i) {
+    vm_thread *thread = vm->active_threads[i];
+    thread->bytes_until_sample = sampler->interval;
+    limit_tlab(sampler, thread);
+  }
+  return sampler;
+}
+
+void stop_allocation_sampler(alloc_sampler *sampler) {
+  vm *vm = sampler->vm;
+  if (!vm || vm->alloc_sampler != sampler)
+    return;
+  vm->alloc_sampler = nullptr;
+  sampler->vm = nullptr;
+  for (int i = 0; i < arrlen(vm->active_threads); ++i) {
+    limit_tlab(nullptr, vm->active_threads[i]);
+  }
+}
+
+// The index of the method in sampler->methods, adding it if it is new
+static int intern_method(alloc_sampler *sampler, const cp_method *method) {
+  attribute_source_file *source = method->my_class->source_file;
+  slice source_file = source ? source->name : STR("");
+  int len = build_str(&sampler->key, 0, "%.*s\n%.*s\n%.*s\n%.*s", fmt_slice(method->my_class->name),
+                      fmt_slice(method->name), fmt_slice(method->unparsed_descriptor), fmt_slice(source_file));
+  uintptr_t position = (uintptr_t)hash_table_lookup(&sampler->method_index, sampler->key.chars, len);
+  if (!position) {
+    alloc_method copy = {make_heap_str_from(method->my_class->name), make_heap_str_from(method->name),
+                         make_heap_str_from(source_file)};
+    arrput(sampler->methods, copy);
+    position = arrlen(sampler->methods);
+    (void)hash_table_insert(&sampler->method_index, sampler->key.chars, len, (void *)position);
+  }
+  return (int)position - 1;
+}
+
+static void record_sample(alloc_sampler *sampler, vm_thread *thread, size_t bytes) {
+  alloc_frame stack[sampler->max_depth];
+  int depth = 0;
+  for (stack_frame *frame = thread->stack.top; frame && depth < sampler->max_depth; frame = frame->prev) {
+    bool native = is_frame_native(frame);
+    int pc = native ? 0 : frame->program_counter;
+    attribute_code *code = frame->method->code;
+    stack[depth++] = (alloc_frame){intern_method(sampler, frame->method), pc,
+                                   native || !code ? -1 : get_line_number(code, pc)};
+  }
+  if (depth == 0)
+    return; // allocations by the VM itself, outside of any method
+
+  int key_len = depth * (int)sizeof(alloc_frame);
+  uintptr_t position = (uintptr_t)hash_table_lookup(&sampler->index, (char *)stack, key_len);
+  if (!position) {
+    alloc_site site = {.frames = malloc(key_len), .depth = depth};
+    memcpy(site.frames, stack, key_len);
+    arrput(sampler->sites, site);
+    position = arrlen(sampler->sites);
+    (void)hash_table_insert(&sampler->index, (char *)stack, key_len, (void *)position);
+  }
+  alloc_site *site = &sampler->sites[position - 1];
+  site->samples++;
+  site->sampled_bytes += bytes;
+}
+
+void sample_allocation(alloc_sampler *sampler, vm_thread *thread, size_t bytes) {
+  thread->bytes_until_sample -= bytes;
+  if (thread->bytes_until_sample <= 0) {
+    record_sample(sampler, thread, bytes);
+    thread->bytes_until_sample = sampler->interval;
+  }
+  limit_tlab(sampler, thread);
+}
+
+char *allocation_samples_collapsed(alloc_sampler *sampler) {
+  string_builder out;
+  string_builder_init(&out);
+  for (int i = 0; i < arrlen(sampler->sites); ++i) {
+    alloc_site *site = &sampler->sites[i];
+    for (int j = site->depth - 1; j >= 0; --j) {
+      alloc_method *method = &sampler->methods[site->frames[j].method];
+      string_builder_append(&out, "%.*s:%.*s@%d%s", fmt_slice(hslc(method->class_name)), fmt_slice(hslc(method->name)),
+                            site->frames[j].pc, j > 0 ? ";" : "");
+    }
+    string_builder_append(&out, " %zu\n", site->samples * sampler->interval);
+  }
+  char *result = strdup(out.data ? out.data : "");
+  string_builder_free(&out);
+  return result;
+}
+
+// Minimal protocol buffer encoding, for the pprof format
+static void pb_varint(u8 **buf, u64 value) {
+  do {
+    u8 byte = value & 0x7f;
+    value >>= 7;
+    arrput(*buf, byte | (value ? 0x80 : 0));
+  } while (value);
+}
+
+static void pb_uint(u8 **buf, int field, u64 value) {
+  pb_varint(buf, (u64)field << 3); // wire type 0: varint
+  pb_varint(buf, value);
+}
+
+static void pb_bytes(u8 **buf, int field, const void *data, size_t len) {
+  pb_varint(buf, (u64)field << 3 | 2); // wire type 2: length-delimited
+  pb_varint(buf, len);
+  memcpy(arraddnptr(*buf, len), data, len);
+}
+
+// Append a submessage (or packed repeated field) built in msg, and clear msg for reuse
+static void pb_message(u8 **buf, int field, u8 **msg) {
+  pb_bytes(buf, field, *msg, arrlen(*msg));
+  arrsetlen(*msg, 0);
+}
+
+typedef struct {
+  alloc_sampler *sampler;
+  u8 *profile;             // stb_ds array
+  string_hash_table index; // string -> 1 + index in the string table
+  u64 string_count;
+  string_hash_table functions, locations; // method index / alloc_frame -> id
+} pprof_ctx;
+
+static u64 pprof_string(pprof_ctx *ctx, slice str) {
+  u64 id = (uintptr_t)hash_table_lookup(&ctx->index, str.chars, (int)str.len);
+  if (!id) {
+    id = ++ctx->string_count;
+    (void)hash_table_insert(&ctx->index, str.chars, (int)str.len, (void *)id);
+    pb_bytes(&ctx->profile, 6, str.chars, str.len); // Profile.string_table
+  }
+  return id - 1;
+}
+
+static void pprof_value_type(pprof_ctx *ctx, int field, const char *type, const char *unit, u8 **msg) {
+  pb_uint(msg, 1, pprof_string(ctx, str_to_utf8(type))); // ValueType.type
+  pb_uint(msg, 2, pprof_string(ctx, str_to_utf8(unit))); // ValueType.unit
+  pb_message(&ctx->profile, field, msg);
+}
+
+static u64 pprof_function(pprof_ctx *ctx, int method_index, u8 **msg) {
+  u64 id = (uintptr_t)hash_table_lookup(&ctx->functions, (char *)&method_index, sizeof(method_index));
+  if (id)
+    return id;
+  id = ctx->functions.entries_count + 1;
+  (void)hash_table_insert(&ctx->functions, (char *)&method_index, sizeof(method_index), (void *)id);
+
+  alloc_method *method = &ctx->sampler->methods[method_index];
+  INIT_STACK_STRING(name, MAX_CF_NAME_LENGTH * 2 + 2);
+  name = bprintf(name, "%.*s.%.*s", fmt_slice(hslc(method->class_name)), fmt_slice(hslc(method->name)));
+  u64 name_id = pprof_string(ctx, name), file_id = pprof_string(ctx, hslc(method->source_file));
+  pb_uint(msg, 1, id);      // Function.id
+  pb_uint(msg, 2, name_id); // Function.name
+  pb_uint(msg, 3, name_id); // Function.system_name
+  pb_uint(msg, 4, file_id); // Function.filename
+  pb_message(&ctx->profile, 5, msg);
+  return id;
+}
+
+static u64 pprof_location(pprof_ctx *ctx, alloc_frame frame, u8 **msg, u8 **line) {
+  u64 id = (uintptr_t)hash_table_lookup(&ctx->locations, (char *)&frame, sizeof(frame));
+  if (id)
+    return id;
+  id = ctx->locations.entries_count + 1;
+  (void)hash_table_insert(&ctx->locations, (char *)&frame, sizeof(frame), (void *)id);
+
+  u64 function = pprof_function(ctx, frame.method, msg);
+  pb_uint(line, 1, function); // Line.function_id
+  if (frame.line > 0) {
+    pb_uint(line, 2, frame.line); // Line.line
+  }
+  pb_uint(msg, 1, id);       // Location.id
+  pb_uint(msg, 3, frame.pc); // Location.address
+  pb_message(msg, 4, line);  // Location.line
+  pb_message(&ctx->profile, 4, msg);
+  return id;
+}
+
+u8 *allocation_samples_pprof(alloc_sampler *sampler, size_t *length) {
+  pprof_ctx ctx = {.sampler = sampler,
+                   .index = make_hash_table(nullptr, 0.75, 64),
+                   .functions = make_hash_table(nullptr, 0.75, 64),
+                   .locations = make_hash_table(nullptr, 0.75, 64)};
+  u8 *msg = nullptr, *inner = nullptr, *packed = nullptr;
+
+  pprof_string(&ctx, STR("")); // the string table must start with ""
+  pprof_value_type(&ctx, 1, "alloc_objects", "count", &msg); // Profile.sample_type
+  pprof_value_type(&ctx, 1, "alloc_space", "bytes", &msg);
+  pprof_value_type(&ctx, 11, "space", "bytes", &msg); // Profile.period_type
+  pb_uint(&ctx.profile, 12, sampler->interval);      // Profile.period
+
+  for (int i = 0; i < arrlen(sampler->sites); ++i) {
+    alloc_site *site = &sampler->sites[i];
+    u8 *sample = nullptr;
+    for (int j = 0; j < site->depth; ++j) { // leaf first, as pprof expects
+      pb_varint(&packed, pprof_location(&ctx, site->frames[j], &msg, &inner));
+    }
+    pb_message(&sample, 1, &packed); // Sample.location_id
+    // Each sample stands for about one interval's worth of allocations, of objects of the sampled size
+    size_t bytes = site->samples * sampler->interval;
+    size_t average_size = site->sampled_bytes / site->samples;
+    pb_varint(&packed, average_size ? (bytes + average_size - 1) / average_size : site->samples);
+    pb_varint(&packed, bytes);
+    pb_message(&sample, 2, &packed); // Sample.value
+    pb_message(&ctx.profile, 2, &sample);
+    arrfree(sample);
+  }
+
+  arrfree(msg);
+  arrfree(inner);
+  arrfree(packed);
+  free_hash_table(ctx.index);
+  free_hash_table(ctx.functions);
+  free_hash_table(ctx.locations);
+
+  *length = arrlen(ctx.profile);
+  u8 *result = malloc(*length);
+  memcpy(result, ctx.profile, *length);
+  arrfree(ctx.profile);
+  return result;
+}
+
+int write_allocation_samples(alloc_sampler *sampler, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+  size_t path_len = strlen(path), length;
+  u8 *data;
+  if (path_len >= 3 && strcmp(path + path_len - 3, ".pb") == 0) {
+    data = allocation_samples_pprof(sampler, &length);
+  } else {
+    data = (u8 *)allocation_samples_collapsed(sampler);
+    length = strlen((char *)data);
+  }
+  bool ok = fwrite(data, 1, length, file) == length;
+  ok &= fclose(file) == 0;
+  free(data);
+  return ok ? 0 : -1;
+}
+
+void free_allocation_sampler(alloc_sampler *sampler) {
+  if (!sampler)
+    return;
+  stop_allocation_sampler(sampler);
+  for (int i = 0; i < arrlen(sampler->sites); ++i) {
+    free(sampler->sites[i].frames);
+  }
+  arrfree(sampler->sites);
+  free_hash_table(sampler->index);
+  for (int i = 0; i < arrlen(sampler->methods); ++i) {
+    free_heap_str(sampler->methods[i].class_name);
+    free_heap_str(sampler->methods[i].name);
+    free_heap_str(sampler->methods[i].source_file);
+  }
+  arrfree(sampler->methods);
+  free_hash_table(sampler->method_index);
+  free_heap_str(sampler->key);
+  free(sampler);
+}
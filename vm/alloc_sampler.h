@@ -0,0 +1,55 @@
+// Allocation sampling profiler. While a sampler is attached to a VM, roughly one allocation in every interval_bytes
+// bytes (across all threads) is sampled: the allocating thread's stack is recorded, truncated to max_depth frames, and
+// aggregated into a table of allocation sites. The fast allocation path isn't slowed down: each thread's tlab_end is
+// lowered to its next sample point, so that only the sampled allocation takes the slow path.
+//
+// Samples hold copies of the names of the methods in them, so the results may be exported after the VM is freed, or
+// after the classes are unloaded.
+
+#ifndef ALLOC_SAMPLER_H
+#define ALLOC_SAMPLER_H
+
+#include "bjvm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct alloc_sampler alloc_sampler;
+
+// Starts sampling the VM's allocations, replacing any sampler already attached (which is detached, but not freed).
+EMSCRIPTEN_KEEPALIVE
+alloc_sampler *start_allocation_sampler(vm *vm, size_t interval_bytes, int max_depth);
+
+// Detaches the sampler from its VM, keeping its results
+EMSCRIPTEN_KEEPALIVE
+void stop_allocation_sampler(alloc_sampler *sampler);
+
+// The sampled sites in collapsed-stack format (one "outer;...;inner <bytes>" line per site, with each frame written as
+// class:method@pc), for flamegraph.pl and similar tools. Bytes are estimated from the sampling interval. Heap
+// allocated; the caller must free it.
+EMSCRIPTEN_KEEPALIVE
+char *allocation_samples_collapsed(alloc_sampler *sampler);
+
+// The sampled sites as an (uncompressed) pprof profile.proto message, with alloc_objects and alloc_space sample
+// types, writing its length to *length. Heap allocated; the caller must free it.
+EMSCRIPTEN_KEEPALIVE
+u8 *allocation_samples_pprof(alloc_sampler *sampler, size_t *length);
+
+// Writes the sampled sites to the given path, in pprof format if it ends in ".pb" and collapsed-stack format
+// otherwise. Returns 0 on success.
+int write_allocation_samples(alloc_sampler *sampler, const char *path);
+
+// Detaches (if needed) and frees the sampler
+EMSCRIPTEN_KEEPALIVE
+void free_allocation_sampler(alloc_sampler *sampler);
+
+// Called from bump_allocate_slow_path, after an allocation of `bytes` which may have reached the thread's next sample
+// point. Records a sample if so, and sets tlab_end to the next sample point.
+void sample_allocation(alloc_sampler *sampler, vm_thread *thread, size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ALLOC_SAMPLER_H
@@ -979,6 +979,281 @@ static void intersect_exception_handlers(struct method_analysis_ctx *ctx, int in
   }
 }
 
+// Record the state of the stack and locals at the given instruction, sharing it with earlier instructions in the same
+// state if there are any
+static void record_stack_state(code_analysis *analy, string_hash_table *state_indices, char **buf,
+                               const analy_stack_state *stack, const analy_stack_state *locals, int insn_i) {
+  size_t summary_size = sizeof(stack_summary) + (stack->count + locals->count) * sizeof(type_kind);
+  arrsetlen(*buf, summary_size);
+  stack_summary *summary = (stack_summary *)*buf;
+  summary->stack = stack->count;
+  summary->locals = locals->count;
+  for (int i = 0; i < stack->count; ++i)
+    summary->entries[i] = stack->entries[i].type;
+  for (int j = 0; j < locals->count; ++j)
+    summary->entries[stack->count + j] = locals->entries[j].type;
+
+  // Values are 1 + the state index
+  uintptr_t index = (uintptr_t)hash_table_lookup(state_indices, *buf, (int)summary_size);
+  if (!index) {
+    stack_summary *copy = malloc(summary_size);
+    memcpy(copy, summary, summary_size);
+    arrput(analy->states, copy);
+    index = arrlen(analy->states);
+    (void)hash_table_insert(state_indices, *buf, (int)summary_size, (void *)index);
+  }
+  analy->insn_states[insn_i] = index - 1;
+}
+
+// Rewrite common instruction sequences into superinstructions, so that the interpreter dispatches once for the whole
+// sequence. The absorbed instructions are left alone. (aload; getfield is instead fused when the getfield is resolved,
+// since only then do we know the field's type.)
+static void fuse_superinstructions(attribute_code *code) {
+  bytecode_insn *insns = code->code;
+  for (int i = 0; i + 1 < code->insn_count; ++i) {
+    bytecode_insn *first = insns + i, *second = first + 1;
+    switch (first->kind) {
+    case insn_iload:
+      if (second->kind == insn_iload && i + 2 < code->insn_count && second[1].kind == insn_iadd) {
+        first->kind = insn_iload_iload_iadd;
+        i += 2;
+      } else if (second->kind >= insn_if_icmpeq && second->kind <= insn_if_icmple && first->tos_before == TOS_INT) {
+        first->kind = insn_iload_if_icmpeq + (second->kind - insn_if_icmpeq);
+        i += 1;
+      }
+      break;
+    case insn_aload:
+      if (second->kind == insn_arraylength) {
+        first->kind = insn_aload_arraylength;
+        i += 1;
+      }
+      break;
+    case insn_iinc:
+      // The interpreter only implements this for an empty stack, which is how javac's loops look
+      if (second->kind == insn_goto && first->tos_before == TOS_VOID) {
+        first->kind = insn_iinc_goto;
+        i += 1;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Choose how each lookupswitch will find its targets. A handful of keys is scanned; dense keys become a table indexed
+// by the key; up to LOOKUPSWITCH_MAX_HASHED keys get a multiplicative perfect hash (if we find one quickly); and the
+// rest are binary searched.
+#define LOOKUPSWITCH_MAX_LINEAR 4
+#define LOOKUPSWITCH_MAX_HASHED 32
+#define LOOKUPSWITCH_MAX_TABLE 4096
+
+static void plan_lookupswitch(arena *arena, struct lookupswitch_data *data) {
+  int n = data->keys_count;
+  const s32 *keys = data->keys;
+  data->strategy = LOOKUPSWITCH_LINEAR;
+  if (n <= LOOKUPSWITCH_MAX_LINEAR)
+    return;
+  for (int i = 1; i < n; ++i) {
+    if (keys[i - 1] >= keys[i]) // the verifier should have rejected this, but there's no harm in scanning
+      return;
+  }
+
+  s64 range = (s64)keys[n - 1] - keys[0] + 1;
+  if (range <= 8 * (s64)n && range <= LOOKUPSWITCH_MAX_TABLE) {
+    int *table = arena_alloc(arena, range, sizeof(int));
+    for (int i = 0; i < range; ++i)
+      table[i] = data->default_target;
+    for (int i = 0; i < n; ++i)
+      table[keys[i] - keys[0]] = data->targets[i];
+    data->strategy = LOOKUPSWITCH_TABLE;
+    data->low = keys[0];
+    data->table_size = (u32)range;
+    data->table = table;
+    return;
+  }
+
+  if (n <= LOOKUPSWITCH_MAX_HASHED) {
+    int scratch[16 * LOOKUPSWITCH_MAX_HASHED];
+    int min_bits = 1;
+    while ((1 << min_bits) < 2 * n)
+      ++min_bits;
+    for (int bits = min_bits; (1 << bits) <= 16 * n; ++bits) {
+      u32 multiplier = 0x9e3779b1; // golden ratio
+      for (int attempt = 0; attempt < 32; ++attempt, multiplier = multiplier * 0x2c1b3c6d + 0x297a2d38) {
+        multiplier |= 1;
+        int size = 1 << bits;
+        memset(scratch, -1, size * sizeof(int));
+        int i = 0;
+        for (; i < n; ++i) {
+          int *bucket = &scratch[((u32)keys[i] * multiplier) >> (32 - bits)];
+          if (*bucket >= 0)
+            break;
+          *bucket = i;
+        }
+        if (i < n)
+          continue; // collision
+        data->strategy = LOOKUPSWITCH_HASH;
+        data->hash_multiplier = multiplier;
+        data->hash_shift = 32 - bits;
+        data->table_size = size;
+        data->table = arena_alloc(arena, size, sizeof(int));
+        memcpy(data->table, scratch, size * sizeof(int));
+        return;
+      }
+    }
+  }
+
+  data->strategy = LOOKUPSWITCH_BINARY_SEARCH;
+}
+
+// Whether a frame may be suspended at an instruction of this kind while a collection runs: anything which may call into
+// the VM (invocations, allocations, class initialization, exceptions, monitors, returns), and branches, where threads
+// yield. Constants, local and stack shuffling, and arithmetic which can't throw never do.
+static bool may_collect_at(insn_code_kind kind) {
+  switch (kind) {
+  case insn_nop:
+  case insn_aconst_null:
+  case insn_iconst:
+  case insn_dconst:
+  case insn_fconst:
+  case insn_lconst:
+  case insn_dload ... insn_astore:
+  case insn_iinc:
+  case insn_pop:
+  case insn_pop2:
+  case insn_swap:
+  case insn_dup ... insn_dup2_x2:
+  case insn_iload_iload_iadd:
+  case insn_d2f ... insn_d2l:
+  case insn_f2d ... insn_f2l:
+  case insn_i2b ... insn_i2s:
+  case insn_l2d ... insn_l2i:
+  case insn_dadd:
+  case insn_dcmpg:
+  case insn_dcmpl:
+  case insn_ddiv:
+  case insn_dmul:
+  case insn_dneg:
+  case insn_drem:
+  case insn_dsub:
+  case insn_fadd:
+  case insn_fcmpg:
+  case insn_fcmpl:
+  case insn_fdiv:
+  case insn_fmul:
+  case insn_fneg:
+  case insn_frem:
+  case insn_fsub:
+  case insn_iadd:
+  case insn_iand:
+  case insn_imul:
+  case insn_ineg:
+  case insn_ior:
+  case insn_ishl:
+  case insn_ishr:
+  case insn_isub:
+  case insn_iushr:
+  case insn_ixor:
+  case insn_ladd:
+  case insn_land:
+  case insn_lcmp:
+  case insn_lmul:
+  case insn_lneg:
+  case insn_lor:
+  case insn_lshl:
+  case insn_lshr:
+  case insn_lsub:
+  case insn_lushr:
+  case insn_lxor:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// The instruction starting at the given pc in the original bytecode, or -1 if there is none
+static int insn_at_original_pc(const attribute_code *code, int pc) {
+  int lo = 0, hi = code->insn_count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (code->code[mid].original_pc == pc)
+      return mid;
+    if (code->code[mid].original_pc < pc)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -1;
+}
+
+// Build the GC maps at the safepoints of the method (see code_analysis.insn_gc_maps) from its stack states. Instructions
+// in the same state share a map, as do states which only differ in their non-reference types.
+static void build_gc_maps(const attribute_code *code, code_analysis *analy, arena *arena, const struct edge *edges) {
+  bool *safepoint = calloc(code->insn_count, sizeof(bool));
+  safepoint[0] = true; // frames are pushed before they run anything
+  for (int i = 0; i < code->insn_count; ++i)
+    safepoint[i] |= may_collect_at(code->code[i].kind);
+  for (int i = 0; i < arrlen(edges); ++i)
+    safepoint[edges[i].end] = true; // compiled code yields at loop headers
+  if (code->exception_table) {
+    for (int i = 0; i < code->exception_table->entries_count; ++i)
+      safepoint[code->exception_table->entries[i].handler_insn] = true;
+  }
+  if (code->line_number_table) {
+    for (int i = 0; i < code->line_number_table->entry_count; ++i) {
+      int insn = insn_at_original_pc(code, code->line_number_table->entries[i].start_pc);
+      if (insn >= 0)
+        safepoint[insn] = true;
+    }
+  }
+
+  // Index of the map of each state which has been needed so far, and of each distinct map, keyed by its bytes
+  u16 *state_maps = malloc(arrlen(analy->states) * sizeof(u16));
+  for (int i = 0; i < arrlen(analy->states); ++i)
+    state_maps[i] = NO_GC_MAP;
+  string_hash_table map_indices = make_hash_table(nullptr, 0.75, 16);
+  char *buf = nullptr;
+
+  analy->insn_gc_maps = arena_alloc(arena, code->insn_count, sizeof(u16));
+  for (int i = 0; i < code->insn_count; ++i) {
+    u16 state = analy->insn_states[i];
+    if (!safepoint[i] || state_maps[state] != NO_GC_MAP) {
+      analy->insn_gc_maps[i] = safepoint[i] ? state_maps[state] : NO_GC_MAP;
+      continue;
+    }
+
+    const stack_summary *ss = analy->states[state];
+    int entries = ss->stack + ss->locals;
+    size_t map_size = sizeof(gc_map) + (entries + 63) / 64 * sizeof(u64);
+    arrsetlen(buf, map_size);
+    memset(buf, 0, map_size);
+    gc_map *map = (gc_map *)buf;
+    map->stack = ss->stack;
+    map->locals = ss->locals;
+    for (int j = 0; j < entries; ++j) {
+      if (ss->entries[j] == TYPE_KIND_REFERENCE)
+        map->bits[j / 64] |= 1ULL << (j % 64);
+    }
+
+    // Values are 1 + the map index
+    uintptr_t index = (uintptr_t)hash_table_lookup(&map_indices, buf, (int)map_size);
+    if (!index) {
+      gc_map *copy = arena_alloc(arena, 1, map_size);
+      memcpy(copy, map, map_size);
+      arrput(analy->gc_maps, copy);
+      index = arrlen(analy->gc_maps);
+      (void)hash_table_insert(&map_indices, buf, (int)map_size, (void *)index);
+    }
+    analy->insn_gc_maps[i] = state_maps[state] = index - 1;
+  }
+
+  arrfree(buf);
+  free_hash_table(map_indices);
+  free(state_maps);
+  free(safepoint);
+}
+
 int analyze_method_code(cp_method *method, heap_string *error) {
   attribute_code *code = method->code;
   arena *arena = &method->my_class->arena;
@@ -1024,7 +1299,13 @@ int analyze_method_code(cp_method *method, heap_string *error) {
   analy->blocks = nullptr;
   analy->insn_index_to_sd = insn_index_to_stack_depth;
   analy->sources = arena_alloc(arena, code->insn_count, sizeof(*analy->sources));
-  analy->stack_states = arena_alloc(arena, code->insn_count, sizeof(stack_summary *));
+  analy->insn_states = calloc(code->insn_count, sizeof(u16));
+  analy->states = nullptr;
+  analy->gc_maps = nullptr;
+  analy->insn_gc_maps = nullptr;
+  // Distinct states seen so far, keyed by their stack_summary bytes
+  string_hash_table state_indices = make_hash_table(nullptr, 0.75, 16);
+  char *summary_buf = nullptr;
 
   // This is set to true when we are ready to record analysis information, i.e., after filtration of locals and stack
   // types has occurred. This is already true if we have an SMT (and can do the whole analysis in one pass)
@@ -1081,16 +1362,7 @@ analyze:
 
     insn_index_to_stack_depth[i] = stack->count;
     if (finished_refinement) {
-      size_t summary_size = sizeof(stack_summary) + (stack->count + ctx.locals.count) * sizeof(type_kind);
-      stack_summary *summary = arena_alloc(arena, 1, summary_size);
-      analy->stack_states[i] = summary;
-
-      summary->locals = ctx.locals.count;
-      summary->stack = stack->count;
-      for (int summary_i = 0; summary_i < stack->count; ++summary_i)
-        summary->entries[summary_i] = stack->entries[summary_i].type;
-      for (int j = 0; j < ctx.locals.count; ++j)
-        summary->entries[stack->count + j] = ctx.locals.entries[j].type;
+      record_stack_state(analy, &state_indices, &summary_buf, stack, &ctx.locals, i);
     }
 
     state_terminated = false;
@@ -1111,6 +1383,12 @@ analyze:
     goto analyze;
   }
   DCHECK(!ctx.changed);
+  fuse_superinstructions(code);
+  for (int i = 0; i < code->insn_count; ++i) {
+    if (code->code[i].kind == insn_lookupswitch)
+      plan_lookupswitch(arena, code->code[i].lookupswitch);
+  }
+  build_gc_maps(code, analy, arena, ctx.edges);
 
 inval:
   stack_map_frame_iterator_uninit(&iter);
@@ -1126,10 +1404,21 @@ inval:
   }
 
   arrfree(ctx.edges);
+  arrfree(summary_buf);
+  free_hash_table(state_indices);
 
   return result;
 }
 
+void release_stack_states(code_analysis *analy) {
+  for (int i = 0; i < arrlen(analy->states); ++i) {
+    free(analy->states[i]);
+  }
+  arrfree(analy->states);
+  free(analy->insn_states);
+  analy->insn_states = nullptr;
+}
+
 void free_code_analysis(code_analysis *analy) {
   if (!analy)
     return;
@@ -1142,6 +1431,8 @@ void free_code_analysis(code_analysis *analy) {
     }
     free(analy->blocks);
   }
+  release_stack_states(analy);
+  arrfree(analy->gc_maps);
   free(analy);
 }
 
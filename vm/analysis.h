@@ -65,13 +65,25 @@ typedef struct {
   variable_source_kind kind;
 } stack_variable_source;
 
-// Summary of the state of the stack and locals at a given PC. Used by the GC.
+// Summary of the state of the stack and locals at a given PC.
 typedef struct {
   u16 stack;
   u16 locals;
   type_kind entries[]; // first 'stack' entries, then 'locals' entries
 } stack_summary;
 
+// Precise GC map for an instruction a frame may be suspended at during a collection: which of the stack and local slots
+// hold references. Built when the method is analyzed, and shared between all the instructions of the method with the
+// same map.
+typedef struct gc_map {
+  u16 stack;
+  u16 locals;
+  u64 bits[]; // bit i is set if entry i (indexed as in stack_summary) is a reference
+} gc_map;
+
+// Index in insn_gc_maps of an instruction that no frame is suspended at during a collection
+#define NO_GC_MAP UINT16_MAX
+
 // Result of the analysis of a code segment. During analysis, stack operations
 // on longs/doubles are simplified as if they only took up one stack slot (e.g.,
 // pop2 on a double becomes a pop, while pop2 on two ints stays as a pop2).
@@ -79,8 +91,18 @@ typedef struct {
 // table at each program counter, and store a bitset of which stack/local
 // variables are references, so that the GC can follow them.
 typedef struct code_analysis {
-  // For each instruction, the simplified state of the stack and local variables at that instruction
-  stack_summary **stack_states;
+  // The distinct simplified states of the stack and local variables, and for each instruction, the index of the
+  // state at that instruction. Most instructions share their state with others. Only the JITs need these once the
+  // GC maps are built, so a VM without a JIT releases them after analysis (see release_stack_states); both are null
+  // from then on.
+  stack_summary **states; // stb_ds array
+  u16 *insn_states;
+
+  // The distinct GC maps, and for each instruction, the index of its map, or NO_GC_MAP if it isn't a safepoint: the
+  // calls, allocations, exceptions and other ways into the VM, branches and their targets (where threads yield),
+  // exception handlers, line starts (where the debugger pauses) and the method entry.
+  gc_map **gc_maps; // stb_ds array
+  u16 *insn_gc_maps;
 
   // For each instruction, the stack depth at that instruction
   u16 *insn_index_to_sd;
@@ -105,6 +127,20 @@ typedef struct code_analysis {
  * Returns -1 if an error occurred, and writes the error message into error.
  */
 int analyze_method_code(cp_method *method, heap_string *error);
+
+static inline stack_summary *insn_stack_state(const code_analysis *analy, int insn) {
+  DCHECK(analy->states, "Stack states were released");
+  return analy->states[analy->insn_states[insn]];
+}
+
+// The GC map at the given instruction, or null if a frame can't be suspended there during a collection
+static inline const gc_map *gc_map_at(const code_analysis *analy, int insn) {
+  u16 map = analy->insn_gc_maps[insn];
+  return map == NO_GC_MAP ? nullptr : analy->gc_maps[map];
+}
+
+// Free the per-instruction stack states, keeping the GC maps, once nothing will compile the method
+void release_stack_states(code_analysis *analy);
 void free_code_analysis(code_analysis *analy);
 int scan_basic_blocks(const attribute_code *code, code_analysis *analy);
 void compute_dominator_tree(code_analysis *analy);
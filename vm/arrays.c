@@ -102,15 +102,7 @@ static object create_1d_primitive_array(vm_thread *thread, type_kind array_type,
   classdesc *array_desc = get_or_create_array_classdesc(thread, primitive_classdesc(thread, array_type));
   DCHECK(array_desc);
 
-  size_t allocation_size = kArrayDataOffset + count * size;
-  obj_header *array = AllocateObject(thread, array_desc, allocation_size);
-  if (array) {
-    *(int *)((char *)array + kArrayLengthOffset) = count;
-    memset(ArrayData(array), 0, count * size); // zero initialize
-    DCHECK(size_of_object(array) == allocation_size);
-  }
-
-  return array;
+  return AllocateArray1D(thread, array_desc, count, size);
 }
 
 // Create a 1D object array of the given type and size.
@@ -121,15 +113,7 @@ obj_header *CreateObjectArray1D(vm_thread *thread, classdesc *cd, int count) {
   classdesc *array_desc = get_or_create_array_classdesc(thread, cd);
   DCHECK(array_desc);
 
-  size_t allocation_size = kArrayDataOffset + count * sizeof(object);
-  obj_header *array = AllocateObject(thread, array_desc, allocation_size);
-  if (array) {
-    *(int *)((char *)array + kArrayLengthOffset) = count;
-    memset(ArrayData(array), 0, count * sizeof(object));
-    DCHECK(size_of_object(array) == allocation_size);
-  }
-
-  return array;
+  return AllocateArray1D(thread, array_desc, count, sizeof(heap_ref));
 }
 
 // Create a multi-dimensional array of the given type and dimensions. total_dimensions may equal 1, in which case
@@ -166,8 +150,7 @@ oom:
 
 // Create a 1D primitive array of the given type and size.
 obj_header *CreatePrimitiveArray1D(vm_thread *thread, type_kind inner_type, int count) {
-  auto desc = get_or_create_array_classdesc(thread, primitive_classdesc(thread, inner_type));
-  return CreateArray(thread, desc, &count, 1);
+  return create_1d_primitive_array(thread, inner_type, count);
 }
 
 // Create a byte array with the given data.
@@ -6,6 +6,8 @@
 #define ARRAYS_H
 
 #include "bjvm.h"
+#include "objects.h"
+#include <config.h>
 #include <stdint.h>
 #include <types.h>
 
@@ -28,29 +30,36 @@ static int constexpr kArrayHeaderSize = kArrayDataOffset - sizeof(obj_header);
 static int constexpr kArrayMaxDimensions = 255;
 
 static inline bool Is1DPrimitiveArray(obj_header *src) {
-  return src->descriptor->kind == CD_KIND_PRIMITIVE_ARRAY && src->descriptor->dimensions == 1;
+  return obj_class(src)->kind == CD_KIND_PRIMITIVE_ARRAY && obj_class(src)->dimensions == 1;
 }
 
 static inline bool Is1DReferenceArray(obj_header *src) {
-  return src->descriptor->kind == CD_KIND_ORDINARY_ARRAY && src->descriptor->dimensions == 1;
+  return obj_class(src)->kind == CD_KIND_ORDINARY_ARRAY && obj_class(src)->dimensions == 1;
 }
 
 static inline int ArrayLength(obj_header *obj) { return *(int *)((char *)obj + kArrayLengthOffset); }
 
 static inline void *ArrayData(obj_header *obj) { return (char *)obj + kArrayDataOffset; }
 
+// Whether elements of arrays of this class are references (including int[][] and the like)
+static inline bool is_reference_array(const classdesc *desc) {
+  return desc->kind == CD_KIND_ORDINARY_ARRAY || (desc->kind == CD_KIND_PRIMITIVE_ARRAY && desc->dimensions > 1);
+}
+
+static inline heap_ref *ReferenceArrayData(obj_header *array) { return (heap_ref *)ArrayData(array); }
+
 static inline obj_header *ReferenceArrayLoad(obj_header *array, int index) {
-  DCHECK(array->descriptor->kind == CD_KIND_ORDINARY_ARRAY);
+  DCHECK(obj_class(array)->kind == CD_KIND_ORDINARY_ARRAY);
   DCHECK(index >= 0 && index < ArrayLength(array));
 
-  return *((obj_header **)ArrayData(array) + index);
+  return decode_heap_ref(ReferenceArrayData(array)[index]);
 }
 
 static inline void ReferenceArrayStore(obj_header *array, int index, obj_header *val) {
-  DCHECK(array->descriptor->kind == CD_KIND_ORDINARY_ARRAY);
+  DCHECK(obj_class(array)->kind == CD_KIND_ORDINARY_ARRAY);
   DCHECK(index >= 0 && index < ArrayLength(array));
 
-  *((obj_header **)ArrayData(array) + index) = val;
+  ReferenceArrayData(array)[index] = encode_heap_ref(val);
 }
 
 static inline void ByteArrayStoreBlock(object array, s32 offset, s32 length, u8 const *data) {
@@ -96,6 +105,36 @@ obj_header *CreatePrimitiveArray1D(vm_thread *thread, type_kind inner_type, int
 
 obj_header *CreateByteArray(vm_thread *thread, u8 *data, int length);
 
+// Allocate a 1D array of the given (linked) array class. Its elements come zeroed from bump_allocate.
+static inline obj_header *AllocateArray1D(vm_thread *thread, classdesc *array_desc, int count, size_t element_size) {
+  DCHECK(count >= 0);
+  size_t allocation_size = kArrayDataOffset + (size_t)count * element_size;
+  obj_header *array = AllocateObject(thread, array_desc, allocation_size);
+  if (array) {
+    *(int *)((char *)array + kArrayLengthOffset) = count;
+    DCHECK(size_of_object(array) == allocation_size);
+  }
+  return array;
+}
+
+// Inline allocation fast paths for newarray and anewarray, in the interpreter and JITed code. They fall back to the
+// functions above the first time an array of the component type is created.
+static inline obj_header *NewPrimitiveArray1D(vm_thread *thread, type_kind inner_type, int count) {
+  classdesc *array_desc = thread->vm->primitive_classes[inner_type]->array_type;
+  if (unlikely(!array_desc)) {
+    return CreatePrimitiveArray1D(thread, inner_type, count);
+  }
+  return AllocateArray1D(thread, array_desc, count, sizeof_type_kind(inner_type));
+}
+
+static inline obj_header *NewObjectArray1D(vm_thread *thread, classdesc *inner_type, int count) {
+  classdesc *array_desc = inner_type->array_type;
+  if (unlikely(!array_desc)) {
+    return CreateObjectArray1D(thread, inner_type, count);
+  }
+  return AllocateArray1D(thread, array_desc, count, sizeof(heap_ref));
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,6 +4,7 @@
 
 #include "arrays.h"
 #include "exceptions.h"
+#include "heap_dump.h"
 #include "objects.h"
 #include "reflection.h"
 
@@ -26,6 +27,19 @@ vm *ffi_create_vm(const char *classpath, size_t heap_size, write_bytes stdout_,
   return vm;
 }
 
+// Write an HPROF heap dump to the given path (in the Emscripten file system) when the heap is first exhausted
+EMSCRIPTEN_KEEPALIVE
+void ffi_set_heap_dump_path(vm *vm, const char *path) {
+  free(vm->heap_dump_path);
+  vm->heap_dump_path = path ? strdup(path) : nullptr;
+}
+
+EMSCRIPTEN_KEEPALIVE
+char *ffi_heap_histogram(vm *vm) { return heap_histogram(vm); }
+
+EMSCRIPTEN_KEEPALIVE
+int ffi_write_heap_dump(vm *vm, const char *path) { return write_heap_dump(vm, path); }
+
 EMSCRIPTEN_KEEPALIVE
 vm_thread *ffi_create_thread(vm *vm) {
   vm_thread *thr = create_main_thread(vm, default_thread_options());
@@ -50,7 +64,7 @@ EMSCRIPTEN_KEEPALIVE
 void ffi_clear_current_exception(vm_thread *thr) { thr->current_exception = nullptr; }
 
 EMSCRIPTEN_KEEPALIVE
-classdesc *ffi_get_classdesc(obj_header *obj) { return obj->descriptor; }
+classdesc *ffi_get_classdesc(obj_header *obj) { return obj_class(obj); }
 
 bool check_casts(vm_thread *thread, cp_method *method, stack_value *args) {
   // Perform the moral equivalent of a checkcast instruction
@@ -80,8 +94,8 @@ bool check_casts(vm_thread *thread, cp_method *method, stack_value *args) {
       class = method->my_class;
     }
 
-    if (!instanceof(args[i].obj->descriptor, class)) {
-      raise_class_cast_exception(thread, args[i].obj->descriptor, class);
+    if (!instanceof(obj_class(args[i].obj), class)) {
+      raise_class_cast_exception(thread, obj_class(args[i].obj), class);
       return true;
     }
   }
@@ -147,13 +161,13 @@ enum ArrayClassification : s32 {
 
 EMSCRIPTEN_KEEPALIVE
 enum ArrayClassification ffi_classify_array(object obj) {
-  switch (obj->descriptor->kind) {
+  switch (obj_class(obj)->kind) {
   case CD_KIND_ORDINARY:
     return NOT_AN_ARRAY;
   case CD_KIND_ORDINARY_ARRAY:
     return OBJECT_ARRAY;
   case CD_KIND_PRIMITIVE_ARRAY: {
-    switch (obj->descriptor->primitive_component) {
+    switch (obj_class(obj)->primitive_component) {
     case TYPE_KIND_BOOLEAN:
       return BOOLEAN_ARRAY;
     case TYPE_KIND_CHAR:
@@ -188,10 +202,10 @@ uintptr_t ffi_get_element_ptr(vm_thread *thread, object obj, int index) {
     raise_array_index_oob_exception(thread, index, length);
     return 0;
   }
-  if (obj->descriptor->kind == CD_KIND_ORDINARY_ARRAY) {
-    return (uintptr_t)((object *)ArrayData(obj) + index);
+  if (obj_class(obj)->kind == CD_KIND_ORDINARY_ARRAY) {
+    return (uintptr_t)(ReferenceArrayData(obj) + index);
   }
-  return (uintptr_t)ArrayData(obj) + index * sizeof_type_kind(obj->descriptor->primitive_component);
+  return (uintptr_t)ArrayData(obj) + index * sizeof_type_kind(obj_class(obj)->primitive_component);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -223,12 +237,12 @@ object ffi_create_string(vm_thread *thread, const char *str, size_t len) {
 }
 
 EMSCRIPTEN_KEEPALIVE
-bool ffi_is_string(object obj) { return obj && utf8_equals(obj->descriptor->name, "java/lang/String"); }
+bool ffi_is_string(object obj) { return obj && utf8_equals(obj_class(obj)->name, "java/lang/String"); }
 
 EMSCRIPTEN_KEEPALIVE
 uint8_t *ffi_get_string_data(object str) {
   assert(str);
-  assert(utf8_equals(str->descriptor->name, "java/lang/String"));
+  assert(utf8_equals(obj_class(str)->name, "java/lang/String"));
   object array = ((struct native_String *)str)->value;
   return ArrayData(array);
 }
@@ -236,7 +250,7 @@ uint8_t *ffi_get_string_data(object str) {
 EMSCRIPTEN_KEEPALIVE
 size_t ffi_get_string_len(object str) {
   assert(str);
-  assert(utf8_equals(str->descriptor->name, "java/lang/String"));
+  assert(utf8_equals(obj_class(str)->name, "java/lang/String"));
   object array = ((struct native_String *)str)->value;
   return ArrayLength(array);
 }
@@ -244,12 +258,12 @@ size_t ffi_get_string_len(object str) {
 EMSCRIPTEN_KEEPALIVE
 u8 ffi_get_string_coder(object str) {
   assert(str);
-  assert(utf8_equals(str->descriptor->name, "java/lang/String"));
+  assert(utf8_equals(obj_class(str)->name, "java/lang/String"));
   return ((struct native_String *)str)->coder;
 }
 
 EMSCRIPTEN_KEEPALIVE
-bool ffi_instanceof(object obj, classdesc *target) { return !obj || instanceof(obj->descriptor, target); }
+bool ffi_instanceof(object obj, classdesc *target) { return !obj || instanceof(obj_class(obj), target); }
 
 EMSCRIPTEN_KEEPALIVE
 bool ffi_run_step(call_interpreter_t *ctx, stack_value *result) {
@@ -8,6 +8,7 @@
 #include <wchar.h>
 #include <zlib.h>
 
+#include "alloc_sampler.h"
 #include "analysis.h"
 #include "arrays.h"
 #include "objects.h"
@@ -18,6 +19,9 @@
 #include <reflection.h>
 
 #include "cached_classdescs.h"
+#include "dumb_jit.h"
+#include "heap_dump.h"
+#include "jit_queue.h"
 #include <errno.h>
 #include <linkage.h>
 #include <monitors.h>
@@ -70,14 +74,14 @@ inline int set_unpark_permit(vm_thread *thread) {
 
 inline bool query_unpark_permit(vm_thread *thread) { return thread->unpark_permit; }
 
-bool has_expanded_data(header_word *data) { return !((uintptr_t)data->expanded_data & IS_MARK_WORD); }
-
-mark_word_t *get_mark_word(vm *vm, header_word *data) {
-  mark_word_t *word = has_expanded_data(data) ? &data->expanded_data->mark_word : &data->mark_word;
+u32 *get_mark_word(vm *vm, header_word *data) {
+  monitor_data *monitor = inspect_monitor(vm, *data);
+  u32 *word = monitor ? &monitor->mark_word : data;
 #if DCHECKS_ENABLED
-  if (!in_heap(vm, (void *)word)) {
+  // header_word is the first field of an object, and an inflated monitor points back at its object
+  if (!in_heap(vm, (void *)data) || (monitor && monitor->object != (obj_header *)data)) {
     // Data got corrupted. Print out information
-    fprintf(stderr, "Corrupted mark word: %p at %p (expanded data: %d)\n", word, data, has_expanded_data(data));
+    fprintf(stderr, "Corrupted mark word: %p at %p (expanded data: %d)\n", word, data, monitor != nullptr);
     fprintf(stderr, "Surrounding bytes (-16 to +16): ");
     for (int i = -16; i < 16; i++) {
       fprintf(stderr, "%02x ", ((u8 *)data)[i]);
@@ -89,14 +93,37 @@ mark_word_t *get_mark_word(vm *vm, header_word *data) {
   return word;
 }
 
-monitor_data *inspect_monitor(header_word *data) { return has_expanded_data(data) ? data->expanded_data : nullptr; }
+monitor_data *inspect_monitor(vm *vm, header_word word) {
+  if (!has_expanded_data(word))
+    return nullptr;
+  u32 index = word >> 1;
+  return vm->monitor_slabs[index / MONITORS_PER_SLAB] + index % MONITORS_PER_SLAB;
+}
 
 monitor_data *allocate_monitor_for(vm_thread *thread, obj_header *obj) {
   CHECK(in_heap(thread->vm, obj)); // if you're synchronizing on staticFieldBase, you deserve the chair
-  monitor_data *data = bump_allocate(thread, sizeof(monitor_data));
+  vm *vm = thread->vm;
+  if (arrlen(vm->free_monitors) == 0) {
+    monitor_data *slab = calloc(MONITORS_PER_SLAB, sizeof(monitor_data));
+    if (!slab)
+      return nullptr;
+    u32 first_index = arrlen(vm->monitor_slabs) * MONITORS_PER_SLAB;
+    arrput(vm->monitor_slabs, slab);
+    for (int i = MONITORS_PER_SLAB - 1; i >= 0; --i) {
+      slab[i].index = first_index + i;
+      arrput(vm->free_monitors, slab + i);
+    }
+  }
+  monitor_data *data = arrpop(vm->free_monitors);
+  data->object = obj;
   return data;
 }
 
+void free_monitor(vm *vm, monitor_data *monitor) {
+  monitor->object = nullptr;
+  arrput(vm->free_monitors, monitor);
+}
+
 u16 stack_depth(const stack_frame *frame) {
   DCHECK(!is_frame_native(frame), "Can't get stack depth of native frame");
   DCHECK(frame->method, "Can't get stack depth of fake frame");
@@ -186,6 +213,8 @@ void drop_handle(vm_thread *thread, handle *handle) {
   if (!handle || handle == &thread->null_handle)
     return;
   DCHECK(handle >= thread->handles && handle < thread->handles + thread->handles_capacity);
+  // Natives store into handle-held objects without write barriers, so dirty the card now
+  gc_write_barrier(thread->vm, handle->obj);
   handle->obj = nullptr;
 }
 
@@ -327,7 +356,14 @@ stack_frame *push_frame(vm_thread *thread, cp_method *method, stack_value *args,
 }
 
 const char *infer_type(code_analysis *analysis, int insn, int index, bool is_local) {
-  stack_summary *sum = analysis->stack_states[insn];
+  if (!analysis->states) { // released, so all we know is which slots of the GC map (if any) are references
+    const gc_map *map = gc_map_at(analysis, insn);
+    if (!map)
+      return "?";
+    int i = index + (is_local ? map->stack : 0);
+    return map->bits[i / 64] & 1ULL << (i % 64) ? type_kind_to_string(TYPE_KIND_REFERENCE) : "?";
+  }
+  stack_summary *sum = insn_stack_state(analysis, insn);
   return type_kind_to_string(sum->entries[index + (is_local ? sum->stack : 0)]);
 }
 
@@ -414,7 +450,7 @@ void register_native(vm *vm, slice class, const slice method_name, const slice m
 }
 
 void read_string(vm_thread *, obj_header *obj, s8 **buf, size_t *len) {
-  DCHECK(utf8_equals(obj->descriptor->name, "java/lang/String"));
+  DCHECK(utf8_equals(obj_class(obj)->name, "java/lang/String"));
   obj_header *array = ((struct native_String *)obj)->value;
   *buf = ArrayData(array);
   *len = ArrayLength(array);
@@ -527,16 +563,66 @@ static slice get_default_boot_cp() {
 vm_options default_vm_options() {
   vm_options options = {nullptr};
   options.heap_size = 1 << 26;
+  options.heap_policy = HEAP_POLICY_OCCUPANCY;
+  options.heap_target_occupancy = 40;
+  options.gc_time_ratio = 12;
+  options.soft_ref_lru_ms_per_mb = 1000;
+  options.large_object_threshold = 256 * 1024;
   options.runtime_classpath = get_default_boot_cp();
 
   return options;
 }
 
+#if COMPRESSED_CLASS_POINTERS
+#define CLASS_TABLE_CAPACITY (1 << 20)
+
+classdesc **class_table;
+static u32 class_table_used = 1; // slot 0 is reserved
+static u32 *free_class_refs;     // stb_ds array of vacated slots
+static pthread_mutex_t class_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Give desc a slot in the class table. The table never moves, so that obj_class needn't take the lock.
+u32 register_class(classdesc *desc) {
+  pthread_mutex_lock(&class_table_lock);
+  if (!desc->class_ref) {
+    if (!class_table) {
+      class_table = calloc(CLASS_TABLE_CAPACITY, sizeof(classdesc *));
+      CHECK(class_table, "Failed to allocate the class table");
+    }
+    u32 index = arrlen(free_class_refs) ? arrpop(free_class_refs) : class_table_used++;
+    CHECK(index < CLASS_TABLE_CAPACITY, "Class table is full");
+    class_table[index] = desc;
+    desc->class_ref = index;
+  }
+  pthread_mutex_unlock(&class_table_lock);
+  return desc->class_ref;
+}
+
+// Called once no instances of desc remain
+void unregister_class(classdesc *desc) {
+  if (!desc->class_ref)
+    return;
+  pthread_mutex_lock(&class_table_lock);
+  class_table[desc->class_ref] = nullptr;
+  arrput(free_class_refs, desc->class_ref);
+  desc->class_ref = 0;
+  pthread_mutex_unlock(&class_table_lock);
+}
+#endif
+
 // NOLINTNEXTLINE(misc-no-recursion)
 void free_classdesc(void *cd_) {
   classdesc *cd = cd_;
   if (cd->array_type)
     free_classdesc(cd->array_type);
+#if COMPRESSED_CLASS_POINTERS
+  unregister_class(cd);
+#endif
+  for (int i = 0; i < cd->methods_count; ++i) {
+    if (cd->methods[i].jit_info) {
+      free_dumb_jit_result(cd->methods[i].jit_info);
+    }
+  }
   free_classfile(*cd);
   free_function_tables(cd);
   free(cd);
@@ -554,6 +640,7 @@ void existing_classes_are_javabase(vm *vm, module *module) {
       classdesc->module = module;
       if (classdesc->mirror) {
         classdesc->mirror->module = module->reflection_object;
+        gc_write_barrier(vm, (object)classdesc->mirror);
       }
       hash_table_iterator_next(&it);
     }
@@ -595,14 +682,45 @@ vm *create_vm(const vm_options options) {
 
   vm->inchoate_classes = make_hash_table(nullptr, 0.75, 16);
   vm->natives = make_hash_table(free_native_entries, 0.75, 16);
-  vm->interned_strings = make_hash_table(nullptr, 0.75, 16);
   vm->class_padding = make_hash_table(nullptr, 0.75, 16);
   vm->modules = make_hash_table(free, 0.75, 16);
   vm->main_thread_group = nullptr;
 
-  vm->heap = aligned_alloc(4096, options.heap_size);
+  vm->heap = alloc_object_memory(options.heap_size, false);
+  CHECK(vm->heap, "failed to allocate the heap");
+  memset(vm->heap, 0, options.heap_size); // the free part of the heap is always zeroed (see bump_allocate)
   vm->heap_used = 0;
-  vm->heap_capacity = options.heap_size;
+  vm->heap_capacity = vm->heap_min_capacity = options.heap_size;
+  vm->heap_max_capacity = options.max_heap_size > options.heap_size ? options.max_heap_size : options.heap_size;
+  vm->heap_policy = options.heap_policy;
+  vm->heap_target_occupancy = options.heap_target_occupancy;
+  vm->gc_time_ratio = options.gc_time_ratio;
+  vm->soft_ref_lru_ms_per_mb = options.soft_ref_lru_ms_per_mb;
+  vm->heap_dump_path = options.heap_dump_path ? strdup(options.heap_dump_path) : nullptr;
+  if (options.alloc_sample_path) {
+    vm->alloc_sample_path = strdup(options.alloc_sample_path);
+    start_allocation_sampler(vm, options.alloc_sample_interval ? options.alloc_sample_interval : 512 << 10, 64);
+  }
+  vm->start_us = vm->last_major_gc_end_us = get_unix_us();
+  vm->gc_events = calloc(GC_EVENT_LOG_CAPACITY, sizeof(gc_event));
+  vm->gc_log = options.gc_log;
+  vm->print_inline_caches = options.print_inline_caches;
+  vm->jit_enabled = options.jit_enabled;
+  vm->opt_jit_enabled = options.jit_enabled && options.opt_jit_enabled;
+  vm->jit_threshold = options.jit_threshold > 0 ? options.jit_threshold : JIT_THRESHOLD;
+  vm->opt_jit_threshold = options.opt_jit_threshold > 0 ? options.opt_jit_threshold : OPT_JIT_THRESHOLD;
+  vm->jit_compiler_threads = options.jit_compiler_threads > 0 ? options.jit_compiler_threads : 0;
+  vm->print_jit_stats = options.print_jit_stats;
+  if (options.young_generation_size) {
+    // Sized for the largest the heap may become
+    vm->young_capacity = options.young_generation_size;
+    vm->card_table = calloc(align_up(vm->heap_max_capacity, CARD_BYTES) / CARD_BYTES, 1);
+    vm->old_object_starts = calloc(align_up(vm->heap_max_capacity, CARD_BYTES) / 64, 1);
+  }
+  vm->gc_threads = options.gc_threads;
+  if (options.large_object_threshold) {
+    vm->large_object_threshold = options.large_object_threshold < 8192 ? 8192 : options.large_object_threshold;
+  }
   vm->active_classloaders = nullptr;
 
   vm->bootstrap_classloader = calloc(1, sizeof(classloader));
@@ -662,10 +780,39 @@ void free_zstreams(vm *vm) {
   arrfree(vm->z_streams);
 }
 
+static void print_report(vm *vm, char *report) {
+  if (vm->write_stderr) {
+    vm->write_stderr(report, (int)strlen(report), vm->stdio_override_param);
+  } else {
+    fputs(report, stderr);
+  }
+  free(report);
+}
+
 void free_vm(vm *vm) {
+  if (vm->print_inline_caches) {
+    print_report(vm, inline_cache_report(vm));
+  }
+  if (vm->print_jit_stats) {
+    print_report(vm, jit_queue_report(vm));
+  }
+  free_jit_queue(vm); // before the classes whose methods the compiler threads may be compiling
+  if (vm->alloc_sample_path && vm->alloc_sampler) {
+    alloc_sampler *sampler = vm->alloc_sampler; // started by create_vm, so ours to free
+    if (write_allocation_samples(sampler, vm->alloc_sample_path)) {
+      fprintf(stderr, "Failed to write allocation samples to %s\n", vm->alloc_sample_path);
+    }
+    free_allocation_sampler(sampler);
+  } else if (vm->alloc_sampler) {
+    stop_allocation_sampler(vm->alloc_sampler); // its results outlive the VM, but it mustn't point at it
+  }
+  free(vm->alloc_sample_path);
   free_hash_table(vm->natives);
   free_hash_table(vm->inchoate_classes);
-  free_hash_table(vm->interned_strings);
+  free(vm->interned_strings.strings);
+  free(vm->interned_strings.hashes);
+  free(vm->heap_dump_path);
+  free(vm->gc_events);
   free_hash_table(vm->class_padding);
   free_hash_table(vm->modules);
 
@@ -689,7 +836,20 @@ void free_vm(vm *vm) {
     free_thread(vm->active_threads[i]);
   }
   arrfree(vm->active_threads);
-  free(vm->heap);
+  free_gc_workers(vm);
+  free_object_memory(vm->heap, vm->heap_capacity);
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    large_object *header = large_object_header(vm->large_objects[i]);
+    free_object_memory(header, sizeof(large_object) + header->size);
+  }
+  for (int i = 0; i < arrlen(vm->monitor_slabs); ++i) {
+    free(vm->monitor_slabs[i]);
+  }
+  arrfree(vm->monitor_slabs);
+  arrfree(vm->free_monitors);
+  arrfree(vm->large_objects);
+  free(vm->card_table);
+  free(vm->old_object_starts);
   free_unsafe_allocations(vm);
   free_zstreams(vm);
 
@@ -749,6 +909,10 @@ __attribute__((noinline)) cp_field *field_lookup(classdesc *classdesc, slice con
 obj_header *get_main_thread_group(vm_thread *thread);
 
 void set_field(obj_header *obj, cp_field *field, stack_value stack_value) {
+  if (field->compressed) {
+    *(heap_ref *)((void *)obj + field->byte_offset) = encode_heap_ref(stack_value.obj);
+    return;
+  }
   store_stack_value((void *)obj + field->byte_offset, stack_value, field->parsed_descriptor.repr_kind);
 }
 
@@ -758,6 +922,8 @@ void set_static_field(cp_field *field, stack_value stack_value) {
 }
 
 stack_value get_field(obj_header *obj, cp_field *field) {
+  if (field->compressed)
+    return (stack_value){.obj = decode_heap_ref(*(heap_ref *)((void *)obj + field->byte_offset))};
   return load_stack_value((void *)obj + field->byte_offset, field->parsed_descriptor.repr_kind);
 }
 
@@ -859,7 +1025,7 @@ vm_thread *create_main_thread(vm *vm, thread_options options) {
 
       if (thr->current_exception) {
         // Failed to initialize
-        method = method_lookup(thr->current_exception->descriptor, STR("getMessage"), STR("()Ljava/lang/String;"), true,
+        method = method_lookup(obj_class(thr->current_exception), STR("getMessage"), STR("()Ljava/lang/String;"), true,
                                true);
         DCHECK(method);
 
@@ -869,7 +1035,7 @@ vm_thread *create_main_thread(vm *vm, thread_options options) {
         if (obj.obj) {
           CHECK(read_string_to_utf8(thr, &message, obj.obj) == 0);
         }
-        printf("Error in init phase %.*s: %.*s, %s\n", fmt_slice(thr->current_exception->descriptor->name),
+        printf("Error in init phase %.*s: %.*s, %s\n", fmt_slice(obj_class(thr->current_exception)->name),
                fmt_slice(phases[i]), obj.obj ? message.chars : "no message");
         abort();
       }
@@ -952,7 +1118,7 @@ vm_thread *create_vm_thread(vm *vm, vm_thread *creator_thread, struct native_Thr
 
       if (thr->current_exception) {
         // Failed to initialize
-        method = method_lookup(thr->current_exception->descriptor, STR("getMessage"), STR("()Ljava/lang/String;"), true,
+        method = method_lookup(obj_class(thr->current_exception), STR("getMessage"), STR("()Ljava/lang/String;"), true,
                                true);
         DCHECK(method);
 
@@ -962,7 +1128,7 @@ vm_thread *create_vm_thread(vm *vm, vm_thread *creator_thread, struct native_Thr
         if (obj.obj) {
           CHECK(read_string_to_utf8(thr, &message, obj.obj) == 0);
         }
-        fprintf(stderr, "Error in init phase %.*s: %.*s, %s\n", fmt_slice(thr->current_exception->descriptor->name),
+        fprintf(stderr, "Error in init phase %.*s: %.*s, %s\n", fmt_slice(obj_class(thr->current_exception)->name),
                 fmt_slice(phases[i]), obj.obj ? message.chars : "no message");
         abort();
       }
@@ -1023,7 +1189,7 @@ DEFINE_ASYNC(resolve_method_type) {
       ASYNC_RETURN(nullptr);
 
     object mirror = (void *)get_class_mirror(thread, arg_desc);
-    *((struct native_Class **)ArrayData(self->ptypes->obj) + i) = (void *)mirror;
+    ReferenceArrayStore(self->ptypes->obj, i, mirror);
   }
 
   AWAIT(load_class_of_field_descriptor, thread, self->args.cl, method->return_type.unparsed);
@@ -1138,7 +1304,7 @@ DEFINE_ASYNC(resolve_mh_mt) {
       args->thread, CreateObjectArray1D(args->thread, cached_classes(args->thread->vm)->klass, info.ptypes_count));
   for (u32 i = 0; i < info.ptypes_count; ++i) {
     object mirror = (void *)get_class_mirror(args->thread, info.ptypes[i]);
-    *((obj_header **)ArrayData(self->ptypes_array->obj) + i) = mirror;
+    ReferenceArrayStore(self->ptypes_array->obj, i, mirror);
   }
   arrfree(info.ptypes);
 
@@ -1538,7 +1704,7 @@ DEFINE_ASYNC(lookup_class) {
 
       object java_mirror = cl->java_mirror;
       DCHECK(java_mirror);
-      cp_method *method = method_lookup(java_mirror->descriptor, STR("loadClass"),
+      cp_method *method = method_lookup(obj_class(java_mirror), STR("loadClass"),
                                         STR("(Ljava/lang/String;)Ljava/lang/Class;"), true, false);
 
       INIT_STACK_STRING(with_dots, 1024);
@@ -1621,28 +1787,125 @@ classdesc *bootstrap_lookup_class(vm_thread *thread, const slice name) {
 void out_of_memory(vm_thread *thread) {
   thread->current_exception = nullptr; // ignore the currently propagating exception
 
+  vm *vm = thread->vm;
+  if (vm->heap_dump_path) {
+    if (write_heap_dump(vm, vm->heap_dump_path)) {
+      fprintf(stderr, "Failed to write heap dump to %s\n", vm->heap_dump_path);
+    }
+    free(vm->heap_dump_path);
+    vm->heap_dump_path = nullptr; // only the first time
+  }
+
   obj_header *oom = thread->out_of_mem_error;
   raise_exception_object(thread, oom);
 }
 
-void *bump_allocate(vm_thread *thread, size_t bytes) {
-  // round up to multiple of 8
-  bytes = align_up(bytes, 8);
+// Size of a thread-local allocation buffer. Allocations larger than a quarter of this go straight to the shared heap.
+#define TLAB_BYTES (32 * 1024)
+
+// The compacting heap and the large-object space share the heap capacity
+static bool heap_fits(const vm *vm, size_t bytes) {
+  return vm->heap_used + vm->large_object_bytes + bytes <= vm->heap_capacity;
+}
+
+static bool heap_has_room(const vm *vm, size_t bytes) {
+  bool young_full = vm->young_capacity && vm->heap_used - vm->young_start + bytes > vm->young_capacity;
+  return !young_full && heap_fits(vm, bytes);
+}
+
+// Allocate a zeroed object in its own chunk of the large-object space
+static void *allocate_large_object(vm_thread *thread, size_t bytes) {
   vm *vm = thread->vm;
-  DCHECK(vm->heap_used % 8 == 0);
-  if (vm->heap_used + bytes > vm->heap_capacity) {
-    major_gc(thread->vm);
-    if (vm->heap_used + bytes > vm->heap_capacity) {
+  size_t chunk_size = sizeof(large_object) + bytes;
+  if (!heap_fits(vm, chunk_size)) {
+    major_gc_with_room(vm, chunk_size);
+    if (!heap_fits(vm, chunk_size)) {
+      major_gc_clearing_soft_references(vm, chunk_size);
+    }
+    if (!heap_fits(vm, chunk_size)) {
       out_of_memory(thread);
       return nullptr;
     }
   }
-  void *result = vm->heap + vm->heap_used;
-  memset(result, 0, bytes);
-  vm->heap_used += bytes;
+
+  // Allocations this large are served directly by mmap, so the pages come zeroed and untouched
+  large_object *chunk = alloc_object_memory(chunk_size, true);
+  if (!chunk) {
+    out_of_memory(thread);
+    return nullptr;
+  }
+  chunk->size = bytes;
+  vm->large_object_bytes += chunk_size;
+
+  obj_header *obj = (obj_header *)(chunk + 1);
+  int i = 0;
+  while (i < arrlen(vm->large_objects) && vm->large_objects[i] < obj) {
+    ++i;
+  }
+  arrins(vm->large_objects, i, obj);
+  return obj;
+}
+
+// Reserve a new TLAB (or, for large objects, just the object itself) from the shared heap, collecting if necessary.
+static void *refill_tlab(vm_thread *thread, size_t bytes) {
+  vm *vm = thread->vm;
+  size_t chunk = bytes > TLAB_BYTES / 4 ? bytes : TLAB_BYTES;
+
+  if (!heap_has_room(vm, chunk)) {
+    if (vm->young_capacity) {
+      minor_gc(vm);
+    }
+    if (!heap_fits(vm, chunk)) {
+      major_gc_with_room(vm, chunk);
+      if (!heap_fits(vm, chunk)) {
+        chunk = bytes; // not enough space for a whole TLAB
+        if (!heap_fits(vm, bytes)) {
+          major_gc_clearing_soft_references(vm, bytes);
+        }
+        if (!heap_fits(vm, bytes)) {
+          out_of_memory(thread);
+          return nullptr;
+        }
+      }
+    }
+  }
+
+  u8 *result = vm->heap + vm->heap_used;
+  vm->heap_used += chunk;
+  if (chunk != bytes) {
+    thread->tlab_top = thread->tlab_sample_base = result + bytes;
+    thread->tlab_end = thread->tlab_hard_end = result + chunk;
+  }
   return result;
 }
 
+void *bump_allocate_slow_path(vm_thread *thread, size_t bytes) {
+  DCHECK(bytes % 8 == 0 && thread->vm->heap_used % 8 == 0);
+  size_t large = thread->vm->large_object_threshold;
+  alloc_sampler *sampler = thread->vm->alloc_sampler;
+  if (unlikely(sampler)) {
+    // Account for the bytes bump-allocated since the last sample check. We may only be here because tlab_end was
+    // lowered to the next sample point, in which case the object still fits in the TLAB.
+    thread->bytes_until_sample -= thread->tlab_top - thread->tlab_sample_base;
+    thread->tlab_sample_base = thread->tlab_top;
+    void *result;
+    if ((size_t)(thread->tlab_hard_end - thread->tlab_top) >= bytes) {
+      result = thread->tlab_top;
+      thread->tlab_top += bytes;
+    } else {
+      result = large && bytes >= large ? allocate_large_object(thread, bytes) : refill_tlab(thread, bytes);
+    }
+    if (result) {
+      sample_allocation(sampler, thread, bytes);
+    }
+    return result;
+  }
+  if (large && bytes >= large) {
+    return allocate_large_object(thread, bytes);
+  }
+  return refill_tlab(thread, bytes); // free heap memory is already zeroed
+}
+
 // Returns true if the class descriptor is a subclass of java.lang.Error.
 // NOLINTNEXTLINE(misc-no-recursion)
 bool is_error(classdesc *d) {
@@ -1805,7 +2068,7 @@ DEFINE_ASYNC(initialize_class) {
   if (clinit) {
 
     AWAIT(call_interpreter, thread, clinit, nullptr);
-    if (thread->current_exception && !is_error(thread->current_exception->descriptor)) {
+    if (thread->current_exception && !is_error(obj_class(thread->current_exception))) {
       wrap_in_exception_in_initializer_error(thread);
       goto done;
     }
@@ -2041,7 +2304,7 @@ obj_header *new_object(vm_thread *thread, classdesc *classdesc) {
 }
 
 bool is_instanceof_name(const obj_header *mirror, const slice name) {
-  return mirror && utf8_equals_utf8(mirror->descriptor->name, name);
+  return mirror && utf8_equals_utf8(obj_class(mirror)->name, name);
 }
 
 classdesc *unmirror_class(obj_header *mirror) {
@@ -2122,12 +2385,7 @@ struct native_Class *get_class_mirror(vm_thread *thread, classdesc *cd) {
 }
 
 bool instanceof_interface(const classdesc *o, const classdesc *target) {
-  if (o == target)
-    return true;
-  for (int i = 0; i < arrlen(o->itables.interfaces); ++i)
-    if (o->itables.interfaces[i] == target)
-      return true;
-  return false;
+  return o == target || find_itable(o, target) != nullptr;
 }
 
 bool instanceof_super(const classdesc *o, const classdesc *target) {
@@ -2186,8 +2444,8 @@ bool method_types_compatible(struct native_MethodType *provider_mt, struct nativ
     return false;
   }
   for (int i = 0; i < ArrayLength(provider_mt->ptypes); ++i) {
-    classdesc *left = unmirror_class(((obj_header **)ArrayData(provider_mt->ptypes))[i]);
-    classdesc *right = unmirror_class(((obj_header **)ArrayData(targ->ptypes))[i]);
+    classdesc *left = unmirror_class(ReferenceArrayLoad(provider_mt->ptypes, i));
+    classdesc *right = unmirror_class(ReferenceArrayLoad(targ->ptypes, i));
 
     if (left != right) {
       return false;
@@ -2267,7 +2525,7 @@ doit:
     if (!mts_are_same && is_invoke) {
       // Call asType to get an adapter handle
       cp_method *asType =
-          method_lookup(mh->base.descriptor, STR("asType"),
+          method_lookup(obj_class(&mh->base), STR("asType"),
                         STR("(Ljava/lang/invoke/MethodType;)Ljava/lang/invoke/MethodHandle;"), true, false);
       if (!asType)
         UNREACHABLE();
@@ -2335,7 +2593,7 @@ doit:
     // accessModeType method of java.lang.invoke.VarHandle on the instance objectref, with the instance of
     // java.lang.invoke.VarHandle.AccessMode as the argument.
     cp_method *accessModeType =
-        method_lookup(self->vh->obj->descriptor, STR("accessModeType"),
+        method_lookup(obj_class(self->vh->obj), STR("accessModeType"),
                       STR("(Ljava/lang/invoke/VarHandle$AccessMode;)Ljava/lang/invoke/MethodType;"), true, false);
     DCHECK(accessModeType);
 
@@ -2563,7 +2821,7 @@ DEFINE_ASYNC(indy_resolve) {
   ReferenceArrayStore(self->invoke_array->obj, 2, (void *)indy->resolved_mt);
 
   // Invoke the bootstrap method using invokeWithArguments
-  cp_method *invokeWithArguments = method_lookup(self->bootstrap_handle->obj->descriptor, STR("invokeWithArguments"),
+  cp_method *invokeWithArguments = method_lookup(obj_class(self->bootstrap_handle->obj), STR("invokeWithArguments"),
                                                  STR("([Ljava/lang/Object;)Ljava/lang/Object;"), true, false);
   DCHECK(invokeWithArguments, "Method not found");
 
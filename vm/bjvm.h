@@ -125,45 +125,105 @@ typedef struct {
   native_callback callback;
 } native_t;
 
-//      struct { flags, hash? }
-typedef struct {
-  u32 data[2];
-} mark_word_t;
+#define NOT_HELD_TID (-1)
+#define MONITORS_PER_SLAB 256
 
+// An inflated monitor. These live outside the heap, in slabs owned by the VM, and point back at their object. Idle
+// monitors are deflated during GC.
 typedef struct {
   s32 tid;
   volatile u32 hold_count; // only changed by owner thread; therefore volatile is safe here
-  mark_word_t mark_word;
+  u32 mark_word;           // the object's mark word from before inflation, which keeps its identity hash
+  u32 index;               // slab * MONITORS_PER_SLAB + position in the slab
+  obj_header *object;      // nullptr if the monitor is free
 } monitor_data;
 
-static_assert(offsetof(monitor_data, mark_word) % 8 == 0);
+// The first 32 bits of every object. With IS_MARK_WORD set it's a mark word, whose other bits hold the identity hash
+// (0 if not yet computed). Otherwise the object's monitor is inflated, and it holds the monitor's index shifted left
+// by one.
+typedef u32 header_word;
 
-typedef union {
-  // least significant flag bit set if it's a mark_word, using the fact that expanded_data will be aligned
-  mark_word_t mark_word;
-  monitor_data *expanded_data;
-} header_word;
+typedef enum : u32 {
+  IS_MARK_WORD = 1 << 0,
+} mark_word_flags;
 
-// Appears at the top of every object -- corresponds to HotSpot's oopDesc
+#define MARK_WORD_HASH_SHIFT 1
+
+// Appears at the top of every object -- corresponds to HotSpot's oopDesc, with compressed class pointers
 typedef struct obj_header {
   header_word header_word; // accessed atomically, except during a full GC pause
-  classdesc *descriptor;
+  u32 class_ref;           // see obj_class
 } obj_header;
 
-typedef enum : u32 {
-  IS_MARK_WORD = 1 << 0,
-  IS_REACHABLE = 1 << 1,
-} mark_word_flags;
+static_assert(sizeof(obj_header) == 8);
+
+// On 64-bit hosts, classdescs are referred to from objects by their index in this table, which is shared by every VM
+// in the process. Index 0 is never used, so the first 8 bytes of an object are never zero. On 32-bit hosts the class
+// reference is just the pointer.
+#define COMPRESSED_CLASS_POINTERS (UINTPTR_MAX > UINT32_MAX)
+
+#if COMPRESSED_CLASS_POINTERS
+extern classdesc **class_table;
+u32 register_class(classdesc *desc);
+void unregister_class(classdesc *desc);
+#endif
+
+static inline classdesc *obj_class(const obj_header *obj) {
+#if COMPRESSED_CLASS_POINTERS
+  return class_table[obj->class_ref];
+#else
+  return (classdesc *)(uintptr_t)obj->class_ref;
+#endif
+}
+
+static inline u32 encode_class_ref(classdesc *desc) {
+#if COMPRESSED_CLASS_POINTERS
+  return likely(desc->class_ref) ? desc->class_ref : register_class(desc);
+#else
+  return (u32)(uintptr_t)desc;
+#endif
+}
+
+// A reference stored in the heap: an element of a reference array, or an instance field laid out by the VM (see
+// cp_field.compressed). With COMPRESSED_REFS, every object lives in a single reservation of address space, shared by
+// every VM in the process (see alloc_object_memory), and is referred to by its offset from compressed_heap_base in
+// 8-byte units. The base is aligned to 32 GiB, so that compressing null -- truncating -base >> 3 -- gives 0, and the
+// first page of the reservation is never used, so that no object compresses to 0.
+#if COMPRESSED_REFS
+typedef u32 heap_ref;
+extern uintptr_t compressed_heap_base;
+#define COMPRESSED_HEAP_BYTES ((uintptr_t)1 << 35)
+#else
+typedef object heap_ref;
+#endif
+
+static inline object decode_heap_ref(heap_ref ref) {
+#if COMPRESSED_REFS
+  return ref ? (object)(compressed_heap_base + ((uintptr_t)ref << 3)) : nullptr;
+#else
+  return ref;
+#endif
+}
+
+static inline heap_ref encode_heap_ref(object obj) {
+#if COMPRESSED_REFS
+  DCHECK(!obj || (uintptr_t)obj - compressed_heap_base < COMPRESSED_HEAP_BYTES);
+  return (heap_ref)(((uintptr_t)obj - compressed_heap_base) >> 3);
+#else
+  return obj;
+#endif
+}
 
 struct vm;
 
-bool has_expanded_data(header_word *data);
-mark_word_t *get_mark_word(struct vm *vm, header_word *data);
-// nullptr if the object has never been locked, otherwise a pointer to a lock_record.
-monitor_data *inspect_monitor(header_word *data);
+static inline bool has_expanded_data(header_word word) { return !(word & IS_MARK_WORD); }
+u32 *get_mark_word(struct vm *vm, header_word *data);
+// nullptr if the object's monitor is not inflated, otherwise the monitor
+monitor_data *inspect_monitor(struct vm *vm, header_word word);
 // only call this if inspect_monitor returns nullptr
 // doesn't store this allocated data onto the object, because that should later be done atomically by someone else
 monitor_data *allocate_monitor_for(vm_thread *thread, obj_header *obj); // doesn't initialize any monitor data
+void free_monitor(struct vm *vm, monitor_data *monitor);
 
 void read_string(vm_thread *thread, obj_header *obj, s8 **buf,
                  size_t *len); // todo: get rid of
@@ -403,6 +463,23 @@ typedef struct {
   size_t len;
 } mmap_allocation;
 
+// How the heap capacity is adjusted after each major GC (see vm_options)
+typedef enum : u8 {
+  // Resize so that live data occupies a target fraction of the heap
+  HEAP_POLICY_OCCUPANCY,
+  // Grow while too large a fraction of time is spent collecting, and shrink while well under that fraction
+  HEAP_POLICY_GC_TIME_RATIO
+} heap_sizing_policy;
+
+// Weak table of interned Strings, open-addressed with linear probing and keyed on the coder and payload bytes of
+// the String. Entries are dropped when their String dies.
+typedef struct {
+  obj_header **strings; // nullptr for an empty slot
+  u32 *hashes;          // hash of each occupied slot's key
+  u32 capacity;         // power of two, or zero
+  u32 count;
+} interned_string_table;
+
 struct cached_classdescs;
 typedef struct vm {
   // Classes currently under creation -- used to detect circularity
@@ -421,8 +498,8 @@ typedef struct vm {
   // Main thread group
   obj_header *main_thread_group;
 
-  // Interned strings (string -> instance of java/lang/String)
-  string_hash_table interned_strings;
+  // Interned strings (weak: not GC roots)
+  interned_string_table interned_strings;
 
   // Classes with implementation-required padding before other fields (map class
   // name -> padding bytes)
@@ -461,6 +538,60 @@ typedef struct vm {
   size_t heap_used;
   size_t heap_capacity;
 
+  // Bounds for heap_capacity, which is recomputed after each major GC according to the sizing policy. Equal if the
+  // heap has a fixed size.
+  size_t heap_min_capacity;
+  size_t heap_max_capacity;
+  heap_sizing_policy heap_policy;
+  int heap_target_occupancy;
+  int gc_time_ratio;
+  int soft_ref_lru_ms_per_mb;
+  char *heap_dump_path; // owned copy of vm_options.heap_dump_path, cleared once the dump is written
+  char *alloc_sample_path; // owned copy of vm_options.alloc_sample_path
+  // Microseconds spent collecting since the end of the last major GC, and when it ended
+  u64 gc_us_since_major;
+  u64 last_major_gc_end_us;
+  u64 start_us; // when the VM was created
+  // The last GC_EVENT_LOG_CAPACITY collections (a ring buffer indexed by event id, see gc.h), and per-gc_kind totals
+  struct gc_event *gc_events;
+  u64 gc_event_count;
+  u64 gc_collections[2], gc_pause_us[2];
+  bool gc_log;
+  bool print_inline_caches;
+  bool print_jit_stats;
+  bool jit_enabled, opt_jit_enabled;
+  int jit_threshold, opt_jit_threshold; // normalized: the defaults filled in
+  int jit_compiler_threads; // normalized: 0 to compile on the thread which asks
+  void *jit_queue; // jit_queue (see jit_queue.h), created by the first request for a compilation
+
+  // Generational collection. Objects below heap + young_start have survived at least one collection (the old
+  // generation); everything above it was allocated since the last collection (the young generation). A minor GC
+  // compacts only the young generation, sliding its survivors down onto the end of the old generation. Both fields
+  // are 0 if minor collections are disabled.
+  size_t young_start;
+  size_t young_capacity;
+
+  // One byte per CARD_BYTES of heap. A card is dirtied when a reference is stored into an old object whose header
+  // lies in that card; minor GCs scan the objects in dirty cards for pointers into the young generation.
+  u8 *card_table;
+  // One bit per 8 bytes of the old generation, set at the start of each object. Used to find the objects in a dirty
+  // card.
+  u64 *old_object_starts;
+  // Objects of at least large_object_threshold bytes (0 if disabled) are allocated outside the compacting heap, each
+  // in its own chunk, and are never moved. large_objects is sorted by address. The chunks are charged against the
+  // heap capacity.
+  size_t large_object_threshold;
+  obj_header **large_objects;
+  size_t large_object_bytes;
+
+  // Number of threads which perform major collections (<= 1 to collect on the allocating thread only)
+  int gc_threads;
+  void *gc_workers; // gc_worker_pool (see gc.c), started by the first parallel collection
+
+  // Slabs of MONITORS_PER_SLAB monitors, and the free ones among them
+  monitor_data **monitor_slabs;
+  monitor_data **free_monitors;
+
   // Handles referenced from JS
   obj_header **js_handles;
 
@@ -482,6 +613,7 @@ typedef struct vm {
   // Latest TID
   s32 next_tid;
   struct native_Reference *reference_pending_list; // for java/lang/ref/Reference implementation
+  struct alloc_sampler *alloc_sampler;             // if allocations are being sampled (see alloc_sampler.h)
 
   bool vm_initialized;
   void *scheduler; // rr_scheduler or null
@@ -512,8 +644,60 @@ typedef struct {
   // Passed to write_stdout/write_stderr/read_stdin
   void *stdio_override_param;
 
-  // Heap size (static for now)
+  // Initial heap size
   size_t heap_size;
+  // Size the heap may grow to (0 to fix the heap at heap_size). Like -Xmx, with heap_size as -Xms.
+  size_t max_heap_size;
+  // How the heap is resized between heap_size and max_heap_size
+  heap_sizing_policy heap_policy;
+  // HEAP_POLICY_OCCUPANCY: percentage of the heap that live data should occupy after a major GC (default 40)
+  int heap_target_occupancy;
+  // HEAP_POLICY_GC_TIME_RATIO: aim to spend at most 1 / (1 + gc_time_ratio) of the time collecting (default 12), like
+  // -XX:GCTimeRatio
+  int gc_time_ratio;
+  // A softly reachable object is kept for this many milliseconds since its SoftReference was last read, per MiB free in
+  // the heap (default 1000), like -XX:SoftRefLRUPolicyMSPerMB. Soft references are always cleared before throwing an
+  // OutOfMemoryError.
+  int soft_ref_lru_ms_per_mb;
+  // If non-null, write an HPROF heap dump (see heap_dump.h) to this path the first time an OutOfMemoryError is thrown,
+  // like -XX:+HeapDumpOnOutOfMemoryError -XX:HeapDumpPath
+  const char *heap_dump_path;
+  // If non-null, sample allocations from startup (see alloc_sampler.h), one per alloc_sample_interval bytes (default
+  // 512 KiB), and write the sampled sites to this path when the VM is freed: as a pprof profile if the path ends in
+  // ".pb", otherwise as collapsed stacks
+  const char *alloc_sample_path;
+  size_t alloc_sample_interval;
+  // Print a line to stdout for each collection, like -Xlog:gc
+  bool gc_log;
+  // Print inline_cache_report to stderr when the VM is freed
+  bool print_inline_caches;
+  // Print jit_queue_report to stderr when the VM is freed
+  bool print_jit_stats;
+  // Compile methods which are called often with the baseline JIT, and run the compiled code from then on. Off by
+  // default until the JIT tiers have passed the test suite with compilation forced on (see jit-tests.cc). Only
+  // WebAssembly and x86-64 Linux builds have a JIT.
+  bool jit_enabled;
+  // Calls after which the baseline JIT compiles a method (0 for the default, JIT_THRESHOLD)
+  int jit_threshold;
+  // Also compile methods whose baseline code keeps running with the optimizing JIT (requires jit_enabled; off by
+  // default). Only x86-64 Linux builds have an optimizing JIT.
+  bool opt_jit_enabled;
+  // Calls and loop iterations of baseline code after which the optimizing JIT compiles a method (0 for the default,
+  // OPT_JIT_THRESHOLD)
+  int opt_jit_threshold;
+  // Background threads which compile hot methods (0 or negative, the default, to compile on the Java thread which
+  // asks, before it goes on). Only x86-64 Linux builds have compiler threads: elsewhere, methods are compiled between
+  // scheduler time slices and while every thread sleeps, or on the thread which asks if the VM has no scheduler.
+  int jit_compiler_threads;
+  // Bytes that may be allocated between minor collections (0 disables minor collections, so that every collection
+  // is a full compaction of the heap)
+  size_t young_generation_size;
+  // Objects (in practice, arrays) of at least this many bytes are allocated in a non-moving large-object space instead
+  // of the compacting heap (0 to disable). Values below 8 KiB are raised to 8 KiB.
+  size_t large_object_threshold;
+  // Worker threads used to mark and compact during a major GC (0 or 1 for a serial collector). Ignored on platforms
+  // without pthreads.
+  int gc_threads;
   // Classpath for built-in files, e.g. rt.jar. Must have definitions for
   // Object.class, etc.
   slice runtime_classpath;
@@ -649,6 +833,15 @@ typedef struct vm_thread {
   handle null_handle;
 
   int allocations_so_far;
+  // Thread-local allocation buffer, carved out of the shared heap. Objects are bump-allocated from tlab_top until
+  // tlab_end is reached, at which point a new buffer is requested. Both are reset whenever the heap is collected.
+  u8 *tlab_top;
+  u8 *tlab_end;
+  // While allocations are sampled, tlab_end is lowered to the thread's next sample point and tlab_hard_end is the
+  // buffer's real end. bytes_until_sample counts down the bytes allocated since tlab_sample_base.
+  u8 *tlab_hard_end;
+  u8 *tlab_sample_base;
+  s64 bytes_until_sample;
   // This value is used to periodically check whether we should yield back to the scheduler ...
   u32 fuel;
   // ... if the current time is past this value
@@ -700,12 +893,21 @@ void pop_frame(vm_thread *thr, [[maybe_unused]] const stack_frame *reference);
 
 vm_options default_vm_options();
 void free_classdesc(void *cd);
+// Turn a monomorphic invokevirtual/invokeinterface inline cache into a polymorphic_cache (see vtable.h), allocated in
+// the arena of the class whose code contains inst
+void make_invokevtable_polymorphic_(arena *arena, bytecode_insn *inst);
+void make_invokeitable_polymorphic_(arena *arena, bytecode_insn *inst);
+
+// Returns a table of the polymorphic invokevirtual and invokeinterface call sites in the VM's loaded classes, with
+// their inline cache hits and misses, most misses first. Heap allocated; the caller must free it.
+EMSCRIPTEN_KEEPALIVE
+char *inline_cache_report(vm *vm);
 
 vm *create_vm(vm_options options);
 
 typedef struct {
   u32 stack_space;
-  // Whether to enable JavaScript JIT compilation
+  // Whether to enable JIT compilation (to WebAssembly, or to x86-64 machine code on Linux)
   bool js_jit_enabled;
   // What thread group to construct the thread in (nullptr = default thread
   // group)
@@ -804,7 +1006,20 @@ static inline stack_value *frame_beginning(const stack_frame *frame) {
 
 classdesc *primitive_classdesc(vm_thread *thread, type_kind prim_kind);
 void out_of_memory(vm_thread *thread);
-void *bump_allocate(vm_thread *thread, size_t bytes);
+// Refill the thread's TLAB (collecting if necessary) and allocate from it, or allocate a large object
+void *bump_allocate_slow_path(vm_thread *thread, size_t bytes);
+
+// Allocate `bytes` of zeroed heap memory. The collector keeps the heap's free space zeroed, so a new TLAB needs no
+// clearing and the fast path is just a bump of the thread's cursor.
+static inline void *bump_allocate(vm_thread *thread, size_t bytes) {
+  bytes = align_up(bytes, 8);
+  u8 *result = thread->tlab_top;
+  if (unlikely((size_t)(thread->tlab_end - result) < bytes)) {
+    return bump_allocate_slow_path(thread, bytes);
+  }
+  thread->tlab_top = result + bytes;
+  return result;
+}
 
 #ifdef __cplusplus
 }
@@ -71,6 +71,9 @@ extern "C" {
   X(character, "java/lang/Character")                                                                                  \
   X(byte, "java/lang/Byte")                                                                                            \
   X(reference, "java/lang/ref/Reference")                                                                              \
+  X(soft_reference, "java/lang/ref/SoftReference")                                                                     \
+  X(final_reference, "java/lang/ref/FinalReference")                                                                   \
+  X(phantom_reference, "java/lang/ref/PhantomReference")                                                               \
   X(class_loader, "java/lang/ClassLoader")                                                                             \
   X(member_name, "java/lang/invoke/MemberName")                                                                        \
   X(throwable, "java/lang/Throwable")
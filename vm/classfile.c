@@ -1182,6 +1182,60 @@ static void parse_bootstrap_methods_attribute(cf_byteslice attr_reader, attribut
 static void parse_attribute(cf_byteslice *reader, classfile_parse_ctx *ctx, attribute *attr);
 
 // NOLINTNEXTLINE(misc-no-recursion)
+static int compare_ints(const void *a, const void *b) { return *(const int *)a - *(const int *)b; }
+
+// Build the per-instruction handler lists of the exception table. The entries' boundaries cut the code into regions
+// within which the covering entries don't change, so each region needs only one list.
+static void index_exception_table(arena *arena, attribute_exception_table *table, int insn_count) {
+  int *bounds = malloc((2 * table->entries_count + 1) * sizeof(int)), bounds_count = 0;
+  bounds[bounds_count++] = 0;
+  for (int i = 0; i < table->entries_count; ++i) {
+    bounds[bounds_count++] = table->entries[i].start_insn;
+    bounds[bounds_count++] = table->entries[i].end_insn;
+  }
+  qsort(bounds, bounds_count, sizeof(int), compare_ints);
+
+  // Count the list entries: for each region, the entries covering it plus the terminator
+  size_t lists_size = 1; // the shared empty list
+  for (int b = 0; b < bounds_count; ++b) {
+    if ((b > 0 && bounds[b] == bounds[b - 1]) || bounds[b] >= insn_count)
+      continue;
+    for (int i = 0; i < table->entries_count; ++i)
+      lists_size += table->entries[i].start_insn <= bounds[b] && bounds[b] < table->entries[i].end_insn;
+    lists_size++;
+  }
+
+  table->insn_handlers = arena_alloc(arena, insn_count, sizeof(u32));
+  table->handler_lists = arena_alloc(arena, lists_size, sizeof(s32));
+  table->handler_lists[0] = -1;
+  u32 write = 1;
+  for (int b = 0; b < bounds_count; ++b) {
+    int start = bounds[b];
+    if ((b > 0 && start == bounds[b - 1]) || start >= insn_count)
+      continue;
+    int end = insn_count;
+    for (int next = b + 1; next < bounds_count; ++next) {
+      if (bounds[next] != start) {
+        end = bounds[next] < insn_count ? bounds[next] : insn_count;
+        break;
+      }
+    }
+    u32 list = write;
+    for (int i = 0; i < table->entries_count; ++i) {
+      if (table->entries[i].start_insn <= start && start < table->entries[i].end_insn)
+        table->handler_lists[write++] = i;
+    }
+    if (write == list) {
+      list = 0; // share the empty list
+    } else {
+      table->handler_lists[write++] = -1;
+    }
+    for (int insn = start; insn < end; ++insn)
+      table->insn_handlers[insn] = list;
+  }
+  free(bounds);
+}
+
 static attribute_code parse_code_attribute(cf_byteslice attr_reader, classfile_parse_ctx *ctx) {
   u16 max_stack = reader_next_u16(&attr_reader, "max stack");
   u16 max_locals = reader_next_u16(&attr_reader, "max locals");
@@ -1236,6 +1290,7 @@ static attribute_code parse_code_attribute(cf_byteslice attr_reader, classfile_p
                             ? nullptr
                             : &checked_cp_entry(ctx->cp, catch_type, CP_KIND_CLASS, "exception catch type")->class_info;
     }
+    index_exception_table(ctx->arena, table, insn_count);
   }
 
   free(pc_to_insn);
@@ -1692,6 +1747,7 @@ parse_result_t parse_classfile(const u8 *bytes, size_t len, classdesc *result, h
   cf->static_fields = nullptr;
   cf->static_references = nullptr;
   cf->instance_references = nullptr;
+  cf->compressed_references = nullptr;
 
   // Parse methods
   cf->methods_count = reader_next_u16(&reader, "methods count");
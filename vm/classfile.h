@@ -257,15 +257,51 @@ typedef enum : u8 {
   insn_putstatic_Z,
   insn_putstatic_L,
 
+  /** Resolved versions of getfield and putfield on a compressed reference field (see cp_field.compressed) */
+  insn_getfield_N,
+  insn_putfield_N,
+
   /** intrinsics understood by the interpreter */
   insn_pow, // (FF)F, (DD)D
   insn_sin, // (F)F, (D)D
   insn_cos, // (F)F, (D)D
   insn_tan, // (F)F, (D)D
-  insn_sqrt // (F)F, (D)D
+  insn_sqrt, // (F)F, (D)D
+
+  /** Superinstructions understood by the interpreter. Each replaces the first instruction of its sequence, while the
+   * instructions it absorbs keep their own kinds (so that branches into the middle of the sequence still work). */
+  insn_aload_getfield_I,  // aload; getfield_I
+  insn_aload_getfield_L,  // aload; getfield_L
+  insn_aload_arraylength, // aload; arraylength
+  insn_iload_iload_iadd,  // iload; iload; iadd
+  insn_iinc_goto,         // iinc; goto
+  insn_iload_if_icmpeq,   // iload; if_icmpeq
+  insn_iload_if_icmpne,   // iload; if_icmpne
+  insn_iload_if_icmplt,   // iload; if_icmplt
+  insn_iload_if_icmpge,   // iload; if_icmpge
+  insn_iload_if_icmpgt,   // iload; if_icmpgt
+  insn_iload_if_icmple    // iload; if_icmple
 } insn_code_kind;
 
-#define MAX_INSN_KIND (insn_sqrt + 1)
+#define MAX_INSN_KIND (insn_iload_if_icmple + 1)
+
+// The instruction that a superinstruction stands in for, or the kind itself if it is not a superinstruction. Code
+// which is not the interpreter (e.g. the JIT) should look at instructions through this.
+static inline insn_code_kind unfused_insn_kind(insn_code_kind kind) {
+  switch (kind) {
+  case insn_aload_getfield_I:
+  case insn_aload_getfield_L:
+  case insn_aload_arraylength:
+    return insn_aload;
+  case insn_iload_iload_iadd:
+  case insn_iload_if_icmpeq ... insn_iload_if_icmple:
+    return insn_iload;
+  case insn_iinc_goto:
+    return insn_iinc;
+  default:
+    return kind;
+  }
+}
 
 // The four top-of-stack kinds considered by the interpreter. (All integer types, including long and reference, are
 // merged into one.)
@@ -293,6 +329,18 @@ typedef enum : char {
 type_kind read_type_kind_char(char c);
 char type_kind_to_char(type_kind kind);
 
+// The type of the field accessed by a resolved getfield, putfield, getstatic or putstatic
+static inline type_kind resolved_field_type(insn_code_kind kind) {
+  int i = kind >= insn_putstatic_B   ? kind - insn_putstatic_B
+          : kind >= insn_getstatic_B ? kind - insn_getstatic_B
+          : kind >= insn_putfield_B  ? kind - insn_putfield_B
+                                     : kind - insn_getfield_B;
+  // In the order of the resolved kinds: B C S I J F D Z L
+  static const type_kind types[] = {TYPE_KIND_BYTE,  TYPE_KIND_CHAR,   TYPE_KIND_SHORT,   TYPE_KIND_INT,      TYPE_KIND_LONG,
+                                    TYPE_KIND_FLOAT, TYPE_KIND_DOUBLE, TYPE_KIND_BOOLEAN, TYPE_KIND_REFERENCE};
+  return types[i];
+}
+
 typedef enum {
   CD_KIND_ORDINARY,
   // e.g. classdesc corresponding to int.class. No objects mapping to this
@@ -531,6 +579,10 @@ typedef struct {
 typedef struct {
   exception_table_entry *entries;
   u16 entries_count;
+  // For each instruction, the offset in handler_lists of the indices of the entries covering it, in table order and
+  // terminated by -1. Lets find_exception_handler skip entries that can't apply.
+  u32 *insn_handlers;
+  s32 *handler_lists;
 } attribute_exception_table;
 
 typedef struct attribute attribute;
@@ -580,6 +632,14 @@ struct tableswitch_data {
   int targets[];
 };
 
+// How a lookupswitch finds the target for a key. Chosen per instruction by plan_lookupswitch during analysis.
+typedef enum : u8 {
+  LOOKUPSWITCH_LINEAR,        // compare against each key in turn (few keys, or keys that aren't sorted)
+  LOOKUPSWITCH_TABLE,         // the keys are dense enough to index `table` with key - low
+  LOOKUPSWITCH_BINARY_SEARCH, // over the sorted keys
+  LOOKUPSWITCH_HASH           // `table` is a perfect hash of the keys, indexed by (key * hash_multiplier) >> hash_shift
+} lookupswitch_strategy;
+
 struct lookupswitch_data {
   int default_target;
   int *targets;
@@ -587,8 +647,50 @@ struct lookupswitch_data {
 
   int *keys;
   int keys_count;
+
+  lookupswitch_strategy strategy;
+  u8 hash_shift;
+  u32 hash_multiplier;
+  int low;
+  u32 table_size;
+  // TABLE: the target for each key - low. HASH: the index into keys/targets for each bucket, or -1 if it's empty.
+  int *table;
 };
 
+// The instruction index that a lookupswitch jumps to for the given key
+static inline int lookupswitch_target(const struct lookupswitch_data *data, s32 key) {
+  switch (data->strategy) {
+  case LOOKUPSWITCH_TABLE: {
+    u32 index = (u32)key - (u32)data->low;
+    return index < data->table_size ? data->table[index] : data->default_target;
+  }
+  case LOOKUPSWITCH_HASH: {
+    int i = data->table[((u32)key * data->hash_multiplier) >> data->hash_shift];
+    return i >= 0 && data->keys[i] == key ? data->targets[i] : data->default_target;
+  }
+  case LOOKUPSWITCH_BINARY_SEARCH: {
+    int lo = 0, hi = data->keys_count - 1;
+    while (lo <= hi) {
+      int mid = (lo + hi) >> 1;
+      if (data->keys[mid] < key)
+        lo = mid + 1;
+      else if (data->keys[mid] > key)
+        hi = mid - 1;
+      else
+        return data->targets[mid];
+    }
+    return data->default_target;
+  }
+  case LOOKUPSWITCH_LINEAR:
+  default:
+    for (int i = 0; i < data->keys_count; ++i) {
+      if (data->keys[i] == key)
+        return data->targets[i];
+    }
+    return data->default_target;
+  }
+}
+
 struct iinc_data {
   u16 index;
   s16 const_;
@@ -791,7 +893,8 @@ typedef struct cp_method {
   void *jit_entry;    // if NULL, there's no way to call this function from JITed code D:
   void *trampoline;   // if NULL, there's no way to call this function from the interpreter D:
   bool jit_available; // whether jit_entry is NOT the interpreter entry but rather a JITed result
-  void *jit_info;
+  void *jit_info;     // dumb_jit_result owning the JITed code, if any
+  void *jit_request;  // compilation asked for and not yet installed (see jit_queue.h), if any
 } cp_method;
 
 int method_argc(const cp_method *method);
@@ -805,6 +908,9 @@ typedef struct cp_field {
   attribute *attributes;
   // Offset of the field in the static or instance data area
   size_t byte_offset;
+  // An instance reference field stored as a heap_ref rather than as a pointer: with COMPRESSED_REFS, every instance
+  // reference field, except those of the classes whose layout is fixed by a struct in natives_gen.h
+  bool compressed;
 
   field_descriptor parsed_descriptor;
   struct native_Field *reflection_field;
@@ -864,6 +970,8 @@ typedef struct classdesc {
   // followed. Only defined at linkage time.
   reference_list *static_references;
   reference_list *instance_references; // duplicates all superclass fields for convenience/locality
+  // Likewise, which 4-byte aligned offsets hold instance fields which are compressed (see cp_field.compressed)
+  reference_list *compressed_references;
 
   classdesc *one_fewer_dim; // NULL for non-array types
   classdesc *base_component;
@@ -880,12 +988,14 @@ typedef struct classdesc {
 
   vtable vtable;
   itables itables;
+  u32 interface_id; // interfaces only: unique in the process, and the key of the class in itables.slots
 
   classdesc **hierarchy; // 0 = java/lang/Object, etc. Used for fast instanceof checks
   s32 hierarchy_len;
 
   // The tid of the thread which is initializing this class
   s32 initializing_thread;
+  u32 class_ref; // index in the class table (64-bit hosts only), or 0 until the first instance is allocated
   arena arena; // most things are allocated in here
 } classdesc;
 
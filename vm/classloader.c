@@ -4,7 +4,7 @@
 
 // NOLINTNEXTLINE(misc-no-recursion)
 int classloader_init(vm *vm, classloader *cl, obj_header *java_mirror) {
-  DCHECK(java_mirror == nullptr || instanceof(java_mirror->descriptor, cached_classes(vm)->class_loader),
+  DCHECK(java_mirror == nullptr || instanceof(obj_class(java_mirror), cached_classes(vm)->class_loader),
          "Object is not a java/lang/ClassLoader");
 
   struct native_ClassLoader *mirror = (struct native_ClassLoader *)java_mirror;
@@ -27,7 +27,7 @@ classloader *unmirror_classloader(vm *vm, obj_header *java_mirror) {
     return vm->bootstrap_classloader;
   }
 
-  DCHECK(instanceof(java_mirror->descriptor, cached_classes(vm)->class_loader));
+  DCHECK(instanceof(obj_class(java_mirror), cached_classes(vm)->class_loader));
   struct native_ClassLoader *mirror = (struct native_ClassLoader *)java_mirror;
   if (mirror->reflected_loader == nullptr) {
     // Class loader is not yet registered: push a new one
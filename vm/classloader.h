@@ -25,6 +25,11 @@ typedef struct classloader {
   string_hash_table loaded;
   // set of classes for which this loader is an initiating loader
   string_hash_table initiating;
+
+  // During a major GC: whether the loader was found reachable (through its mirror, an instance or frame of one of
+  // its classes, or a loader which resolved one of its classes), and whether its classes' roots have been pushed.
+  // Loaders which aren't reachable are unloaded along with their classes.
+  bool alive, traced;
 } classloader;
 
 // CONTRACT: java_mirror must be null or a (subclass of) java/lang/ClassLoader, and not already registered.
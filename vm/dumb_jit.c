@@ -2,15 +2,25 @@
 //
 // There is a one-to-one mapping between the operand stack/locals and WASM locals. Construction of the CFG
 // structure is done using the "Stackifier" algorithm. Inlining is not yet implemented.
+//
+// Compiled code pushes a frame of kind FRAME_KIND_COMPILED, laid out like an interpreter frame. Before anything that
+// may collect garbage or walk the stack (a "safepoint": calls, allocations, exceptions) it stores the program counter
+// and every reference into the frame ("spilling"), and afterwards reloads the references, which the GC may have moved.
+// Instructions that can't be compiled instead store the whole state into the frame and hand it to the interpreter,
+// which finishes running the method (a deoptimization).
 
 #include "dumb_jit.h"
 
 #include <analysis.h>
 #include <arrays.h>
 #include <exceptions.h>
+#include <gc.h>
+#include <jit_allocator.h>
 #include <math.h>
 #include <objects.h>
+#include <stddef.h>
 #include <wasm/wasm_utils.h>
+#include <wasm_trampolines.h>
 
 typedef wasm_expression *expression;
 
@@ -38,7 +48,7 @@ void init_function_builder(wasm_module *module, function_builder *builder, const
   builder->next_local = arrlen(builder->params);
 }
 
-[[maybe_unused]] static int fb_new_local(function_builder *builder, wasm_value_type local) {
+static int fb_new_local(function_builder *builder, wasm_value_type local) {
   int local_i = builder->next_local++;
   arrput(builder->locals, local);
   DCHECK(arrlen(builder->locals) + arrlen(builder->params) == builder->next_local);
@@ -86,11 +96,16 @@ typedef struct method_jit_ctx_s {
   wasm_module *module;
   int curr_pc; // program counter
   int curr_sd; // stack depth
-  bool frame_requested;
-  int frame_local;
+  int frame_local;  // the compiled frame
+  int locals_local; // its locals, which precede it
+  dumb_jit_result *result; // passed to the runtime on deoptimization
+
+  // The block wrapping the code of the basic block being compiled, so that a branch to the next block in the
+  // topological order is a br out of it. bb_end is the instruction index following the basic block.
+  expression bb_exit;
+  int bb_end;
 
   expression *building; // emit(...) puts expressions here
-  pc_to_oop_count *pc_to_oops;
   code_analysis *analysis;
 
   int *stack_to_local; // maps (stack_i << 2 | type) -> WASM local, or -1 if not yet available
@@ -131,8 +146,38 @@ static wasm_value_type to_wasm_type(type_kind result) {
   UNREACHABLE();
 }
 
+// The WebAssembly types of the method's arguments (including the receiver, but not the thread and method which every
+// entry point also takes) and return value. Returns the number of arguments.
+static int method_wasm_signature(const cp_method *method, wasm_value_type *args, wasm_value_type *returns) {
+  int argc = 0;
+  if (!(method->access_flags & ACCESS_STATIC)) {
+    args[argc++] = WASM_TYPE_KIND_INT32;
+  }
+  for (int i = 0; i < method->descriptor->args_count; ++i) {
+    args[argc++] = to_wasm_type(method->descriptor->args[i].repr_kind);
+  }
+  *returns = to_wasm_type(method->descriptor->return_type.repr_kind);
+  return argc;
+}
+
+// Index of the type among the WASM locals kept for each stack slot and local
+static int type_index(wasm_value_type type) {
+  switch (type) {
+  case WASM_TYPE_KIND_INT32:
+    return 0;
+  case WASM_TYPE_KIND_INT64:
+    return 1;
+  case WASM_TYPE_KIND_FLOAT32:
+    return 2;
+  case WASM_TYPE_KIND_FLOAT64:
+    return 3;
+  default:
+    UNREACHABLE();
+  }
+}
+
 static int _get_local_slot(int local_i, wasm_value_type type) {
-  int i = local_i << 2 | type;
+  int i = local_i << 2 | type_index(type);
   if (ctx->local_to_local[i] == -1) {
     ctx->local_to_local[i] = fb_new_local(&ctx->fb, type);
   }
@@ -140,216 +185,389 @@ static int _get_local_slot(int local_i, wasm_value_type type) {
 }
 
 static int _get_stack_slot(int stack_i, wasm_value_type type) {
-  int i = stack_i << 2 | type;
+  int i = stack_i << 2 | type_index(type);
   if (ctx->stack_to_local[i] == -1) {
     ctx->stack_to_local[i] = fb_new_local(&ctx->fb, type);
   }
   return ctx->stack_to_local[i];
 }
 
-static wasm_value_type type_at(int slot) {
-  return to_wasm_type(ctx->analysis->stack_states[ctx->curr_pc]->entries[slot]);
+static const stack_summary *current_state() { return insn_stack_state(ctx->analysis, ctx->curr_pc); }
+
+// Type of the stack slot before the current instruction executes
+static wasm_value_type type_at(int stack_i) {
+  DCHECK(stack_i < current_state()->stack);
+  return to_wasm_type(current_state()->entries[stack_i]);
 }
 
-static int get_frame_local() {
-  if (!ctx->frame_requested) {
-    ctx->frame_requested = true;
-    ctx->frame_local = fb_new_local(&ctx->fb, WASM_TYPE_KIND_INT32);
-  }
-  return ctx->frame_local;
+static wasm_value_type local_type_at(int local_i) {
+  const stack_summary *ss = current_state();
+  return to_wasm_type(ss->entries[ss->stack + local_i]);
 }
 
-static expression get_frame() { return wasm_local_get(ctx->module, get_frame_local(), wasm_int32()); }
+static expression get_frame() { return wasm_local_get(ctx->module, ctx->frame_local, wasm_int32()); }
+
+static expression get_frame_locals() { return wasm_local_get(ctx->module, ctx->locals_local, wasm_int32()); }
 
 static expression get_local(int local_i) {
-  wasm_value_type type = type_at(local_i + ctx->method->code->max_stack);
+  wasm_value_type type = local_type_at(local_i);
   int slot = _get_local_slot(local_i, type);
   return wasm_local_get(ctx->module, slot, (wasm_type){.val = type});
 }
 
-[[maybe_unused]] static wasm_store_op_kind simple_store_op(wasm_value_type ty) {
-  switch (ty) {
-  default:
-  case WASM_TYPE_KIND_VOID:
-    UNREACHABLE();
-  case WASM_TYPE_KIND_FLOAT64:
-    return WASM_OP_KIND_F64_STORE;
-  case WASM_TYPE_KIND_FLOAT32:
-    return WASM_OP_KIND_F32_STORE;
-  case WASM_TYPE_KIND_INT64:
-    return WASM_OP_KIND_I64_STORE;
-  case WASM_TYPE_KIND_INT32:
-    return WASM_OP_KIND_I32_STORE;
-  }
-  return 0;
+static expression get_stack_slot_of_type(int stack_i, wasm_value_type type) {
+  int slot = _get_stack_slot(stack_i, type);
+  return wasm_local_get(ctx->module, slot, (wasm_type){.val = type});
 }
 
-static expression deopt() {
-  // We need to construct an equivalent frame in place, then side-exit to the interpreter.
-  stack_frame dummy;
-  dummy.kind = FRAME_KIND_INTERPRETER;
-  dummy.is_async_suspended = false;
-  dummy.method = ctx->method;
-  s32 locals = dummy.num_locals = ctx->method->code->max_locals;
-  s32 max_stack = dummy.max_stack = ctx->method->code->max_stack;
-  dummy.program_counter = ctx->curr_pc;
-
-  // Tantamount to performing two i64 stores, beginning at the frame base
-  expression *exprs = nullptr;
-  s64 part1, part2;
-  memcpy(&part1, &dummy, sizeof(s64));
-  memcpy(&part2, ((char *)&dummy) + sizeof(s64), sizeof(s64));
+static expression get_stack(int stack_i) { return get_stack_slot_of_type(stack_i, type_at(stack_i)); }
 
-  arrput(exprs, wasm_store(ctx->module, WASM_OP_KIND_I64_STORE, get_frame(), wasm_i64_const(ctx->module, part1), 0, 0));
-  arrput(exprs, wasm_store(ctx->module, WASM_OP_KIND_I64_STORE, get_frame(), wasm_i64_const(ctx->module, part2), 0, 8));
+static expression get_stack_assert(int stack_i, wasm_value_type expected) {
+  CHECK(type_at(stack_i) == expected);
+  return get_stack_slot_of_type(stack_i, expected);
+}
 
-  // Now perform a store to (get_frame() - locals + i) for each live local variable i
-  for (int local_i = 0; local_i < locals; ++local_i) {
-    wasm_value_type ty = type_at(local_i + max_stack);
-    if (ty == WASM_TYPE_KIND_VOID)
-      continue;
-    int slot = _get_local_slot(local_i, ty);
-    expression value = get_local(slot);
+static expression set_stack(int stack_i, expression value, wasm_value_type type) {
+  return wasm_local_set(ctx->module, _get_stack_slot(stack_i, type), value);
+}
+
+static expression set_local(int local_i, expression value, wasm_value_type type) {
+  return wasm_local_set(ctx->module, _get_local_slot(local_i, type), value);
+}
 
-    arrput(exprs, wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, get_frame(), value, 0, -8 * (locals - local_i)));
+// The JIT only targets wasm32, where an object's class reference is the classdesc pointer itself
+static expression get_descriptor(expression object) {
+  return wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, object, 2, offsetof(obj_header, class_ref));
+}
+
+static void emit(expression expr) { arrput(ctx->building, expr); }
+
+static expression thread_param() { return wasm_local_get(ctx->module, 0, wasm_int32()); }
+
+static expression make_block(expression *exprs) {
+  expression block = wasm_block(ctx->module, exprs, arrlen(exprs), wasm_void(), false);
+  arrfree(exprs);
+  return block;
+}
+
+// Import the given function with the given signature. The function must be exported, with EMSCRIPTEN_KEEPALIVE.
+static expression upcall_impl([[maybe_unused]] void *fn, const char *fn_name, const char *sig, expression *args) {
+  DCHECK(fn != nullptr);
+  wasm_function *f = wasm_import_runtime_function_impl(ctx->module, fn_name, sig);
+  return wasm_call(ctx->module, f, args, (int)strlen(sig) - 1);
+}
+
+#define upcall(fn, sig, args) upcall_impl(&fn, #fn, sig, args)
+
+// Pointers into the thread and the frame
+
+static expression set_pc() {
+  return wasm_store(ctx->module, WASM_OP_KIND_I32_STORE16, get_frame(), wasm_i32_const(ctx->module, ctx->curr_pc), 0,
+                    offsetof(stack_frame, program_counter));
+}
+
+static expression frame_slot_address(bool is_local, int i, int *offset) {
+  if (is_local) {
+    *offset = i * (int)sizeof(stack_value);
+    return get_frame_locals();
   }
+  *offset = (int)(offsetof(stack_frame, stack) + i * sizeof(stack_value));
+  return get_frame();
+}
 
-  return nullptr;
+// Store a value into a slot of the frame, in the representation that the interpreter expects
+static expression store_to_frame(bool is_local, int i, type_kind kind, expression value) {
+  int offset;
+  expression addr = frame_slot_address(is_local, i, &offset);
+  switch (kind) {
+  case TYPE_KIND_REFERENCE:
+    return wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, addr, value, 0, offset);
+  case TYPE_KIND_LONG:
+    return wasm_store(ctx->module, WASM_OP_KIND_I64_STORE, addr, value, 0, offset);
+  case TYPE_KIND_FLOAT:
+    return wasm_store(ctx->module, WASM_OP_KIND_F32_STORE, addr, value, 0, offset);
+  case TYPE_KIND_DOUBLE:
+    return wasm_store(ctx->module, WASM_OP_KIND_F64_STORE, addr, value, 0, offset);
+  default: // ints fill the whole slot, sign-extended
+    value = wasm_unop(ctx->module, WASM_OP_KIND_I64_EXTEND_S_I32, value);
+    return wasm_store(ctx->module, WASM_OP_KIND_I64_STORE, addr, value, 0, offset);
+  }
 }
 
-static expression get_stack_slot_of_type(int stack_i, wasm_value_type tk) {
-  [[maybe_unused]] int slot = _get_stack_slot(stack_i, tk);
-  return nullptr;
+// Store the references (or with all_values, every value) in the current state into the frame
+static void store_frame_state(expression **exprs, bool all_values) {
+  const stack_summary *ss = current_state();
+  for (int i = 0; i < ss->stack + ss->locals; ++i) {
+    type_kind kind = ss->entries[i];
+    if (kind == TYPE_KIND_VOID || (!all_values && kind != TYPE_KIND_REFERENCE))
+      continue;
+    bool is_local = i >= ss->stack;
+    int index = is_local ? i - ss->stack : i;
+    expression value = is_local ? get_local(index) : get_stack(index);
+    arrput(*exprs, store_to_frame(is_local, index, kind, value));
+  }
 }
 
-static expression get_stack(int stack_i) {
-  wasm_value_type type = type_at(stack_i);
-  int slot = _get_stack_slot(stack_i, type);
-  return wasm_local_get(ctx->module, slot, (wasm_type){.val = type});
+// Prepare the frame for a safepoint at the current instruction
+static expression spill_oops() {
+  expression *exprs = nullptr;
+  arrput(exprs, set_pc());
+  store_frame_state(&exprs, false);
+  return make_block(exprs);
 }
 
-static expression get_stack_assert(int stack_i, wasm_value_type expected) {
-  wasm_value_type type = type_at(stack_i);
-  CHECK(type == expected);
-  int slot = _get_stack_slot(stack_i, type);
-  return wasm_local_get(ctx->module, slot, (wasm_type){.val = type});
+// After a safepoint, reload the references in the locals and in the stack slots below max_stack_i
+static expression reload_oops(int max_stack_i) {
+  const stack_summary *ss = current_state();
+  expression *exprs = nullptr;
+  for (int i = 0; i < ss->stack + ss->locals; ++i) {
+    bool is_local = i >= ss->stack;
+    if (ss->entries[i] != TYPE_KIND_REFERENCE || (!is_local && i >= max_stack_i))
+      continue;
+    int index = is_local ? i - ss->stack : i;
+    int offset;
+    expression addr = frame_slot_address(is_local, index, &offset);
+    expression value = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, addr, 0, offset);
+    arrput(exprs, is_local ? set_local(index, value, WASM_TYPE_KIND_INT32)
+                           : set_stack(index, value, WASM_TYPE_KIND_INT32));
+  }
+  return make_block(exprs);
 }
 
-static expression npe_and_exit() { return nullptr; }
+static expression load_jit_entry(expression method) {
+  return wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, method, 0, offsetof(cp_method, jit_entry));
+}
 
-static expression if_exception_exit() { return nullptr; }
+// Exits
 
-static expression get_descriptor(expression object) {
-  return wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, object, 2, offsetof(obj_header, descriptor));
+static expression return_zero() {
+  // Return the 0 of whatever the current function's return type is
+  switch (ctx->fb.returns.val) {
+  case WASM_TYPE_KIND_INT32:
+    return wasm_return(ctx->module, wasm_i32_const(ctx->module, 0));
+  case WASM_TYPE_KIND_FLOAT32:
+    return wasm_return(ctx->module, wasm_f32_const(ctx->module, 0.0f));
+  case WASM_TYPE_KIND_FLOAT64:
+    return wasm_return(ctx->module, wasm_f64_const(ctx->module, 0.0));
+  case WASM_TYPE_KIND_INT64:
+    return wasm_return(ctx->module, wasm_i64_const(ctx->module, 0));
+  default:
+    return wasm_return(ctx->module, nullptr);
+  }
 }
 
-static expression set_stack(int stack_i, expression value, wasm_value_type type) { return nullptr; }
+static expression pop_frame_expr() {
+  expression prev = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, get_frame(), 0, offsetof(stack_frame, prev));
+  return wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, thread_param(), prev, 0, offsetof(vm_thread, stack.top));
+}
 
-static expression set_local(int local_i, expression value, wasm_value_type type) { return nullptr; }
+// Pop the frame and return; the caller checks thread->current_exception
+static expression do_exit() {
+  expression steps[2] = {pop_frame_expr(), return_zero()};
+  return wasm_block(ctx->module, steps, 2, wasm_void(), false);
+}
 
-static void emit(expression expr) { arrput(ctx->building, expr); }
+EMSCRIPTEN_KEEPALIVE
+void wasm_runtime_raise_npe(vm_thread *thread) { raise_null_pointer_exception(thread); }
 
-static expression thread_param() { return wasm_local_get(ctx->module, 0, wasm_int32()); }
+static expression npe_and_exit() {
+  expression args[1] = {thread_param()};
+  expression steps[3] = {spill_oops(), upcall(wasm_runtime_raise_npe, "vi", args), do_exit()};
+  return wasm_block(ctx->module, steps, 3, wasm_void(), false);
+}
 
-[[maybe_unused]] static expression set_pc() {
-  return nullptr;
-  /*
-  return wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, get_frame(),
-    wasm_i32_const(ctx->module, ctx->curr_pc), 2, offsetof(stack_frame, compiled) + offsetof(compiled_frame, pc));*/
+static expression if_null_npe(expression object) {
+  return wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, object), npe_and_exit(), nullptr,
+                      wasm_void());
 }
 
-static expression spill_or_reload_oops(int max_stack_i, bool is_reload) {
-#if 0
-  int spill_i = 0;
-  compressed_bitset bs = ctx->analysis->insn_index_to_references[ctx->curr_pc];
-  int *vec = nullptr;
-  list_compressed_bitset_bits(bs, &vec);
-  expression *exprs = nullptr;
-  if (!is_reload)
-    arrput(exprs, set_pc());
-  for (int i = 0; i < arrlen(vec); ++i) {
-    int stack_i = vec[i];
-    if (stack_i >= max_stack_i && stack_i < ctx->curr_sd)
-      continue;
-    int offs = 0; // offsetof(stack_frame, compiled) + offsetof(compiled_frame, oops);
-    offs += (int)(spill_i * sizeof(void *));
-    if (is_reload) {
-      expression value = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, get_frame(), 2, offs);
-      arrput(exprs, set_stack(stack_i, value, WASM_TYPE_KIND_INT32));
-    } else {
-      expression value = get_stack(stack_i);
-      arrput(exprs, wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, get_frame(), value, 2, offs));
+static expression if_exception_exit() {
+  expression exception =
+      wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, thread_param(), 0, offsetof(vm_thread, current_exception));
+  return wasm_if_else(ctx->module, exception, do_exit(), nullptr, wasm_void());
+}
+
+void dumb_jit_count_deopt(cp_method *method, dumb_jit_result *code) {
+  if (++code->deopts == JIT_DEOPTS_BEFORE_RECOMPILE && method->jit_info == code &&
+      code->compilations < JIT_MAX_COMPILATIONS) {
+    // The code keeps deoptimizing, probably at instructions which weren't resolved yet when it was compiled. Fall
+    // back to the interpreter (frames already running the code keep it alive) so that the method is compiled again.
+    method->jit_available = false;
+    method->call_count = 0;
+    dumb_jit_link_method(method);
+  }
+}
+
+void dumb_jit_forget_classes(cp_method *method, bool (*is_unloaded)(classdesc *cd)) {
+  for (dumb_jit_result *code = method->jit_info; code; code = code->previous) {
+    bool forgot = false;
+    for (int i = 0; i < code->class_guard_count; ++i) {
+      jit_class_guard *guard = &code->class_guards[i];
+      if (guard->desc && is_unloaded(guard->desc)) {
+        guard->desc = nullptr;
+        guard->class_ref = 0;
+        forgot = true;
+      }
+    }
+    // Frames still running older code deoptimize at the guards instead
+    if (forgot && code == method->jit_info && method->jit_available) {
+      method->jit_available = false;
+      method->call_count = 0;
+      dumb_jit_link_method(method);
     }
   }
-  expression block = nullptr;
-  DCHECK(exprs);
-  block = wasm_block(ctx->module, exprs, arrlen(exprs), wasm_void(), false);
-  arrfree(vec);
-  ctx->pc_to_oops->count[ctx->curr_pc] = spill_i;
-  return block;
-#endif
-  return nullptr;
 }
 
-static expression spill_oops(int max_stack_i) { return spill_or_reload_oops(max_stack_i, false); }
+// Hand the frame to the interpreter, which runs the rest of the method and pops the frame
+static stack_value run_deoptimized_frame(vm_thread *thread, stack_frame *frame, dumb_jit_result *code) {
+  dumb_jit_count_deopt(frame->method, code);
 
-static expression reload_oops(int max_stack_i) { return spill_or_reload_oops(max_stack_i, true); }
+  frame->kind = FRAME_KIND_INTERPRETER;
+  thread->stack.synchronous_depth++;
+  interpret_t state = {.args = {thread, frame}};
+  future_t fut = interpret(&state);
+  CHECK(fut.status == FUTURE_READY, "deoptimized method tried to suspend");
+  thread->stack.synchronous_depth--;
+  return state._result;
+}
 
-static expression load_jit_entry(expression method) {
-  return wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, method, 0, offsetof(cp_method, jit_entry));
+EMSCRIPTEN_KEEPALIVE
+s64 wasm_runtime_deopt(vm_thread *thread, stack_frame *frame, dumb_jit_result *code) {
+  return run_deoptimized_frame(thread, frame, code).l;
 }
 
-// Import the given function with the given signature. The function must be exported, with EMSCRIPTEN_KEEPALIVE.
-static expression upcall_impl([[maybe_unused]] void *fn, const char *fn_name, const char *sig, expression *args) {
-  DCHECK(fn != nullptr);
-  wasm_function *f = wasm_import_runtime_function_impl(ctx->module, fn_name, sig);
-  return wasm_call(ctx->module, f, args, arrlen(args));
+EMSCRIPTEN_KEEPALIVE
+void wasm_runtime_deopt_void(vm_thread *thread, stack_frame *frame, dumb_jit_result *code) {
+  run_deoptimized_frame(thread, frame, code);
 }
 
-#define upcall(fn, sig, args) upcall_impl(&fn, #fn, sig, args)
+// Store the state at the current instruction into the frame, and let the interpreter resume from there
+static expression deopt() {
+  expression *exprs = nullptr;
+  arrput(exprs, set_pc());
+  store_frame_state(&exprs, true);
+
+  expression args[3] = {thread_param(), get_frame(), wasm_i32_const(ctx->module, (intptr_t)ctx->result)};
+  wasm_value_type returns = ctx->fb.returns.val;
+  if (returns == WASM_TYPE_KIND_VOID) {
+    arrput(exprs, upcall(wasm_runtime_deopt_void, "viii", args));
+    arrput(exprs, wasm_return(ctx->module, nullptr));
+  } else {
+    expression result = upcall(wasm_runtime_deopt, "jiii", args);
+    switch (returns) {
+    case WASM_TYPE_KIND_INT32:
+      result = wasm_unop(ctx->module, WASM_OP_KIND_I32_WRAP_I64, result);
+      break;
+    case WASM_TYPE_KIND_FLOAT32:
+      result = wasm_unop(ctx->module, WASM_OP_KIND_I32_WRAP_I64, result);
+      result = wasm_unop(ctx->module, WASM_OP_KIND_F32_REINTERPRET_I32, result);
+      break;
+    case WASM_TYPE_KIND_FLOAT64:
+      result = wasm_unop(ctx->module, WASM_OP_KIND_F64_REINTERPRET_I64, result);
+      break;
+    default:
+      break;
+    }
+    arrput(exprs, wasm_return(ctx->module, result));
+  }
+  return make_block(exprs);
+}
 
-static u32 get_method_func_type(cp_method *method) { return 0; }
+// Branches
 
-static expression branch_target(int pc) {
-  // Iterate over blocks to find the block with the correct start pc.
-  int block_i = 0;
+static int block_topo_at(int pc) {
   for (int i = 0; i < ctx->blockc; ++i) {
-    if (ctx->analysis->blocks[i].start_index == pc) {
-      block_i = ctx->block_to_topo[i];
-      goto found;
-    }
+    if (ctx->analysis->blocks[i].start_index == pc)
+      return ctx->block_to_topo[i];
   }
   UNREACHABLE();
-found:
-  if (pc <= ctx->curr_pc) {
+}
+
+static expression branch_target(int pc) {
+  int topo = block_topo_at(pc);
+  if (topo <= ctx->topo_i) {
     // Look for a loop header so we can jump backwards
-    expression loop = ctx->loop_headers[block_i];
+    expression loop = ctx->loop_headers[topo];
     CHECK(loop);
     return loop;
   }
-  expression blk = ctx->block_ends[block_i];
+  if (topo == ctx->topo_i + 1)
+    return ctx->bb_exit;
+  expression blk = ctx->block_ends[topo];
   CHECK(blk);
   return blk;
 }
 
-static expression do_exit() {
-  // Return the 0 of whatever the current function's return type is
-  switch (ctx->fb.returns.val) {
-  case WASM_TYPE_KIND_INT32:
-    return wasm_return(ctx->module, wasm_i32_const(ctx->module, 0));
-  case WASM_TYPE_KIND_FLOAT32:
-    return wasm_return(ctx->module, wasm_f32_const(ctx->module, 0.0f));
-  case WASM_TYPE_KIND_FLOAT64:
-    return wasm_return(ctx->module, wasm_f64_const(ctx->module, 0.0));
-  case WASM_TYPE_KIND_INT64:
-    return wasm_return(ctx->module, wasm_i64_const(ctx->module, 0));
-  default:
-    return wasm_return(ctx->module, nullptr);
+static void emit_goto(int pc) {
+  if (block_topo_at(pc) != ctx->topo_i + 1) // otherwise, just fall out of the basic block
+    emit(wasm_br(ctx->module, nullptr, branch_target(pc)));
+}
+
+static void emit_cond_branch(expression cond, int taken, int not_taken) {
+  if (block_topo_at(taken) == ctx->topo_i + 1) {
+    emit(wasm_br(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_I32_EQZ, cond), branch_target(not_taken)));
+  } else {
+    emit(wasm_br(ctx->module, cond, branch_target(taken)));
+    emit_goto(not_taken);
+  }
+}
+
+// Calls
+
+// Call the method through its jit_entry with the thread, the method, the leading arguments and the top argc stack
+// slots. If the method is known, call it directly (or deoptimize if it has no jit_entry yet); otherwise, `method`
+// must be free of side effects.
+static int lower_call(cp_method *known, expression method, const method_descriptor *descriptor, expression *leading,
+                      int leading_count, int argc) {
+  if (known) {
+    if (!known->jit_entry) {
+      emit(deopt());
+      return -1;
+    }
+    method = wasm_i32_const(ctx->module, (intptr_t)known);
+  } else {
+    // Keep the method in a stack slot which the call doesn't use
+    emit(set_stack(ctx->curr_sd, method, WASM_TYPE_KIND_INT32));
+    method = get_stack_slot_of_type(ctx->curr_sd, WASM_TYPE_KIND_INT32);
+    expression no_entry = wasm_unop(ctx->module, WASM_OP_KIND_I32_EQZ, load_jit_entry(method));
+    emit(wasm_if_else(ctx->module, no_entry, deopt(), nullptr, wasm_void()));
+  }
+
+  expression args[260];
+  wasm_value_type types[260];
+  int arg_i = 0;
+  types[arg_i] = WASM_TYPE_KIND_INT32;
+  args[arg_i++] = thread_param();
+  types[arg_i] = WASM_TYPE_KIND_INT32;
+  args[arg_i++] = method;
+  for (int j = 0; j < leading_count; ++j) {
+    types[arg_i] = WASM_TYPE_KIND_INT32;
+    args[arg_i++] = leading[j];
+  }
+  DCHECK(argc < 256);
+  for (int j = 0; j < argc; ++j) {
+    int stack_i = ctx->curr_sd - argc + j;
+    types[arg_i] = type_at(stack_i);
+    args[arg_i++] = get_stack(stack_i);
+  }
+
+  wasm_value_type returns = to_wasm_type(descriptor->return_type.repr_kind);
+  u32 functype =
+      register_function_type(ctx->module, wasm_make_tuple(ctx->module, types, arg_i), (wasm_type){.val = returns});
+  expression do_call = wasm_call_indirect(ctx->module, 0, load_jit_entry(method), args, arg_i, functype);
+  if (returns != WASM_TYPE_KIND_VOID) {
+    do_call = set_stack(ctx->curr_sd - argc, do_call, returns);
   }
+
+  emit(spill_oops());
+  emit(do_call);
+  emit(if_exception_exit()); // TODO check nothrow
+  emit(reload_oops(ctx->curr_sd - argc));
+  return 0;
 }
 
 // Call where there is only one possible target.
-static void lower_monomorphic_call(const bytecode_insn *insn) {
+static int lower_monomorphic_call(const bytecode_insn *insn) {
   bool is_monomorphic_vtable =
       insn->kind == insn_invokevtable_monomorphic || insn->kind == insn_invokeitable_monomorphic;
   bool is_invokespecial = insn->kind == insn_invokespecial_resolved;
@@ -357,147 +575,79 @@ static void lower_monomorphic_call(const bytecode_insn *insn) {
 
   DCHECK(is_monomorphic_vtable || is_invokespecial || is_invokestatic);
 
-  // For this instruction, we have to de-opt if the observed class descriptor is different from the IC descriptor.
-  classdesc *ic = insn->ic;
-  cp_method *method = insn->ic2;
-  int argc = method_argc(method);
+  cp_method *method = insn->ic;
+  int argc = insn->args;
+  if (method->is_signature_polymorphic) {
+    emit(deopt());
+    return -1;
+  }
 
-  expression if_null_then_npe = nullptr;
-  expression if_cd_different_then_deopt = nullptr;
   if (!is_invokestatic) {
     expression receiver = get_stack(ctx->curr_sd - argc);
-    expression is_null = wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, receiver);
-    if_null_then_npe = wasm_if_else(ctx->module, is_null, npe_and_exit(), nullptr, wasm_void());
+    emit(if_null_npe(receiver));
 
     if (is_monomorphic_vtable) {
+      // We have to de-opt if the observed class descriptor is different from the IC descriptor
+      classdesc *expected = insn->ic2;
       expression cd_different = wasm_binop(ctx->module, WASM_OP_KIND_REF_NE, get_descriptor(receiver),
-                                           wasm_i32_const(ctx->module, (intptr_t)ic));
-      if_cd_different_then_deopt = wasm_if_else(ctx->module, cd_different, deopt(), nullptr, wasm_void());
+                                           wasm_i32_const(ctx->module, (intptr_t)expected));
+      emit(wasm_if_else(ctx->module, cd_different, deopt(), nullptr, wasm_void()));
     }
   }
 
   // TODO make this a direct call using a funcref if the target JIT is stable
-  expression method_const = wasm_i32_const(ctx->module, (intptr_t)method);
-
-  expression args[259];
-  int arg_i = 0;
-  args[arg_i++] = thread_param();
-  args[arg_i++] = method_const;
-  for (int j = 0; j < argc; ++j) {
-    args[arg_i++] = get_stack(ctx->curr_sd - argc + j);
-  }
-  DCHECK(argc < 256);
-
-  u32 functype = get_method_func_type(method);
-
-  expression do_call = wasm_call_indirect(ctx->module, 0, load_jit_entry(method_const), args, argc + 2, functype);
-
-  type_kind result = method->descriptor->return_type.repr_kind;
-  if (result != TYPE_KIND_VOID) {
-    do_call = set_stack(ctx->curr_sd - argc, do_call, to_wasm_type(result));
-  }
-
-  if (if_null_then_npe) {
-    emit(if_null_then_npe);
-  }
-  if (if_cd_different_then_deopt) {
-    emit(if_cd_different_then_deopt);
-  }
-  emit(spill_oops(ctx->curr_sd - argc));
-  emit(do_call);
-  emit(if_exception_exit()); // TODO check nothrow
-  emit(reload_oops(ctx->curr_sd - argc));
+  return lower_call(method, nullptr, method->descriptor, nullptr, 0, argc);
 }
 
-static void lower_vtable_call(const bytecode_insn *insn) {
+static int lower_vtable_call(const bytecode_insn *insn) {
   DCHECK(insn->kind == insn_invokevtable_polymorphic);
 
   int argc = insn->args;
   expression receiver = get_stack(ctx->curr_sd - argc);
-  type_kind returns = insn->cp->methodref.descriptor->return_type.repr_kind;
-  size_t vtable_i = (size_t)insn->ic2;
+  size_t vtable_i = ((polymorphic_cache *)insn->ic)->index;
 
-  // Look in classdesc->vtable.methods[vtable_i] for the method
-  expression exit_on_npe = wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, receiver),
-                                        npe_and_exit(), nullptr, wasm_void());
+  emit(if_null_npe(receiver));
 
+  // Look in classdesc->vtable.methods[vtable_i] for the method
   expression method = get_descriptor(receiver);
   method =
       wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, method, 0, offsetof(classdesc, vtable) + offsetof(vtable, methods));
   method = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, method, 2, (s32)(vtable_i * sizeof(void *)));
 
-  expression args[259];
-  int arg_i = 0;
-  args[arg_i++] = thread_param();
-  args[arg_i++] = method;
-  for (int j = 0; j < argc; ++j) {
-    args[arg_i++] = get_stack(ctx->curr_sd - argc + j);
-  }
-
-  emit(exit_on_npe);
-  emit(spill_oops(ctx->curr_sd - insn->args));
-  cp_method *resolved = insn->cp->methodref.resolved;
-  expression do_call =
-      wasm_call_indirect(ctx->module, 0, load_jit_entry(method), args, argc + 2, get_method_func_type(resolved));
-  if (returns != TYPE_KIND_VOID) {
-    do_call = set_stack(ctx->curr_sd - argc, do_call, to_wasm_type(returns));
-  }
-  emit(do_call);
-  emit(if_exception_exit());
-  emit(reload_oops(ctx->curr_sd - argc));
+  return lower_call(nullptr, method, insn->cp->methodref.descriptor, nullptr, 0, argc);
 }
 
 EMSCRIPTEN_KEEPALIVE
-static cp_method *wasm_runtime_itable_lookup(vm_thread *thread, object target, classdesc *iface, size_t itable_i,
-                                             cp_method *reference) {
-  DCHECK(target && iface);
-  cp_method *method = itable_lookup(target->descriptor, iface, itable_i);
+cp_method *wasm_runtime_itable_lookup(vm_thread *thread, object target, polymorphic_cache *cache,
+                                      cp_method *reference) {
+  DCHECK(target && cache);
+  cp_method *method = polymorphic_cache_lookup(cache, obj_class(target));
   if (unlikely(!method)) {
     raise_abstract_method_error(thread, reference);
   }
   return method;
 }
 
-static void lower_itable_call(const bytecode_insn *insn) {
+static int lower_itable_call(const bytecode_insn *insn) {
   DCHECK(insn->kind == insn_invokeitable_polymorphic);
-  // The logic here is painful so for now do an upcall to itable_lookup
-  expression receiver = get_stack(ctx->curr_sd - insn->args);
-  type_kind returns = insn->cp->methodref.descriptor->return_type.repr_kind;
-  size_t itable_i = (size_t)insn->ic2;
+  // The logic here is painful so for now do an upcall, which goes through the call site's inline cache
   int argc = insn->args;
+  expression receiver = get_stack(ctx->curr_sd - argc);
 
-  expression exit_on_npe = wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, receiver),
-                                        npe_and_exit(), nullptr, wasm_void());
-  expression itable_lookup_args[5] = {thread_param(), receiver, wasm_i32_const(ctx->module, (intptr_t)insn->ic),
-                                      wasm_i32_const(ctx->module, (intptr_t)itable_i),
+  expression itable_lookup_args[4] = {thread_param(), receiver, wasm_i32_const(ctx->module, (intptr_t)insn->ic),
                                       wasm_i32_const(ctx->module, (intptr_t)insn->cp->methodref.resolved)};
-  expression found_method = get_stack_slot_of_type(ctx->curr_sd, WASM_TYPE_KIND_INT32);
 
-  emit(exit_on_npe);
+  emit(if_null_npe(receiver));
+  emit(spill_oops());
   // Known unused slot
-  emit(set_stack(ctx->curr_sd, upcall(wasm_runtime_itable_lookup, "iiiiii", itable_lookup_args), WASM_TYPE_KIND_INT32));
+  emit(set_stack(ctx->curr_sd, upcall(wasm_runtime_itable_lookup, "iiiii", itable_lookup_args), WASM_TYPE_KIND_INT32));
   emit(if_exception_exit()); // abstract method error
-  emit(spill_oops(ctx->curr_sd));
 
-  expression args[259];
-  int arg_i = 0;
-  args[arg_i++] = thread_param();
-  args[arg_i++] = found_method;
-  for (int j = 0; j < argc; ++j) {
-    args[arg_i++] = get_stack(ctx->curr_sd - argc + j);
-  }
-
-  expression do_call = wasm_call_indirect(ctx->module, 0, load_jit_entry(found_method), args, argc + 2,
-                                          get_method_func_type(insn->cp->methodref.resolved));
-  if (returns != TYPE_KIND_VOID) {
-    do_call = set_stack(ctx->curr_sd - argc, do_call, to_wasm_type(returns));
-  }
-  emit(do_call);
-  emit(if_exception_exit());
-  emit(reload_oops(ctx->curr_sd - insn->args));
+  expression found_method = get_stack_slot_of_type(ctx->curr_sd, WASM_TYPE_KIND_INT32);
+  return lower_call(nullptr, found_method, insn->cp->methodref.descriptor, nullptr, 0, argc);
 }
 
-static void lower_invokecallsite(const bytecode_insn *insn) {
+static int lower_invokecallsite(const bytecode_insn *insn) {
   DCHECK(insn->kind == insn_invokecallsite);
 
   struct native_CallSite *cs = insn->ic;
@@ -506,50 +656,33 @@ static void lower_invokecallsite(const bytecode_insn *insn) {
   struct native_MemberName *name = (void *)form->vmentry;
 
   method_handle_kind kind = (name->flags >> 24) & 0xf;
-  if (kind == MH_KIND_INVOKE_STATIC) {
-    bool returns = form->result != -1;
-    // Invoke name->vmtarget with arguments mh, args
-    cp_method *invoke = name->vmtarget;
-    expression method_const = wasm_i32_const(ctx->module, (intptr_t)invoke);
-
-    // GC can move both the CallSite and MethodHandle around -- so always load it from the insn->ic which is a GC root
-    expression get_mh =
-        wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, wasm_i32_const(ctx->module, (intptr_t)&insn->ic), 0, 0);
-    get_mh = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, get_mh, 0, offsetof(struct native_CallSite, target));
-
-    expression args[259];
-    int args_i = 0;
-    args[args_i++] = thread_param();
-    args[args_i++] = method_const;
-    args[args_i++] = get_mh;
-    for (int i = 0; i < insn->args; ++i) {
-      args[args_i++] = get_stack(ctx->curr_sd - insn->args + i);
-    }
-
-    emit(spill_oops(ctx->curr_sd - insn->args));
-    expression do_call = wasm_call_indirect(ctx->module, 0, load_jit_entry(method_const), args, insn->args + 3,
-                                            get_method_func_type(invoke));
-    if (returns) {
-      wasm_value_type tk = to_wasm_type(invoke->descriptor->return_type.repr_kind);
-      set_stack(ctx->curr_sd - insn->args, do_call, tk);
-    }
-    emit(do_call);
-    emit(if_exception_exit());
-    emit(reload_oops(ctx->curr_sd - insn->args));
-  } else {
-    UNREACHABLE();
+  if (kind != MH_KIND_INVOKE_STATIC) {
+    emit(deopt());
+    return -1;
   }
+
+  // Invoke name->vmtarget with arguments mh, args
+  cp_method *invoke = name->vmtarget;
+
+  // GC can move both the CallSite and MethodHandle around -- so always load it from the insn->ic which is a GC root
+  expression get_mh =
+      wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, wasm_i32_const(ctx->module, (intptr_t)&insn->ic), 0, 0);
+  get_mh = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, get_mh, 0, offsetof(struct native_CallSite, target));
+
+  return lower_call(invoke, nullptr, invoke->descriptor, &get_mh, 1, insn->args);
 }
 
+// Allocation and type checks
+
 EMSCRIPTEN_KEEPALIVE
-static object wasm_runtime_allocate_object(vm_thread *thread, classdesc *cd) {
+object wasm_runtime_allocate_object(vm_thread *thread, classdesc *cd) {
   return AllocateObject(thread, cd, cd->instance_bytes);
 }
 
 static void lower_new_resolved(const bytecode_insn *insn) {
   DCHECK(insn->kind == insn_new_resolved);
 
-  emit(spill_oops(ctx->curr_sd));
+  emit(spill_oops());
   expression args[2] = {thread_param(), wasm_i32_const(ctx->module, (intptr_t)insn->classdesc)};
   expression do_alloc = upcall(wasm_runtime_allocate_object, "iii", args);
   do_alloc = set_stack(ctx->curr_sd, do_alloc, WASM_TYPE_KIND_INT32);
@@ -559,10 +692,10 @@ static void lower_new_resolved(const bytecode_insn *insn) {
 }
 
 EMSCRIPTEN_KEEPALIVE
-static bool wasm_runtime_instanceof(object o, classdesc *cd) { return o != nullptr && instanceof(o->descriptor, cd); }
+bool wasm_runtime_instanceof(object o, classdesc *cd) { return o != nullptr && instanceof(obj_class(o), cd); }
 
 static void lower_instanceof_resolved(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_instanceof_resolved); // instanceof(obj->descriptor, insn->classdesc)
+  DCHECK(insn->kind == insn_instanceof_resolved); // instanceof(obj_class(obj), insn->classdesc)
 
   expression args[2] = {get_stack(ctx->curr_sd - 1), wasm_i32_const(ctx->module, (intptr_t)insn->classdesc)};
   expression check = upcall(wasm_runtime_instanceof, "iii", args);
@@ -571,28 +704,108 @@ static void lower_instanceof_resolved(const bytecode_insn *insn) {
 }
 
 EMSCRIPTEN_KEEPALIVE
-static float wasm_runtime_frem(float a, float b) { return fmodf(a, b); }
+bool wasm_runtime_checkcast(vm_thread *thread, object o, classdesc *cd) {
+  if (o == nullptr || instanceof(obj_class(o), cd))
+    return false;
+  raise_class_cast_exception(thread, obj_class(o), cd);
+  return true;
+}
 
-static void lower_frem(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_frem);
-  expression right = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_FLOAT32);
-  expression left = get_stack_assert(ctx->curr_sd - 2, WASM_TYPE_KIND_FLOAT32);
-  expression args[2] = {left, right};
-  expression call = upcall(wasm_runtime_frem, "fff", args);
-  emit(set_stack(ctx->curr_sd - 2, call, WASM_TYPE_KIND_FLOAT32));
+static void lower_checkcast_resolved(const bytecode_insn *insn) {
+  DCHECK(insn->kind == insn_checkcast_resolved); // instanceof(obj_class(obj), insn->classdesc)
+  expression receiver = get_stack(ctx->curr_sd - 1);
+  expression args[3] = {thread_param(), receiver, wasm_i32_const(ctx->module, (intptr_t)insn->classdesc)};
+  expression check = upcall(wasm_runtime_checkcast, "iiii", args);
+  check = wasm_if_else(ctx->module, check, do_exit(), nullptr, wasm_void());
+  emit(spill_oops());
+  emit(check);
+}
+
+EMSCRIPTEN_KEEPALIVE
+obj_header *wasm_runtime_newarray(vm_thread *thread, type_kind array_type, s32 count) {
+  if (unlikely(count < 0)) {
+    raise_negative_array_size_exception(thread, count);
+    return nullptr;
+  }
+  obj_header *array = NewPrimitiveArray1D(thread, array_type, count);
+  return array;
+}
+
+EMSCRIPTEN_KEEPALIVE
+obj_header *wasm_runtime_anewarray(vm_thread *thread, classdesc *type, s32 count) {
+  if (count < 0) {
+    raise_negative_array_size_exception(thread, count);
+    return nullptr;
+  }
+  obj_header *array = NewObjectArray1D(thread, type, count);
+  return array;
+}
+
+static void lower_newarray(const bytecode_insn *insn) {
+  bool is_primitive = insn->kind == insn_newarray;
+  DCHECK(is_primitive || insn->kind == insn_anewarray_resolved);
+
+  emit(spill_oops());
+  expression count = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
+  expression args[3] = {thread_param(),
+                        wasm_i32_const(ctx->module, is_primitive ? insn->array_type : (intptr_t)insn->classdesc), count};
+  expression newarray = is_primitive ? upcall(wasm_runtime_newarray, "iiii", args)
+                                     : upcall(wasm_runtime_anewarray, "iiii", args);
+  emit(set_stack(ctx->curr_sd - 1, newarray, WASM_TYPE_KIND_INT32));
+
+  newarray = get_stack_slot_of_type(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
+  // Return immediately if null
+  emit(wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, newarray), do_exit(), nullptr,
+                    wasm_void()));
+  emit(reload_oops(ctx->curr_sd - 1));
+}
+
+static int lower_ldc(const bytecode_insn *insn) {
+  DCHECK(insn->kind == insn_ldc);
+
+  cp_entry *ent = insn->cp;
+  if (ent->kind == CP_KIND_STRING) {
+    if (!ent->string.interned)
+      return -1;
+    expression load_string = wasm_i32_const(ctx->module, (intptr_t)&ent->string.interned);
+    load_string = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, load_string, 0, 0);
+    load_string = set_stack(ctx->curr_sd, load_string, WASM_TYPE_KIND_INT32);
+    emit(load_string);
+  } else if (ent->kind == CP_KIND_CLASS) {
+    if (!ent->class_info.vm_object)
+      return -1;
+
+    expression load_class = wasm_i32_const(ctx->module, (intptr_t)&ent->class_info.vm_object);
+    load_class = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, load_class, 0, 0);
+    load_class = set_stack(ctx->curr_sd, load_class, WASM_TYPE_KIND_INT32);
+    emit(load_class);
+  } else {
+    return -1; // resolved by the interpreter
+  }
+  return 0;
 }
 
-static void lower_drem(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_drem);
-  expression right = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_FLOAT64);
-  expression left = get_stack_assert(ctx->curr_sd - 2, WASM_TYPE_KIND_FLOAT64);
+// Arithmetic
+
+EMSCRIPTEN_KEEPALIVE
+float wasm_runtime_frem(float a, float b) { return fmodf(a, b); }
+
+EMSCRIPTEN_KEEPALIVE
+double wasm_runtime_drem(double a, double b) { return fmod(a, b); }
+
+static void lower_frem_drem(const bytecode_insn *insn) {
+  bool is_float = insn->kind == insn_frem;
+  DCHECK(is_float || insn->kind == insn_drem);
+  wasm_value_type type = is_float ? WASM_TYPE_KIND_FLOAT32 : WASM_TYPE_KIND_FLOAT64;
+  expression right = get_stack_assert(ctx->curr_sd - 1, type);
+  expression left = get_stack_assert(ctx->curr_sd - 2, type);
   expression args[2] = {left, right};
-  expression call = upcall(wasm_runtime_frem, "ddd", args);
-  emit(set_stack(ctx->curr_sd - 2, call, WASM_TYPE_KIND_FLOAT64));
+  expression call = is_float ? upcall(wasm_runtime_frem, "fff", args) : upcall(wasm_runtime_drem, "ddd", args);
+  emit(set_stack(ctx->curr_sd - 2, call, type));
 }
 
 EMSCRIPTEN_KEEPALIVE
-static void wasm_runtime_throw_div0(vm_thread *thread) { raise_div0_arithmetic_exception(thread); }
+void wasm_runtime_throw_div0(vm_thread *thread) { raise_div0_arithmetic_exception(thread); }
 
 static void lower_integral_div_rem(const bytecode_insn *insn) {
   bool is_div = insn->kind == insn_ldiv || insn->kind == insn_idiv;
@@ -601,30 +814,34 @@ static void lower_integral_div_rem(const bytecode_insn *insn) {
 
   wasm_value_type type = is_long ? WASM_TYPE_KIND_INT64 : WASM_TYPE_KIND_INT32;
 
-  // Two cases: 0 and INT_MIN / -1. This can be simplified to b == 0 ? div0 : b == -1 ? -a : a / b
   expression right = get_stack_assert(ctx->curr_sd - 1, type);
   expression left = get_stack_assert(ctx->curr_sd - 2, type);
 
   expression div0_args[1] = {thread_param()};
-  expression div0_steps[3] = {spill_oops(0), upcall(wasm_runtime_throw_div0, "vi", div0_args), do_exit()};
+  expression div0_steps[3] = {spill_oops(), upcall(wasm_runtime_throw_div0, "vi", div0_args), do_exit()};
   expression div0 = wasm_block(ctx->module, div0_steps, 3, wasm_void(), false);
-  expression if_zero_div0 =
-      wasm_if_else(ctx->module, wasm_binop(ctx->module, WASM_OP_KIND_I32_EQ, right, wasm_i32_const(ctx->module, 0)),
-                   div0, nullptr, wasm_void());
-
-  wasm_binary_op_kind eq = is_long ? WASM_OP_KIND_I64_EQ : WASM_OP_KIND_I32_EQ;
-  expression denom_is_neg1 =
-      wasm_binop(ctx->module, eq, right, is_long ? wasm_i64_const(ctx->module, -1) : wasm_i32_const(ctx->module, -1));
-  expression negate_numerator =
-      wasm_binop(ctx->module, is_long ? WASM_OP_KIND_I64_SUB : WASM_OP_KIND_I32_SUB,
-                 is_long ? wasm_i64_const(ctx->module, 0) : wasm_i32_const(ctx->module, 0), left);
-  expression do_div = wasm_binop(ctx->module, is_long ? WASM_OP_KIND_I64_DIV_S : WASM_OP_KIND_I32_DIV_S, left, right);
-  expression division =
-      wasm_if_else(ctx->module, denom_is_neg1, negate_numerator, do_div, is_long ? wasm_int64() : wasm_int32());
-  division = set_stack(ctx->curr_sd - 2, division, type);
-
-  emit(if_zero_div0);
-  emit(division);
+  expression is_zero = wasm_unop(ctx->module, is_long ? WASM_OP_KIND_I64_EQZ : WASM_OP_KIND_I32_EQZ, right);
+  emit(wasm_if_else(ctx->module, is_zero, div0, nullptr, wasm_void()));
+
+  expression result;
+  if (is_div) {
+    // INT_MIN / -1 traps in WebAssembly, so b == -1 ? -a : a / b, computed as a / 1 when b == -1
+    expression one = is_long ? wasm_i64_const(ctx->module, 1) : wasm_i32_const(ctx->module, 1);
+    expression neg_one = is_long ? wasm_i64_const(ctx->module, -1) : wasm_i32_const(ctx->module, -1);
+    expression zero = is_long ? wasm_i64_const(ctx->module, 0) : wasm_i32_const(ctx->module, 0);
+    expression denom_is_neg1 =
+        wasm_binop(ctx->module, is_long ? WASM_OP_KIND_I64_EQ : WASM_OP_KIND_I32_EQ, right, neg_one);
+    expression divisor = wasm_select(ctx->module, denom_is_neg1, one, right);
+    expression negate_numerator =
+        wasm_binop(ctx->module, is_long ? WASM_OP_KIND_I64_SUB : WASM_OP_KIND_I32_SUB, zero, left);
+    expression do_div =
+        wasm_binop(ctx->module, is_long ? WASM_OP_KIND_I64_DIV_S : WASM_OP_KIND_I32_DIV_S, left, divisor);
+    result = wasm_select(ctx->module, denom_is_neg1, negate_numerator, do_div);
+  } else {
+    // INT_MIN % -1 is 0 in both Java and WebAssembly
+    result = wasm_binop(ctx->module, is_long ? WASM_OP_KIND_I64_REM_S : WASM_OP_KIND_I32_REM_S, left, right);
+  }
+  emit(set_stack(ctx->curr_sd - 2, result, type));
 }
 
 static void lower_direct_binop(const bytecode_insn *insn) {
@@ -735,22 +952,105 @@ static void lower_i2c(const bytecode_insn *insn) {
   emit(extend);
 }
 
+static void lower_sqrt(const bytecode_insn *insn) {
+  DCHECK(insn->kind == insn_sqrt);
+  wasm_unary_op_kind op = insn->tos_before == TOS_FLOAT ? WASM_OP_KIND_F32_SQRT : WASM_OP_KIND_F64_SQRT;
+  wasm_value_type type = insn->tos_before == TOS_FLOAT ? WASM_TYPE_KIND_FLOAT32 : WASM_TYPE_KIND_FLOAT64;
+  expression value = get_stack_assert(ctx->curr_sd - 1, type);
+  expression sqrt = wasm_unop(ctx->module, op, value);
+  emit(set_stack(ctx->curr_sd - 1, sqrt, type));
+}
+
+EMSCRIPTEN_KEEPALIVE
+double wasm_runtime_sin(double x) { return sin(x); }
+
+EMSCRIPTEN_KEEPALIVE
+double wasm_runtime_cos(double x) { return cos(x); }
+
+EMSCRIPTEN_KEEPALIVE
+double wasm_runtime_tan(double x) { return tan(x); }
+
+EMSCRIPTEN_KEEPALIVE
+double wasm_runtime_pow(double x, double y) { return pow(x, y); }
+
+// The Math intrinsics on doubles; the interpreter handles the rest
+static int lower_math_intrinsic(const bytecode_insn *insn) {
+  if (type_at(ctx->curr_sd - 1) != WASM_TYPE_KIND_FLOAT64)
+    return -1;
+  int sd = ctx->curr_sd;
+  expression result;
+  if (insn->kind == insn_pow) {
+    if (type_at(sd - 2) != WASM_TYPE_KIND_FLOAT64)
+      return -1;
+    expression args[2] = {get_stack(sd - 2), get_stack(sd - 1)};
+    emit(set_stack(sd - 2, upcall(wasm_runtime_pow, "ddd", args), WASM_TYPE_KIND_FLOAT64));
+    return 0;
+  }
+  expression args[1] = {get_stack(sd - 1)};
+  switch (insn->kind) {
+  case insn_sin:
+    result = upcall(wasm_runtime_sin, "dd", args);
+    break;
+  case insn_cos:
+    result = upcall(wasm_runtime_cos, "dd", args);
+    break;
+  case insn_tan:
+    result = upcall(wasm_runtime_tan, "dd", args);
+    break;
+  default:
+    UNREACHABLE();
+  }
+  emit(set_stack(sd - 1, result, WASM_TYPE_KIND_FLOAT64));
+  return 0;
+}
+
+// Arrays
+
 static void lower_arraylength(const bytecode_insn *insn) {
   DCHECK(insn->kind == insn_arraylength);
   expression array = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
-  expression if_npe = wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, array), npe_and_exit(),
-                                   nullptr, wasm_void());
   expression length = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, array, 0, kArrayLengthOffset);
   length = set_stack(ctx->curr_sd - 1, length, WASM_TYPE_KIND_INT32);
-  emit(if_npe);
+  emit(if_null_npe(array));
   emit(length);
 }
 
 EMSCRIPTEN_KEEPALIVE
-static void wasm_runtime_array_oob(vm_thread *thread, int index, int length) {
+void wasm_runtime_array_oob(vm_thread *thread, int index, int length) {
   raise_array_index_oob_exception(thread, index, length);
 }
 
+// All of aastore's checks can throw, and the store needs a write barrier, so it's an upcall. Returns whether an
+// exception was thrown.
+EMSCRIPTEN_KEEPALIVE
+bool wasm_runtime_aastore(vm_thread *thread, obj_header *array, s32 index, obj_header *value) {
+  if (!array) {
+    raise_null_pointer_exception(thread);
+    return true;
+  }
+  int length = ArrayLength(array);
+  if (index < 0 || index >= length) {
+    raise_array_index_oob_exception(thread, index, length);
+    return true;
+  }
+  if (value && !instanceof(obj_class(value), obj_class(array)->one_fewer_dim)) {
+    raise_array_store_exception(thread, obj_class(value)->name);
+    return true;
+  }
+  ReferenceArrayStore(array, index, value);
+  gc_write_barrier(thread->vm, array);
+  return false;
+}
+
+static void lower_aastore(const bytecode_insn *insn) {
+  DCHECK(insn->kind == insn_aastore);
+  int sd = ctx->curr_sd;
+  expression args[4] = {thread_param(), get_stack_assert(sd - 3, WASM_TYPE_KIND_INT32),
+                        get_stack_assert(sd - 2, WASM_TYPE_KIND_INT32), get_stack_assert(sd - 1, WASM_TYPE_KIND_INT32)};
+  emit(spill_oops());
+  emit(wasm_if_else(ctx->module, upcall(wasm_runtime_aastore, "iiiii", args), do_exit(), nullptr, wasm_void()));
+}
+
 static void lower_array_load_store(const bytecode_insn *insn) {
   wasm_load_op_kind load_op;
   wasm_store_op_kind store_op;
@@ -781,7 +1081,6 @@ static void lower_array_load_store(const bytecode_insn *insn) {
     data_type = TYPE_KIND_DOUBLE;
     break;
   case insn_aaload:
-  case insn_aastore:
     load_op = WASM_OP_KIND_I32_LOAD;
     store_op = WASM_OP_KIND_I32_STORE;
     data_type = TYPE_KIND_REFERENCE;
@@ -814,13 +1113,11 @@ static void lower_array_load_store(const bytecode_insn *insn) {
 
   expression array = get_stack_assert(ctx->curr_sd - 2 - !is_load, WASM_TYPE_KIND_INT32);
   expression index = get_stack_assert(ctx->curr_sd - 1 - !is_load, WASM_TYPE_KIND_INT32);
-  expression null_check = wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, array), npe_and_exit(),
-                                       nullptr, wasm_void());
 
   expression length = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, array, 0, kArrayLengthOffset);
 
   expression oob_args[3] = {thread_param(), index, length};
-  expression oob_steps[3] = {spill_oops(0), upcall(wasm_runtime_array_oob, "viii", oob_args), do_exit()};
+  expression oob_steps[3] = {spill_oops(), upcall(wasm_runtime_array_oob, "viii", oob_args), do_exit()};
 
   expression oob_block = wasm_block(ctx->module, oob_steps, 3, wasm_void(), false);
   expression index_check =
@@ -831,197 +1128,149 @@ static void lower_array_load_store(const bytecode_insn *insn) {
   expression addr = wasm_binop(ctx->module, WASM_OP_KIND_I32_ADD, array,
                                wasm_binop(ctx->module, WASM_OP_KIND_I32_MUL, index, size_bytes));
 
-  emit(null_check);
+  emit(if_null_npe(array));
   emit(index_check);
   if (is_load) {
     expression load = wasm_load(ctx->module, load_op, addr, 0, kArrayDataOffset);
     load = set_stack(ctx->curr_sd - 2, load, to_wasm_type(data_type));
     emit(load);
   } else {
-    expression value = get_stack_assert(ctx->curr_sd - 3, to_wasm_type(data_type));
-    // TODO ArrayStoreException
+    expression value = get_stack_assert(ctx->curr_sd - 1, to_wasm_type(data_type));
     emit(wasm_store(ctx->module, store_op, addr, value, 0, kArrayDataOffset));
   }
 }
 
-static void lower_fused_compare(const bytecode_insn *insn) {
+// Branches
+
+static bool is_fused_compare_branch(insn_code_kind kind) {
+  return kind == insn_iflt || kind == insn_ifge || kind == insn_ifgt || kind == insn_ifle || kind == insn_ifeq ||
+         kind == insn_ifne;
+}
+
+// A comparison which is true exactly when the outcome of comparing a and b is in the given set (never for NaNs)
+static wasm_binary_op_kind comparison_for(bool lt, bool eq, bool gt, insn_code_kind compare) {
+  static const wasm_binary_op_kind ops[3][6] = {
+      {WASM_OP_KIND_F32_EQ, WASM_OP_KIND_F32_NE, WASM_OP_KIND_F32_LT, WASM_OP_KIND_F32_GT, WASM_OP_KIND_F32_LE,
+       WASM_OP_KIND_F32_GE},
+      {WASM_OP_KIND_F64_EQ, WASM_OP_KIND_F64_NE, WASM_OP_KIND_F64_LT, WASM_OP_KIND_F64_GT, WASM_OP_KIND_F64_LE,
+       WASM_OP_KIND_F64_GE},
+      {WASM_OP_KIND_I64_EQ, WASM_OP_KIND_I64_NE, WASM_OP_KIND_I64_LT_S, WASM_OP_KIND_I64_GT_S, WASM_OP_KIND_I64_LE_S,
+       WASM_OP_KIND_I64_GE_S},
+  };
+  int type = compare == insn_fcmpg || compare == insn_fcmpl ? 0 : compare == insn_lcmp ? 2 : 1;
+  int which = lt && gt ? 1 : lt && eq ? 4 : gt && eq ? 5 : lt ? 2 : gt ? 3 : 0;
+  // F32_NE and F64_NE are true for NaNs, but they're never needed: {lt, gt} always includes the unordered outcome
+  DCHECK(which != 1 || type == 2);
+  return ops[type][which];
+}
+
+// lcmp, fcmp<op> or dcmp<op> followed by if<cond>, which is compiled as one comparison and branch. Returns 1 (the
+// branch has been compiled too) or -1 (deoptimize) if they can't be fused.
+static int lower_fused_compare(const bytecode_insn *insn) {
   // fcmpg(a, b): a > b ? 1 : (a < b ? -1 : (a == b ? 0 : 1))
   // fcmpl(a, b): a > b ? 1 : (a < b ? -1 : (a == b ? 0 : -1))
   // Hence fcmpg returns 1 on NaN and fcmpl returns -1 on NaN.
   // For float compares we need to decide 1. which comparison to use and 2. whether to flip the branches, because
   // !(a >= b) is not equivalent to a < b in the presence of NaNs.
-
   bool fp_compare =
-      insn->kind == insn_fcmpg || insn->kind == insn_fcmpl || insn->kind == insn_dcmpg || insn->kind == insn_dcmpl;
-  DCHECK(fp_compare || insn->kind == insn_lcmp);
-
-  const bytecode_insn *branch = insn + 1;
-  CHECK(branch->kind == insn_iflt || branch->kind == insn_ifge || branch->kind == insn_ifgt ||
-        branch->kind == insn_ifle || branch->kind == insn_ifeq || branch->kind == insn_ifne);
-
-  bool taken_a_lt_b = branch->kind == insn_iflt || branch->kind == insn_ifle || branch->kind == insn_ifeq;
-  bool taken_a_eq_b = branch->kind == insn_ifeq || branch->kind == insn_ifge || branch->kind == insn_ifle;
-  bool taken_a_gt_b = branch->kind == insn_ifgt || branch->kind == insn_ifge || branch->kind == insn_ifne;
-  bool taken_unordered = (branch->kind == insn_fcmpg || branch->kind == insn_dcmpg) ? taken_a_gt_b : taken_a_lt_b;
-
-  // Based on this table we can then select the right operation and branch ordering. Because all comparisons are false
-  // when at least one operand is NaN, the branches have to be flipped iff taken_unordered is true.
-  if (taken_unordered) { // swap to account for the branches which will be flipped
-    int tmp = taken_a_lt_b;
-    taken_a_lt_b = taken_a_gt_b;
-    taken_a_gt_b = tmp;
-  }
-
-  wasm_binary_op_kind op;
-  if (taken_a_lt_b && taken_a_eq_b) { // we'll adjust f32 compares to f64 compares
-    op = fp_compare ? WASM_OP_KIND_F32_LE : WASM_OP_KIND_I64_LE_S;
-  } else if (taken_a_lt_b && !taken_a_eq_b) {
-    op = fp_compare ? WASM_OP_KIND_F32_LT : WASM_OP_KIND_I64_LT_S;
-  } else if (taken_a_gt_b && taken_a_eq_b) {
-    op = fp_compare ? WASM_OP_KIND_F32_GE : WASM_OP_KIND_I64_GE_S;
-  } else if (taken_a_gt_b && !taken_a_eq_b) {
-    op = fp_compare ? WASM_OP_KIND_F32_GT : WASM_OP_KIND_I64_GT_S;
-  } else if (taken_a_eq_b) {
-    op = fp_compare ? WASM_OP_KIND_F32_EQ : WASM_OP_KIND_I64_EQ;
-  } else {
-    op = fp_compare ? WASM_OP_KIND_F32_NE : WASM_OP_KIND_I64_NE;
-  }
-
-  if (fp_compare && (insn->kind == insn_dcmpg || insn->kind == insn_dcmpl)) {
-    // Adjust the operation to use f64 instead of f32
-    op += WASM_OP_KIND_F64_EQ - WASM_OP_KIND_F32_EQ;
-  }
-
-  expression cmp = wasm_binop(ctx->module, op, get_stack(ctx->curr_sd - 2), get_stack(ctx->curr_sd - 1));
-  expression taken = branch_target(insn->index);
-  expression not_taken = branch_target(ctx->curr_pc + 2);
-  if (taken_unordered) {
-    expression tmp = taken;
-    taken = not_taken;
-    not_taken = tmp;
-  }
-  emit(wasm_br(ctx->module, cmp, taken));
-  emit(wasm_br(ctx->module, nullptr, not_taken));
-}
-
-EMSCRIPTEN_KEEPALIVE
-static bool wasm_runtime_checkcast(vm_thread *thread, object o, classdesc *cd) {
-  if (o == nullptr || instanceof(o->descriptor, cd))
-    return false;
-  raise_class_cast_exception(thread, o->descriptor, cd);
-  return true;
-}
-
-static void lower_checkcast_resolved(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_checkcast_resolved); // instanceof(obj->descriptor, insn->classdesc)
-  expression receiver = get_stack(ctx->curr_sd - 1);
-  expression args[3] = {thread_param(), receiver, wasm_i32_const(ctx->module, (intptr_t)insn->classdesc)};
-  expression check = upcall(wasm_runtime_checkcast, "iiii", args);
-  check = wasm_if_else(ctx->module, check, do_exit(), nullptr, wasm_void());
-  emit(spill_oops(0));
-  emit(check);
-}
-
-static int lower_ldc(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_ldc);
-
-  cp_entry *ent = insn->cp;
-  if (ent->kind == CP_KIND_STRING) {
-    if (!ent->string.interned)
-      return -1;
-    expression load_string = wasm_i32_const(ctx->module, (intptr_t)&ent->string.interned);
-    load_string = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, load_string, 0, 0);
-    load_string = set_stack(ctx->curr_sd, load_string, WASM_TYPE_KIND_INT32);
-    emit(load_string);
-  } else if (ent->kind == CP_KIND_CLASS) {
-    if (!ent->class_info.vm_object)
-      return -1;
-
-    expression load_class = wasm_i32_const(ctx->module, (intptr_t)&ent->class_info.vm_object);
-    load_class = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, load_class, 0, 0);
-    load_class = set_stack(ctx->curr_sd, load_class, WASM_TYPE_KIND_INT32);
-    emit(load_class);
-  }
-  return 0;
-}
-
-static void lower_constant(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_aconst_null || insn->kind == insn_iconst || insn->kind == insn_dconst ||
-         insn->kind == insn_fconst || insn->kind == insn_lconst);
-  switch (insn->kind) {
-  case insn_aconst_null:
-    emit(set_stack(ctx->curr_sd, wasm_i32_const(ctx->module, 0), WASM_TYPE_KIND_INT32));
-    break;
-  case insn_iconst:
-    emit(set_stack(ctx->curr_sd, wasm_i32_const(ctx->module, (int)insn->integer_imm), WASM_TYPE_KIND_INT32));
-    break;
-  case insn_lconst:
-    emit(set_stack(ctx->curr_sd, wasm_i64_const(ctx->module, insn->integer_imm), WASM_TYPE_KIND_INT64));
-    break;
-  case insn_fconst:
-    emit(set_stack(ctx->curr_sd, wasm_f32_const(ctx->module, insn->f_imm), WASM_TYPE_KIND_FLOAT32));
-    break;
-  case insn_dconst:
-    emit(set_stack(ctx->curr_sd, wasm_f64_const(ctx->module, insn->d_imm), WASM_TYPE_KIND_FLOAT64));
-    break;
-  default:
-    UNREACHABLE();
-  }
-}
-
-static void lower_return(const bytecode_insn *insn) {
-  switch (insn->kind) {
-  case insn_return:
-    emit(do_exit());
-    break;
-  default:
-    emit(wasm_return(ctx->module, get_stack(ctx->curr_sd - 1)));
-    break;
-  }
-}
+      insn->kind == insn_fcmpg || insn->kind == insn_fcmpl || insn->kind == insn_dcmpg || insn->kind == insn_dcmpl;
+  DCHECK(fp_compare || insn->kind == insn_lcmp);
 
-static void lower_athrow(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_athrow);
-  expression exception = get_stack(ctx->curr_sd - 1);
-  // Store to thread->current_exception
-  expression store_exception = wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, thread_param(), exception, 0,
-                                          offsetof(vm_thread, current_exception));
-  emit(store_exception);
+  if (ctx->curr_pc + 1 >= ctx->bb_end)
+    return -1;
+  const bytecode_insn *branch = insn + 1;
+  insn_code_kind branch_kind = unfused_insn_kind(branch->kind);
+  if (!is_fused_compare_branch(branch_kind))
+    return -1;
+
+  // Which outcomes of the comparison take the branch
+  bool lt = branch_kind == insn_iflt || branch_kind == insn_ifle || branch_kind == insn_ifne;
+  bool eq = branch_kind == insn_ifeq || branch_kind == insn_ifge || branch_kind == insn_ifle;
+  bool gt = branch_kind == insn_ifgt || branch_kind == insn_ifge || branch_kind == insn_ifne;
+  bool g_variant = insn->kind == insn_fcmpg || insn->kind == insn_dcmpg;
+  bool taken_unordered = fp_compare && (g_variant ? gt : lt);
+
+  expression left = get_stack(ctx->curr_sd - 2), right = get_stack(ctx->curr_sd - 1);
+  int taken = branch->index, not_taken = ctx->curr_pc + 2;
+  // Comparisons are false when at least one operand is NaN, so if NaNs take the branch, test for the outcomes which
+  // don't, and flip the branches.
+  if (taken_unordered) {
+    expression cmp = wasm_binop(ctx->module, comparison_for(!lt, !eq, !gt, insn->kind), left, right);
+    emit_cond_branch(cmp, not_taken, taken);
+  } else {
+    expression cmp = wasm_binop(ctx->module, comparison_for(lt, eq, gt, insn->kind), left, right);
+    emit_cond_branch(cmp, taken, not_taken);
+  }
+  return 1;
 }
 
-static void lower_stack_manipulation(const bytecode_insn *insn) {
-  int sd = ctx->curr_sd;
-  switch (insn->kind) {
-  case insn_dup:
-    //   A    B   ->    A    B    B
-    // sp-2 sp-1  ->  sp-2 sp-1  sp
-    emit(set_stack(sd, get_stack(sd - 1), type_at(sd - 1)));
-    break;
-  case insn_dup2:
-    //   A    B   ->    A    B    A   B
-    // sp-2 sp-1  ->  sp-2 sp-1 sp  sp+1
-    emit(set_stack(sd, get_stack(sd - 2), type_at(sd - 2)));
-    emit(set_stack(sd + 1, get_stack(sd - 1), type_at(sd - 1)));
-    break;
-  case insn_dup_x1:
-    //   A    B   ->    B    A    B
-    // sp-2 sp-1  ->  sp-2 sp-1  sp
-    emit(set_stack(sd, get_stack(sd - 1), type_at(sd - 1)));
-    emit(set_stack(sd - 1, get_stack(sd - 2), type_at(sd - 2)));
-    emit(set_stack(sd - 2, get_stack_slot_of_type(sd, type_at(sd - 1)), type_at(sd - 1)));
-    break;
-  case insn_dup_x2:
-    //   A    B    C  ->   C    A      B     C
-    // sp-3 sp-2 sp-1 -> sp-3 sp-2  sp-1  sp+1
-    break; //  TODO
-  default:
-    UNREACHABLE();
+EMSCRIPTEN_KEEPALIVE
+s32 wasm_runtime_lookupswitch(const struct lookupswitch_data *data, s32 key) { return lookupswitch_target(data, key); }
+
+// Uses the strategy that analysis chose for the interpreter, since we don't emit br_table (yet)
+static void lower_lookupswitch(const bytecode_insn *insn) {
+  const struct lookupswitch_data *data = insn->lookupswitch;
+  int sd = ctx->curr_sd - 1;
+  if (data->strategy == LOOKUPSWITCH_LINEAR) {
+    for (int i = 0; i < data->keys_count; ++i) {
+      expression key = get_stack_assert(sd, WASM_TYPE_KIND_INT32);
+      expression cmp = wasm_binop(ctx->module, WASM_OP_KIND_I32_EQ, key, wasm_i32_const(ctx->module, data->keys[i]));
+      emit(wasm_br(ctx->module, cmp, branch_target(data->targets[i])));
+    }
+  } else {
+    // Replace the key with the target's instruction index, then branch on that
+    expression args[2] = {wasm_i32_const(ctx->module, (int)(intptr_t)data), get_stack_assert(sd, WASM_TYPE_KIND_INT32)};
+    emit(set_stack(sd, upcall(wasm_runtime_lookupswitch, "iii", args), WASM_TYPE_KIND_INT32));
+    for (int i = 0; i < data->targets_count; ++i) {
+      bool seen = false;
+      for (int j = 0; j < i && !seen; ++j)
+        seen = data->targets[j] == data->targets[i];
+      if (seen || data->targets[i] == data->default_target)
+        continue;
+      expression target = get_stack_assert(sd, WASM_TYPE_KIND_INT32);
+      expression cmp =
+          wasm_binop(ctx->module, WASM_OP_KIND_I32_EQ, target, wasm_i32_const(ctx->module, data->targets[i]));
+      emit(wasm_br(ctx->module, cmp, branch_target(data->targets[i])));
+    }
+  }
+  emit_goto(data->default_target);
+}
+
+static void lower_tableswitch(const bytecode_insn *insn) {
+  const struct tableswitch_data *data = insn->tableswitch;
+  int sd = ctx->curr_sd - 1;
+  // Replace the key with its (unsigned) index into the table
+  expression key = get_stack_assert(sd, WASM_TYPE_KIND_INT32);
+  expression index = wasm_binop(ctx->module, WASM_OP_KIND_I32_SUB, key, wasm_i32_const(ctx->module, data->low));
+  emit(set_stack(sd, index, WASM_TYPE_KIND_INT32));
+  for (int i = 0; i < data->targets_count; ++i) {
+    if (data->targets[i] == data->default_target)
+      continue;
+    index = get_stack_slot_of_type(sd, WASM_TYPE_KIND_INT32);
+    expression cmp = wasm_binop(ctx->module, WASM_OP_KIND_I32_EQ, index, wasm_i32_const(ctx->module, i));
+    emit(wasm_br(ctx->module, cmp, branch_target(data->targets[i])));
   }
+  emit_goto(data->default_target);
 }
 
 static void lower_branch(const bytecode_insn *insn) {
   if (insn->kind == insn_goto) {
-    emit(wasm_br(ctx->module, nullptr, branch_target(insn->index)));
+    emit_goto(insn->index);
+    return;
+  }
+  if (insn->kind == insn_lookupswitch) {
+    lower_lookupswitch(insn);
+    return;
+  }
+  if (insn->kind == insn_tableswitch) {
+    lower_tableswitch(insn);
+    return;
+  }
+  if (insn->kind == insn_ifnull || insn->kind == insn_ifnonnull) {
+    expression value = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
+    if (insn->kind == insn_ifnull)
+      value = wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, value);
+    emit_cond_branch(value, insn->index, ctx->curr_pc + 1);
     return;
   }
   wasm_binary_op_kind op;
@@ -1069,16 +1318,78 @@ static void lower_branch(const bytecode_insn *insn) {
     UNREACHABLE();
   }
 
-  // Get top two ints from the stack
-  expression right = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
-  expression left =
-      lhs_zero ? wasm_i32_const(ctx->module, 0) : get_stack_assert(ctx->curr_sd - 2, WASM_TYPE_KIND_INT32);
+  // if<cond> compares the top of the stack with 0, and if_icmp<cond> compares the top two ints
+  expression right =
+      lhs_zero ? wasm_i32_const(ctx->module, 0) : get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
+  expression left = get_stack_assert(ctx->curr_sd - 1 - !lhs_zero, WASM_TYPE_KIND_INT32);
   expression cmp = wasm_binop(ctx->module, op, left, right);
-  emit(wasm_br(ctx->module, cmp, branch_target((int)insn->index)));
-  emit(wasm_br(ctx->module, nullptr, branch_target(ctx->curr_pc + 1)));
+  emit_cond_branch(cmp, insn->index, ctx->curr_pc + 1);
+}
+
+// Whether execution can continue with the following instruction
+static bool falls_through(insn_code_kind kind) {
+  switch (kind) {
+  case insn_goto:
+  case insn_if_acmpeq:
+  case insn_if_acmpne:
+  case insn_if_icmpeq:
+  case insn_if_icmpne:
+  case insn_if_icmplt:
+  case insn_if_icmpge:
+  case insn_if_icmpgt:
+  case insn_if_icmple:
+  case insn_ifeq:
+  case insn_ifne:
+  case insn_iflt:
+  case insn_ifge:
+  case insn_ifgt:
+  case insn_ifle:
+  case insn_ifnonnull:
+  case insn_ifnull:
+  case insn_tableswitch:
+  case insn_lookupswitch:
+  case insn_areturn:
+  case insn_dreturn:
+  case insn_freturn:
+  case insn_ireturn:
+  case insn_lreturn:
+  case insn_return:
+  case insn_athrow:
+    return false;
+  default:
+    return true;
+  }
+}
+
+// Fields
+
+EMSCRIPTEN_KEEPALIVE
+void wasm_runtime_write_barrier(vm_thread *thread, obj_header *holder) { gc_write_barrier(thread->vm, holder); }
+
+// gc_write_barrier, with the common case (marking a card) inline
+static expression write_barrier(expression holder) {
+  expression the_vm = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, thread_param(), 0, offsetof(vm_thread, vm));
+  expression heap = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, the_vm, 0, offsetof(vm, heap));
+  expression offset = wasm_binop(ctx->module, WASM_OP_KIND_I32_SUB, holder, heap);
+
+  expression young_start = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, the_vm, 0, offsetof(vm, young_start));
+  expression card_table = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, the_vm, 0, offsetof(vm, card_table));
+  expression card = wasm_binop(ctx->module, WASM_OP_KIND_I32_ADD, card_table,
+                               wasm_binop(ctx->module, WASM_OP_KIND_I32_DIV_U, offset,
+                                          wasm_i32_const(ctx->module, CARD_BYTES)));
+  expression mark = wasm_store(ctx->module, WASM_OP_KIND_I32_STORE8, card, wasm_i32_const(ctx->module, 1), 0, 0);
+
+  // Large objects live outside the heap
+  expression heap_capacity = wasm_load(ctx->module, WASM_OP_KIND_I32_LOAD, the_vm, 0, offsetof(vm, heap_capacity));
+  expression slow_args[2] = {thread_param(), holder};
+  expression slow = wasm_if_else(ctx->module, wasm_binop(ctx->module, WASM_OP_KIND_I32_GE_U, offset, heap_capacity),
+                                 upcall(wasm_runtime_write_barrier, "vii", slow_args), nullptr, wasm_void());
+
+  return wasm_if_else(ctx->module, wasm_binop(ctx->module, WASM_OP_KIND_I32_LT_U, offset, young_start), mark, slow,
+                      wasm_void());
 }
 
-void lower_get_put_resolved(const bytecode_insn *insn) {
+static void lower_get_put_resolved(const bytecode_insn *insn) {
   wasm_load_op_kind load_op;
   wasm_store_op_kind store_op;
   type_kind type;
@@ -1099,6 +1410,14 @@ void lower_get_put_resolved(const bytecode_insn *insn) {
     store_op = WASM_OP_KIND_I32_STORE8;
     type = TYPE_KIND_BYTE;
     break;
+  case insn_getfield_Z:
+  case insn_putfield_Z:
+  case insn_getstatic_Z:
+  case insn_putstatic_Z:
+    load_op = WASM_OP_KIND_I32_LOAD8_U;
+    store_op = WASM_OP_KIND_I32_STORE8;
+    type = TYPE_KIND_BOOLEAN;
+    break;
   case insn_getfield_C:
   case insn_putfield_C:
   case insn_getstatic_C:
@@ -1161,9 +1480,7 @@ void lower_get_put_resolved(const bytecode_insn *insn) {
   int offset;
   if (is_putfield || is_getfield) {
     expression receiver = get_stack_assert(ctx->curr_sd - 1 - is_putfield, WASM_TYPE_KIND_INT32);
-    expression if_null_npe = wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, receiver),
-                                          npe_and_exit(), nullptr, wasm_void());
-    emit(if_null_npe);
+    emit(if_null_npe(receiver));
     addr = receiver;
     offset = (int)(intptr_t)insn->ic2;
   } else {
@@ -1173,123 +1490,163 @@ void lower_get_put_resolved(const bytecode_insn *insn) {
 
   if (is_putfield || is_putstatic) {
     emit(wasm_store(ctx->module, store_op, addr, get_stack(ctx->curr_sd - 1), 0, offset));
+    if (is_putfield && type == TYPE_KIND_REFERENCE) {
+      emit(write_barrier(get_stack(ctx->curr_sd - 2)));
+    }
   } else {
     int store_to = is_getstatic ? ctx->curr_sd : ctx->curr_sd - 1 - is_putfield;
     emit(set_stack(store_to, wasm_load(ctx->module, load_op, addr, 0, offset), to_wasm_type(type)));
   }
 }
 
-void lower_iinc(const bytecode_insn *insn) {
+// Locals, constants and the operand stack
+
+static void lower_iinc(const bytecode_insn *insn) {
   expression expr = get_local(insn->iinc.index);
   expr = wasm_binop(ctx->module, WASM_OP_KIND_I32_ADD, expr, wasm_i32_const(ctx->module, insn->iinc.const_));
   emit(set_local(insn->iinc.index, expr, WASM_TYPE_KIND_INT32));
 }
 
-void lower_local_load(const bytecode_insn *insn) {
-  wasm_value_type type;
-  switch (insn->kind) {
+static wasm_value_type local_insn_type(insn_code_kind kind) {
+  switch (kind) {
   case insn_dload:
-    type = WASM_TYPE_KIND_FLOAT64;
-    break;
+  case insn_dstore:
+    return WASM_TYPE_KIND_FLOAT64;
   case insn_fload:
-    type = WASM_TYPE_KIND_FLOAT32;
-    break;
+  case insn_fstore:
+    return WASM_TYPE_KIND_FLOAT32;
   case insn_iload:
-    type = WASM_TYPE_KIND_INT32;
-    break;
+  case insn_istore:
+  case insn_aload:
+  case insn_astore:
+    return WASM_TYPE_KIND_INT32;
   case insn_lload:
-    type = WASM_TYPE_KIND_INT64;
-    break;
+  case insn_lstore:
+    return WASM_TYPE_KIND_INT64;
   default:
     UNREACHABLE();
   }
-  emit(set_stack(ctx->curr_sd, get_local(insn->index), type));
 }
 
-void lower_local_store(const bytecode_insn *insn) {
-  wasm_value_type type;
+static void lower_local_load(const bytecode_insn *insn) {
+  emit(set_stack(ctx->curr_sd, get_local(insn->index), local_insn_type(insn->kind)));
+}
+
+static void lower_local_store(const bytecode_insn *insn) {
+  emit(set_local(insn->index, get_stack(ctx->curr_sd - 1), local_insn_type(insn->kind)));
+}
+
+static void lower_constant(const bytecode_insn *insn) {
+  DCHECK(insn->kind == insn_aconst_null || insn->kind == insn_iconst || insn->kind == insn_dconst ||
+         insn->kind == insn_fconst || insn->kind == insn_lconst);
   switch (insn->kind) {
-  case insn_dstore:
-    type = WASM_TYPE_KIND_FLOAT64;
+  case insn_aconst_null:
+    emit(set_stack(ctx->curr_sd, wasm_i32_const(ctx->module, 0), WASM_TYPE_KIND_INT32));
     break;
-  case insn_fstore:
-    type = WASM_TYPE_KIND_FLOAT32;
+  case insn_iconst:
+    emit(set_stack(ctx->curr_sd, wasm_i32_const(ctx->module, (int)insn->integer_imm), WASM_TYPE_KIND_INT32));
     break;
-  case insn_istore:
-    type = WASM_TYPE_KIND_INT32;
+  case insn_lconst:
+    emit(set_stack(ctx->curr_sd, wasm_i64_const(ctx->module, insn->integer_imm), WASM_TYPE_KIND_INT64));
     break;
-  case insn_lstore:
-    type = WASM_TYPE_KIND_INT64;
+  case insn_fconst:
+    emit(set_stack(ctx->curr_sd, wasm_f32_const(ctx->module, insn->f_imm), WASM_TYPE_KIND_FLOAT32));
+    break;
+  case insn_dconst:
+    emit(set_stack(ctx->curr_sd, wasm_f64_const(ctx->module, insn->d_imm), WASM_TYPE_KIND_FLOAT64));
     break;
   default:
     UNREACHABLE();
   }
-  emit(set_local(insn->index, get_stack(ctx->curr_sd - 1), type));
 }
 
-EMSCRIPTEN_KEEPALIVE
-obj_header *wasm_runtime_newarray(vm_thread *thread, type_kind array_type, s32 count) {
-  if (unlikely(count < 0)) {
-    raise_negative_array_size_exception(thread, count);
-    return nullptr;
+static void lower_return(const bytecode_insn *insn) {
+  if (insn->kind == insn_return) {
+    emit(do_exit());
+    return;
   }
-  obj_header *array = CreatePrimitiveArray1D(thread, array_type, count);
-  return array;
+  expression steps[2] = {pop_frame_expr(), wasm_return(ctx->module, get_stack(ctx->curr_sd - 1))};
+  emit(wasm_block(ctx->module, steps, 2, wasm_void(), false));
 }
 
-void lower_newarray(const bytecode_insn *insn) {
-  emit(spill_oops(0));
-  expression count = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
-  expression args[3] = {thread_param(), wasm_i32_const(ctx->module, insn->array_type), count};
-  expression newarray = upcall(wasm_runtime_newarray, "iiii", args);
-  emit(set_stack(ctx->curr_sd - 1, newarray, WASM_TYPE_KIND_INT32));
-
-  newarray = get_stack_slot_of_type(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
-  // Return immediately if null
-  emit(wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, newarray), do_exit(), nullptr,
-                    wasm_void()));
+static void lower_athrow(const bytecode_insn *insn) {
+  DCHECK(insn->kind == insn_athrow);
+  expression exception = get_stack(ctx->curr_sd - 1);
+  emit(if_null_npe(exception));
+  // Store to thread->current_exception. Methods with exception handlers aren't compiled, so it propagates to the
+  // caller.
+  emit(wasm_store(ctx->module, WASM_OP_KIND_I32_STORE, thread_param(), exception, 0,
+                  offsetof(vm_thread, current_exception)));
+  emit(do_exit());
 }
 
-EMSCRIPTEN_KEEPALIVE
-obj_header *wasm_runtime_anewarray(vm_thread *thread, classdesc *type, s32 count) {
-  if (count < 0) {
-    raise_negative_array_size_exception(thread, count);
-    return nullptr;
+static void lower_stack_manipulation(const bytecode_insn *insn) {
+  // The analysis simplifies the forms acting on longs and doubles as if they took one slot. Each form takes the top
+  // `inputs` slots and replaces them with the given sequence of them (0 = the deepest input).
+  int inputs;
+  const char *outputs;
+  switch (insn->kind) {
+  case insn_pop:
+  case insn_pop2:
+    return;
+  case insn_dup:
+    inputs = 1, outputs = "00";
+    break;
+  case insn_dup_x1:
+    inputs = 2, outputs = "101";
+    break;
+  case insn_dup_x2:
+    inputs = 3, outputs = "2012";
+    break;
+  case insn_dup2:
+    inputs = 2, outputs = "0101";
+    break;
+  case insn_dup2_x1:
+    inputs = 3, outputs = "12012";
+    break;
+  case insn_dup2_x2:
+    inputs = 4, outputs = "230123";
+    break;
+  case insn_swap:
+    inputs = 2, outputs = "10";
+    break;
+  default:
+    UNREACHABLE();
   }
-  obj_header *array = CreateObjectArray1D(thread, type, count);
-  return array;
-}
-
-void lower_anewarray_resolved(const bytecode_insn *insn) {
-  emit(spill_oops(0));
-  expression count = get_stack_assert(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
-  expression args[3] = {thread_param(), wasm_i32_const(ctx->module, (intptr_t)insn->classdesc), count};
-  expression newarray = upcall(wasm_runtime_anewarray, "iiii", args);
-  emit(set_stack(ctx->curr_sd - 1, newarray, WASM_TYPE_KIND_INT32));
 
-  newarray = get_stack_slot_of_type(ctx->curr_sd - 1, WASM_TYPE_KIND_INT32);
-  // Return immediately if null
-  emit(wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, newarray), do_exit(), nullptr,
-                    wasm_void()));
-}
-
-void lower_sqrt(const bytecode_insn *insn) {
-  DCHECK(insn->kind == insn_sqrt);
-  wasm_unary_op_kind op = insn->tos_before == TOS_FLOAT ? WASM_OP_KIND_F32_SQRT : WASM_OP_KIND_F64_SQRT;
-  wasm_value_type type = insn->tos_before == TOS_FLOAT ? WASM_TYPE_KIND_FLOAT32 : WASM_TYPE_KIND_FLOAT64;
-  expression value = get_stack_assert(ctx->curr_sd - 1, type);
-  expression sqrt = wasm_unop(ctx->module, op, value);
-  emit(set_stack(ctx->curr_sd - 1, sqrt, type));
+  int base = ctx->curr_sd - inputs;
+  int temps[4];
+  wasm_value_type types[4];
+  for (int i = 0; i < inputs; ++i) {
+    types[i] = type_at(base + i);
+    temps[i] = fb_new_local(&ctx->fb, types[i]);
+    emit(wasm_local_set(ctx->module, temps[i], get_stack(base + i)));
+  }
+  for (int i = 0; outputs[i]; ++i) {
+    int from = outputs[i] - '0';
+    expression value = wasm_local_get(ctx->module, temps[from], (wasm_type){.val = types[from]});
+    emit(set_stack(base + i, value, types[from]));
+  }
 }
 
+// Returns -1 if the rest of the basic block must be left to the interpreter (a deopt has been emitted), otherwise
+// the number of following instructions that were compiled along with this one.
 static int lower_instruction(const bytecode_insn *insn) {
+  if (unfused_insn_kind(insn->kind) != insn->kind) {
+    // Superinstructions only help the interpreter; compile the instruction it began as
+    bytecode_insn unfused = *insn;
+    unfused.kind = unfused_insn_kind(insn->kind);
+    return lower_instruction(&unfused);
+  }
   switch (insn->kind) {
   default:
-    UNREACHABLE();
+    break;
   case insn_nop:
-    UNREACHABLE();
-  case insn_aaload:
+    return 0;
   case insn_aastore:
+    lower_aastore(insn);
+    return 0;
+  case insn_aaload:
   case insn_baload:
   case insn_bastore:
   case insn_caload:
@@ -1307,6 +1664,10 @@ static int lower_instruction(const bytecode_insn *insn) {
     lower_array_load_store(insn);
     return 0;
   case insn_aconst_null:
+  case insn_iconst:
+  case insn_dconst:
+  case insn_fconst:
+  case insn_lconst:
     lower_constant(insn);
     return 0;
   case insn_areturn:
@@ -1334,7 +1695,6 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_i2f:
   case insn_i2l:
   case insn_i2s:
-  case insn_ior:
   case insn_l2d:
   case insn_l2f:
   case insn_l2i:
@@ -1345,6 +1705,13 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_sqrt:
     lower_sqrt(insn);
     return 0;
+  case insn_sin:
+  case insn_cos:
+  case insn_tan:
+  case insn_pow:
+    if (lower_math_intrinsic(insn))
+      break;
+    return 0;
   case insn_dadd:
   case insn_ddiv:
   case insn_dmul:
@@ -1354,7 +1721,9 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_fmul:
   case insn_fsub:
   case insn_iadd:
+  case insn_iand:
   case insn_imul:
+  case insn_ior:
   case insn_ishl:
   case insn_ishr:
   case insn_isub:
@@ -1372,11 +1741,15 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_dcmpl:
   case insn_fcmpg:
   case insn_fcmpl:
-  case insn_lcmp:
-    lower_fused_compare(insn);
-    return 0;
+  case insn_lcmp: {
+    int compiled = lower_fused_compare(insn);
+    if (compiled < 0)
+      break;
+    return compiled;
+  }
+  case insn_frem:
   case insn_drem:
-    lower_drem(insn);
+    lower_frem_drem(insn);
     return 0;
   case insn_dup:
   case insn_dup_x1:
@@ -1389,9 +1762,6 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_pop2:
     lower_stack_manipulation(insn);
     return 0;
-  case insn_frem:
-    lower_frem(insn);
-    return 0;
   case insn_i2c:
     lower_i2c(insn);
     return 0;
@@ -1412,22 +1782,6 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_lushr:
     lower_long_shiftop(insn);
     return 0;
-  case insn_monitorenter:
-  case insn_monitorexit:
-    break;
-  case insn_anewarray:
-  case insn_checkcast:
-  case insn_getfield:
-  case insn_getstatic:
-  case insn_instanceof:
-  case insn_invokedynamic:
-  case insn_new:
-  case insn_putfield:
-  case insn_putstatic:
-  case insn_invokevirtual:
-  case insn_invokespecial:
-  case insn_invokestatic:
-    break;
   case insn_ldc:
     if (lower_ldc(insn))
       break;
@@ -1463,35 +1817,16 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_ifle:
   case insn_ifnonnull:
   case insn_ifnull:
+  case insn_tableswitch:
+  case insn_lookupswitch:
     lower_branch(insn);
-  case insn_jsr:
-    break;
-  case insn_iconst:
-  case insn_dconst:
-  case insn_fconst:
-  case insn_lconst:
-    lower_constant(insn);
     return 0;
   case insn_iinc:
     lower_iinc(insn);
     return 0;
-  case insn_invokeinterface:
-    break;
-  case insn_multianewarray: // TODO implement this (probably one runtime fn for each # of dimensions + fallback)
-    break;
   case insn_newarray:
-    lower_newarray(insn);
-    return 0;
-  case insn_tableswitch: // TODO
-    // lower_tableswitch(insn);
-    break;
-  case insn_lookupswitch:
-    // lower_lookupswitch(insn);
-    break;
-  case insn_ret:
-    break;
   case insn_anewarray_resolved:
-    lower_anewarray_resolved(insn);
+    lower_newarray(insn);
     return 0;
   case insn_checkcast_resolved:
     lower_checkcast_resolved(insn);
@@ -1506,19 +1841,13 @@ static int lower_instruction(const bytecode_insn *insn) {
   case insn_invokeitable_monomorphic:
   case insn_invokespecial_resolved:
   case insn_invokestatic_resolved:
-    lower_monomorphic_call(insn);
-    return 0;
+    return lower_monomorphic_call(insn);
   case insn_invokevtable_polymorphic:
-    lower_vtable_call(insn);
-    return 0;
+    return lower_vtable_call(insn);
   case insn_invokeitable_polymorphic:
-    lower_itable_call(insn);
-    return 0;
+    return lower_itable_call(insn);
   case insn_invokecallsite:
-    lower_invokecallsite(insn);
-    return 0;
-  case insn_invokesigpoly:
-    break;
+    return lower_invokecallsite(insn);
   case insn_getfield_B:
   case insn_getfield_C:
   case insn_getfield_S:
@@ -1559,7 +1888,8 @@ static int lower_instruction(const bytecode_insn *insn) {
     return 0;
   }
 
-  // De-opt if we can't lower this instruction
+  // De-opt if we can't lower this instruction: unresolved instructions (which the interpreter resolves and rewrites,
+  // so that recompiling the method can do better), monitors, multianewarray, jsr/ret and signature-polymorphic calls
   emit(deopt());
   return -1;
 }
@@ -1575,7 +1905,7 @@ void free_topo_ctx(method_jit_ctx ctx) {
   free(ctx.stack_to_local);
   free(ctx.local_to_local);
   for (int i = 0; i < ctx.blockc; ++i) {
-    free(ctx.creations[i].requested);
+    arrfree(ctx.creations[i].requested);
   }
   free(ctx.creations);
 }
@@ -1677,39 +2007,91 @@ typedef struct {
 static int cmp_ints_reverse(const void *a, const void *b) { return *(int *)b - *(int *)a; }
 
 void free_dumb_jit_result(dumb_jit_result *result) {
-  free(result->pc_to_oops.count);
-  free(result);
+  while (result) {
+    dumb_jit_result *previous = result->previous;
+    if (result->instantiation) {
+      free_wasm_instantiation_result(result->instantiation);
+    }
+    jit_free_code(result->code, result->code_size);
+    free(result->class_guards);
+    free(result);
+    result = previous;
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE
+stack_frame *wasm_runtime_push_frame(vm_thread *thread, cp_method *method) {
+  // Like get_next_frame_start: above the caller's operand stack. The arguments are passed as WASM parameters, so the
+  // new frame doesn't overlap the caller's stack like interpreter frames do.
+  stack_frame *top = thread->stack.top;
+  char *start = top ? (char *)top + sizeof(stack_frame) + top->max_stack * sizeof(stack_value)
+                    : (char *)thread->stack.frame_buffer;
+  stack_frame *frame = push_plain_frame(thread, method, (stack_value *)start, 0);
+  if (frame) {
+    frame->kind = FRAME_KIND_COMPILED;
+  }
+  return frame;
+}
+
+// Push the frame and copy the arguments into the locals
+static expression compile_prologue(const wasm_value_type *args, int argc) {
+  expression *exprs = nullptr;
+
+  expression push_args[2] = {thread_param(), wasm_i32_const(ctx->module, (intptr_t)ctx->method)};
+  arrput(exprs, wasm_local_set(ctx->module, ctx->frame_local, upcall(wasm_runtime_push_frame, "iii", push_args)));
+  // StackOverflowError
+  arrput(exprs, wasm_if_else(ctx->module, wasm_unop(ctx->module, WASM_OP_KIND_REF_EQZ, get_frame()), return_zero(),
+                             nullptr, wasm_void()));
+  expression locals = wasm_binop(ctx->module, WASM_OP_KIND_I32_SUB, get_frame(),
+                                 wasm_i32_const(ctx->module, ctx->method->code->max_locals * sizeof(stack_value)));
+  arrput(exprs, wasm_local_set(ctx->module, ctx->locals_local, locals));
+
+  // The analysis gives every argument one local, even longs and doubles
+  for (int i = 0; i < argc; ++i) {
+    expression arg = wasm_local_get(ctx->module, i + 2 /* thread, method */, (wasm_type){.val = args[i]});
+    arrput(exprs, set_local(i, arg, args[i]));
+  }
+  return make_block(exprs);
 }
 
-expression compile_bb(basic_block *bb) {
+static expression compile_bb(basic_block *bb) {
   // Go instruction by instruction, if an instruction returns -1 then we're done
   ctx->building = nullptr;
-  ctx->curr_pc = bb->start_index;
-  ctx->curr_sd = ctx->analysis->insn_index_to_sd[ctx->curr_pc];
-  CHECK(bb->insn_count > 0);
+  ctx->bb_exit = wasm_block(ctx->module, nullptr, 0, wasm_void(), false);
+  ctx->bb_end = bb->start_index + bb->insn_count;
+  bool falls_off = true;
   for (int i = 0; i < bb->insn_count; ++i) {
+    ctx->curr_pc = bb->start_index + i;
+    ctx->curr_sd = ctx->analysis->insn_index_to_sd[ctx->curr_pc];
     const bytecode_insn *insn = bb->start + i;
     int ret = lower_instruction(insn);
-    if (ret != 0)
+    if (ret < 0) {
+      falls_off = false;
       break;
+    }
+    i += ret;
+    falls_off = falls_through(unfused_insn_kind(bb->start[i].kind));
+  }
+  if (falls_off) {
+    emit_goto(ctx->bb_end);
   }
-  CHECK(arrlen(ctx->building) > 0);
-  expression result = arrlen(ctx->building) == 1
-                          ? ctx->building[0]
-                          : wasm_block(ctx->module, ctx->building, arrlen(ctx->building), wasm_void(), false);
+  wasm_update_block(ctx->module, ctx->bb_exit, ctx->building, arrlen(ctx->building), wasm_void(), false);
   arrfree(ctx->building);
-  return result;
+  return ctx->bb_exit;
 }
 
 dumb_jit_result *dumb_jit_compile(cp_method *method, dumb_jit_options options) {
 #ifndef EMSCRIPTEN
-  return nullptr;
+  return nullptr; // there's nothing to run the code
 #endif
 
   attribute_code *code = method->code;
   code_analysis *analy = method->code_analysis;
 
-  if (!code || !analy)
+  // The interpreter can't pick up a compiled frame halfway through a synchronized method, and exceptions always
+  // leave compiled code, so methods which catch them aren't compiled.
+  if (!code || !analy || method->is_signature_polymorphic || (method->access_flags & ACCESS_SYNCHRONIZED) ||
+      (code->exception_table && code->exception_table->entries_count > 0) || !method->trampoline)
     return nullptr;
 
   scan_basic_blocks(code, analy);
@@ -1719,35 +2101,36 @@ dumb_jit_result *dumb_jit_compile(cp_method *method, dumb_jit_options options) {
     return nullptr;
   }
 
-  dumb_jit_result *result = nullptr;
-
-  pc_to_oop_count pc_to_oops = {};
-  pc_to_oops.count = calloc(code->insn_count, sizeof(u16));
-  pc_to_oops.max_pc = code->insn_count;
+  dumb_jit_result *result = calloc(1, sizeof(dumb_jit_result));
 
   wasm_module *module = wasm_module_create();
   ctx = make_topo(analy);
   ctx->module = module;
-  ctx->pc_to_oops = &pc_to_oops;
+  ctx->analysis = analy;
+  ctx->method = method;
+  ctx->result = result;
   ctx->stack_to_local = calloc(4 * (code->max_stack + 1), sizeof(int));
-  memset(ctx->stack_to_local, -1, 16 * (code->max_stack + 1));
+  memset(ctx->stack_to_local, -1, 4 * (code->max_stack + 1) * sizeof(int));
   ctx->local_to_local = calloc(4 * code->max_locals, sizeof(int));
-  memset(ctx->local_to_local, -1, 16 * code->max_locals);
+  memset(ctx->local_to_local, -1, 4 * code->max_locals * sizeof(int));
 
-  wasm_value_type returns = to_wasm_type(method->descriptor->return_type.repr_kind);
+  wasm_value_type args[256];
+  wasm_value_type returns;
+  int argc = method_wasm_signature(method, args, &returns);
 
   wasm_value_type *params_list = nullptr;
   arrput(params_list, WASM_TYPE_KIND_INT32);
   arrput(params_list, WASM_TYPE_KIND_INT32);
-  if (!(method->access_flags & ACCESS_STATIC)) { // this
-    arrput(params_list, WASM_TYPE_KIND_INT32);
-  }
-  for (int i = 0; i < method->descriptor->args_count; ++i) {
-    arrput(params_list, to_wasm_type(method->descriptor->args[i].repr_kind));
+  for (int i = 0; i < argc; ++i) {
+    arrput(params_list, args[i]);
   }
   CHECK(arrlen(params_list) == method_argc(method) + 2 /* thread, method */);
   init_function_builder(ctx->module, &ctx->fb, params_list, (wasm_type){.val = returns});
   arrfree(params_list);
+  ctx->frame_local = fb_new_local(&ctx->fb, WASM_TYPE_KIND_INT32);
+  ctx->locals_local = fb_new_local(&ctx->fb, WASM_TYPE_KIND_INT32);
+
+  expression prologue = compile_prologue(args, argc);
 
   inchoate_expression *expr_stack = nullptr;
 
@@ -1775,6 +2158,7 @@ dumb_jit_result *dumb_jit_compile(cp_method *method, dumb_jit_options options) {
           ctx->loop_headers[expr->started_at] = nullptr;
         expr->close_at = -1;
         stack_count = i + 1;
+        arrsetlen(expr_stack, stack_count);
       }
     }
     // Done pushing expressions
@@ -1802,31 +2186,44 @@ dumb_jit_result *dumb_jit_compile(cp_method *method, dumb_jit_options options) {
     int block_i = ctx->topo_to_block[ctx->topo_i];
     basic_block *bb = analy->blocks + block_i;
     expression expr = compile_bb(bb);
-    if (!expr) {
-      goto error_2;
-    }
     *arraddnptr(expr_stack, 1) = (inchoate_expression){expr, ctx->topo_i, -1, false};
   }
 
-  expression body = expr_stack[0].ref;
+  expression parts[2] = {prologue, expr_stack[0].ref};
+  expression body = wasm_block(module, parts, 2, wasm_void(), false);
+  arrfree(expr_stack);
   wasm_function *fn = finalize_function_builder(&ctx->fb, "run", body);
   fn->exported = true;
 
-  wasm_instantiation_result *instantiated = wasm_instantiate_module(ctx->module, method->name.chars);
+  char name[256];
+  snprintf(name, sizeof(name), "%.*s.%.*s", fmt_slice(method->my_class->name), fmt_slice(method->name));
+  wasm_instantiation_result *instantiated = wasm_instantiate_module(ctx->module, name);
+  wasm_module_free(ctx->module);
   if (instantiated->status == WASM_INSTANTIATION_FAIL) {
     free_wasm_instantiation_result(instantiated);
-    goto error_2;
+    free(result);
+    result = nullptr;
+  } else {
+    result->entry = instantiated->run;
+    result->instantiation = instantiated;
   }
 
-  wasm_module_free(ctx->module);
-
-  result = calloc(1, sizeof(dumb_jit_result));
-  result->entry = instantiated->run;
-  result->instantiation = instantiated;
-  result->pc_to_oops = pc_to_oops;
-
-error_2:
   free_topo_ctx(*ctx);
   free(ctx);
+  ctx = nullptr;
   return result;
-}
\ No newline at end of file
+}
+
+void dumb_jit_link_method(cp_method *method) {
+#ifdef EMSCRIPTEN
+  if (!method->code || method->is_signature_polymorphic)
+    return;
+  wasm_value_type args[256];
+  wasm_value_type returns;
+  int argc = method_wasm_signature(method, args, &returns);
+  method->jit_entry = get_wasm_interpreter_trampoline(returns, args, argc);
+  method->trampoline = get_wasm_jit_trampoline(returns, args, argc);
+#else
+  (void)method;
+#endif
+}
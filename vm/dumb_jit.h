@@ -10,15 +10,39 @@
 
 #include <wasm/wasm_utils.h>
 
-typedef struct {
-  u16 *count;
-  int max_pc;
-} pc_to_oop_count;
+// Default number of calls after which a method is compiled (see vm_options.jit_threshold)
+#define JIT_THRESHOLD 500
+// Default number of calls and loop iterations of baseline code after which a method is compiled with the optimizing
+// tier (see vm_options.opt_jit_threshold)
+#define OPT_JIT_THRESHOLD 10000
+// After this many deoptimizations, compiled code is thrown away so that the method can be compiled again with the
+// instructions the interpreter has since resolved
+#define JIT_DEOPTS_BEFORE_RECOMPILE 50
+// Stop recompiling a method after this many compilations
+#define JIT_MAX_COMPILATIONS 3
 
+// A guard in optimized code that a receiver's class is `desc` (see SSA_CLASS_CHECK). The code compares with class_ref
+// here rather than an immediate, so that when desc is unloaded and its slot in the class table is reused, the guard
+// can be made to fail instead of passing for an unrelated class (see dumb_jit_forget_classes).
 typedef struct {
-  pc_to_oop_count pc_to_oops;
-  void *entry; // (vm_thread *, cp_method *, arg1, arg2 ...) -> double
+  classdesc *desc; // or nullptr once unloaded
+  u32 class_ref;   // 0, which no object has, once desc is unloaded
+} jit_class_guard;
+
+typedef struct dumb_jit_result {
+  void *entry; // (vm_thread *, cp_method *, arg1, arg2 ...) -> return value, as an index into the function table
   wasm_instantiation_result *instantiation;
+  void *code; // native code in executable memory, if compiled by the x86-64 JIT
+  size_t code_size;
+  int deopts; // side exits to the interpreter so far
+  int compilations; // including this one
+  bool optimized; // compiled by the optimizing tier (see x86_opt_jit.h)
+  // Calls and loop iterations left before baseline code asks for the optimizing tier (x86-64 only)
+  int tier_up_countdown;
+  int tier_up_requests; // times the countdown has run out
+  jit_class_guard *class_guards; // in optimized code
+  int class_guard_count;
+  struct dumb_jit_result *previous; // earlier code for the same method, which may still be running
 } dumb_jit_result;
 
 // Reads arguments from "args", calls the entry point and writes the return value to "result". Yielding is signaled
@@ -26,10 +50,27 @@ typedef struct {
 typedef void (*jit_adapter_t)(void *entry, vm_thread *thread, stack_value *args, stack_value *result);
 
 typedef struct {
-
+  // x86-64 baseline code only: count calls and loop iterations down from tier_up_countdown, and ask for the optimizing
+  // tier once it runs out (see vm_options.opt_jit_enabled)
+  bool tier_up;
 } dumb_jit_options;
 
+// Compiled code pushes a frame of kind FRAME_KIND_COMPILED with the same layout as an interpreter frame, keeping the
+// program counter and the references in it up to date at every safepoint, so that the GC and stack walks treat it like
+// an interpreter frame. Instructions it can't compile hand the frame over to the interpreter (a deoptimization).
+// Methods with exception handlers or ACC_SYNCHRONIZED are not compiled. Returns nullptr if the method can't be
+// compiled; on success, the caller installs result->entry as the method's jit_entry.
 dumb_jit_result *dumb_jit_compile(cp_method *method, dumb_jit_options options);
+// Frees the result and all previous results for the method
 void free_dumb_jit_result(dumb_jit_result *result);
+// Count a deoptimization of the code. Once there have been JIT_DEOPTS_BEFORE_RECOMPILE, fall back to the interpreter
+// so that the method is compiled again.
+void dumb_jit_count_deopt(cp_method *method, dumb_jit_result *code);
+// Make the guards in the method's compiled code which check for unloaded classes fail, and fall back to the interpreter
+// if its current code has any, so that the method is compiled again. Called before the classes are unloaded.
+void dumb_jit_forget_classes(cp_method *method, bool (*is_unloaded)(classdesc *cd));
+// Point the method's jit_entry at the interpreter (so that compiled code can call it) and set its trampoline (so that
+// the interpreter can call compiled code), if trampolines exist for its signature. A no-op outside WebAssembly builds.
+void dumb_jit_link_method(cp_method *method);
 
 #endif // DUMB_JIT_H
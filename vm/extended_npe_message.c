@@ -84,7 +84,8 @@ static int extended_npe_phase2(const cp_method *method, stack_variable_source *s
       break;
     }
     case insn_getfield:
-    case insn_getfield_B ... insn_getfield_L: {
+    case insn_getfield_B ... insn_getfield_L:
+    case insn_getfield_N: {
       // <a>.name or just "name" if a can't be resolved
       int err = extended_npe_phase2(method, &analy->sources[index].a, index, builder, false);
       if (!err) {
@@ -180,10 +181,12 @@ int get_extended_npe_message(cp_method *method, u16 pc, heap_string *result) {
     CASE(insn_monitorexit, "Cannot exit synchronized block")
   case insn_getfield:
   case insn_getfield_B ... insn_getfield_L:
+  case insn_getfield_N:
     string_builder_append(&builder, "Cannot read field \"%.*s\"", fmt_slice(faulting_insn->cp->field.nat->name));
     break;
   case insn_putfield:
   case insn_putfield_B ... insn_putfield_L:
+  case insn_putfield_N:
     string_builder_append(&builder, "Cannot assign field \"%.*s\"", fmt_slice(faulting_insn->cp->field.nat->name));
     break;
   case insn_invokevirtual:
@@ -4,28 +4,226 @@
 #include "arrays.h"
 #include "bjvm.h"
 #include "cached_classdescs.h"
+#include "util.h"
 
+#include <dumb_jit.h>
 #include <gc.h>
+#include <inttypes.h>
+#include <instrumentation.h>
+#include <jit_queue.h>
+#include <objects.h>
 #include <roundrobin_scheduler.h>
 
+#if !defined(EMSCRIPTEN) || defined(__EMSCRIPTEN_PTHREADS__)
+#define PTHREADS_SUPPORTED
+#endif
+
+#ifdef PTHREADS_SUPPORTED
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if COMPRESSED_REFS
+#include <sys/mman.h>
+#endif
+
+struct gc_parallel;
+
 typedef struct gc_ctx {
   vm *vm;
 
   // Vector of pointer to things to rewrite
   object **roots;
-
-  // If lowest bit is a 1, it's a monitor_data*, otherwise it's an object.
-  void **objs;
-  object *new_location;
   object *worklist; // should contain a reachable object exactly once over its lifetime
 
-  object **relocations;
-
-  classdesc *Reference;
+  // Objects in [collect_lo, collect_hi) are being collected: the whole heap for a major GC, the young generation for
+  // a minor GC. Anything outside is assumed live and is never moved.
+  u8 *collect_lo, *collect_hi;
+  // Old objects which may contain pointers into the young generation (minor GC only)
+  object *remembered;
+  // Whether large objects are being collected too (major GC only). Otherwise they are assumed live.
+  bool mark_large_objects;
+  // Whether unreachable class loaders are unloaded (major GC only). Otherwise every loader's classes are roots.
+  bool unload_classes;
+  // Roots before this index have already been marked from
+  size_t marked_roots;
+
+  // Side bitmap over the collected region, one bit per 8-byte word, set for every word occupied by a reachable object
+  u64 *live_words;
+  size_t words, bitmap_words;
+  // Survivors slide down to compact_to, preserving their order. For each 64-word block of the collected region,
+  // block_offsets holds the number of live bytes before it, so an object's forwarding address is computed in O(1)
+  // from the bitmap alone (see forwarding_address).
+  u8 *compact_to;
+  size_t *block_offsets;
+  size_t live_bytes;
+  // Base of the heap being compacted into, which old_object_starts is relative to
+  u8 *heap_base;
+
+  // Parallel collection only: for each chunk of GC_CHUNK_WORDS words, the first word not covered by a live object
+  // which starts in an earlier chunk. Lets each chunk be parsed independently.
+  size_t *chunk_skip;
+  // Non-null during a parallel collection, in which case each worker thread has its own copy of the context
+  struct gc_parallel *parallel;
+  int worker_index;
+
+  // The java/lang/ref classes, or null during VM boot
+  classdesc *Reference, *SoftReference, *FinalReference, *PhantomReference;
+  // References with a non-null referent found while marking, dealt with once marking is done (see
+  // process_references)
+  object *discovered;
+  // FinalReferences which were on the pending list when the collection began, sorted by address
+  object *pending_finals;
+  // Whether to clear every soft reference, rather than only those that weren't read recently
+  bool clear_soft_references;
+  // Objects marked so far (by this worker, during a parallel phase)
+  size_t live_objects;
 } gc_ctx;
 
+#if COMPRESSED_REFS
+uintptr_t compressed_heap_base;
+
+// A part of the reservation which isn't in use, and is mapped PROT_NONE
+typedef struct {
+  uintptr_t start, end;
+} free_range;
+
+static free_range *free_ranges; // stb_ds array, sorted by address, never adjacent
+static pthread_mutex_t reservation_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Reserve COMPRESSED_HEAP_BYTES of address space aligned to its size, by reserving twice as much and trimming it
+static bool reserve_compressed_heap() {
+  size_t bytes = 2 * COMPRESSED_HEAP_BYTES;
+  void *reservation = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reservation == MAP_FAILED)
+    return false;
+  uintptr_t start = (uintptr_t)reservation, base = align_up(start, COMPRESSED_HEAP_BYTES);
+  if (base > start)
+    munmap(reservation, base - start);
+  munmap((void *)(base + COMPRESSED_HEAP_BYTES), start + bytes - (base + COMPRESSED_HEAP_BYTES));
+  compressed_heap_base = base;
+  arrput(free_ranges, ((free_range){base + 4096, base + COMPRESSED_HEAP_BYTES})); // see heap_ref
+  return true;
+}
+
+// First fit, or 0 if no free range is large enough
+static uintptr_t take_free_range(size_t bytes) {
+  for (int i = 0; i < arrlen(free_ranges); ++i) {
+    free_range *range = free_ranges + i;
+    if (range->end - range->start >= bytes) {
+      uintptr_t start = range->start;
+      range->start += bytes;
+      if (range->start == range->end)
+        arrdel(free_ranges, i);
+      return start;
+    }
+  }
+  return 0;
+}
+
+static void return_free_range(uintptr_t start, uintptr_t end) {
+  int i = 0;
+  while (i < arrlen(free_ranges) && free_ranges[i].start < start)
+    ++i;
+  arrins(free_ranges, i, ((free_range){start, end}));
+  if (i + 1 < arrlen(free_ranges) && free_ranges[i + 1].start == end) {
+    free_ranges[i].end = free_ranges[i + 1].end;
+    arrdel(free_ranges, i + 1);
+  }
+  if (i > 0 && free_ranges[i - 1].end == start) {
+    free_ranges[i - 1].end = free_ranges[i].end;
+    arrdel(free_ranges, i);
+  }
+}
+#endif
+
+void *alloc_object_memory(size_t bytes, bool zeroed) {
+#if COMPRESSED_REFS
+  // Pages which are mapped afresh are always zeroed
+  bytes = align_up(bytes, 4096);
+  pthread_mutex_lock(&reservation_lock);
+  uintptr_t start = compressed_heap_base || reserve_compressed_heap() ? take_free_range(bytes) : 0;
+  pthread_mutex_unlock(&reservation_lock);
+  if (!start)
+    return nullptr;
+  void *memory =
+      mmap((void *)start, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    pthread_mutex_lock(&reservation_lock);
+    return_free_range(start, start + bytes);
+    pthread_mutex_unlock(&reservation_lock);
+    return nullptr;
+  }
+  return memory;
+#else
+  return zeroed ? calloc(1, bytes) : aligned_alloc(4096, bytes);
+#endif
+}
+
+void free_object_memory(void *memory, size_t bytes) {
+#if COMPRESSED_REFS
+  if (!memory)
+    return;
+  bytes = align_up(bytes, 4096);
+  // Drop the pages, but keep the addresses reserved
+  void *reserved = mmap(memory, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+  CHECK(reserved != MAP_FAILED, "failed to release heap memory");
+  pthread_mutex_lock(&reservation_lock);
+  return_free_range((uintptr_t)memory, (uintptr_t)memory + bytes);
+  pthread_mutex_unlock(&reservation_lock);
+#else
+  (void)bytes;
+  free(memory);
+#endif
+}
+
 int in_heap(const vm *vm, object field) {
-  return (u8 *)field >= vm->heap && (u8 *)field < vm->heap + vm->heap_capacity;
+  return ((u8 *)field >= vm->heap && (u8 *)field < vm->heap + vm->heap_capacity) || find_large_object(vm, field);
+}
+
+obj_header *find_large_object(const vm *vm, const void *p) {
+  // Most pointers checked lie outside the space's address range (e.g. in the compacting heap, or null), so rule those
+  // out before searching
+  ptrdiff_t count = arrlen(vm->large_objects);
+  if (!count)
+    return nullptr;
+  obj_header *last = vm->large_objects[count - 1];
+  if ((uintptr_t)p < (uintptr_t)vm->large_objects[0] ||
+      (uintptr_t)p >= (uintptr_t)last + large_object_header(last)->size)
+    return nullptr;
+
+  // Binary search for the last large object starting at or before p
+  ptrdiff_t low = 0, high = count - 1;
+  obj_header *candidate = nullptr;
+  while (low <= high) {
+    ptrdiff_t mid = (low + high) / 2;
+    if ((uintptr_t)vm->large_objects[mid] <= (uintptr_t)p) {
+      candidate = vm->large_objects[mid];
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  if (candidate && (uintptr_t)p < (uintptr_t)candidate + large_object_header(candidate)->size) {
+    return candidate;
+  }
+  return nullptr;
+}
+
+// Reached for stores into anything outside the compacting heap: large objects, but also static fields written
+// through Unsafe, which must be left alone.
+void gc_large_object_write_barrier(vm *vm, obj_header *holder) {
+  if (find_large_object(vm, holder) == holder) {
+    large_object_header(holder)->dirty = true;
+  }
+}
+
+static bool in_collected_region(const gc_ctx *ctx, const void *p) {
+  return (u8 *)p >= ctx->collect_lo && (u8 *)p < ctx->collect_hi;
+}
+
+static bool is_reference(const gc_ctx *ctx, classdesc *desc) {
+  return ctx->Reference && instanceof(desc, ctx->Reference);
 }
 
 #define lengthof(x) (sizeof(x) / sizeof(x[0]))
@@ -103,6 +301,35 @@ static void enumerate_reflection_roots(gc_ctx *ctx, classdesc *desc) {
   }
 }
 
+// Major GC only: note that the loader is reachable, so that it's kept along with its classes
+static void keep_classloader_alive(classloader *cl) {
+  if (cl && !__atomic_load_n(&cl->alive, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&cl->alive, true, __ATOMIC_RELAXED);
+  }
+}
+
+// Static fields and reflection objects of the classes defined by the loader, and the loader's mirror
+static void push_classloader_roots(gc_ctx *ctx, classloader *cl) {
+  PUSH_ROOT(&cl->java_mirror);
+  hash_table_iterator it = hash_table_get_iterator(&cl->loaded);
+  char *key;
+  size_t key_len;
+  classdesc *desc;
+  while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
+    if (desc->static_references) {
+      for (size_t i = 0; i < desc->static_references->count; ++i) {
+        u16 offs = desc->static_references->slots_unscaled[i];
+        object *root = ((object *)desc->static_fields) + offs;
+        PUSH_ROOT(root);
+      }
+    }
+
+    // Also, push things like Class, Method and Constructors
+    enumerate_reflection_roots(ctx, desc);
+    hash_table_iterator_next(&it);
+  }
+}
+
 static void push_thread_roots(gc_ctx *ctx, vm_thread *thr) {
   PUSH_ROOT(&thr->thread_obj);
   PUSH_ROOT(&thr->current_exception);
@@ -114,6 +341,9 @@ static void push_thread_roots(gc_ctx *ctx, vm_thread *thr) {
 
   stack_frame *frame = thr->stack.top;
   while (frame) {
+    if (ctx->unload_classes) {
+      keep_classloader_alive(frame->method->my_class->classloader);
+    }
     if (is_frame_native(frame)) {
       frame = frame->prev;
       continue;
@@ -133,23 +363,22 @@ static void push_thread_roots(gc_ctx *ctx, vm_thread *thr) {
     //                only scan this ←─────────→│     Fr.2 locals     │ Fr.2 metadata ...
     //             part of Fr1's stack          └─────────────────────┴─────────────────
 
-    stack_summary *ss = analy->stack_states[frame->program_counter];
-    int i = 0;
-    for (; i < ss->stack; ++i) {
-      if (ss->entries[i] != TYPE_KIND_REFERENCE)
-        continue;
-      object *val = &frame->stack[i].obj;
-      if ((uintptr_t)val >= min_frame_addr_scanned) { // see above
-        continue;
+    const gc_map *map = gc_map_at(analy, frame->program_counter);
+    DCHECK(map, "No GC map at a frame's program counter");
+    int entries = map->stack + map->locals;
+    for (int w = 0; w < (entries + 63) / 64; ++w) {
+      for (u64 bits = map->bits[w]; bits; bits &= bits - 1) {
+        int i = w * 64 + __builtin_ctzll(bits);
+        if (i < map->stack) {
+          object *val = &frame->stack[i].obj;
+          if ((uintptr_t)val >= min_frame_addr_scanned) { // see above
+            continue;
+          }
+          PUSH_ROOT(val);
+        } else {
+          PUSH_ROOT(&frame_locals(frame)[i - map->stack].obj);
+        }
       }
-      PUSH_ROOT(val);
-    }
-
-    // Scan the locals
-    for (int local_i = 0; i < ss->locals + ss->stack; ++i, ++local_i) {
-      if (ss->entries[i] != TYPE_KIND_REFERENCE)
-        continue;
-      PUSH_ROOT(&frame_locals(frame)[local_i].obj);
     }
 
     min_frame_addr_scanned = (uintptr_t)frame_locals(frame);
@@ -179,38 +408,28 @@ static void major_gc_enumerate_gc_roots(gc_ctx *ctx) {
     PUSH_ROOT(&vm->js_handles[i]);
   }
 
-  // Pending references
-  PUSH_ROOT(&vm->reference_pending_list);
+  // Pending references (even if there are none yet, since more may be enqueued by process_references)
+  arrput(ctx->roots, (object *)&vm->reference_pending_list);
 
-  // Static fields of classes
-  hash_table_iterator it;
-  char *key;
-  size_t key_len;
+  // Static fields of classes. When unloading classes, only the bootstrap loader's are roots to begin with; the
+  // other loaders' are pushed once they're found reachable (see trace_live_classloaders).
   for (int classloader_i = 0; classloader_i < arrlen(vm->active_classloaders); classloader_i++) {
     classloader *cl = vm->active_classloaders[classloader_i];
-    PUSH_ROOT(&cl->java_mirror);
-    it = hash_table_get_iterator(&cl->loaded);
-    classdesc *desc;
-    while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
-      if (desc->static_references) {
-        for (size_t i = 0; i < desc->static_references->count; ++i) {
-          u16 offs = desc->static_references->slots_unscaled[i];
-          object *root = ((object *)desc->static_fields) + offs;
-          PUSH_ROOT(root);
-        }
-      }
-
-      // Also, push things like Class, Method and Constructors
-      enumerate_reflection_roots(ctx, desc);
-      hash_table_iterator_next(&it);
+    if (ctx->unload_classes) {
+      cl->alive = cl->traced = cl->is_bootstrap;
+      if (!cl->is_bootstrap)
+        continue;
     }
+    push_classloader_roots(ctx, cl);
   }
 
   // main thread group
   PUSH_ROOT(&vm->main_thread_group);
 
   // Modules
-  it = hash_table_get_iterator(&vm->modules);
+  hash_table_iterator it = hash_table_get_iterator(&vm->modules);
+  char *key;
+  size_t key_len;
   module *module;
   while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&module)) {
     PUSH_ROOT(&module->reflection_object);
@@ -223,84 +442,158 @@ static void major_gc_enumerate_gc_roots(gc_ctx *ctx) {
     push_thread_roots(ctx, thr);
   }
 
-  // Interned strings (TODO remove)
-  it = hash_table_get_iterator(&vm->interned_strings);
-  object str;
-  while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&str)) {
-    PUSH_ROOT(&it.current->data);
-    hash_table_iterator_next(&it);
-  }
-
   // Scheduler roots
   if (vm->scheduler) {
     rr_scheduler_enumerate_gc_roots(vm->scheduler, ctx->roots);
   }
 }
 
-static u32 *get_flags(vm *vm, object o) {
-  assert(o != nullptr);
-  return &get_mark_word(vm, &o->header_word)->data[0];
+static size_t word_index(const gc_ctx *ctx, const void *p) { return ((u8 *)p - ctx->collect_lo) / 8; }
+
+static bool test_bit(const u64 *bits, size_t i) { return bits[i / 64] >> (i % 64) & 1; }
+
+// Set bits [begin, end), atomically if other threads may be setting bits in the same words. Returns whether the
+// first bit was previously clear.
+static bool set_bits(u64 *bits, size_t begin, size_t end, bool atomic) {
+  bool first_was_clear = false;
+  for (bool first = true; begin < end; first = false) {
+    size_t n = end - begin < 64 - begin % 64 ? end - begin : 64 - begin % 64;
+    u64 mask = n == 64 ? ~0ULL : ((1ULL << n) - 1) << (begin % 64);
+    u64 old;
+    if (atomic) {
+      old = __atomic_fetch_or(&bits[begin / 64], mask, __ATOMIC_RELAXED);
+    } else {
+      old = bits[begin / 64];
+      bits[begin / 64] = old | mask;
+    }
+    if (first)
+      first_was_clear = !(old >> (begin % 64) & 1);
+    begin += n;
+  }
+  return first_was_clear;
 }
 
-static void mark_reachable(gc_ctx *ctx, object obj) {
-  arrput(ctx->objs, obj);
-  if (has_expanded_data(&obj->header_word)) {
-    arrput(ctx->objs, (void *)((uintptr_t)obj->header_word.expanded_data | 1));
+static bool is_marked(const gc_ctx *ctx, object obj) { return test_bit(ctx->live_words, word_index(ctx, obj)); }
+
+#define GC_CHUNK_WORDS (1 << 17) // 1 MiB of heap
+
+// Set the live bits of an object. Returns false if another thread (or an earlier visit) got there first.
+static bool mark_extent(gc_ctx *ctx, size_t word, size_t bytes) {
+  size_t end = word + align_up(bytes, 8) / 8;
+  if (!ctx->parallel) {
+    return set_bits(ctx->live_words, word, end, false);
   }
+  // Claim the first word before touching the rest, so that exactly one worker traces the object
+  if (!set_bits(ctx->live_words, word, word + 1, true))
+    return false;
+  set_bits(ctx->live_words, word + 1, end, true);
+  for (size_t chunk = word / GC_CHUNK_WORDS + 1; chunk * GC_CHUNK_WORDS < end; ++chunk) {
+    ctx->chunk_skip[chunk] = end; // only this object covers the start of the chunk, so there is no race
+  }
+  return true;
+}
+
+static void push_work(gc_ctx *ctx, object obj);
 
-  // Visit all instance fields
-  classdesc *desc = obj->descriptor;
+static void mark_if_unreachable(gc_ctx *ctx, object obj) {
+  if (!obj)
+    return;
+  if (in_collected_region(ctx, obj)) {
+    if (!is_marked(ctx, obj) && mark_extent(ctx, word_index(ctx, obj), size_of_object(obj))) {
+      ctx->live_objects++;
+      push_work(ctx, obj);
+    }
+  } else if (ctx->mark_large_objects && find_large_object(ctx->vm, obj) == obj) {
+    large_object *header = large_object_header(obj);
+    if (!__atomic_load_n(&header->marked, __ATOMIC_RELAXED) &&
+        !__atomic_exchange_n(&header->marked, true, __ATOMIC_RELAXED)) {
+      ctx->live_objects++;
+      push_work(ctx, obj);
+    }
+  }
+}
+
+// Whether the (non-null) object survives this collection. Must be called after marking.
+static bool survives(const gc_ctx *ctx, object obj) {
+  if (in_collected_region(ctx, obj))
+    return is_marked(ctx, obj);
+  if (ctx->mark_large_objects) {
+    obj_header *large = find_large_object(ctx->vm, obj);
+    return !large || large_object_header(large)->marked;
+  }
+  return true;
+}
+
+static bool is_pending_final(const gc_ctx *ctx, object ref) {
+  ptrdiff_t low = 0, high = arrlen(ctx->pending_finals) - 1;
+  while (low <= high) {
+    ptrdiff_t mid = (low + high) / 2;
+    if (ctx->pending_finals[mid] == ref)
+      return true;
+    if ((uintptr_t)ctx->pending_finals[mid] < (uintptr_t)ref)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+  return false;
+}
+
+// The referent of a Reference isn't traced through. Instead, the Reference is recorded, and its referent dealt with
+// after marking. The exception is a FinalReference which has already been enqueued: its referent stays strongly
+// reachable until the finalizer has run and cleared it.
+static void discover_reference(gc_ctx *ctx, object obj) {
+  struct native_Reference *ref = (struct native_Reference *)obj;
+  if (!ref->referent)
+    return;
+  if (instanceof(obj_class(obj), ctx->FinalReference) && (ref->next || is_pending_final(ctx, obj))) {
+    mark_if_unreachable(ctx, ref->referent);
+  } else {
+    arrput(ctx->discovered, obj);
+  }
+}
+
+// Visit all instance fields or array elements of the object, except for the referents of Reference objects.
+static void trace_fields(gc_ctx *ctx, object obj) {
+  classdesc *desc = obj_class(obj);
   if (desc->kind == CD_KIND_ORDINARY) {
     reference_list *refs = desc->instance_references;
     size_t i = 0;
-    if (instanceof(desc, ctx->Reference)) {
+    if (is_reference(ctx, desc)) {
       ++i; // skip the 'referent' field
+      discover_reference(ctx, obj);
     }
 
     for (; i < refs->count; ++i) {
-      object field_obj = *((object *)obj + refs->slots_unscaled[i]);
-      if (field_obj && in_heap(ctx->vm, field_obj) && !(*get_flags(ctx->vm, field_obj) & IS_REACHABLE)) {
-        *get_flags(ctx->vm, field_obj) |= IS_REACHABLE;
-        arrput(ctx->worklist, field_obj);
-      }
+      mark_if_unreachable(ctx, *((object *)obj + refs->slots_unscaled[i]));
+    }
+    refs = desc->compressed_references;
+    for (i = 0; i < refs->count; ++i) {
+      mark_if_unreachable(ctx, decode_heap_ref(*((heap_ref *)obj + refs->slots_unscaled[i])));
     }
   } else if (desc->kind == CD_KIND_ORDINARY_ARRAY || (desc->kind == CD_KIND_PRIMITIVE_ARRAY && desc->dimensions > 1)) {
     // Visit all components
     int arr_len = ArrayLength(obj);
     for (int i = 0; i < arr_len; ++i) {
-      object arr_element = ReferenceArrayLoad(obj, i);
-      if (arr_element && in_heap(ctx->vm, arr_element) && !(*get_flags(ctx->vm, arr_element) & IS_REACHABLE)) {
-        *get_flags(ctx->vm, arr_element) |= IS_REACHABLE;
-        arrput(ctx->worklist, arr_element);
-      }
+      mark_if_unreachable(ctx, ReferenceArrayLoad(obj, i));
     }
   }
 }
 
-size_t size_of_object(object obj) {
-  if (obj->descriptor->kind == CD_KIND_ORDINARY) {
-    return obj->descriptor->instance_bytes;
-  }
-  if (obj->descriptor->kind == CD_KIND_ORDINARY_ARRAY) {
-    return kArrayDataOffset + ArrayLength(obj) * sizeof(void *);
+static void mark_reachable(gc_ctx *ctx, object obj) {
+  if (ctx->unload_classes) {
+    keep_classloader_alive(obj_class(obj)->classloader); // instances keep their class (and so its loader) alive
   }
-  return kArrayDataOffset + ArrayLength(obj) * sizeof_type_kind(obj->descriptor->primitive_component);
+  trace_fields(ctx, obj);
 }
 
-[[maybe_unused]] static void **binary_search_for_pointer(void *ptr, void **ptrs, size_t count) {
-  ptrdiff_t low = 0, high = (ptrdiff_t)count - 1;
-  while (low <= high) {
-    ptrdiff_t mid = (low + high) / 2;
-    if ((uintptr_t)ptrs[mid] == (uintptr_t)ptr) {
-      return &ptrs[mid];
-    }
-    if ((uintptr_t)ptrs[mid] < (uintptr_t)ptr) {
-      low = mid + 1;
-    } else {
-      high = mid - 1;
-    }
+size_t size_of_object(object obj) {
+  if (obj_class(obj)->kind == CD_KIND_ORDINARY) {
+    return obj_class(obj)->instance_bytes;
   }
-  return nullptr;
+  if (obj_class(obj)->kind == CD_KIND_ORDINARY_ARRAY) {
+    return kArrayDataOffset + ArrayLength(obj) * sizeof(heap_ref);
+  }
+  return kArrayDataOffset + ArrayLength(obj) * sizeof_type_kind(obj_class(obj)->primitive_component);
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
@@ -329,80 +622,109 @@ static void quicksort_pointers(void **ptrs, size_t count) {
   quicksort_pointers(left, ptrs + count - left);
 }
 
-// Returns false if the object could not be relocated
-static bool relocate_object(const gc_ctx *ctx, object *obj) {
-  if (!*obj)
-    return true; // object was nullptr
+// Index of the first live word at or after `word`, or ctx->words if there is none
+static size_t next_live_word(const gc_ctx *ctx, size_t word) {
+  size_t i = word / 64;
+  if (i >= ctx->bitmap_words)
+    return ctx->words;
+  u64 bits = ctx->live_words[i] & (~0ULL << (word % 64));
+  while (!bits) {
+    if (++i == ctx->bitmap_words)
+      return ctx->words;
+    bits = ctx->live_words[i];
+  }
+  return i * 64 + __builtin_ctzll(bits);
+}
+
+// Size in bytes of the live object starting at the given word
+static size_t live_entry_size(const gc_ctx *ctx, size_t word) {
+  return align_up(size_of_object((object)(ctx->collect_lo + word * 8)), 8);
+}
 
-  DCHECK(((uintptr_t)obj & 1) == 0);
+// Survivors keep their relative order, so the new address of a live object is the destination of its block plus the
+// number of live words preceding it within the block.
+static void *forwarding_address(const gc_ctx *ctx, const void *p) {
+  size_t word = word_index(ctx, p);
+  u64 below = ctx->live_words[word / 64] & ((1ULL << (word % 64)) - 1);
+  return ctx->compact_to + ctx->block_offsets[word / 64] + 8 * __builtin_popcountll(below);
+}
 
-  // Binary search for obj in ctx->roots
-  void **found = binary_search_for_pointer(*obj, ctx->objs, arrlen(ctx->objs));
-  if (found) {
-    object relocated = ctx->new_location[found - ctx->objs];
-    DCHECK(relocated);
-    DCHECK(!((uintptr_t)relocated & 1));
-    *obj = relocated;
-    return true;
+static void compute_forwarding_addresses(gc_ctx *ctx) {
+  size_t offset = 0;
+  for (size_t i = 0; i < ctx->bitmap_words; ++i) {
+    ctx->block_offsets[i] = offset;
+    offset += 8 * __builtin_popcountll(ctx->live_words[i]);
   }
+  ctx->live_bytes = offset;
+}
 
-  return false;
+static void relocate_object(const gc_ctx *ctx, object *obj) {
+  if (*obj && in_collected_region(ctx, *obj)) {
+    DCHECK(is_marked(ctx, *obj));
+    *obj = forwarding_address(ctx, *obj);
+  }
 }
 
-void relocate_instance_fields(gc_ctx *ctx) {
-  for (int i = 0; i < arrlen(ctx->objs); ++i) {
-    if ((uintptr_t)ctx->objs[i] & 1) { // monitor
-      continue;
-    }
-    object obj = ctx->new_location[i];
+// Rewrite the references in a surviving object (or, in a minor GC, in a remembered old object). This happens before
+// anything is moved, so obj is still at its old address.
+static void relocate_object_fields(gc_ctx *ctx, object obj) {
+  // Point the monitor, if any, at the object's new location
+  if (has_expanded_data(obj->header_word) && in_collected_region(ctx, obj)) {
+    inspect_monitor(ctx->vm, obj->header_word)->object = forwarding_address(ctx, obj);
+  }
 
-    // Re-map the monitor, if any
-    if (has_expanded_data(&obj->header_word)) {
-      monitor_data *monitor = obj->header_word.expanded_data;
-      void *key = (void *)((uintptr_t)monitor | 1);
-      void **found = binary_search_for_pointer(key, ctx->objs, arrlen(ctx->objs));
-      if (!found) {
-        fprintf(stderr, "Can't find monitor %p!\n", monitor);
-        abort();
-      }
-      obj->header_word.expanded_data = (void *)ctx->new_location[found - ctx->objs];
+  if (obj_class(obj)->kind == CD_KIND_ORDINARY) {
+    // Referents which didn't survive were cleared by process_references, so they're treated like any other field
+    reference_list *refs = obj_class(obj)->instance_references;
+    for (size_t j = 0; j < refs->count; ++j) {
+      object *field = (object *)obj + refs->slots_unscaled[j];
+      relocate_object(ctx, field);
+    }
+    refs = obj_class(obj)->compressed_references;
+    for (size_t j = 0; j < refs->count; ++j) {
+      heap_ref *field = (heap_ref *)obj + refs->slots_unscaled[j];
+      object value = decode_heap_ref(*field);
+      relocate_object(ctx, &value);
+      *field = encode_heap_ref(value);
     }
+  } else if (is_reference_array(obj_class(obj))) {
+    int arr_len = ArrayLength(obj);
+    heap_ref *elements = ReferenceArrayData(obj);
+    for (int j = 0; j < arr_len; ++j) {
+      object element = decode_heap_ref(elements[j]);
+      relocate_object(ctx, &element);
+      elements[j] = encode_heap_ref(element);
+    }
+  }
+}
 
-    if (obj->descriptor->kind == CD_KIND_ORDINARY) {
-      classdesc *desc = obj->descriptor;
-      reference_list *refs = desc->instance_references;
+// Linear sweep over the live objects whose first word is in [first, end). first must be the start of a live object
+// (or >= end).
+static void relocate_instance_fields_range(gc_ctx *ctx, size_t first, size_t end) {
+  for (size_t word = first; word < end;) {
+    size_t size = live_entry_size(ctx, word);
+    relocate_object_fields(ctx, (object)(ctx->collect_lo + word * 8));
+    word = next_live_word(ctx, word + size / 8);
+  }
+}
 
-      bool is_ref = instanceof(desc, ctx->Reference);
-      size_t j = is_ref ? 1 : 0;
+static void relocate_instance_fields(gc_ctx *ctx) {
+  relocate_instance_fields_range(ctx, next_live_word(ctx, 0), ctx->words);
+}
 
-      for (; j < refs->count; ++j) {
-        object *field = (object *)obj + refs->slots_unscaled[j];
-        relocate_object(ctx, field);
-      }
+static void mark_roots(gc_ctx *ctx) {
+  for (size_t i = ctx->marked_roots; i < arrlenu(ctx->roots); ++i) {
+    mark_if_unreachable(ctx, *ctx->roots[i]);
+  }
+  ctx->marked_roots = arrlenu(ctx->roots);
+}
 
-      if (is_ref) {
-        DCHECK(refs->count >= 1);
-        object *referent = (object *)obj + refs->slots_unscaled[0];
-        bool found = relocate_object(ctx, referent);
-        if (!found) {
-          // The object is no longer reachable. (TODO: these are not the semantics for FinalReference)
-          struct native_Reference *as_ref = (struct native_Reference *)obj;
-          as_ref->referent = nullptr;
-          if (!as_ref->discovered) {
-            as_ref->discovered = (object)ctx->vm->reference_pending_list;
-            ctx->vm->reference_pending_list = as_ref;
-          }
-        }
-      }
-    } else if (obj->descriptor->kind == CD_KIND_ORDINARY_ARRAY ||
-               (obj->descriptor->kind == CD_KIND_PRIMITIVE_ARRAY && obj->descriptor->dimensions > 1)) {
-      int arr_len = ArrayLength(obj);
-      for (int j = 0; j < arr_len; ++j) {
-        object *field = (object *)ArrayData(obj) + j;
-        relocate_object(ctx, field);
-      }
-    }
+static void drain_worklist(gc_ctx *ctx) {
+  while (arrlen(ctx->worklist) > 0) {
+    object obj = arrpop(ctx->worklist);
+    mark_reachable(ctx, obj);
   }
+  arrfree(ctx->worklist);
 }
 
 #if DCHECKS_ENABLED
@@ -411,85 +733,1037 @@ void relocate_instance_fields(gc_ctx *ctx) {
 #define NEW_HEAP_EACH_GC 0
 #endif
 
-void major_gc(vm *vm) {
-  // TODO wait for all threads to get ready (for now we'll just call this from
-  // an already-running thread)
-  gc_ctx ctx = {.vm = vm, .Reference = cached_classes(vm)->reference};
-  major_gc_enumerate_gc_roots(&ctx);
+static size_t card_count(const vm *vm) { return align_up(vm->heap_capacity, CARD_BYTES) / CARD_BYTES; }
 
-  // Mark phase
-  for (int i = 0; i < arrlen(ctx.roots); ++i) {
-    object root = *ctx.roots[i];
-    if (!in_heap(vm, root) || *get_flags(vm, root) & IS_REACHABLE) // already visited
+static void allocate_mark_bitmaps(gc_ctx *ctx) {
+  ctx->words = (ctx->collect_hi - ctx->collect_lo) / 8;
+  ctx->bitmap_words = (ctx->words + 63) / 64;
+  ctx->live_words = calloc(ctx->bitmap_words, sizeof(u64));
+  ctx->block_offsets = malloc(ctx->bitmap_words * sizeof(size_t));
+}
+
+// Slide the live objects whose first word is in [first, end) to their forwarding addresses, in address
+// order. Because the destination never exceeds the source address when compacting in place, memmove suffices.
+static void compact_objects_range(gc_ctx *ctx, size_t first, size_t end) {
+  vm *vm = ctx->vm;
+  u8 *write_ptr = first < end ? forwarding_address(ctx, ctx->collect_lo + first * 8) : nullptr;
+
+  for (size_t word = first; word < end;) {
+    u8 *obj = ctx->collect_lo + word * 8;
+    size_t sz = live_entry_size(ctx, word);
+    DCHECK(write_ptr == forwarding_address(ctx, obj));
+    DCHECK(write_ptr + sz <= ctx->heap_base + vm->heap_capacity);
+    if (vm->old_object_starts) {
+      size_t start = (write_ptr - ctx->heap_base) / 8;
+      set_bits(vm->old_object_starts, start, start + 1, ctx->parallel != nullptr);
+    }
+    memmove(write_ptr, obj, sz); // not memcpy because the heap is the same; overlap is possible
+    write_ptr += sz;
+    word = next_live_word(ctx, word + sz / 8);
+  }
+}
+
+static void compact_objects(gc_ctx *ctx) { compact_objects_range(ctx, next_live_word(ctx, 0), ctx->words); }
+
+typedef enum { GC_PHASE_MARK, GC_PHASE_RELOCATE_ROOTS, GC_PHASE_RELOCATE_FIELDS, GC_PHASE_COMPACT } gc_phase;
+
+#ifdef PTHREADS_SUPPORTED
+// Once a worker's private worklist grows past this, it offers half of it up for stealing
+#define GC_SHARE_THRESHOLD 64
+
+typedef struct {
+  gc_ctx ctx; // private copy of the collector's context, refreshed at the start of each phase
+
+  // Objects which other workers may steal, guarded by lock. shared_count is also read without the lock to find
+  // victims and to detect termination.
+  pthread_mutex_t lock;
+  object *shared;
+  int shared_count;
+} gc_worker;
+
+// A parallel major collection. Each phase runs on worker_count threads (the collecting thread being worker 0, and
+// the threads of the VM's gc_worker_pool the others):
+//  - Marking: each worker marks from its slice of the roots, then traces from its private worklist, stealing from
+//    the others' shared worklists when it runs dry. Objects are claimed by atomically setting their first live bit.
+//  - Relocation: roots are partitioned by slice, objects by GC_CHUNK_WORDS chunks of the heap.
+//  - Compaction: chunks are handed out in address order. The destination of a chunk's objects is known from the
+//    block offsets, so a chunk may be moved as soon as the earlier chunks whose objects lie in that destination have
+//    been moved out of the way.
+typedef struct gc_parallel {
+  gc_worker *workers;
+  int worker_count;
+  gc_phase phase;
+
+  int idle; // workers which found no work to do, for mark termination
+  size_t chunk_count;
+  size_t next_chunk;
+  bool *chunk_done;
+} gc_parallel;
+
+// Threads which help with parallel collections. They are started by the VM's first one and kept for its lifetime,
+// parked between phases, since starting threads for every phase would cost much of what small heaps gain.
+typedef struct gc_worker_pool {
+  pthread_t *threads; // thread i runs worker i + 1 of each phase
+  int thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // signaled when a phase starts, or the threads should stop
+  pthread_cond_t done; // signaled when `running` drops to 0
+  u64 phases_started;  // a thread runs a phase once it sees this change
+  int running;         // threads still working on the current phase
+  gc_parallel *par;    // the collection the current phase belongs to
+  bool stopping;
+} gc_worker_pool;
+
+typedef struct {
+  gc_worker_pool *pool;
+  int worker_index;
+} gc_pool_thread_arg;
+
+static size_t chunk_end(const gc_ctx *ctx, size_t chunk) {
+  size_t end = (chunk + 1) * GC_CHUNK_WORDS;
+  return end < ctx->words ? end : ctx->words;
+}
+
+// First live object starting in the chunk, or the chunk's end if there is none
+static size_t chunk_first_object(const gc_ctx *ctx, size_t chunk) {
+  size_t begin = chunk * GC_CHUNK_WORDS;
+  size_t first = next_live_word(ctx, ctx->chunk_skip[chunk] > begin ? ctx->chunk_skip[chunk] : begin);
+  size_t end = chunk_end(ctx, chunk);
+  return first < end ? first : end;
+}
+
+static void share_work(gc_ctx *ctx) {
+  gc_worker *self = &ctx->parallel->workers[ctx->worker_index];
+  if (__atomic_load_n(&self->shared_count, __ATOMIC_RELAXED))
+    return; // nobody has taken the last batch yet
+
+  // Give away the oldest half, which tends to lead to the largest subgraphs
+  int len = arrlen(ctx->worklist), n = len / 2;
+  pthread_mutex_lock(&self->lock);
+  for (int i = 0; i < n; ++i) {
+    arrput(self->shared, ctx->worklist[i]);
+  }
+  __atomic_store_n(&self->shared_count, n, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&self->lock);
+
+  memmove(ctx->worklist, ctx->worklist + n, (len - n) * sizeof(object));
+  arrsetlen(ctx->worklist, len - n);
+}
+
+// Take all the shared work of some worker (our own first). Returns false if there was none.
+static bool steal_work(gc_ctx *ctx) {
+  gc_parallel *par = ctx->parallel;
+  for (int i = 0; i < par->worker_count; ++i) {
+    gc_worker *victim = &par->workers[(ctx->worker_index + i) % par->worker_count];
+    if (!__atomic_load_n(&victim->shared_count, __ATOMIC_ACQUIRE))
       continue;
-    *get_flags(vm, root) |= IS_REACHABLE;
-    arrput(ctx.worklist, root);
+    pthread_mutex_lock(&victim->lock);
+    for (int j = 0; j < arrlen(victim->shared); ++j) {
+      arrput(ctx->worklist, victim->shared[j]);
+    }
+    arrsetlen(victim->shared, 0);
+    __atomic_store_n(&victim->shared_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->lock);
+    if (arrlen(ctx->worklist))
+      return true;
   }
+  return false;
+}
 
-  int *bitset[1] = {nullptr};
-  while (arrlen(ctx.worklist) > 0) {
-    object obj = arrpop(ctx.worklist);
-    *get_flags(vm, obj) |= IS_REACHABLE;
-    mark_reachable(&ctx, obj);
+// Called by a worker with no work left. Returns true once every worker is in the same situation, or false if some
+// work has appeared to steal. (A worker only shares work while it is busy, so when all are idle, none is left.)
+static bool mark_termination(gc_parallel *par) {
+  __atomic_add_fetch(&par->idle, 1, __ATOMIC_SEQ_CST);
+  while (true) {
+    if (__atomic_load_n(&par->idle, __ATOMIC_SEQ_CST) == par->worker_count)
+      return true;
+    for (int i = 0; i < par->worker_count; ++i) {
+      if (__atomic_load_n(&par->workers[i].shared_count, __ATOMIC_ACQUIRE)) {
+        __atomic_sub_fetch(&par->idle, 1, __ATOMIC_SEQ_CST);
+        return false;
+      }
+    }
+    sched_yield();
   }
-  arrfree(ctx.worklist);
-  arrfree(bitset[0]);
+}
 
-  // Sort roots by address
-  quicksort_pointers(ctx.objs, arrlen(ctx.objs));
-  object *new_location = ctx.new_location = malloc(arrlen(ctx.objs) * sizeof(object));
+static void compact_chunk(gc_ctx *ctx, size_t chunk) {
+  gc_parallel *par = ctx->parallel;
+  size_t first = chunk_first_object(ctx, chunk), end = chunk_end(ctx, chunk);
+  if (first < end && ctx->compact_to == ctx->collect_lo) {
+    // This chunk's objects will occupy [forwarding address of first, dest_end). Wait for the earlier chunks which
+    // may still have objects there. That only depends on earlier chunks, which were handed out first, so the lowest
+    // unfinished chunk can always make progress.
+    size_t next = chunk + 1 < par->chunk_count ? chunk_first_object(ctx, chunk + 1) : ctx->words;
+    u8 *dest_end = next < ctx->words ? (u8 *)forwarding_address(ctx, ctx->collect_lo + next * 8)
+                                     : ctx->compact_to + ctx->live_bytes;
+    for (size_t earlier = 0; earlier < chunk && ctx->collect_lo + earlier * GC_CHUNK_WORDS * 8 < dest_end;
+         ++earlier) {
+      while (!__atomic_load_n(&par->chunk_done[earlier], __ATOMIC_ACQUIRE)) {
+        sched_yield();
+      }
+    }
+  }
+  compact_objects_range(ctx, first, end);
+  __atomic_store_n(&par->chunk_done[chunk], true, __ATOMIC_RELEASE);
+}
+
+static void gc_worker_main(gc_ctx *ctx) {
+  gc_parallel *par = ctx->parallel;
+
+  // Roots already marked from (in an earlier round of marking) are skipped in the mark phase
+  size_t first_root = par->phase == GC_PHASE_MARK ? ctx->marked_roots : 0;
+  size_t root_count = arrlen(ctx->roots) - first_root, workers = par->worker_count, i = ctx->worker_index;
+  size_t roots_begin = first_root + root_count * i / workers, roots_end = first_root + root_count * (i + 1) / workers;
+  size_t chunk;
+
+  switch (par->phase) {
+  case GC_PHASE_MARK:
+    for (size_t r = roots_begin; r < roots_end; ++r) {
+      mark_if_unreachable(ctx, *ctx->roots[r]);
+    }
+    do {
+      while (arrlen(ctx->worklist) > 0) {
+        mark_reachable(ctx, arrpop(ctx->worklist));
+      }
+    } while (steal_work(ctx) || !mark_termination(par));
+    break;
+  case GC_PHASE_RELOCATE_ROOTS:
+    for (size_t r = roots_begin; r < roots_end; ++r) {
+      relocate_object(ctx, ctx->roots[r]);
+    }
+    break;
+  case GC_PHASE_RELOCATE_FIELDS:
+    while ((chunk = __atomic_fetch_add(&par->next_chunk, 1, __ATOMIC_RELAXED)) < par->chunk_count) {
+      relocate_instance_fields_range(ctx, chunk_first_object(ctx, chunk), chunk_end(ctx, chunk));
+    }
+    break;
+  case GC_PHASE_COMPACT:
+    while ((chunk = __atomic_fetch_add(&par->next_chunk, 1, __ATOMIC_RELAXED)) < par->chunk_count) {
+      compact_chunk(ctx, chunk);
+    }
+    break;
+  }
+}
 
-  // Create a new heap of the same size so ASAN can enjoy itself
-#if NEW_HEAP_EACH_GC
-  u8 *new_heap = aligned_alloc(4096, vm->heap_capacity), *end = new_heap + vm->heap_capacity;
+static void *gc_pool_thread_main(void *arg) {
+  gc_worker_pool *pool = ((gc_pool_thread_arg *)arg)->pool;
+  int worker_index = ((gc_pool_thread_arg *)arg)->worker_index;
+  free(arg);
+  u64 phases_seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->stopping && pool->phases_started == phases_seen)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    if (pool->stopping)
+      break;
+    phases_seen = pool->phases_started;
+    gc_parallel *par = pool->par;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (worker_index < par->worker_count)
+      gc_worker_main(&par->workers[worker_index].ctx);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return nullptr;
+}
+
+// Start up to `threads` threads, unless the pool exists already
+static gc_worker_pool *get_worker_pool(vm *vm, int threads) {
+  if (vm->gc_workers)
+    return vm->gc_workers;
+  gc_worker_pool *pool = calloc(1, sizeof(gc_worker_pool));
+  pthread_mutex_init(&pool->lock, nullptr);
+  pthread_cond_init(&pool->wake, nullptr);
+  pthread_cond_init(&pool->done, nullptr);
+  // If we can't get as many threads as requested, make do with fewer
+  pool->threads = calloc(threads, sizeof(pthread_t));
+  while (pool->thread_count < threads) {
+    gc_pool_thread_arg *arg = malloc(sizeof(gc_pool_thread_arg));
+    *arg = (gc_pool_thread_arg){pool, pool->thread_count + 1};
+    if (pthread_create(&pool->threads[pool->thread_count], nullptr, gc_pool_thread_main, arg) != 0) {
+      free(arg);
+      break;
+    }
+    pool->thread_count++;
+  }
+  vm->gc_workers = pool;
+  return pool;
+}
+#endif
+
+void free_gc_workers(vm *vm) {
+#ifdef PTHREADS_SUPPORTED
+  gc_worker_pool *pool = vm->gc_workers;
+  if (!pool)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->thread_count; ++i)
+    pthread_join(pool->threads[i], nullptr);
+  free(pool->threads);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->done);
+  free(pool);
+  vm->gc_workers = nullptr;
 #else
-  u8 *new_heap = vm->heap, *end = vm->heap + vm->heap_capacity;
+  (void)vm;
+#endif
+}
+
+static void push_work(gc_ctx *ctx, object obj) {
+  arrput(ctx->worklist, obj);
+#ifdef PTHREADS_SUPPORTED
+  if (ctx->parallel && arrlen(ctx->worklist) > GC_SHARE_THRESHOLD) {
+    share_work(ctx);
+  }
 #endif
+}
 
-  u8 *write_ptr = new_heap;
+// Set up a parallel collection if vm->gc_threads asks for one. Must be called after allocate_mark_bitmaps.
+static void begin_parallel_gc(gc_ctx *ctx) {
+#ifdef PTHREADS_SUPPORTED
+  int threads = ctx->vm->gc_threads;
+  if (threads <= 1)
+    return;
+  gc_worker_pool *pool = get_worker_pool(ctx->vm, threads - 1);
+  if (!pool->thread_count)
+    return;
+  if (threads > pool->thread_count + 1)
+    threads = pool->thread_count + 1;
+  gc_parallel *par = ctx->parallel = calloc(1, sizeof(gc_parallel));
+  par->worker_count = threads;
+  par->workers = calloc(threads, sizeof(gc_worker));
+  for (int i = 0; i < threads; ++i) {
+    pthread_mutex_init(&par->workers[i].lock, nullptr);
+  }
+  par->chunk_count = (ctx->words + GC_CHUNK_WORDS - 1) / GC_CHUNK_WORDS;
+  par->chunk_done = calloc(par->chunk_count, sizeof(bool));
+  ctx->chunk_skip = calloc(par->chunk_count, sizeof(size_t));
+#endif
+}
 
-  // Copy object by object. Monitors are "objects" with a low bit of 1 to differentiate them.
-  for (size_t i = 0; i < arrlenu(ctx.objs); ++i) {
-    // Align to 8 bytes
-    write_ptr = (u8 *)align_up((uintptr_t)write_ptr, 8);
-    object obj = ctx.objs[i];
+// Returns false if the collection is serial, in which case the caller should perform the phase itself.
+static bool run_parallel_phase(gc_ctx *ctx, gc_phase phase) {
+#ifdef PTHREADS_SUPPORTED
+  gc_parallel *par = ctx->parallel;
+  if (!par)
+    return false;
+
+  par->phase = phase;
+  par->idle = 0;
+  par->next_chunk = 0;
+  for (int i = 0; i < par->worker_count; ++i) {
+    gc_worker *worker = &par->workers[i];
+    worker->ctx = *ctx;
+    worker->ctx.worker_index = i;
+    worker->ctx.worklist = nullptr;
+    worker->ctx.discovered = nullptr;
+    worker->ctx.live_objects = 0;
+  }
 
-#if !NEW_HEAP_EACH_GC
-    DCHECK((uintptr_t)obj >= (uintptr_t)write_ptr);
+  // Wake the pool's threads, work alongside them, then wait for them to park again
+  gc_worker_pool *pool = ctx->vm->gc_workers;
+  pthread_mutex_lock(&pool->lock);
+  pool->par = par;
+  pool->running = pool->thread_count;
+  pool->phases_started++;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  gc_worker_main(&par->workers[0].ctx);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < par->worker_count; ++i) {
+    DCHECK(arrlen(par->workers[i].ctx.worklist) == 0);
+    arrfree(par->workers[i].ctx.worklist);
+    object *discovered = par->workers[i].ctx.discovered;
+    for (int j = 0; j < arrlen(discovered); ++j) {
+      arrput(ctx->discovered, discovered[j]);
+    }
+    arrfree(discovered);
+    ctx->live_objects += par->workers[i].ctx.live_objects;
+  }
+  return true;
+#else
+  return false;
 #endif
+}
+
+static void end_parallel_gc(gc_ctx *ctx) {
+#ifdef PTHREADS_SUPPORTED
+  gc_parallel *par = ctx->parallel;
+  if (!par)
+    return;
+  for (int i = 0; i < par->worker_count; ++i) {
+    pthread_mutex_destroy(&par->workers[i].lock);
+    arrfree(par->workers[i].shared);
+  }
+  free(par->workers);
+  free(par->chunk_done);
+  free(par);
+  ctx->parallel = nullptr;
+#endif
+}
+
+// Invalidate all thread-local allocation buffers, which may point into space that was just compacted over.
+static void reset_tlabs(vm *vm) {
+  for (int i = 0; i < arrlen(vm->active_threads); ++i) {
+    vm_thread *thread = vm->active_threads[i];
+    thread->tlab_top = thread->tlab_end = thread->tlab_hard_end = thread->tlab_sample_base = nullptr;
+  }
+}
+
+static void free_gc_ctx(gc_ctx *ctx) {
+  arrfree(ctx->roots);
+  arrfree(ctx->remembered);
+  arrfree(ctx->discovered);
+  arrfree(ctx->pending_finals);
+  free(ctx->live_words);
+  free(ctx->block_offsets);
+  free(ctx->chunk_skip);
+  end_parallel_gc(ctx);
+}
+
+// Old objects are those in the old generation or the large-object space
+static bool is_old_object(const vm *vm, object obj) {
+  if ((u8 *)obj >= vm->heap && (u8 *)obj < vm->heap + vm->young_start)
+    return true;
+  return obj && find_large_object(vm, obj) == obj;
+}
 
-    bool is_monitor = (uintptr_t)obj & 1;
-    size_t sz = is_monitor ? sizeof(monitor_data) : size_of_object(obj);
-    sz = align_up(sz, 8);
-    obj = (void *)((uintptr_t)obj & ~1ULL); // get the actual underlying pointer
-    DCHECK(write_ptr + sz <= end);
-    if (!is_monitor) {
-      *get_flags(vm, obj) &= ~IS_REACHABLE; // clear the reachable flag
+// Collect the old objects that may point into the young generation: those whose header lies in a dirty card, and
+// those currently referenced by a handle (natives write to handle-held objects without a barrier, and dirty the
+// card once the handle is dropped).
+static void push_remembered_objects(gc_ctx *ctx) {
+  vm *vm = ctx->vm;
+  constexpr size_t WORDS_PER_CARD = CARD_BYTES / 8 / 64;
+  size_t dirty_cards_end = align_up(vm->young_start, CARD_BYTES) / CARD_BYTES;
+  for (size_t card = 0; card < dirty_cards_end; ++card) {
+    if (!vm->card_table[card])
+      continue;
+    for (size_t w = card * WORDS_PER_CARD; w < (card + 1) * WORDS_PER_CARD; ++w) {
+      u64 bits = vm->old_object_starts[w];
+      while (bits) {
+        size_t word = w * 64 + __builtin_ctzll(bits);
+        arrput(ctx->remembered, (object)(vm->heap + word * 8));
+        bits &= bits - 1;
+      }
     }
-    memmove(write_ptr, obj, sz); // not memcpy because the heap is the same; overlap is possible
-    object new_obj = (object)write_ptr;
-    new_location[i] = new_obj;
-    write_ptr += sz;
   }
 
-  // Go through all static and instance fields and rewrite in place
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    if (large_object_header(vm->large_objects[i])->dirty) {
+      arrput(ctx->remembered, vm->large_objects[i]);
+    }
+  }
+
+  for (int thread_i = 0; thread_i < arrlen(vm->active_threads); ++thread_i) {
+    vm_thread *thr = vm->active_threads[thread_i];
+    for (int i = 0; i < thr->handles_capacity; ++i) {
+      if (is_old_object(vm, thr->handles[i].obj)) {
+        arrput(ctx->remembered, thr->handles[i].obj);
+      }
+    }
+  }
+  for (int i = 0; i < arrlen(vm->js_handles); ++i) {
+    if (is_old_object(vm, vm->js_handles[i])) {
+      arrput(ctx->remembered, vm->js_handles[i]);
+    }
+  }
+
+  // Each object must be relocated exactly once, so remove duplicates
+  quicksort_pointers((void **)ctx->remembered, arrlen(ctx->remembered));
+  int unique = 0;
+  for (int i = 0; i < arrlen(ctx->remembered); ++i) {
+    if (i == 0 || ctx->remembered[i] != ctx->remembered[i - 1]) {
+      ctx->remembered[unique++] = ctx->remembered[i];
+    }
+  }
+  arrsetlen(ctx->remembered, unique);
+}
+
+// Called after marking. Free the monitors of dead objects, and deflate idle monitors (restoring the object's mark
+// word) unless a thread is waiting on them. In a minor GC, only monitors of young objects can be found dead; the rest
+// wait for the next major GC.
+static void sweep_monitors(gc_ctx *ctx) {
+  vm *vm = ctx->vm;
+  object *waited = nullptr;
+  if (vm->scheduler) {
+    rr_scheduler_enumerate_waited_objects(vm->scheduler, &waited);
+  }
+
+  for (int slab_i = 0; slab_i < arrlen(vm->monitor_slabs); ++slab_i) {
+    for (int i = 0; i < MONITORS_PER_SLAB; ++i) {
+      monitor_data *monitor = vm->monitor_slabs[slab_i] + i;
+      object obj = monitor->object;
+      if (!obj)
+        continue;
+      if (!survives(ctx, obj) || inspect_monitor(vm, obj->header_word) != monitor) {
+        free_monitor(vm, monitor); // dead, or never installed
+        continue;
+      }
+      if (monitor->tid != NOT_HELD_TID || monitor->hold_count != 0)
+        continue;
+      bool is_waited = false;
+      for (int j = 0; j < arrlen(waited); ++j) {
+        is_waited |= waited[j] == obj;
+      }
+      if (!is_waited) {
+        obj->header_word = monitor->mark_word;
+        free_monitor(vm, monitor);
+      }
+    }
+  }
+  arrfree(waited);
+}
+
+// Called after marking. Interned strings are weak: drop the dead ones from the table, then add the survivors' slots
+// as roots so that they are relocated along with the other roots.
+static void sweep_interned_strings(gc_ctx *ctx) {
+  interned_string_table *tbl = &ctx->vm->interned_strings;
+  for (u32 i = 0; i < tbl->capacity; ++i) {
+    if (tbl->strings[i] && !survives(ctx, tbl->strings[i])) {
+      tbl->strings[i] = nullptr;
+      tbl->count--;
+    }
+  }
+  if (tbl->capacity) {
+    rehash_interned_strings(tbl, tbl->count); // close the gaps in the probe sequences
+  }
+  for (u32 i = 0; i < tbl->capacity; ++i) {
+    if (tbl->strings[i]) {
+      arrput(ctx->roots, &tbl->strings[i]);
+    }
+  }
+}
+
+// Called after each round of marking in a major GC. Push the roots of the loaders found reachable since the last call,
+// and keep alive the loaders of every class they have resolved. Returns whether there were any, in which case marking
+// must continue from the new roots.
+static bool trace_live_classloaders(gc_ctx *ctx) {
+  vm *vm = ctx->vm;
+  bool found = false;
+  for (int i = 0; i < arrlen(vm->active_classloaders); ++i) {
+    classloader *cl = vm->active_classloaders[i];
+    if (cl->traced || !(cl->alive || (cl->java_mirror && survives(ctx, cl->java_mirror))))
+      continue;
+    cl->alive = cl->traced = found = true;
+    push_classloader_roots(ctx, cl);
+    keep_classloader_alive(cl->parent);
+
+    hash_table_iterator it = hash_table_get_iterator(&cl->initiating);
+    char *key;
+    size_t key_len;
+    classdesc *desc;
+    while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
+      keep_classloader_alive(desc->classloader);
+      hash_table_iterator_next(&it);
+    }
+  }
+  return found;
+}
+
+static void find_reference_classes(gc_ctx *ctx) {
+  // May be called before the cached classdescs exist, during VM boot (when no Reference can exist yet)
+  if (!ctx->vm->_cached_classdescs)
+    return;
+  struct cached_classdescs *classes = cached_classes(ctx->vm);
+  ctx->Reference = classes->reference;
+  ctx->SoftReference = classes->soft_reference;
+  ctx->FinalReference = classes->final_reference;
+  ctx->PhantomReference = classes->phantom_reference;
+
+  for (struct native_Reference *ref = ctx->vm->reference_pending_list; ref;
+       ref = (struct native_Reference *)ref->discovered) {
+    if (instanceof(obj_class(&ref->base), ctx->FinalReference)) {
+      arrput(ctx->pending_finals, (object)ref);
+    }
+  }
+  quicksort_pointers((void **)ctx->pending_finals, arrlen(ctx->pending_finals));
+}
+
+// Mark from the roots not yet marked from. In a major GC, this continues from the roots of each class loader found
+// reachable until there are no more.
+static void mark_from_new_roots(gc_ctx *ctx) {
+  do {
+    if (!run_parallel_phase(ctx, GC_PHASE_MARK)) {
+      mark_roots(ctx);
+      drain_worklist(ctx);
+    }
+    ctx->marked_roots = arrlenu(ctx->roots);
+  } while (ctx->unload_classes && trace_live_classloaders(ctx));
+}
+
+// Keep alive the referents of the given References, and everything reachable from them
+static void resurrect_referents(gc_ctx *ctx, struct native_Reference **refs) {
+  if (arrlen(refs) == 0)
+    return;
+  size_t first = arrlenu(ctx->roots);
+  for (int i = 0; i < arrlen(refs); ++i) {
+    arrput(ctx->roots, &refs[i]->referent);
+  }
+  mark_from_new_roots(ctx);
+  // The referent fields are relocated along with the References, so they mustn't stay roots
+  arrdeln(ctx->roots, first, arrlen(refs));
+  ctx->marked_roots = arrlenu(ctx->roots);
+}
+
+static void enqueue_reference(gc_ctx *ctx, struct native_Reference *ref) {
+  ref->discovered = (object)ctx->vm->reference_pending_list;
+  ctx->vm->reference_pending_list = ref;
+}
 
-  // this must come first because we read the pending reference list during collection, which is a static root
+// SoftReference.clock: the time of the last collection in milliseconds, which each SoftReference copies into its
+// timestamp field when it is read.
+static s64 *soft_reference_clock(const gc_ctx *ctx) {
+  if (!ctx->SoftReference || ctx->SoftReference->state < CD_STATE_LINKED)
+    return nullptr;
+  cp_field *clock = field_lookup(ctx->SoftReference, STR("clock"), STR("J"));
+  return clock ? (s64 *)(ctx->SoftReference->static_fields + clock->byte_offset) : nullptr;
+}
+
+// Called after marking. Decide the fate of the discovered References whose referents weren't marked, from the
+// strongest kind to the weakest:
+//   1. SoftReferences read recently enough keep their referents alive. The allowed age is proportional to the free
+//      space in the heap (see vm_options.soft_ref_lru_ms_per_mb).
+//   2. The remaining soft references, and weak references, are cleared and enqueued.
+//   3. FinalReferences are enqueued without being cleared, and their referents kept alive for the finalizer.
+//   4. PhantomReferences (and any other References found while keeping referents alive) are cleared and enqueued.
+//      Coming last, a phantom reachable object can't be resurrected by a finalizer afterwards.
+// Enqueued References are pushed onto the pending list for the reference handler thread. They're still at their old
+// addresses, as are the list's links, which are relocated along with the other roots and fields.
+static void process_references(gc_ctx *ctx) {
+  vm *vm = ctx->vm;
+  s64 *clock = soft_reference_clock(ctx);
+  cp_field *timestamp = clock ? field_lookup(ctx->SoftReference, STR("timestamp"), STR("J")) : nullptr;
+  size_t free_bytes = vm->heap_max_capacity - vm->heap_used - vm->large_object_bytes;
+  s64 max_age_ms = ctx->clear_soft_references ? -1 : (s64)(free_bytes >> 20) * vm->soft_ref_lru_ms_per_mb;
+
+  struct native_Reference **kept = nullptr;
+  size_t checked = 0;
+  while (timestamp && checked < arrlenu(ctx->discovered)) { // keeping referents alive may discover more References
+    for (; checked < arrlenu(ctx->discovered); ++checked) {
+      struct native_Reference *ref = (struct native_Reference *)ctx->discovered[checked];
+      if (survives(ctx, ref->referent) || !instanceof(obj_class(&ref->base), ctx->SoftReference))
+        continue;
+      s64 age = *clock - *(s64 *)((u8 *)ref + timestamp->byte_offset);
+      if (age <= max_age_ms) {
+        arrput(kept, ref);
+      }
+    }
+    resurrect_referents(ctx, kept);
+    arrsetlen(kept, 0);
+  }
+
+  for (int i = 0; i < arrlen(ctx->discovered); ++i) {
+    struct native_Reference *ref = (struct native_Reference *)ctx->discovered[i];
+    classdesc *desc = obj_class(&ref->base);
+    if (!survives(ctx, ref->referent) && !instanceof(desc, ctx->FinalReference) &&
+        !instanceof(desc, ctx->PhantomReference)) {
+      ref->referent = nullptr;
+      enqueue_reference(ctx, ref);
+    }
+  }
+
+  checked = 0;
+  while (checked < arrlenu(ctx->discovered)) {
+    for (; checked < arrlenu(ctx->discovered); ++checked) {
+      struct native_Reference *ref = (struct native_Reference *)ctx->discovered[checked];
+      if (ref->referent && !survives(ctx, ref->referent) && instanceof(obj_class(&ref->base), ctx->FinalReference)) {
+        arrput(kept, ref);
+        enqueue_reference(ctx, ref);
+      }
+    }
+    resurrect_referents(ctx, kept);
+    arrsetlen(kept, 0);
+  }
+  arrfree(kept);
+
+  for (int i = 0; i < arrlen(ctx->discovered); ++i) {
+    struct native_Reference *ref = (struct native_Reference *)ctx->discovered[i];
+    if (ref->referent && !survives(ctx, ref->referent)) {
+      ref->referent = nullptr;
+      enqueue_reference(ctx, ref);
+    }
+  }
+
+  if (clock) {
+    *clock = (s64)(get_unix_us() / 1000);
+  }
+}
+
+static bool is_being_unloaded(classdesc *desc) { return !desc->classloader->alive; }
+
+// Inline caches in the surviving code may name a class which is about to be unloaded (e.g. the receiver of an
+// interface call from a class of another loader), and so may the guards of callees inlined into compiled code. Drop
+// those entries, and make those guards fail, before that class's memory and its slot in the class table are reused.
+static void forget_unloaded_receivers(classdesc *desc) {
+  for (int i = 0; i < desc->methods_count; ++i) {
+    dumb_jit_forget_classes(desc->methods + i, is_being_unloaded);
+    attribute_code *code = desc->methods[i].code;
+    if (!code)
+      continue;
+    for (int j = 0; j < code->insn_count; ++j) {
+      bytecode_insn *insn = code->code + j;
+      if ((insn->kind == insn_invokevtable_monomorphic || insn->kind == insn_invokeitable_monomorphic) &&
+          is_being_unloaded(insn->ic2)) {
+        if (insn->kind == insn_invokevtable_monomorphic)
+          make_invokevtable_polymorphic_(&desc->arena, insn);
+        else
+          make_invokeitable_polymorphic_(&desc->arena, insn);
+      }
+      if (insn->kind == insn_invokevtable_polymorphic || insn->kind == insn_invokeitable_polymorphic) {
+        polymorphic_cache_forget(insn->ic, is_being_unloaded);
+      }
+    }
+  }
+}
+
+// Called at the end of a major GC: free the loaders which weren't found reachable, along with their classes and
+// everything the classes own (static fields, code analyses, vtables and itables, and JITed code).
+static void unload_classloaders(vm *vm) {
+  bool any_dead = false;
+  for (int i = 0; i < arrlen(vm->active_classloaders); ++i) {
+    any_dead |= !vm->active_classloaders[i]->alive;
+  }
+  if (!any_dead)
+    return;
+  jit_queue_cancel(vm); // compilations may refer to the classes
+
+  hash_table_iterator it;
+  char *key;
+  size_t key_len;
+  classdesc *desc;
+  for (int i = 0; i < arrlen(vm->active_classloaders); ++i) {
+    classloader *cl = vm->active_classloaders[i];
+    if (!cl->alive)
+      continue;
+    it = hash_table_get_iterator(&cl->loaded);
+    while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
+      forget_unloaded_receivers(desc);
+      hash_table_iterator_next(&it);
+    }
+  }
+
+  int kept = 0;
+  for (int i = 0; i < arrlen(vm->active_classloaders); ++i) {
+    classloader *cl = vm->active_classloaders[i];
+    if (cl->alive) {
+      vm->active_classloaders[kept++] = cl;
+      continue;
+    }
+    it = hash_table_get_iterator(&cl->loaded);
+    while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
+      InstrumentClassUnloaded(desc);
+      hash_table_iterator_next(&it);
+    }
+    classloader_uninit(cl); // frees the classes
+    free(cl);
+  }
+  arrsetlen(vm->active_classloaders, kept);
+}
+
+static size_t marked_large_object_bytes(const vm *vm) {
+  size_t bytes = 0;
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    large_object *header = large_object_header(vm->large_objects[i]);
+    if (header->marked) {
+      bytes += sizeof(large_object) + header->size;
+    }
+  }
+  return bytes;
+}
+
+static void relocate_large_object_fields(gc_ctx *ctx) {
+  for (int i = 0; i < arrlen(ctx->vm->large_objects); ++i) {
+    object obj = ctx->vm->large_objects[i];
+    if (large_object_header(obj)->marked) {
+      relocate_object_fields(ctx, obj);
+    }
+  }
+}
+
+// Free the large objects which weren't marked, and reset the survivors for the next collection
+static void sweep_large_objects(vm *vm) {
+  int kept = 0;
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    object obj = vm->large_objects[i];
+    large_object *header = large_object_header(obj);
+    if (header->marked) {
+      header->marked = header->dirty = false;
+      vm->large_objects[kept++] = obj;
+    } else {
+      vm->large_object_bytes -= sizeof(large_object) + header->size;
+      free_object_memory(header, sizeof(large_object) + header->size);
+    }
+  }
+  arrsetlen(vm->large_objects, kept);
+}
+
+// Bytes occupied by objects, in the compacting heap and the large-object space
+static size_t used_bytes(const vm *vm) {
+  size_t used = vm->heap_used;
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    used += large_object_header(vm->large_objects[i])->size;
+  }
+  return used;
+}
+
+const char *gc_kind_name(gc_kind kind) { return kind == GC_KIND_MINOR ? "Young" : "Full"; }
+
+static gc_event begin_gc_event(vm *vm, gc_kind kind, bool clear_soft_references) {
+  InstrumentGCBegin(kind == GC_KIND_MAJOR);
+  return (gc_event){.id = vm->gc_event_count + 1,
+                    .kind = kind,
+                    .cleared_soft_references = clear_soft_references,
+                    .start_us = get_unix_us(),
+                    .used_before = used_bytes(vm),
+                    .capacity_before = vm->heap_capacity};
+}
+
+static void print_gc_event(vm *vm, const gc_event *event) {
+  // Same shape as HotSpot's -Xlog:gc output, e.g. "[0.153s][info][gc] GC(2) Pause Young 24M->3M(64M) 1.402ms"
+  char line[256];
+  int len = snprintf(line, sizeof(line),
+                     "[%.3fs][info][gc] GC(%" PRIu64 ") Pause %s%s %zuM->%zuM(%zuM) %.3fms\n"
+                     "[%.3fs][info][gc,stats] GC(%" PRIu64 ") Live objects: %zu, roots scanned: %zu\n",
+                     (event->start_us - vm->start_us) / 1e6, event->id - 1, gc_kind_name(event->kind),
+                     event->cleared_soft_references ? " (Clear Soft References)" : "", event->used_before >> 20,
+                     event->used_after >> 20, event->capacity_after >> 20, event->pause_us / 1e3,
+                     (event->start_us - vm->start_us) / 1e6, event->id - 1, event->live_objects, event->roots_scanned);
+  len = len < (int)sizeof(line) ? len : (int)sizeof(line) - 1;
+  if (vm->write_stdout) {
+    vm->write_stdout(line, len, vm->stdio_override_param);
+  } else {
+    fwrite(line, 1, len, stdout);
+  }
+}
+
+// Record a finished collection in the event log and the per-kind totals, and print it if requested
+static void end_gc_event(vm *vm, gc_event *event) {
+  event->pause_us = get_unix_us() - event->start_us;
+  event->used_after = used_bytes(vm);
+  event->capacity_after = vm->heap_capacity;
+
+  vm->gc_events[vm->gc_event_count++ % GC_EVENT_LOG_CAPACITY] = *event;
+  vm->gc_collections[event->kind]++;
+  vm->gc_pause_us[event->kind] += event->pause_us;
+  if (vm->gc_log) {
+    print_gc_event(vm, event);
+  }
+  InstrumentGCEnd();
+}
+
+int recent_gc_events(const vm *vm, gc_event *events, int max) {
+  u64 available = vm->gc_event_count < GC_EVENT_LOG_CAPACITY ? vm->gc_event_count : GC_EVENT_LOG_CAPACITY;
+  int count = available < (u64)max ? (int)available : max;
+  for (int i = 0; i < count; ++i) {
+    events[i] = vm->gc_events[(vm->gc_event_count - count + i) % GC_EVENT_LOG_CAPACITY];
+  }
+  return count;
+}
+
+void minor_gc(vm *vm) {
+  DCHECK(vm->young_capacity);
+  gc_event event = begin_gc_event(vm, GC_KIND_MINOR, false);
+
+  gc_ctx ctx = {.vm = vm,
+                .collect_lo = vm->heap + vm->young_start,
+                .collect_hi = vm->heap + vm->heap_used,
+                .compact_to = vm->heap + vm->young_start,
+                .heap_base = vm->heap};
+  find_reference_classes(&ctx);
+  major_gc_enumerate_gc_roots(&ctx);
+  push_remembered_objects(&ctx);
+  allocate_mark_bitmaps(&ctx);
+
+  // Mark phase, treating every old object as live
+  mark_roots(&ctx);
+  for (int i = 0; i < arrlen(ctx.remembered); ++i) {
+    trace_fields(&ctx, ctx.remembered[i]);
+  }
+  drain_worklist(&ctx);
+  process_references(&ctx);
+  sweep_monitors(&ctx);
+  sweep_interned_strings(&ctx);
+
+  // The survivors will slide down onto the end of the old generation, promoting them. Rewrite every reference to
+  // them, then move them.
+  compute_forwarding_addresses(&ctx);
   for (int i = 0; i < arrlen(ctx.roots); ++i) {
-    object *obj = ctx.roots[i];
-    relocate_object(&ctx, obj);
+    relocate_object(&ctx, ctx.roots[i]);
   }
   relocate_instance_fields(&ctx);
+  for (int i = 0; i < arrlen(ctx.remembered); ++i) {
+    relocate_object_fields(&ctx, ctx.remembered[i]);
+  }
+  compact_objects(&ctx);
+  u8 *write_ptr = ctx.compact_to + ctx.live_bytes;
+  memset(write_ptr, 0, vm->heap + vm->heap_used - write_ptr); // see bump_allocate
+
+  event.live_objects = ctx.live_objects;
+  event.roots_scanned = arrlen(ctx.roots) + arrlen(ctx.remembered);
+  free_gc_ctx(&ctx);
+
+  // No old-to-young pointers remain, since there are no young objects left
+  memset(vm->card_table, 0, card_count(vm));
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    large_object_header(vm->large_objects[i])->dirty = false;
+  }
+  reset_tlabs(vm);
+  vm->heap_used = vm->young_start = write_ptr - vm->heap;
+  end_gc_event(vm, &event);
+  vm->gc_us_since_major += event.pause_us;
+}
 
-  arrfree(ctx.objs);
-  free(ctx.new_location);
-  arrfree(ctx.roots);
-  arrfree(ctx.relocations);
+// Heap capacity to use after a major GC that found live_bytes of live data, leaving at least `room` bytes free if
+// the maximum capacity allows it.
+static size_t choose_heap_capacity(vm *vm, size_t live_bytes, size_t room, u64 start_us) {
+  size_t capacity = vm->heap_capacity;
+  if (vm->heap_min_capacity == vm->heap_max_capacity) {
+    return capacity;
+  }
 
-#if NEW_HEAP_EACH_GC
-  free(vm->heap);
-#endif
+  switch (vm->heap_policy) {
+  case HEAP_POLICY_OCCUPANCY:
+    if (vm->heap_target_occupancy > 0) {
+      capacity = (u64)live_bytes * 100 / vm->heap_target_occupancy;
+    }
+    break;
+  case HEAP_POLICY_GC_TIME_RATIO: {
+    // Compare the time spent collecting (including this GC so far) to the time spent running since the last major GC
+    u64 now = get_unix_us();
+    u64 gc_us = vm->gc_us_since_major + (now - start_us);
+    u64 elapsed_us = now - vm->last_major_gc_end_us;
+    u64 mutator_us = elapsed_us > gc_us ? elapsed_us - gc_us : 0;
+    if (gc_us * vm->gc_time_ratio > mutator_us) {
+      capacity *= 2;
+    } else if (gc_us * vm->gc_time_ratio * 4 < mutator_us) {
+      capacity -= capacity / 4;
+    }
+    break;
+  }
+  }
+
+  if (capacity < live_bytes + room) {
+    capacity = live_bytes + room;
+  }
+  capacity = align_up(capacity, CARD_BYTES);
+  if (capacity < vm->heap_min_capacity) {
+    capacity = vm->heap_min_capacity;
+  }
+  if (capacity > vm->heap_max_capacity) {
+    capacity = vm->heap_max_capacity;
+  }
+  return capacity;
+}
+
+object **collect_gc_roots(vm *vm) {
+  gc_ctx ctx = {.vm = vm};
+  major_gc_enumerate_gc_roots(&ctx);
+  return ctx.roots;
+}
+
+static void major_gc_impl(vm *vm, size_t room, bool clear_soft_references) {
+  gc_event event = begin_gc_event(vm, GC_KIND_MAJOR, clear_soft_references);
+
+  // TODO wait for all threads to get ready (for now we'll just call this from
+  // an already-running thread)
+  gc_ctx ctx = {.vm = vm,
+                .collect_lo = vm->heap,
+                .collect_hi = vm->heap + vm->heap_used,
+                .mark_large_objects = true,
+                .unload_classes = true,
+                .clear_soft_references = clear_soft_references};
+  find_reference_classes(&ctx);
+  major_gc_enumerate_gc_roots(&ctx);
+  allocate_mark_bitmaps(&ctx);
+  begin_parallel_gc(&ctx);
+
+  mark_from_new_roots(&ctx);
+  process_references(&ctx);
+  sweep_monitors(&ctx);
+  sweep_interned_strings(&ctx);
+
+  compute_forwarding_addresses(&ctx);
+
+  // If the heap is being resized, compact into a newly allocated heap (and always do so when DCHECKs are enabled, so
+  // that ASAN can enjoy itself).
+  size_t new_capacity = choose_heap_capacity(vm, ctx.live_bytes + marked_large_object_bytes(vm), room, event.start_us);
+  u8 *new_heap = vm->heap;
+  if (NEW_HEAP_EACH_GC || new_capacity != vm->heap_capacity) {
+    new_heap = alloc_object_memory(new_capacity, false);
+    if (!new_heap) { // keep the current heap after all
+      new_heap = vm->heap;
+      new_capacity = vm->heap_capacity;
+    }
+  }
+  ctx.compact_to = ctx.heap_base = new_heap;
+
+  // Go through all static and instance fields and rewrite in place, while the objects are still at their old
+  // addresses.
+
+  if (!run_parallel_phase(&ctx, GC_PHASE_RELOCATE_ROOTS)) {
+    for (int i = 0; i < arrlen(ctx.roots); ++i) {
+      object *obj = ctx.roots[i];
+      relocate_object(&ctx, obj);
+    }
+  }
+  if (!run_parallel_phase(&ctx, GC_PHASE_RELOCATE_FIELDS)) {
+    relocate_instance_fields(&ctx);
+  }
+  relocate_large_object_fields(&ctx);
+
+  if (vm->old_object_starts) {
+    memset(vm->old_object_starts, 0, card_count(vm) * CARD_BYTES / 64);
+  }
+  if (!run_parallel_phase(&ctx, GC_PHASE_COMPACT)) {
+    compact_objects(&ctx);
+  }
+  u8 *write_ptr = new_heap + ctx.live_bytes;
+  // Allocation relies on the free part of the heap being zeroed (see bump_allocate). Clear it here in one go: the
+  // space vacated by compaction, or all of a new heap.
+  u8 *dirty_end = new_heap == vm->heap ? vm->heap + vm->heap_used : new_heap + new_capacity;
+  memset(write_ptr, 0, dirty_end - write_ptr);
+  sweep_large_objects(vm);
+  unload_classloaders(vm);
+
+  event.live_objects = ctx.live_objects;
+  event.roots_scanned = arrlen(ctx.roots);
+  free_gc_ctx(&ctx);
+
+  if (vm->young_capacity) {
+    memset(vm->card_table, 0, card_count(vm)); // before resizing, so that no dirty cards are left beyond the end
+  }
+  if (new_heap != vm->heap) {
+    free_object_memory(vm->heap, vm->heap_capacity);
+  }
 
   vm->heap = new_heap;
-  vm->heap_used = align_up(write_ptr - new_heap, 8);
-}
\ No newline at end of file
+  vm->heap_capacity = new_capacity;
+  vm->heap_used = write_ptr - new_heap;
+  if (vm->young_capacity) {
+    vm->young_start = vm->heap_used;
+  }
+  reset_tlabs(vm);
+  end_gc_event(vm, &event);
+  vm->gc_us_since_major = 0;
+  vm->last_major_gc_end_us = event.start_us + event.pause_us;
+}
+
+void major_gc(vm *vm) { major_gc_impl(vm, 0, false); }
+
+void major_gc_with_room(vm *vm, size_t room) { major_gc_impl(vm, room, false); }
+
+void major_gc_clearing_soft_references(vm *vm, size_t room) { major_gc_impl(vm, room, true); }
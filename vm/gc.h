@@ -3,8 +3,79 @@
 
 #include <bjvm.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A chunk of the large-object space, holding a single object directly after this header. Large objects are never
+// moved: major GCs mark-sweep them, and minor GCs treat them as old.
+typedef struct large_object {
+  size_t size; // bytes of the object
+  bool marked; // reachable, during a major GC
+  bool dirty;  // may reference young objects (analogous to a dirty card)
+} large_object;
+
+static inline large_object *large_object_header(obj_header *obj) { return (large_object *)obj - 1; }
+
+// Memory for the compacting heap and for large objects, or nullptr on failure. With COMPRESSED_REFS it is carved out of
+// the reservation that heap_refs are relative to (see bjvm.h), and is always zeroed; otherwise it is zeroed only if
+// `zeroed`.
+void *alloc_object_memory(size_t bytes, bool zeroed);
+void free_object_memory(void *memory, size_t bytes);
+
 int in_heap(const vm *vm, object field);
+// The large object containing p, or nullptr if there is none.
+obj_header *find_large_object(const vm *vm, const void *p);
+void gc_large_object_write_barrier(vm *vm, obj_header *holder);
 void major_gc(vm *vm);
+// Like major_gc, but grow the heap (up to its maximum capacity) if fewer than `bytes` would be free afterwards
+void major_gc_with_room(vm *vm, size_t bytes);
+// Like major_gc_with_room, but also clear every softly reachable object. The last resort before an OutOfMemoryError.
+void major_gc_clearing_soft_references(vm *vm, size_t bytes);
+// Collect only the young generation, promoting all survivors. Requires vm->young_capacity != 0.
+void minor_gc(vm *vm);
 size_t size_of_object(obj_header *obj);
+// Stop the threads which help with parallel collections, if any were started
+void free_gc_workers(vm *vm);
+// The slots a major GC would treat as roots (some may hold null), as an stb_ds array. Used for heap dumps.
+object **collect_gc_roots(vm *vm);
+
+typedef enum : u8 { GC_KIND_MINOR, GC_KIND_MAJOR, GC_KIND_COUNT } gc_kind;
+
+// A finished collection, as kept in the VM's event log
+typedef struct gc_event {
+  u64 id; // 1 for the VM's first collection, and so on
+  gc_kind kind;
+  bool cleared_soft_references;
+  u64 start_us; // when the collection began (unix time)
+  u64 pause_us;
+  // Bytes occupied by objects (including large objects), and the capacity of the compacting heap
+  size_t used_before, used_after;
+  size_t capacity_before, capacity_after;
+  size_t live_objects;  // objects found reachable in the collected region (the young generation, for a minor GC)
+  size_t roots_scanned; // root slots, plus remembered old objects for a minor GC
+} gc_event;
+
+#define GC_EVENT_LOG_CAPACITY 64
+
+// "Young" or "Full"
+const char *gc_kind_name(gc_kind kind);
+// Copy up to `max` of the most recent collections, oldest first, into `events`. Returns the number copied.
+int recent_gc_events(const vm *vm, gc_event *events, int max);
+
+// Write barrier: must be called after storing a reference into a field or element of `holder` (unless holder is
+// currently referenced from a handle, whose release dirties the card anyway). A no-op unless holder is old.
+static inline void gc_write_barrier(vm *vm, obj_header *holder) {
+  uintptr_t offset = (uintptr_t)holder - (uintptr_t)vm->heap;
+  if (offset < vm->young_start) {
+    vm->card_table[offset / CARD_BYTES] = 1;
+  } else if (offset >= vm->heap_capacity && vm->large_objects && vm->young_capacity) {
+    gc_large_object_write_barrier(vm, holder);
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
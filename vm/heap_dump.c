@@ -0,0 +1,522 @@
+#include "heap_dump.h"
+
+#include "arrays.h"
+#include "classloader.h"
+#include "gc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Visit every object in the heap and the large-object space. The unused tails of TLABs lie between the objects of the
+// heap, but they're zeroed (see bump_allocate), while an object's header word never is.
+static void walk_heap(vm *vm, void (*visit)(void *arg, object obj, size_t bytes), void *arg) {
+  u8 *p = vm->heap, *end = vm->heap + vm->heap_used;
+  while (p < end) {
+    if (*(u64 *)p == 0) {
+      p += 8;
+      continue;
+    }
+    object obj = (object)p;
+    size_t bytes = align_up(size_of_object(obj), 8);
+    visit(arg, obj, bytes);
+    p += bytes;
+  }
+  for (int i = 0; i < arrlen(vm->large_objects); ++i) {
+    object obj = vm->large_objects[i];
+    visit(arg, obj, large_object_header(obj)->size);
+  }
+}
+
+// Classes are keyed by the bytes of their classdesc pointer
+#define POINTER_KEY(p) (const char *)&(p), sizeof(p)
+
+typedef struct {
+  classdesc *desc;
+  size_t instances, bytes;
+} histogram_entry;
+
+typedef struct {
+  histogram_entry *entries;    // stb_ds array
+  string_hash_table positions; // classdesc -> 1 + index in entries
+} histogram;
+
+static void count_object(void *arg, object obj, size_t bytes) {
+  histogram *h = arg;
+  classdesc *desc = obj_class(obj);
+  uintptr_t position = (uintptr_t)hash_table_lookup(&h->positions, POINTER_KEY(desc));
+  if (!position) {
+    arrput(h->entries, ((histogram_entry){.desc = desc}));
+    position = arrlen(h->entries);
+    (void)hash_table_insert(&h->positions, POINTER_KEY(desc), (void *)position);
+  }
+  h->entries[position - 1].instances++;
+  h->entries[position - 1].bytes += bytes;
+}
+
+static int compare_histogram_entries(const void *a, const void *b) {
+  const histogram_entry *x = a, *y = b;
+  return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+char *heap_histogram(vm *vm) {
+  histogram h = {.positions = make_hash_table(nullptr, 0.75, 64)};
+  walk_heap(vm, count_object, &h);
+  qsort(h.entries, arrlen(h.entries), sizeof(histogram_entry), compare_histogram_entries);
+
+  string_builder out;
+  string_builder_init(&out);
+  string_builder_append(&out, " num     #instances         #bytes  class name\n");
+  string_builder_append(&out, "----------------------------------------------\n");
+  size_t total_instances = 0, total_bytes = 0;
+  for (int i = 0; i < arrlen(h.entries); ++i) {
+    histogram_entry *e = &h.entries[i];
+    string_builder_append(&out, "%4d: %14zu %14zu  %.*s\n", i + 1, e->instances, e->bytes, fmt_slice(e->desc->name));
+    total_instances += e->instances;
+    total_bytes += e->bytes;
+  }
+  string_builder_append(&out, "Total %14zu %14zu\n", total_instances, total_bytes);
+
+  char *result = strdup(out.data);
+  string_builder_free(&out);
+  arrfree(h.entries);
+  free_hash_table(h.positions);
+  return result;
+}
+
+// HPROF record tags, and sub-record tags within a heap dump segment
+enum {
+  HPROF_UTF8 = 0x01,
+  HPROF_LOAD_CLASS = 0x02,
+  HPROF_STACK_TRACE = 0x05,
+  HPROF_HEAP_DUMP_SEGMENT = 0x1C,
+  HPROF_HEAP_DUMP_END = 0x2C,
+
+  HPROF_GC_ROOT_UNKNOWN = 0xFF,
+  HPROF_GC_ROOT_STICKY_CLASS = 0x05,
+  HPROF_GC_CLASS_DUMP = 0x20,
+  HPROF_GC_INSTANCE_DUMP = 0x21,
+  HPROF_GC_OBJ_ARRAY_DUMP = 0x22,
+  HPROF_GC_PRIM_ARRAY_DUMP = 0x23,
+};
+
+// Every object is attributed to this (empty) stack trace
+enum { HPROF_STACK_SERIAL = 1 };
+
+// Records are gathered in memory and written out once about this many bytes have accumulated. The heap dump is split
+// into segments of about this size too, and arrays whose dump is larger are streamed in segments of their own.
+#define HPROF_FLUSH_BYTES (1 << 20)
+
+typedef struct {
+  vm *vm;
+  // Where the dump goes: a file, or if there is none, a growing heap allocation
+  FILE *file;
+  u8 *memory;
+  size_t memory_length, memory_capacity;
+  bool failed; // a write (or allocation) failed, so the output is incomplete
+
+  u8 *out;              // stb_ds array: what hasn't been written yet, at most about HPROF_FLUSH_BYTES
+  ptrdiff_t segment_at; // position in `out` of the open heap dump segment's length, or -1 if none is open
+  string_hash_table string_ids;
+  u64 next_string_id;
+  classdesc **classes; // stb_ds array of the classes to dump
+  string_hash_table class_set;
+  classdesc *Object;
+} hprof_ctx;
+
+static void put_u1(hprof_ctx *ctx, u8 value) { arrput(ctx->out, value); }
+
+static void put_u2(hprof_ctx *ctx, u16 value) {
+  put_u1(ctx, value >> 8);
+  put_u1(ctx, value);
+}
+
+static void put_u4(hprof_ctx *ctx, u32 value) {
+  put_u2(ctx, value >> 16);
+  put_u2(ctx, value);
+}
+
+static void put_u8(hprof_ctx *ctx, u64 value) {
+  put_u4(ctx, value >> 32);
+  put_u4(ctx, value);
+}
+
+static void put_id(hprof_ctx *ctx, const void *id) { put_u8(ctx, (uintptr_t)id); }
+
+// Write a record header, returning the position of its length to be filled in by end_record
+static size_t begin_record(hprof_ctx *ctx, u8 tag) {
+  put_u1(ctx, tag);
+  put_u4(ctx, 0); // microseconds since the header's timestamp
+  size_t length_at = arrlen(ctx->out);
+  put_u4(ctx, 0);
+  return length_at;
+}
+
+static void patch_u4(hprof_ctx *ctx, size_t at, u32 value) {
+  for (int i = 0; i < 4; ++i) {
+    ctx->out[at + i] = value >> (24 - 8 * i);
+  }
+}
+
+// Write out what has been gathered
+static void flush(hprof_ctx *ctx) {
+  size_t length = arrlen(ctx->out);
+  if (ctx->file) {
+    ctx->failed |= fwrite(ctx->out, 1, length, ctx->file) != length;
+  } else if (!ctx->failed) {
+    if (ctx->memory_length + length > ctx->memory_capacity) {
+      size_t capacity = 2 * (ctx->memory_length + length);
+      u8 *memory = realloc(ctx->memory, capacity);
+      if (!memory) {
+        ctx->failed = true;
+        arrsetlen(ctx->out, 0);
+        return;
+      }
+      ctx->memory = memory;
+      ctx->memory_capacity = capacity;
+    }
+    memcpy(ctx->memory + ctx->memory_length, ctx->out, length);
+    ctx->memory_length += length;
+  }
+  arrsetlen(ctx->out, 0);
+}
+
+// Fill in the record's length, and write out what has been gathered if it's enough. Records other than heap dump
+// segments are far smaller than 4 GiB, and segments are kept so (see next_sub_record).
+static void end_record(hprof_ctx *ctx, size_t length_at) {
+  patch_u4(ctx, length_at, arrlen(ctx->out) - length_at - 4);
+  if (arrlen(ctx->out) >= HPROF_FLUSH_BYTES)
+    flush(ctx);
+}
+
+static void end_segment(hprof_ctx *ctx) {
+  if (ctx->segment_at >= 0) {
+    end_record(ctx, ctx->segment_at);
+    ctx->segment_at = -1;
+  }
+}
+
+// Called before each sub-record of the heap dump: opens a segment for it, or starts a new one once the current
+// segment is large enough
+static void next_sub_record(hprof_ctx *ctx) {
+  if (ctx->segment_at >= 0 && arrlen(ctx->out) - ctx->segment_at >= HPROF_FLUSH_BYTES)
+    end_segment(ctx);
+  if (ctx->segment_at < 0)
+    ctx->segment_at = begin_record(ctx, HPROF_HEAP_DUMP_SEGMENT);
+}
+
+// The ID of the UTF8 record holding the string, writing the record the first time
+static u64 string_id(hprof_ctx *ctx, slice str) {
+  u64 id = (uintptr_t)hash_table_lookup(&ctx->string_ids, str.chars, (int)str.len);
+  if (!id) {
+    id = ++ctx->next_string_id;
+    (void)hash_table_insert(&ctx->string_ids, str.chars, (int)str.len, (void *)id);
+    size_t record = begin_record(ctx, HPROF_UTF8);
+    put_u8(ctx, id);
+    for (u32 i = 0; i < str.len; ++i) {
+      put_u1(ctx, str.chars[i]);
+    }
+    end_record(ctx, record);
+  }
+  return id;
+}
+
+// NOLINTNEXTLINE(misc-no-recursion)
+static void add_class(hprof_ctx *ctx, classdesc *desc) {
+  if (desc->kind == CD_KIND_PRIMITIVE || hash_table_contains(&ctx->class_set, POINTER_KEY(desc)))
+    return;
+  (void)hash_table_insert(&ctx->class_set, POINTER_KEY(desc), (void *)1);
+  arrput(ctx->classes, desc);
+  if (desc->super_class) {
+    add_class(ctx, desc->super_class->classdesc);
+  }
+}
+
+static void add_class_of_object(void *arg, object obj, size_t) { add_class(arg, obj_class(obj)); }
+
+static u8 hprof_basic_type(type_kind kind) {
+  switch (kind) {
+  case TYPE_KIND_REFERENCE:
+    return 2;
+  case TYPE_KIND_BOOLEAN:
+    return 4;
+  case TYPE_KIND_CHAR:
+    return 5;
+  case TYPE_KIND_FLOAT:
+    return 6;
+  case TYPE_KIND_DOUBLE:
+    return 7;
+  case TYPE_KIND_BYTE:
+    return 8;
+  case TYPE_KIND_SHORT:
+    return 9;
+  case TYPE_KIND_INT:
+    return 10;
+  case TYPE_KIND_LONG:
+    return 11;
+  default:
+    UNREACHABLE();
+  }
+}
+
+// Write a value of the given kind, as stored in memory, in big-endian order
+static void put_value(hprof_ctx *ctx, const void *p, type_kind kind) {
+  if (kind == TYPE_KIND_REFERENCE) {
+    put_id(ctx, *(void *const *)p); // IDs are 8 bytes, even where pointers aren't
+    return;
+  }
+  switch (sizeof_type_kind(kind)) {
+  case 1:
+    put_u1(ctx, *(const u8 *)p);
+    break;
+  case 2:
+    put_u2(ctx, *(const u16 *)p);
+    break;
+  case 4:
+    put_u4(ctx, *(const u32 *)p);
+    break;
+  default:
+    put_u8(ctx, *(const u64 *)p);
+    break;
+  }
+}
+
+static bool is_instance_field(const cp_field *field) { return !(field->access_flags & ACCESS_STATIC); }
+
+static void put_class_dump(hprof_ctx *ctx, classdesc *desc) {
+  next_sub_record(ctx);
+  put_u1(ctx, HPROF_GC_CLASS_DUMP);
+  put_id(ctx, desc);
+  put_u4(ctx, HPROF_STACK_SERIAL);
+  put_id(ctx, desc->kind == CD_KIND_ORDINARY ? (desc->super_class ? desc->super_class->classdesc : nullptr)
+                                             : ctx->Object);
+  put_id(ctx, desc->classloader ? desc->classloader->java_mirror : nullptr);
+  put_id(ctx, nullptr); // signers
+  put_id(ctx, nullptr); // protection domain
+  put_id(ctx, nullptr); // reserved
+  put_id(ctx, nullptr);
+  put_u4(ctx, desc->kind == CD_KIND_ORDINARY ? desc->instance_bytes : 0);
+  put_u2(ctx, 0); // constant pool
+
+  bool has_fields = desc->kind == CD_KIND_ORDINARY;
+  bool has_statics = has_fields && desc->static_fields;
+  u16 statics = 0, instance_fields = 0;
+  for (int i = 0; has_fields && i < desc->fields_count; ++i) {
+    if (is_instance_field(&desc->fields[i]))
+      instance_fields++;
+    else
+      statics += has_statics;
+  }
+
+  put_u2(ctx, statics);
+  for (int i = 0; has_statics && i < desc->fields_count; ++i) {
+    cp_field *field = &desc->fields[i];
+    if (is_instance_field(field))
+      continue;
+    type_kind kind = field->parsed_descriptor.repr_kind;
+    put_u8(ctx, string_id(ctx, field->name)); // already written (see dump_heap)
+    put_u1(ctx, hprof_basic_type(kind));
+    put_value(ctx, desc->static_fields + field->byte_offset, kind);
+  }
+  put_u2(ctx, instance_fields);
+  for (int i = 0; has_fields && i < desc->fields_count; ++i) {
+    cp_field *field = &desc->fields[i];
+    if (!is_instance_field(field))
+      continue;
+    put_u8(ctx, string_id(ctx, field->name));
+    put_u1(ctx, hprof_basic_type(field->parsed_descriptor.repr_kind));
+  }
+}
+
+// An array whose dump is larger than HPROF_FLUSH_BYTES, streamed in a segment of its own rather than gathered in
+// memory. Segment lengths are 32 bits, so arrays too large for one are truncated (as HotSpot does).
+static void put_large_array_dump(hprof_ctx *ctx, object obj, bool references, type_kind kind, size_t header_bytes) {
+  int element_size = references ? 8 : sizeof_type_kind(kind);
+  size_t length = ArrayLength(obj);
+  if (header_bytes + length * element_size > UINT32_MAX)
+    length = (UINT32_MAX - header_bytes) / element_size;
+
+  end_segment(ctx);
+  put_u1(ctx, HPROF_HEAP_DUMP_SEGMENT);
+  put_u4(ctx, 0);
+  put_u4(ctx, header_bytes + length * element_size);
+  put_u1(ctx, references ? HPROF_GC_OBJ_ARRAY_DUMP : HPROF_GC_PRIM_ARRAY_DUMP);
+  put_id(ctx, obj);
+  put_u4(ctx, HPROF_STACK_SERIAL);
+  put_u4(ctx, length);
+  if (references) {
+    put_id(ctx, obj_class(obj));
+  } else {
+    put_u1(ctx, hprof_basic_type(kind));
+  }
+  for (size_t i = 0; i < length; ++i) {
+    if (references) {
+      put_id(ctx, decode_heap_ref(ReferenceArrayData(obj)[i]));
+    } else {
+      put_value(ctx, (u8 *)ArrayData(obj) + i * element_size, kind);
+    }
+    if (arrlen(ctx->out) >= HPROF_FLUSH_BYTES)
+      flush(ctx);
+  }
+}
+
+static void put_object_dump(void *arg, object obj, size_t) {
+  hprof_ctx *ctx = arg;
+  classdesc *desc = obj_class(obj);
+  switch (desc->kind) {
+  case CD_KIND_ORDINARY: {
+    next_sub_record(ctx);
+    put_u1(ctx, HPROF_GC_INSTANCE_DUMP);
+    put_id(ctx, obj);
+    put_u4(ctx, HPROF_STACK_SERIAL);
+    put_id(ctx, desc);
+    size_t length_at = arrlen(ctx->out);
+    put_u4(ctx, 0);
+    // Field values, from the object's class up through its superclasses, each in declaration order
+    for (classdesc *c = desc; c; c = c->super_class ? c->super_class->classdesc : nullptr) {
+      for (int i = 0; i < c->fields_count; ++i) {
+        cp_field *field = &c->fields[i];
+        if (field->compressed) {
+          put_id(ctx, decode_heap_ref(*(heap_ref *)((u8 *)obj + field->byte_offset)));
+        } else if (is_instance_field(field)) {
+          put_value(ctx, (u8 *)obj + field->byte_offset, field->parsed_descriptor.repr_kind);
+        }
+      }
+    }
+    patch_u4(ctx, length_at, arrlen(ctx->out) - length_at - 4);
+    break;
+  }
+  case CD_KIND_ORDINARY_ARRAY:
+  case CD_KIND_PRIMITIVE_ARRAY: {
+    bool references = desc->kind == CD_KIND_ORDINARY_ARRAY || desc->dimensions > 1;
+    int length = ArrayLength(obj);
+    type_kind kind = references ? TYPE_KIND_REFERENCE : desc->primitive_component;
+    int element_size = references ? 8 : sizeof_type_kind(kind);
+    size_t header_bytes = 1 + 8 + 4 + 4 + (references ? 8 : 1);
+    if (header_bytes + (size_t)length * element_size > HPROF_FLUSH_BYTES) {
+      put_large_array_dump(ctx, obj, references, kind, header_bytes);
+      break;
+    }
+    next_sub_record(ctx);
+    put_u1(ctx, references ? HPROF_GC_OBJ_ARRAY_DUMP : HPROF_GC_PRIM_ARRAY_DUMP);
+    put_id(ctx, obj);
+    put_u4(ctx, HPROF_STACK_SERIAL);
+    put_u4(ctx, length);
+    if (references) {
+      put_id(ctx, desc);
+    } else {
+      put_u1(ctx, hprof_basic_type(kind));
+    }
+    for (int i = 0; i < length; ++i) {
+      if (references) {
+        put_id(ctx, decode_heap_ref(ReferenceArrayData(obj)[i]));
+      } else {
+        put_value(ctx, (u8 *)ArrayData(obj) + i * element_size, kind);
+      }
+    }
+    break;
+  }
+  default:
+    UNREACHABLE();
+  }
+}
+
+// Write the dump to ctx's file or memory
+static void dump_heap(hprof_ctx *ctx) {
+  vm *vm = ctx->vm;
+  ctx->segment_at = -1;
+  ctx->string_ids = make_hash_table(nullptr, 0.75, 1024);
+  ctx->class_set = make_hash_table(nullptr, 0.75, 1024);
+  ctx->Object = cached_classes(vm)->object;
+
+  const char header[] = "JAVA PROFILE 1.0.2";
+  for (size_t i = 0; i < sizeof(header); ++i) { // including the terminating null
+    put_u1(ctx, header[i]);
+  }
+  put_u4(ctx, 8); // size of IDs, which are addresses (of objects, or of classdescs for classes)
+  put_u8(ctx, get_unix_us() / 1000);
+
+  // Loaded classes (including those of every object on the heap) and their names
+  for (int i = 0; i < arrlen(vm->active_classloaders); ++i) {
+    hash_table_iterator it = hash_table_get_iterator(&vm->active_classloaders[i]->loaded);
+    char *key;
+    size_t key_len;
+    classdesc *desc;
+    while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
+      add_class(ctx, desc);
+      hash_table_iterator_next(&it);
+    }
+  }
+  walk_heap(vm, add_class_of_object, ctx);
+  for (int i = 0; i < arrlen(ctx->classes); ++i) {
+    classdesc *desc = ctx->classes[i];
+    // All strings are written up front, since they can't appear inside the heap dump segment
+    u64 name = string_id(ctx, desc->name);
+    for (int j = 0; desc->kind == CD_KIND_ORDINARY && j < desc->fields_count; ++j) {
+      string_id(ctx, desc->fields[j].name);
+    }
+    size_t record = begin_record(ctx, HPROF_LOAD_CLASS);
+    put_u4(ctx, i + 1); // class serial number
+    put_id(ctx, desc);
+    put_u4(ctx, HPROF_STACK_SERIAL);
+    put_u8(ctx, name);
+    end_record(ctx, record);
+  }
+
+  size_t record = begin_record(ctx, HPROF_STACK_TRACE);
+  put_u4(ctx, HPROF_STACK_SERIAL);
+  put_u4(ctx, 0); // thread serial number
+  put_u4(ctx, 0); // no frames
+  end_record(ctx, record);
+
+  object **roots = collect_gc_roots(vm);
+  for (int i = 0; i < arrlen(roots); ++i) {
+    if (*roots[i]) {
+      next_sub_record(ctx);
+      put_u1(ctx, HPROF_GC_ROOT_UNKNOWN);
+      put_id(ctx, *roots[i]);
+    }
+  }
+  arrfree(roots);
+  for (int i = 0; i < arrlen(ctx->classes); ++i) {
+    classdesc *desc = ctx->classes[i];
+    if (desc->classloader && desc->classloader->is_bootstrap) {
+      next_sub_record(ctx);
+      put_u1(ctx, HPROF_GC_ROOT_STICKY_CLASS);
+      put_id(ctx, desc);
+    }
+    put_class_dump(ctx, desc);
+  }
+  walk_heap(vm, put_object_dump, ctx);
+  end_segment(ctx);
+  end_record(ctx, begin_record(ctx, HPROF_HEAP_DUMP_END));
+  flush(ctx);
+
+  arrfree(ctx->out);
+  arrfree(ctx->classes);
+  free_hash_table(ctx->string_ids);
+  free_hash_table(ctx->class_set);
+}
+
+#ifdef EMSCRIPTEN
+u8 *heap_dump_hprof(vm *vm, size_t *length) {
+  hprof_ctx ctx = {.vm = vm};
+  dump_heap(&ctx);
+  if (ctx.failed) {
+    free(ctx.memory);
+    return nullptr;
+  }
+  *length = ctx.memory_length;
+  return ctx.memory;
+}
+#endif
+
+int write_heap_dump(vm *vm, const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return -1;
+  hprof_ctx ctx = {.vm = vm, .file = file};
+  dump_heap(&ctx);
+  bool ok = !ctx.failed;
+  ok &= fclose(file) == 0;
+  return ok ? 0 : -1;
+}
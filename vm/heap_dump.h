@@ -0,0 +1,36 @@
+// Heap inspection for diagnosing memory problems, roughly what jmap offers: a class histogram and an HPROF dump.
+
+#ifndef HEAP_DUMP_H
+#define HEAP_DUMP_H
+
+#include "bjvm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns a table of the number of instances and bytes per class on the heap (including the large-object space),
+// largest first, in the format of jmap -histo. Heap allocated; the caller must free it. Must be called while no thread
+// is allocating, e.g. from the thread that runs the VM.
+EMSCRIPTEN_KEEPALIVE
+char *heap_histogram(vm *vm);
+
+// Writes a heap dump in the HPROF binary format ("JAVA PROFILE 1.0.2", with 8-byte IDs) as read by VisualVM, Eclipse
+// MAT, etc., to the given file. The dump is written as it is produced, needing about a megabyte of memory whatever the
+// size of the heap, since it's taken on OutOfMemoryError. Returns 0 on success, and -1 if the file couldn't be written.
+// Same restrictions as heap_histogram.
+EMSCRIPTEN_KEEPALIVE
+int write_heap_dump(vm *vm, const char *path);
+
+#ifdef EMSCRIPTEN
+// The heap dump written by write_heap_dump, in memory for JavaScript to pick up, writing its length to *length. Heap
+// allocated; the caller must free it. Returns nullptr if memory runs out.
+EMSCRIPTEN_KEEPALIVE
+u8 *heap_dump_hprof(vm *vm, size_t *length);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HEAP_DUMP_H
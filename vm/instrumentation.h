@@ -54,6 +54,12 @@ static inline void InstrumentGCEnd() {
 #endif
 }
 
+static inline void InstrumentClassUnloaded(classdesc *cd) {
+#if DTRACE_ENABLED
+  BJVM_CLASS_UNLOADED(cd->name.chars, cd->name.len, cd->classloader, false);
+#endif
+}
+
 static inline void InstrumentObjectAlloc(vm_thread *thread, classdesc *cd, size_t size) {
 #if DTRACE_ENABLED
   BJVM_OBJECT_ALLOC(thread->tid, cd->name.chars, cd->name.len, size);
@@ -58,8 +58,10 @@
 #include "bjvm.h"
 #include "classfile.h"
 #include "dumb_jit.h"
+#include "jit_queue.h"
 #include "util.h"
 #include "wasm_trampolines.h"
+#include "x86_jit.h"
 
 #include <analysis.h>
 #include <debugger.h>
@@ -589,6 +591,7 @@ static continuation_frame *async_stack_peek(vm_thread *thread) {
 static bool refuel_check(vm_thread *thread) {
   const int REFUEL = 200000;
   thread->fuel = REFUEL;
+  jit_queue_install(thread->vm);
 
   if (thread->stack.synchronous_depth) // we're in a synchronous call, don't try to yield
     return false;
@@ -960,10 +963,22 @@ DEFINE_ASYNC(resolve_getfield_putfield) {
     ASYNC_RETURN(-1);
   }
 
-  inst->kind = getfield_putfield_resolved_kind(putfield, field_info->parsed_descriptor->repr_kind);
+  if (field_info->field->compressed)
+    inst->kind = putfield ? insn_putfield_N : insn_getfield_N;
+  else
+    inst->kind = getfield_putfield_resolved_kind(putfield, field_info->parsed_descriptor->repr_kind);
   inst->ic = field_info->field;
   inst->ic2 = (void *)field_info->field->byte_offset;
 
+  // Now that the field type is known, fuse a preceding aload into a superinstruction
+  bytecode_insn *prev = inst - 1;
+  if (inst > frame->code && prev->kind == insn_aload) {
+    if (inst->kind == insn_getfield_I)
+      prev->kind = insn_aload_getfield_I;
+    else if (inst->kind == insn_getfield_L)
+      prev->kind = insn_aload_getfield_L;
+  }
+
   ASYNC_END(0);
 
 #undef frame
@@ -1110,6 +1125,7 @@ static s64 putfield_L_impl_int(ARGS_INT) {
   NPE_ON_NULL(obj);
   obj_header **field = (obj_header **)((char *)obj + (size_t)insn->ic2);
   *field = (obj_header *)tos;
+  gc_write_barrier(thread->vm, obj);
   sp -= 2;
   STACK_POLYMORPHIC_NEXT(*(sp - 1));
 }
@@ -1145,6 +1161,24 @@ static s64 putfield_D_impl_double(ARGS_DOUBLE) {
   STACK_POLYMORPHIC_NEXT(*(sp - 1));
 }
 
+static s64 getfield_N_impl_int(ARGS_INT) {
+  DEBUG_CHECK();
+  NPE_ON_NULL(tos);
+  heap_ref *field = (heap_ref *)((char *)tos + (size_t)insn->ic2);
+  NEXT_INT(decode_heap_ref(*field))
+}
+
+static s64 putfield_N_impl_int(ARGS_INT) {
+  DEBUG_CHECK();
+  obj_header *obj = (sp - 2)->obj;
+  NPE_ON_NULL(obj);
+  heap_ref *field = (heap_ref *)((char *)obj + (size_t)insn->ic2);
+  *field = encode_heap_ref((obj_header *)tos);
+  gc_write_barrier(thread->vm, obj);
+  sp -= 2;
+  STACK_POLYMORPHIC_NEXT(*(sp - 1));
+}
+
 /** Arithmetic operations */
 
 // Binary operation on two integers (ints or longs)
@@ -1378,12 +1412,13 @@ static s64 aastore_impl_int(ARGS_INT) {
     return RETVAL_EXCEPTION_THROWN;
   }
   // Instanceof check against the component type
-  if (value && !instanceof(value->descriptor, array->descriptor->one_fewer_dim)) {
+  if (value && !instanceof(obj_class(value), obj_class(array)->one_fewer_dim)) {
     SPILL(tos);
-    raise_array_store_exception(thread, value->descriptor->name);
+    raise_array_store_exception(thread, obj_class(value)->name);
     return RETVAL_EXCEPTION_THROWN;
   }
   ReferenceArrayStore(array, index, value);
+  gc_write_barrier(thread->vm, array);
   sp -= 3;
   STACK_POLYMORPHIC_NEXT(*(sp - 1));
 }
@@ -1461,48 +1496,19 @@ static s64 goto_impl_int(ARGS_INT) {
 
 static s64 tableswitch_impl_int(ARGS_INT) {
   DEBUG_CHECK();
-  s32 index = (s32)tos;
-  s32 low = insn->tableswitch->low;
-  s32 high = insn->tableswitch->high;
-  s32 *offsets = insn->tableswitch->targets;
-  if (index < low || index > high) {
-    int delta = (s32)(insn->tableswitch->default_target - 1) - (s32)pc;
-
-    insns += delta;
-  } else {
-    int delta = (offsets[index - low] - 1) - pc;
-
-    insns += delta;
-  }
+  const struct tableswitch_data *data = insn->tableswitch;
+  u32 index = (u32)tos - (u32)data->low; // one comparison checks both bounds
+  int target = index < (u32)data->targets_count ? data->targets[index] : data->default_target;
+  insns = frame->code + target;
   sp--;
-  STACK_POLYMORPHIC_NEXT(*(sp - 1));
+  STACK_POLYMORPHIC_JMP(*(sp - 1));
 }
 
 static s64 lookupswitch_impl_int(ARGS_INT) {
   DEBUG_CHECK();
-  struct lookupswitch_data data = *insn->lookupswitch;
-
-  s32 key = (s32)tos;
-  s32 *keys = data.keys;
-  s32 *offsets = data.targets;
-  s32 n = data.keys_count;
-  s32 default_target = data.default_target;
-  // Look through keys one by one
-  for (int i = 0; i < n; i++) {
-    if (keys[i] == key) {
-      int delta = (offsets[i] - 1) - pc;
-
-      insns += delta;
-      sp--;
-      STACK_POLYMORPHIC_NEXT(*(sp - 1));
-    }
-  }
-  // No key found, jump to default
-  int delta = (default_target - 1) - pc;
-
-  insns += delta;
+  insns = frame->code + lookupswitch_target(insn->lookupswitch, (s32)tos);
   sp--;
-  STACK_POLYMORPHIC_NEXT(*(sp - 1));
+  STACK_POLYMORPHIC_JMP(*(sp - 1));
 }
 
 #define MAKE_INT_BRANCH_AGAINST_0(which, op)                                                                           \
@@ -1635,7 +1641,7 @@ FORWARD_TO_NULLARY(new)
 static s64 new_resolved_impl_void(ARGS_VOID) {
   DEBUG_CHECK();
   SPILL_VOID
-  obj_header *obj = new_object(thread, insn->classdesc);
+  obj_header *obj = AllocateObject(thread, insn->classdesc, insn->classdesc->instance_bytes);
   if (!obj)
     return RETVAL_EXCEPTION_THROWN;
 
@@ -1652,7 +1658,7 @@ static s64 newarray_impl_int(ARGS_INT) {
     raise_negative_array_size_exception(thread, count);
     return RETVAL_EXCEPTION_THROWN;
   }
-  obj_header *array = CreatePrimitiveArray1D(thread, insn->array_type, count);
+  obj_header *array = NewPrimitiveArray1D(thread, insn->array_type, count);
   if (unlikely(!array)) {
     return RETVAL_EXCEPTION_THROWN; // oom
   }
@@ -1685,7 +1691,7 @@ static s64 anewarray_resolved_impl_int(ARGS_INT) {
     return RETVAL_EXCEPTION_THROWN;
     ;
   }
-  obj_header *array = CreateObjectArray1D(thread, insn->classdesc, count);
+  obj_header *array = NewObjectArray1D(thread, insn->classdesc, count);
   if (likely(array)) {
     NEXT_INT(array)
   }
@@ -1757,40 +1763,66 @@ FORWARD_TO_NULLARY(invokestatic)
 
 #define AttemptInvoke(thread, invoked_frame, argc, returns) return 0;
 
-#define JIT_THRESHOLD 500
+// Ask for the method to be compiled with the baseline JIT (see jit_queue.h), or never again if the thread doesn't run
+// compiled code
+static void attempt_jit(vm_thread *thread, cp_method *method) {
+  if (!thread->js_jit_enabled) {
+    method->call_count = INT_MIN;
+    return;
+  }
+  jit_queue_request(thread, method, JIT_TIER_BASELINE, method->call_count);
+}
 
-void attempt_jit(cp_method *method) {
-  method->call_count = INT_MIN;
-  return;
+void jit_tier_up(vm_thread *thread, cp_method *method) {
+#ifdef X86_JIT_SUPPORTED
+  dumb_jit_result *baseline = method->jit_info;
+  if (baseline->compilations >= JIT_MAX_COMPILATIONS)
+    return;
+  // Count down again, so that the request gets hotter if it's still waiting by then
+  int threshold = thread->vm->opt_jit_threshold;
+  baseline->tier_up_countdown = threshold;
+  s64 hotness = (s64)threshold * ++baseline->tier_up_requests;
+  jit_queue_request(thread, method, JIT_TIER_OPTIMIZING, hotness > INT_MAX ? INT_MAX : (int)hotness);
+#else
+  (void)thread, (void)method;
+#endif
+}
 
-  CHECK(!method->jit_entry);
-  dumb_jit_options options = {};
-  dumb_jit_result *result = dumb_jit_compile(method, options);
-  printf("Attempted JIT for %.*s.%.*s\n", fmt_slice(method->my_class->name), fmt_slice(method->name));
-  if (result && method->trampoline) {
-    printf("Result: %p\n", result->entry);
-    method->jit_entry = result->entry;
-  } else {
-    method->call_count = INT_MIN;
+// Count a call of a method that hasn't been compiled, and compile it once it has been called jit_threshold times.
+// Nothing is counted if the JIT is disabled.
+static inline void consider_jit(vm_thread *thread, cp_method *method) {
+  if (unlikely(!method->jit_available) && thread->vm->jit_enabled &&
+      unlikely(++method->call_count >= thread->vm->jit_threshold)) {
+    attempt_jit(thread, method);
   }
 }
 
-// Expects sp and insn->args to be in scope
+void jit_count_call(vm_thread *thread, cp_method *method) { consider_jit(thread, method); }
+
+stack_value jit_call_interpreter(vm_thread *thread, cp_method *method, stack_value *args) {
+  consider_jit(thread, method);
+  if (method->jit_available) { // compiled since the caller loaded the method's jit_entry
+    ((jit_trampoline)method->trampoline)(method->jit_entry, thread, method, args);
+    return args[0];
+  }
+  return call_interpreter_synchronous(thread, method, args);
+}
+
+// Expects sp, insn and returns to be in scope. Runs the method's JITed code instead of pushing an interpreter frame,
+// if there is any.
 #define ConsiderJitEntry(thread, method, argz)                                                                         \
-  retry:                                                                                                               \
-  if (method->jit_entry) {                                                                                             \
+  consider_jit(thread, method);                                                                                        \
+  if ((method)->jit_available) {                                                                                       \
     ((jit_trampoline)(method)->trampoline)((method)->jit_entry, thread, method, argz);                                 \
     if (thread->current_exception) {                                                                                   \
       return RETVAL_EXCEPTION_THROWN;                                                                                  \
     }                                                                                                                  \
+    if (thread->stack.top != frame) { /* the compiled code handed its frame to the interpreter */                      \
+      return 0;                                                                                                        \
+    }                                                                                                                  \
     sp -= insn->args;                                                                                                  \
     sp += returns;                                                                                                     \
-    return 0;                                                                                                          \
-  } else if (method->call_count > JIT_THRESHOLD) {                                                                     \
-    attempt_jit(method);                                                                                               \
-    goto retry;                                                                                                        \
-  } else {                                                                                                             \
-    method->call_count += 15;                                                                                          \
+    STACK_POLYMORPHIC_NEXT(*(sp - 1));                                                                                 \
   }
 
 static s64 invokestatic_resolved_impl_void(ARGS_VOID) {
@@ -1868,8 +1900,8 @@ __attribute__((noinline)) static s64 invokevirtual_impl_void(ARGS_VOID) {
   }
 
   insn->kind = insn_invokevtable_monomorphic;
-  insn->ic = vtable_lookup(receiver->descriptor, method_info->resolved->vtable_index);
-  insn->ic2 = receiver->descriptor;
+  insn->ic = vtable_lookup(obj_class(receiver), method_info->resolved->vtable_index);
+  insn->ic2 = obj_class(receiver);
   JMP_VOID
 }
 FORWARD_TO_NULLARY(invokevirtual)
@@ -1983,7 +2015,7 @@ __attribute__((noinline)) static s64 invokeinterface_impl_void(ARGS_VOID) {
   mark_insn_returns(insn);
 
   cp_method *method =
-      itable_lookup(receiver->descriptor, method_info->resolved->my_class, method_info->resolved->itable_index);
+      itable_lookup(obj_class(receiver), method_info->resolved->my_class, method_info->resolved->itable_index);
   if (!method) {
     raise_abstract_method_error(thread, method_info->resolved);
     return RETVAL_EXCEPTION_THROWN;
@@ -1992,7 +2024,7 @@ __attribute__((noinline)) static s64 invokeinterface_impl_void(ARGS_VOID) {
   if (method_argc(method) != method_argc(method_info->resolved)) {
     printf("Looking for method %.*s.%.*s, receiver is %.*s; found %.*s.%.*s\n",
            fmt_slice(method_info->resolved->my_class->name), fmt_slice(method_info->resolved->name),
-           fmt_slice(receiver->descriptor->name), fmt_slice(method->my_class->name), fmt_slice(method->name));
+           fmt_slice(obj_class(receiver)->name), fmt_slice(method->my_class->name), fmt_slice(method->name));
   }
 
   if (method_info->resolved->access_flags & ACCESS_FINAL) { // if the method is FINAL, we can make it an invokespecial
@@ -2002,25 +2034,37 @@ __attribute__((noinline)) static s64 invokeinterface_impl_void(ARGS_VOID) {
   }
 
   insn->ic = method;
-  insn->ic2 = receiver->descriptor;
+  insn->ic2 = obj_class(receiver);
   insn->kind = insn_invokeitable_monomorphic;
   JMP_VOID
 }
 FORWARD_TO_NULLARY(invokeinterface)
 
-__attribute__((noinline)) void make_invokevtable_polymorphic_(bytecode_insn *inst) {
+// The new cache starts out with the receiver class and method of the monomorphic one
+__attribute__((noinline)) void make_invokevtable_polymorphic_(arena *arena, bytecode_insn *inst) {
   DCHECK(inst->kind == insn_invokevtable_monomorphic);
   cp_method *method = inst->ic;
   DCHECK(method);
+  polymorphic_cache *cache = arena_alloc(arena, 1, sizeof(polymorphic_cache));
+  *cache = (polymorphic_cache){
+      .index = method->vtable_index, .count = 1, .receivers = {inst->ic2}, .targets = {method}};
   inst->kind = insn_invokevtable_polymorphic;
-  inst->ic2 = (void *)method->vtable_index;
+  inst->ic = cache;
+  inst->ic2 = nullptr;
 }
 
-__attribute__((noinline)) void make_invokeitable_polymorphic_(bytecode_insn *inst) {
+__attribute__((noinline)) void make_invokeitable_polymorphic_(arena *arena, bytecode_insn *inst) {
   DCHECK(inst->kind == insn_invokeitable_monomorphic);
+  cp_method *resolved = inst->cp->methodref.resolved;
+  polymorphic_cache *cache = arena_alloc(arena, 1, sizeof(polymorphic_cache));
+  *cache = (polymorphic_cache){.interface = resolved->my_class,
+                               .index = resolved->itable_index,
+                               .count = 1,
+                               .receivers = {inst->ic2},
+                               .targets = {inst->ic}};
   inst->kind = insn_invokeitable_polymorphic;
-  inst->ic = (void *)inst->cp->methodref.resolved->my_class;
-  inst->ic2 = (void *)inst->cp->methodref.resolved->itable_index;
+  inst->ic = cache;
+  inst->ic2 = nullptr;
 }
 
 static s64 invokeitable_vtable_monomorphic_impl_void(ARGS_VOID) {
@@ -2029,11 +2073,11 @@ static s64 invokeitable_vtable_monomorphic_impl_void(ARGS_VOID) {
   bool returns = insn->returns;
   SPILL_VOID
   NPE_ON_NULL(receiver);
-  if (unlikely(receiver->descriptor != insn->ic2)) {
+  if (unlikely(obj_class(receiver) != insn->ic2)) {
     if (insn->kind == insn_invokevtable_monomorphic)
-      make_invokevtable_polymorphic_(insn);
+      make_invokevtable_polymorphic_(&frame->method->my_class->arena, insn);
     else
-      make_invokeitable_polymorphic_(insn);
+      make_invokeitable_polymorphic_(&frame->method->my_class->arena, insn);
     JMP_VOID
   }
 
@@ -2083,7 +2127,7 @@ static s64 invokeitable_polymorphic_impl_void(ARGS_VOID) {
   bool returns = insn->returns;
   SPILL_VOID
   NPE_ON_NULL(receiver);
-  cp_method *receiver_method = itable_lookup(receiver->descriptor, insn->ic, (size_t)insn->ic2);
+  cp_method *receiver_method = polymorphic_cache_lookup(insn->ic, obj_class(receiver));
   if (unlikely(!receiver_method)) {
     raise_abstract_method_error(thread, insn->cp->methodref.resolved);
     return RETVAL_EXCEPTION_THROWN;
@@ -2106,7 +2150,7 @@ static s64 invokevtable_polymorphic_impl_void(ARGS_VOID) {
   bool returns = insn->returns;
   SPILL_VOID
   NPE_ON_NULL(receiver);
-  cp_method *receiver_method = vtable_lookup(receiver->descriptor, (size_t)insn->ic2);
+  cp_method *receiver_method = polymorphic_cache_lookup(insn->ic, obj_class(receiver));
   DCHECK(receiver_method);
 
   ConsiderJitEntry(thread, receiver_method, sp - insn->args);
@@ -2288,6 +2332,83 @@ static s64 iinc_impl_int(ARGS_INT) {
   NEXT_INT(tos)
 }
 
+/** Superinstructions (formed by fuse_superinstructions in analysis.c, and by resolve_getfield_putfield) */
+
+// These step insns onto each absorbed instruction before doing its part of the work, so that a spill or exception
+// there sees the same pc as it would have without fusion.
+
+static s64 aload_getfield_I_impl_void(ARGS_VOID) {
+  DEBUG_CHECK();
+  obj_header *obj = get_local(frame, insn)->obj;
+  insns++;
+  sp++;
+  NPE_ON_NULL(obj);
+  int *field = (int *)((char *)obj + (size_t)insn->ic2);
+  NEXT_INT((s64)*field)
+}
+FORWARD_TO_NULLARY(aload_getfield_I)
+
+static s64 aload_getfield_L_impl_void(ARGS_VOID) {
+  DEBUG_CHECK();
+  obj_header *obj = get_local(frame, insn)->obj;
+  insns++;
+  sp++;
+  NPE_ON_NULL(obj);
+  obj_header **field = (obj_header **)((char *)obj + (size_t)insn->ic2);
+  NEXT_INT(*field)
+}
+FORWARD_TO_NULLARY(aload_getfield_L)
+
+static s64 aload_arraylength_impl_void(ARGS_VOID) {
+  DEBUG_CHECK();
+  obj_header *array = get_local(frame, insn)->obj;
+  insns++;
+  sp++;
+  NPE_ON_NULL(array);
+  NEXT_INT(ArrayLength(array))
+}
+FORWARD_TO_NULLARY(aload_arraylength)
+
+static s64 iload_iload_iadd_impl_void(ARGS_VOID) {
+  DEBUG_CHECK();
+  s32 a = get_local(frame, insn)->i, b = get_local(frame, insn + 1)->i;
+  insns += 2;
+  sp++;
+  NEXT_INT((s32)((u32)a + (u32)b))
+}
+FORWARD_TO_NULLARY(iload_iload_iadd)
+
+// Only formed when the stack is empty
+static s64 iinc_goto_impl_void(ARGS_VOID) {
+  DEBUG_CHECK();
+  FUEL_CHECK_VOID // before the increment, since we resume at the iinc
+  int *a = &frame_locals(frame)[insn->iinc.index].i;
+  __builtin_add_overflow(*a, insn->iinc.const_, a);
+  insns++;
+  insns = (bytecode_insn *)((char *)insns + insn->delta);
+  JMP_VOID
+}
+
+// iload; if_icmp<op>, where the TOS is the first operand of the comparison
+#define MAKE_ILOAD_INT_BRANCH(which, op)                                                                               \
+  static s64 iload_##which##_impl_int(ARGS_INT) {                                                                      \
+    DEBUG_CHECK();                                                                                                     \
+    FUEL_CHECK                                                                                                         \
+    s32 a = (s32)tos, b = get_local(frame, insn)->i;                                                                   \
+    insns++;                                                                                                           \
+    s32 offset = UNPREDICTABLE(a op b) ? insn->delta : (s32)sizeof(bytecode_insn);                                     \
+    insns = (bytecode_insn *)((char *)insns + offset);                                                                 \
+    sp--;                                                                                                              \
+    STACK_POLYMORPHIC_JMP(*(sp - 1));                                                                                  \
+  }
+
+MAKE_ILOAD_INT_BRANCH(if_icmpeq, ==)
+MAKE_ILOAD_INT_BRANCH(if_icmpne, !=)
+MAKE_ILOAD_INT_BRANCH(if_icmplt, <)
+MAKE_ILOAD_INT_BRANCH(if_icmpge, >=)
+MAKE_ILOAD_INT_BRANCH(if_icmpgt, >)
+MAKE_ILOAD_INT_BRANCH(if_icmple, <=)
+
 /** Constant-pushing instructions */
 
 static s64 aconst_null_impl_void(ARGS_VOID) {
@@ -2547,9 +2668,9 @@ static s64 checkcast_impl_int(ARGS_INT) {
 static s64 checkcast_resolved_impl_int(ARGS_INT) {
   DEBUG_CHECK();
   obj_header *obj = (obj_header *)tos;
-  if (obj && unlikely(!instanceof(obj->descriptor, insn->classdesc))) {
+  if (obj && unlikely(!instanceof(obj_class(obj), insn->classdesc))) {
     SPILL(tos)
-    raise_class_cast_exception(thread, obj->descriptor, insn->classdesc);
+    raise_class_cast_exception(thread, obj_class(obj), insn->classdesc);
     return RETVAL_EXCEPTION_THROWN;
   }
   NEXT_INT(tos)
@@ -2572,7 +2693,7 @@ static s64 instanceof_impl_int(ARGS_INT) {
 static s64 instanceof_resolved_impl_int(ARGS_INT) {
   DEBUG_CHECK();
   obj_header *obj = (obj_header *)tos;
-  int result = obj ? instanceof(obj->descriptor, insn->classdesc) : 0;
+  int result = obj ? instanceof(obj_class(obj), insn->classdesc) : 0;
   NEXT_INT(result)
 }
 
@@ -2680,11 +2801,17 @@ __attribute__((always_inline)) static s64 entry_notco_impl(vm_thread *thread, st
       standard_debugger *dbg = get_active_debugger(thread->vm);
       DCHECK(dbg && "Debugger not active");
       frame->program_counter = code - frame->code;
-      bool should_pause = dbg->should_pause(dbg, thread, frame);
+      // Other threads keep running (and collecting) while this one is paused, so only pause where there's a GC map
+      bool should_pause = gc_map_at(frame->method->code_analysis, frame->program_counter) &&
+                          dbg->should_pause(dbg, thread, frame);
       if (should_pause) {
         debugger_pause(thread, frame);
         return 0;
       }
+      // Superinstructions would skip over the pcs of the instructions they absorb, so step through those one by one
+      if (handler_i < 4 * MAX_INSN_KIND) {
+        handler_i = 4 * unfused_insn_kind(handler_i / 4) + handler_i % 4;
+      }
     }
 
     enum {
@@ -2779,22 +2906,25 @@ static exception_table_entry *find_exception_handler(vm_thread *thread, stack_fr
 
   int const pc_ = frame->program_counter;
 
-  for (int i = 0; i < table->entries_count; ++i) {
-    exception_table_entry *ent = &table->entries[i];
+  // Only the entries covering pc_, in table order
+  for (const s32 *i = table->handler_lists + table->insn_handlers[pc_]; *i >= 0; ++i) {
+    exception_table_entry *ent = &table->entries[*i];
+    DCHECK(ent->start_insn <= pc_ && pc_ < ent->end_insn);
 
-    if (ent->start_insn <= pc_ && pc_ < ent->end_insn) {
-      if (ent->catch_type) {
-        int error = resolve_class(thread, ent->catch_type) || link_class(thread, ent->catch_type->classdesc);
-        if (error)
-          continue; // can happen if the current classloader != verifier classloader?
-      }
+    if (!ent->catch_type)
+      return ent;
 
-      if (!ent->catch_type || instanceof(exception_type, ent->catch_type->classdesc)) {
-        if (ent->catch_type)
-          DCHECK(ent->catch_type->classdesc->state >= CD_STATE_INITIALIZED);
+    classdesc *catch_type = ent->catch_type->classdesc;
+    if (!catch_type || catch_type->state < CD_STATE_LINKED) {
+      int error = resolve_class(thread, ent->catch_type) || link_class(thread, ent->catch_type->classdesc);
+      if (error)
+        continue; // can happen if the current classloader != verifier classloader?
+      catch_type = ent->catch_type->classdesc;
+    }
 
-        return ent;
-      }
+    if (instanceof(exception_type, catch_type)) {
+      DCHECK(catch_type->state >= CD_STATE_INITIALIZED);
+      return ent;
     }
   }
 
@@ -3105,7 +3235,7 @@ stack_value interpret_2(future_t *fut, vm_thread *thread, stack_frame *entry_fra
       if (unlikely(thread->current_exception)) {
       find_exception_handler:
         exception_table_entry *handler =
-            find_exception_handler(thread, current_frame, thread->current_exception->descriptor);
+            find_exception_handler(thread, current_frame, obj_class(thread->current_exception));
         if (handler) {
           current_frame->program_counter = handler->handler_insn;
           current_frame->stack[0] = (stack_value){.obj = thread->current_exception};
@@ -3183,6 +3313,11 @@ PAGE_ALIGN static s64 (*jmp_table_void[MAX_INSN_KIND])(ARGS_VOID) = {
     [insn_getstatic_D] = getstatic_D_impl_void,
     [insn_getstatic_Z] = getstatic_Z_impl_void,
     [insn_getstatic_L] = getstatic_L_impl_void,
+    [insn_aload_getfield_I] = aload_getfield_I_impl_void,
+    [insn_aload_getfield_L] = aload_getfield_L_impl_void,
+    [insn_aload_arraylength] = aload_arraylength_impl_void,
+    [insn_iload_iload_iadd] = iload_iload_iadd_impl_void,
+    [insn_iinc_goto] = iinc_goto_impl_void,
 };
 
 PAGE_ALIGN static s64 (*jmp_table_double[MAX_INSN_KIND])(ARGS_VOID) = {
@@ -3257,7 +3392,11 @@ PAGE_ALIGN static s64 (*jmp_table_double[MAX_INSN_KIND])(ARGS_VOID) = {
     [insn_sin] = sin_impl_double,
     [insn_cos] = cos_impl_double,
     [insn_tan] = tan_impl_double,
-    [insn_sqrt] = sqrt_impl_double};
+    [insn_sqrt] = sqrt_impl_double,
+    [insn_aload_getfield_I] = aload_getfield_I_impl_double,
+    [insn_aload_getfield_L] = aload_getfield_L_impl_double,
+    [insn_aload_arraylength] = aload_arraylength_impl_double,
+    [insn_iload_iload_iadd] = iload_iload_iadd_impl_double};
 
 PAGE_ALIGN static s64 (*jmp_table_int[MAX_INSN_KIND])(ARGS_VOID) = {
     [insn_nop] = nop_impl_int,
@@ -3419,6 +3558,18 @@ PAGE_ALIGN static s64 (*jmp_table_int[MAX_INSN_KIND])(ARGS_VOID) = {
     [insn_putstatic_J] = putstatic_J_impl_int,
     [insn_putstatic_Z] = putstatic_Z_impl_int,
     [insn_putstatic_L] = putstatic_L_impl_int,
+    [insn_getfield_N] = getfield_N_impl_int,
+    [insn_putfield_N] = putfield_N_impl_int,
+    [insn_aload_getfield_I] = aload_getfield_I_impl_int,
+    [insn_aload_getfield_L] = aload_getfield_L_impl_int,
+    [insn_aload_arraylength] = aload_arraylength_impl_int,
+    [insn_iload_iload_iadd] = iload_iload_iadd_impl_int,
+    [insn_iload_if_icmpeq] = iload_if_icmpeq_impl_int,
+    [insn_iload_if_icmpne] = iload_if_icmpne_impl_int,
+    [insn_iload_if_icmplt] = iload_if_icmplt_impl_int,
+    [insn_iload_if_icmpge] = iload_if_icmpge_impl_int,
+    [insn_iload_if_icmpgt] = iload_if_icmpgt_impl_int,
+    [insn_iload_if_icmple] = iload_if_icmple_impl_int,
 };
 
 PAGE_ALIGN static s64 (*jmp_table_float[MAX_INSN_KIND])(ARGS_VOID) = {
@@ -3493,4 +3644,8 @@ PAGE_ALIGN static s64 (*jmp_table_float[MAX_INSN_KIND])(ARGS_VOID) = {
     [insn_sin] = sin_impl_float,
     [insn_cos] = cos_impl_float,
     [insn_tan] = tan_impl_float,
-    [insn_sqrt] = sqrt_impl_float};
\ No newline at end of file
+    [insn_sqrt] = sqrt_impl_float,
+    [insn_aload_getfield_I] = aload_getfield_I_impl_float,
+    [insn_aload_getfield_L] = aload_getfield_L_impl_float,
+    [insn_aload_arraylength] = aload_arraylength_impl_float,
+    [insn_iload_iload_iadd] = iload_iload_iadd_impl_float};
\ No newline at end of file
@@ -2,61 +2,230 @@
 // Created by Cowpox on 2/20/25.
 //
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // memfd_create
+#endif
+
 #include "jit_allocator.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "adt.h"
+#include "util.h"
+
+#if (defined(__linux__) || defined(__APPLE__)) && !defined(EMSCRIPTEN)
+#define JIT_ARENA_SUPPORTED
+#endif
+
+#ifdef JIT_ARENA_SUPPORTED
 
-#ifdef __APPLE__
-#include <mach/mach.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
-void *jit_arena; // initialized with mmap
-constexpr int JIT_SIZE = 1 << 24;
+#ifdef __APPLE__
+#include <libkern/OSCacheControl.h>
+#endif
 
-struct jit_function {
-  void *addr;                              // callable function pointer, using native calling convention
-  void (*free)(struct jit_function *self); // release resources
-};
+// Size of each chunk the arena grows by (more for code which doesn't fit in one)
+#define JIT_CHUNK_BYTES (1 << 24)
+// Granularity of allocations, so that code starts on a cache line
+#define JIT_CODE_ALIGN 64
+
+typedef struct {
+  size_t start, size; // in bytes from the start of the chunk
+} free_extent;
+
+typedef struct {
+  char *exec;  // where the code runs
+  char *write; // where it is copied in: another view of the same memory on Linux, the same address on macOS
+  size_t size;
+  free_extent *free_extents; // stb_ds array, sorted by address and coalesced
+} code_chunk;
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static code_chunk *chunks; // stb_ds array
+static size_t page_size;
+#ifndef __APPLE__
+static int code_fd = -1;     // memfd holding all the chunks, one after the other
+static off_t code_fd_size;
+#endif
+static bool arena_broken; // we couldn't map a chunk, so don't try again
+
+// Map a new chunk of at least `bytes` bytes. Requires arena_lock.
+static code_chunk *add_chunk(size_t bytes) {
+  if (arena_broken)
+    return nullptr;
+  if (!page_size)
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = bytes > JIT_CHUNK_BYTES ? (bytes + page_size - 1) / page_size * page_size : JIT_CHUNK_BYTES;
+  code_chunk chunk = {.size = size};
 
-struct jit_context {
-  char *insts;
-  size_t insts_bytes;
-  size_t write_offset; // where to put it in the arena.
+#ifdef __APPLE__
+  // MAP_JIT pages are writable or executable depending on the thread, see write_code
+  chunk.exec = mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE | MAP_JIT, -1, 0);
+  if (chunk.exec == MAP_FAILED) {
+    perror("mmap (JIT arena)");
+    arena_broken = true;
+    return nullptr;
+  }
+  chunk.write = chunk.exec;
+#else
+  // Pages of the memfd are only backed by memory once code is written to them
+  if (code_fd < 0 && (code_fd = memfd_create("jit code", MFD_CLOEXEC)) < 0) {
+    perror("memfd_create (JIT arena)");
+    arena_broken = true;
+    return nullptr;
+  }
+  off_t offset = code_fd_size;
+  if (ftruncate(code_fd, offset + (off_t)size)) {
+    perror("ftruncate (JIT arena)");
+    arena_broken = true;
+    return nullptr;
+  }
+  code_fd_size += (off_t)size;
+  chunk.exec = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, code_fd, offset);
+  chunk.write = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, code_fd, offset);
+  if (chunk.exec == MAP_FAILED || chunk.write == MAP_FAILED) {
+    perror("mmap (JIT arena)");
+    if (chunk.exec != MAP_FAILED)
+      munmap(chunk.exec, size);
+    if (chunk.write != MAP_FAILED)
+      munmap(chunk.write, size);
+    arena_broken = true;
+    return nullptr;
+  }
+#endif
+
+  arrput(chunk.free_extents, ((free_extent){0, size}));
+  arrput(chunks, chunk);
+  return &arrlast(chunks);
+}
+
+#ifdef __APPLE__
+struct jit_write {
+  void *dest;
+  const void *code;
+  size_t size;
 };
 
-int jit_writing_callback(void *context) {
-  auto ctx = (struct jit_context *)context;
-  memcpy(jit_arena, ctx->insts, ctx->insts_bytes);
+static int jit_writing_callback(void *context) {
+  struct jit_write *write = context;
+  memcpy(write->dest, write->code, write->size);
   return 0;
 }
 
 PTHREAD_JIT_WRITE_ALLOW_CALLBACKS_NP(jit_writing_callback);
+#endif
 
-void initialize_jit_arena() {
-  if (jit_arena)
-    return;
+static void write_code(const code_chunk *chunk, size_t start, const void *code, size_t size) {
+#ifdef __APPLE__
+  struct jit_write write = {chunk->write + start, code, size};
+  pthread_jit_write_with_callback_np(jit_writing_callback, &write);
+  sys_icache_invalidate(chunk->exec + start, size);
+#else
+  memcpy(chunk->write + start, code, size);
+  __builtin___clear_cache(chunk->exec + start, chunk->exec + start + size);
+#endif
+}
+
+// Give the whole pages of a free extent back to the OS. Requires arena_lock.
+static void release_pages(const code_chunk *chunk, const free_extent *extent) {
+#ifdef __APPLE__
+  (void)chunk, (void)extent;
+#else
+  size_t start = (extent->start + page_size - 1) / page_size * page_size;
+  size_t end = (extent->start + extent->size) / page_size * page_size;
+  if (start < end)
+    madvise(chunk->write + start, end - start, MADV_REMOVE);
+#endif
+}
+
+// Take `bytes` bytes from the first free extent of the chunk that has room. Requires arena_lock.
+static bool take_from_chunk(code_chunk *chunk, size_t bytes, size_t *start) {
+  for (int i = 0; i < arrlen(chunk->free_extents); ++i) { // first fit
+    free_extent *extent = chunk->free_extents + i;
+    if (extent->size >= bytes) {
+      *start = extent->start;
+      extent->start += bytes;
+      extent->size -= bytes;
+      if (extent->size == 0)
+        arrdel(chunk->free_extents, i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Put space back on the chunk's free list, merging it with its neighbours. Requires arena_lock.
+static void return_to_chunk(code_chunk *chunk, size_t start, size_t bytes) {
+  free_extent *list = chunk->free_extents;
+  int i = 0;
+  while (i < arrlen(list) && list[i].start < start)
+    ++i;
+  arrins(list, i, ((free_extent){start, bytes}));
+  if (i + 1 < arrlen(list) && start + bytes == list[i + 1].start) {
+    list[i].size += list[i + 1].size;
+    arrdel(list, i + 1);
+  }
+  if (i > 0 && list[i - 1].start + list[i - 1].size == start) {
+    list[i - 1].size += list[i].size;
+    arrdel(list, i);
+    --i;
+  }
+  chunk->free_extents = list;
+  release_pages(chunk, list + i);
+}
+
+void *jit_install_code(const void *code, size_t size) {
+  if (size == 0)
+    return nullptr;
+  size_t bytes = (size + JIT_CODE_ALIGN - 1) / JIT_CODE_ALIGN * JIT_CODE_ALIGN;
+
+  pthread_mutex_lock(&arena_lock);
+  code_chunk *chunk = nullptr;
+  size_t start;
+  for (int i = 0; i < arrlen(chunks) && !chunk; ++i) {
+    if (take_from_chunk(chunks + i, bytes, &start))
+      chunk = chunks + i;
+  }
+  if (!chunk && (chunk = add_chunk(bytes)))
+    take_from_chunk(chunk, bytes, &start);
+  code_chunk copy = chunk ? *chunk : (code_chunk){};
+  pthread_mutex_unlock(&arena_lock);
+  if (!chunk)
+    return nullptr; // no executable memory
 
-  jit_arena = mmap(NULL, JIT_SIZE, PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE | MAP_JIT, -1, 0);
-  if (jit_arena == MAP_FAILED) {
-    perror("mmap");
-    exit(1);
+  // The space is ours, so nobody else touches it while we write (chunk itself may move as chunks grows)
+  write_code(&copy, start, code, size);
+  return copy.exec + start;
+}
+
+void jit_free_code(void *code, size_t size) {
+  if (!code)
+    return;
+  size_t bytes = (size + JIT_CODE_ALIGN - 1) / JIT_CODE_ALIGN * JIT_CODE_ALIGN;
+  pthread_mutex_lock(&arena_lock);
+  for (int i = 0; i < arrlen(chunks); ++i) {
+    code_chunk *chunk = chunks + i;
+    if ((char *)code >= chunk->exec && (char *)code < chunk->exec + chunk->size) {
+      return_to_chunk(chunk, (char *)code - chunk->exec, bytes);
+      break;
+    }
   }
+  pthread_mutex_unlock(&arena_lock);
+}
 
-  struct jit_context ctx;
-  char shellcode[] = {
-      0x00, 0x00, 0x01, 0x0b, // add w0, w0, w1
-      0xc0, 0x03, 0x5f, 0xd6  // ret
-  };
-  ctx.insts = shellcode;
-  ctx.insts_bytes = sizeof(shellcode);
-  pthread_jit_write_with_callback_np(jit_writing_callback, &ctx);
+#else
 
-  typedef int (*add_fn)(int, int);
-  add_fn add = (add_fn)jit_arena;
-  printf("add(1, 2) = %d\n", add(1, 2));
+void *jit_install_code(const void *code, size_t size) {
+  (void)code, (void)size;
+  return nullptr;
 }
 
-#endif
\ No newline at end of file
+void jit_free_code(void *code, size_t size) { (void)code, (void)size; }
+
+#endif
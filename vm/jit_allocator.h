@@ -5,8 +5,31 @@
 #ifndef JIT_ALLOCATOR_H
 #define JIT_ALLOCATOR_H
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Service to allocate executable memory for JIT code.
+//
+// Code is carved out of chunks at cache-line granularity, first fit, so that small methods share pages and each piece
+// of code can be freed on its own. The arena grows by a chunk when no chunk has room, and freed space is reused (and
+// its whole pages given back to the OS). Code is written once, when it is installed, and never changes afterwards.
+// Code is never written through the address it runs at: on Linux each chunk is mapped twice from a memfd, executable
+// and writable, so installing code is just a copy; on macOS chunks are mapped with MAP_JIT and written through
+// pthread_jit_write_with_callback_np. Other platforms have no executable arena.
+
+// Copy `size` bytes of machine code into executable memory, returning its address, or nullptr if there is no room (or
+// no executable memory on this platform). Thread-safe.
+void *jit_install_code(const void *code, size_t size);
+
+// Release code returned by jit_install_code, which must no longer be running. `size` is the size it was installed
+// with. Thread-safe.
+void jit_free_code(void *code, size_t size);
 
-void initialize_jit_arena();
+#ifdef __cplusplus
+}
+#endif
 
 #endif // JIT_ALLOCATOR_H
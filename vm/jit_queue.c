@@ -0,0 +1,366 @@
+#include "jit_queue.h"
+#include "analysis.h"
+#include "arrays.h"
+#include "dumb_jit.h"
+#include "util.h"
+#include "x86_jit.h"
+#include "x86_opt_jit.h"
+
+#include <inttypes.h>
+
+// Compiler threads need a JIT which emits native code: WebAssembly modules are instantiated per thread, so the
+// WebAssembly JIT runs on the VM thread, in scheduler slices.
+#ifdef X86_JIT_SUPPORTED
+#define COMPILER_THREADS_SUPPORTED
+#include <pthread.h>
+#endif
+
+typedef struct compile_request {
+  cp_method *method;
+  jit_tier tier;
+  int hotness; // raised by the VM thread while compiler threads pick the hottest request, hence accessed atomically
+  // method->jit_info when the method asked. The code is dropped if the method has other code by the time it's done.
+  void *expected;
+  // For baseline compilations on compiler threads: the copy of the instructions which is compiled, compared with the
+  // method's own before the code is installed
+  bytecode_insn *insns;
+  ssa_function *fn; // for optimizing compilations: the SSA form, built when the method asked
+  dumb_jit_result *result; // once compiled; nullptr if the method can't be compiled
+  u64 requested_us, compile_us;
+} compile_request;
+
+typedef struct jit_queue {
+  vm *vm;
+  compile_request **waiting; // stb_ds array, in no particular order
+  compile_request **done;    // stb_ds array of compiled requests for the VM thread to install
+  int done_count;            // arrlen(done), read without the lock at fuel checks
+  int compiling;             // requests taken by compiler threads and not yet done
+  int thread_count;          // compiler threads running (0 to compile in scheduler slices)
+  jit_queue_stats stats;
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t work; // signaled when a request is added, or the threads should stop
+  pthread_cond_t idle; // signaled when `compiling` drops to 0
+  bool stopping;
+#endif
+} jit_queue;
+
+static void lock_queue(jit_queue *q) {
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_mutex_lock(&q->lock);
+#else
+  (void)q;
+#endif
+}
+
+static void unlock_queue(jit_queue *q) {
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_mutex_unlock(&q->lock);
+#else
+  (void)q;
+#endif
+}
+
+static void compile(jit_queue *q, compile_request *req) {
+  u64 start = get_unix_us();
+  if (req->tier == JIT_TIER_OPTIMIZING) {
+    req->result = x86_opt_jit_compile_ssa(req->fn);
+    req->fn = nullptr; // freed by the compiler
+  } else {
+    dumb_jit_options options = {.tier_up = q->vm->opt_jit_enabled};
+#ifdef X86_JIT_SUPPORTED
+    req->result = req->insns ? x86_jit_compile_copy(req->method, req->insns, options)
+                             : x86_jit_compile(req->method, options);
+#else
+    req->result = dumb_jit_compile(req->method, options);
+#endif
+  }
+  req->compile_us = get_unix_us() - start;
+}
+
+static void count_compilation(jit_queue *q, const compile_request *req) {
+  q->stats.compiled++;
+  q->stats.compile_us += req->compile_us;
+  if (req->compile_us > q->stats.max_compile_us)
+    q->stats.max_compile_us = req->compile_us;
+}
+
+// Called with the lock held
+static compile_request *take_hottest(jit_queue *q) {
+  int best = 0;
+  for (int i = 1; i < arrlen(q->waiting); ++i) {
+    if (__atomic_load_n(&q->waiting[i]->hotness, __ATOMIC_RELAXED) >
+        __atomic_load_n(&q->waiting[best]->hotness, __ATOMIC_RELAXED))
+      best = i;
+  }
+  compile_request *req = q->waiting[best];
+  arrdelswap(q->waiting, best);
+  q->stats.depth = (int)arrlen(q->waiting);
+  return req;
+}
+
+#ifdef COMPILER_THREADS_SUPPORTED
+static void *compiler_thread_main(void *arg) {
+  jit_queue *q = arg;
+  pthread_mutex_lock(&q->lock);
+  while (true) {
+    while (!q->stopping && arrlen(q->waiting) == 0)
+      pthread_cond_wait(&q->work, &q->lock);
+    if (q->stopping)
+      break;
+    compile_request *req = take_hottest(q);
+    q->compiling++;
+    pthread_mutex_unlock(&q->lock);
+
+    compile(q, req);
+
+    pthread_mutex_lock(&q->lock);
+    arrput(q->done, req);
+    __atomic_store_n(&q->done_count, (int)arrlen(q->done), __ATOMIC_RELEASE);
+    if (--q->compiling == 0)
+      pthread_cond_broadcast(&q->idle);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return nullptr;
+}
+#endif
+
+static jit_queue *get_queue(vm *vm) {
+  if (vm->jit_queue)
+    return vm->jit_queue;
+  jit_queue *q = calloc(1, sizeof(jit_queue));
+  q->vm = vm;
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_mutex_init(&q->lock, nullptr);
+  pthread_cond_init(&q->work, nullptr);
+  pthread_cond_init(&q->idle, nullptr);
+  if (vm->jit_compiler_threads > 0) {
+    q->threads = calloc(vm->jit_compiler_threads, sizeof(pthread_t));
+    while (q->thread_count < vm->jit_compiler_threads &&
+           pthread_create(&q->threads[q->thread_count], nullptr, compiler_thread_main, q) == 0) {
+      q->thread_count++;
+    }
+  }
+#endif
+  vm->jit_queue = q;
+  return q;
+}
+
+static void free_request(compile_request *req) {
+  free(req->insns);
+  if (req->fn)
+    ssa_free(req->fn);
+  free(req);
+}
+
+// Make the compiled code the method's jit_entry, keeping earlier code around since it may still be running. The entry
+// points are published last, so that whatever finds them also finds the code they belong to in jit_info.
+static void install_compiled_code(cp_method *method, dumb_jit_result *result) {
+  result->previous = method->jit_info;
+  result->compilations = result->previous ? result->previous->compilations + 1 : 1;
+  method->jit_info = result;
+#ifdef X86_JIT_SUPPORTED
+  __atomic_store_n(&method->trampoline, result->entry, __ATOMIC_RELEASE); // native code is called directly
+#endif
+  __atomic_store_n(&method->jit_entry, result->entry, __ATOMIC_RELEASE);
+  __atomic_store_n(&method->jit_available, true, __ATOMIC_RELEASE);
+}
+
+// Whether the code was compiled from what the method still is
+static bool is_current(const compile_request *req) {
+  const cp_method *method = req->method;
+  if (method->jit_info != req->expected)
+    return false;
+  return !req->insns || memcmp(req->insns, method->code->code, method->code->insn_count * sizeof(bytecode_insn)) == 0;
+}
+
+// Called by the VM thread once the request has been compiled. A method whose code is dropped asks again, since its
+// baseline call count or tier-up countdown keeps running out.
+static void install(jit_queue *q, compile_request *req) {
+  cp_method *method = req->method;
+  dumb_jit_result *result = req->result;
+  method->jit_request = nullptr;
+  count_compilation(q, req);
+
+  if (!is_current(req)) {
+    free_dumb_jit_result(result); // never installed, so it has no previous code
+    q->stats.discarded++;
+  } else if (!result) {
+    // Don't ask again
+    if (req->tier == JIT_TIER_BASELINE)
+      method->call_count = INT_MIN;
+    else
+      ((dumb_jit_result *)method->jit_info)->tier_up_countdown = INT_MAX;
+    q->stats.failed++;
+  } else {
+    if (req->tier == JIT_TIER_BASELINE)
+      result->tier_up_countdown = q->vm->opt_jit_threshold - 1;
+    install_compiled_code(method, result);
+    u64 latency = get_unix_us() - req->requested_us;
+    q->stats.installed++;
+    q->stats.latency_us += latency;
+    if (latency > q->stats.max_latency_us)
+      q->stats.max_latency_us = latency;
+  }
+  free_request(req);
+}
+
+static void drop(jit_queue *q, compile_request *req) {
+  req->method->jit_request = nullptr;
+  free_dumb_jit_result(req->result);
+  free_request(req);
+  q->stats.discarded++;
+}
+
+void jit_queue_request(vm_thread *thread, cp_method *method, jit_tier tier, int hotness) {
+  vm *vm = thread->vm;
+  compile_request *waiting = method->jit_request;
+  if (waiting) {
+    if (waiting->tier == tier && hotness > __atomic_load_n(&waiting->hotness, __ATOMIC_RELAXED))
+      __atomic_store_n(&waiting->hotness, hotness, __ATOMIC_RELAXED);
+    return;
+  }
+
+  jit_queue *q = get_queue(vm);
+  compile_request *req = calloc(1, sizeof(compile_request));
+  *req = (compile_request){
+      .method = method, .tier = tier, .hotness = hotness, .expected = method->jit_info, .requested_us = get_unix_us()};
+  q->stats.requests++;
+
+  // Read the instructions now, while the interpreter isn't rewriting them
+  bool synchronous = vm->jit_compiler_threads == 0 || (q->thread_count == 0 && !vm->scheduler);
+  if (tier == JIT_TIER_OPTIMIZING) {
+    req->fn = ssa_build(method);
+    if (!req->fn) {
+      install(q, req); // as a failed compilation
+      return;
+    }
+  } else if (!synchronous && q->thread_count > 0 && method->code && method->code_analysis) {
+    scan_basic_blocks(method->code, method->code_analysis);
+    size_t size = method->code->insn_count * sizeof(bytecode_insn);
+    req->insns = malloc(size);
+    memcpy(req->insns, method->code->code, size);
+  }
+
+  if (synchronous) {
+    compile(q, req);
+    install(q, req);
+    return;
+  }
+
+  method->jit_request = req;
+  lock_queue(q);
+  arrput(q->waiting, req);
+  q->stats.depth = (int)arrlen(q->waiting);
+  if (q->stats.depth > q->stats.max_depth)
+    q->stats.max_depth = q->stats.depth;
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_cond_signal(&q->work);
+#endif
+  unlock_queue(q);
+}
+
+void jit_queue_install(vm *vm) {
+  jit_queue *q = vm->jit_queue;
+  if (!q || !__atomic_load_n(&q->done_count, __ATOMIC_ACQUIRE))
+    return;
+  lock_queue(q);
+  compile_request **done = q->done;
+  q->done = nullptr;
+  __atomic_store_n(&q->done_count, 0, __ATOMIC_RELAXED);
+  unlock_queue(q);
+  for (int i = 0; i < arrlen(done); ++i)
+    install(q, done[i]);
+  arrfree(done);
+}
+
+bool jit_queue_run(vm *vm, u64 budget_us) {
+  jit_queue *q = vm->jit_queue;
+  if (!q || q->thread_count > 0)
+    return false;
+  u64 start = get_unix_us();
+  while (arrlen(q->waiting) > 0 && get_unix_us() - start < budget_us) {
+    lock_queue(q);
+    compile_request *req = take_hottest(q);
+    unlock_queue(q);
+    compile(q, req);
+    install(q, req);
+  }
+  return arrlen(q->waiting) > 0;
+}
+
+void jit_queue_cancel(vm *vm) {
+  jit_queue *q = vm->jit_queue;
+  if (!q)
+    return;
+  lock_queue(q);
+#ifdef COMPILER_THREADS_SUPPORTED
+  while (q->compiling)
+    pthread_cond_wait(&q->idle, &q->lock);
+#endif
+  compile_request **waiting = q->waiting, **done = q->done;
+  q->waiting = q->done = nullptr;
+  __atomic_store_n(&q->done_count, 0, __ATOMIC_RELAXED);
+  q->stats.depth = 0;
+  unlock_queue(q);
+
+  for (int i = 0; i < arrlen(waiting); ++i)
+    drop(q, waiting[i]);
+  for (int i = 0; i < arrlen(done); ++i) {
+    count_compilation(q, done[i]);
+    drop(q, done[i]);
+  }
+  arrfree(waiting);
+  arrfree(done);
+}
+
+jit_queue_stats jit_queue_get_stats(vm *vm) {
+  jit_queue *q = vm->jit_queue;
+  if (!q)
+    return (jit_queue_stats){};
+  lock_queue(q);
+  jit_queue_stats stats = q->stats;
+  unlock_queue(q);
+  return stats;
+}
+
+char *jit_queue_report(vm *vm) {
+  jit_queue_stats s = jit_queue_get_stats(vm);
+  string_builder out;
+  string_builder_init(&out);
+  string_builder_append(&out,
+                        "JIT queue: %" PRIu64 " requests, %" PRIu64 " compiled, %" PRIu64 " installed, %" PRIu64
+                        " failed, %" PRIu64 " discarded, depth %d (max %d)\n",
+                        s.requests, s.compiled, s.installed, s.failed, s.discarded, s.depth, s.max_depth);
+  string_builder_append(&out, "  compile time: %.3fms total, %.3fms mean, %.3fms max\n", s.compile_us / 1000.0,
+                        s.compiled ? s.compile_us / 1000.0 / s.compiled : 0.0, s.max_compile_us / 1000.0);
+  string_builder_append(&out, "  request to install: %.3fms mean, %.3fms max\n",
+                        s.installed ? s.latency_us / 1000.0 / s.installed : 0.0, s.max_latency_us / 1000.0);
+  char *result = strdup(out.data);
+  string_builder_free(&out);
+  return result;
+}
+
+void free_jit_queue(vm *vm) {
+  jit_queue *q = vm->jit_queue;
+  if (!q)
+    return;
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_mutex_lock(&q->lock);
+  q->stopping = true;
+  pthread_cond_broadcast(&q->work);
+  pthread_mutex_unlock(&q->lock);
+  for (int i = 0; i < q->thread_count; ++i)
+    pthread_join(q->threads[i], nullptr);
+  free(q->threads);
+#endif
+  jit_queue_cancel(vm);
+#ifdef COMPILER_THREADS_SUPPORTED
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->work);
+  pthread_cond_destroy(&q->idle);
+#endif
+  free(q);
+  vm->jit_queue = nullptr;
+}
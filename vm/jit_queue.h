@@ -0,0 +1,66 @@
+// Compilation queue. Methods which become hot ask for a compilation here instead of being compiled on the spot, so
+// that the Java thread which asked doesn't wait for the JIT. Requests are ordered by hotness (the calls and loop
+// iterations counted so far, which keep growing while a method waits), and compiled by background compiler threads,
+// or where there are no pthreads, by the scheduler between time slices and while every thread sleeps.
+//
+// Whatever reads the interpreter's instructions runs on the thread that asked: a baseline compilation reads a copy of
+// them (see x86_jit_compile_copy), and an optimizing compilation builds the SSA form up front (see
+// x86_opt_jit_compile_ssa). Compiled code is installed by the VM thread at its next fuel check, and dropped instead if
+// the method's code or instructions have changed since it was asked for.
+
+#ifndef JIT_QUEUE_H
+#define JIT_QUEUE_H
+
+#include "bjvm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { JIT_TIER_BASELINE, JIT_TIER_OPTIMIZING } jit_tier;
+
+typedef struct {
+  u64 requests;   // compilations asked for
+  u64 compiled;   // compilations finished, whatever became of the code
+  u64 installed;  // compiled and installed
+  u64 failed;     // compilations of methods which couldn't be compiled
+  u64 discarded;  // compiled or waiting, but dropped since the method changed meanwhile (or its class was unloaded)
+  int depth;      // requests waiting to be compiled now
+  int max_depth;  // the most that have ever waited at once
+  u64 compile_us; // time spent compiling, in total and the longest single compilation
+  u64 max_compile_us;
+  u64 latency_us; // time from asking for a compilation to installing it, in total and the longest
+  u64 max_latency_us;
+} jit_queue_stats;
+
+// Ask for the method to be compiled with the given tier, unless it already waits to be. `hotness` is the number of
+// calls and loop iterations counted for the method so far. When the method already waits, a higher hotness moves it
+// up the queue. Compiles and installs right away if vm->jit_compiler_threads is 0.
+void jit_queue_request(vm_thread *thread, cp_method *method, jit_tier tier, int hotness);
+
+// Install (or drop) the code compiled since the last call. Called by the VM thread at fuel checks; cheap when there is
+// nothing to install.
+void jit_queue_install(vm *vm);
+
+// Compile waiting requests on this thread, hottest first, and install the code, starting new compilations until
+// budget_us has passed. Called by the scheduler when there are no compiler threads. Returns whether any are left.
+bool jit_queue_run(vm *vm, u64 budget_us);
+
+// Drop every request, waiting for those being compiled. Called before classes are unloaded, since compilations may
+// refer to them.
+void jit_queue_cancel(vm *vm);
+
+jit_queue_stats jit_queue_get_stats(vm *vm);
+
+// The stats as a few lines of text. Heap allocated; the caller must free it.
+EMSCRIPTEN_KEEPALIVE
+char *jit_queue_report(vm *vm);
+
+// Stops the compiler threads and frees the queue, along with any code compiled but not yet installed
+void free_jit_queue(vm *vm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JIT_QUEUE_H
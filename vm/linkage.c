@@ -4,6 +4,7 @@
 
 #include <analysis.h>
 #include <classfile.h>
+#include <dumb_jit.h>
 #include <vtable.h>
 
 #include <bjvm.h>
@@ -105,7 +106,7 @@ static int *reorder_fields_for_compactness(cp_field *fields, int fields_count) {
   int *buckets[4] = {nullptr};
   for (int i = 0; i < fields_count; ++i) {
     cp_field *field = fields + i;
-    int size = sizeof_type_kind(field->parsed_descriptor.repr_kind);
+    int size = field->compressed ? sizeof(heap_ref) : sizeof_type_kind(field->parsed_descriptor.repr_kind);
     DCHECK(size == 1 || size == 2 || size == 4 || size == 8);
     arrput(buckets[__builtin_ctz(size)], i);
   }
@@ -185,7 +186,10 @@ int link_class(vm_thread *thread, classdesc *cd) {
         free_heap_str(error_str);
         return -1;
       }
+      if (!thread->vm->jit_enabled) // nothing else needs the stack states once the GC maps are built
+        release_stack_states(method->code_analysis);
       create_template_interpreter_frame(method);
+      dumb_jit_link_method(method);
     }
   }
 
@@ -198,14 +202,26 @@ int link_class(vm_thread *thread, classdesc *cd) {
   nonstatic_offset += padding;
 
   bool must_have_C_layout = hash_table_contains(&thread->vm->class_padding, cd->name.chars, cd->name.len);
+  // Natives access the fields of classes with a C layout through the structs in natives_gen.h, which hold pointers
+  for (int field_i = 0; field_i < cd->fields_count; ++field_i) {
+    cp_field *field = cd->fields + field_i;
+    field->compressed = COMPRESSED_REFS && !must_have_C_layout && !(field->access_flags & ACCESS_STATIC) &&
+                        field->parsed_descriptor.repr_kind == TYPE_KIND_REFERENCE;
+  }
   int *order = nullptr;
   if (!must_have_C_layout)
     order = reorder_fields_for_compactness(cd->fields, cd->fields_count);
   u32 static_refs_c = 0, nonstatic_refs_c = super ? super->instance_references->count : 0;
-  u32 super_refs_c = nonstatic_refs_c;
+  u32 compressed_refs_c = super ? super->compressed_references->count : 0;
+  u32 super_refs_c = nonstatic_refs_c, super_compressed_refs_c = compressed_refs_c;
   for (int field_i = 0; field_i < cd->fields_count; ++field_i) {
     cp_field *field = cd->fields + (must_have_C_layout ? field_i : order[field_i]);
     type_kind kind = field->parsed_descriptor.repr_kind;
+    if (field->compressed) {
+      field->byte_offset = allocate_field(&nonstatic_offset, TYPE_KIND_INT); // the same size as a heap_ref
+      compressed_refs_c++;
+      continue;
+    }
     field->byte_offset = field->access_flags & ACCESS_STATIC ? allocate_field(&static_offset, kind)
                                                              : allocate_field(&nonstatic_offset, kind);
     // printf("Allocating field %.*s for class %.*s at %zu\n", fmt_slice(field->name), fmt_slice(cd->name),
@@ -219,21 +235,28 @@ int link_class(vm_thread *thread, classdesc *cd) {
   free(order);
   cd->static_references = arena_alloc(&cd->arena, 1, sizeof(reference_list) + static_refs_c * sizeof(u16));
   cd->instance_references = arena_alloc(&cd->arena, 1, sizeof(reference_list) + nonstatic_refs_c * sizeof(u16));
+  cd->compressed_references = arena_alloc(&cd->arena, 1, sizeof(reference_list) + compressed_refs_c * sizeof(u16));
 
   cd->static_references->count = static_refs_c;
   cd->instance_references->count = nonstatic_refs_c;
+  cd->compressed_references->count = compressed_refs_c;
 
   // Add superclass instance references
   if (super) {
     reference_list *super_refs = super->instance_references;
     memcpy(cd->instance_references->slots_unscaled, super_refs->slots_unscaled, super_refs->count * sizeof(u16));
+    super_refs = super->compressed_references;
+    memcpy(cd->compressed_references->slots_unscaled, super_refs->slots_unscaled, super_refs->count * sizeof(u16));
   }
 
   static_refs_c = 0;
   nonstatic_refs_c = super_refs_c;
+  compressed_refs_c = super_compressed_refs_c;
   for (int field_i = 0; field_i < cd->fields_count; ++field_i) {
     cp_field *field = cd->fields + field_i;
-    if (field->parsed_descriptor.repr_kind == TYPE_KIND_REFERENCE) {
+    if (field->compressed) {
+      cd->compressed_references->slots_unscaled[compressed_refs_c++] = field->byte_offset / sizeof(heap_ref);
+    } else if (field->parsed_descriptor.repr_kind == TYPE_KIND_REFERENCE) {
       bool is_static = field->access_flags & ACCESS_STATIC;
       u16 *slots = is_static ? cd->static_references->slots_unscaled : cd->instance_references->slots_unscaled;
       slots[is_static ? static_refs_c : nonstatic_refs_c] = field->byte_offset / sizeof(void *);
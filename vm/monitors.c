@@ -5,8 +5,6 @@
 #include "monitors.h"
 #include <roundrobin_scheduler.h>
 
-#define NOT_HELD_TID (-1)
-
 DEFINE_ASYNC(monitor_acquire) {
   // since this is a single-threaded vm, we don't need atomic operations
   self->handle = make_handle(args->thread, args->obj);
@@ -20,7 +18,7 @@ DEFINE_ASYNC(monitor_acquire) {
   __atomic_load(shared_header, &fetched_header, __ATOMIC_ACQUIRE);
   monitor_data *data;
   for (;;) { // loop until a monitor data is initialized
-    data = inspect_monitor(&fetched_header);
+    data = inspect_monitor(args->thread->vm, fetched_header);
     if (likely(data)) {
       break; // the monitor exists
     }
@@ -34,11 +32,11 @@ DEFINE_ASYNC(monitor_acquire) {
       }
     }
 
-    allocated_data->mark_word = fetched_header.mark_word;
+    allocated_data->mark_word = fetched_header;
     allocated_data->tid = NOT_HELD_TID; // not owned (as a microöptimisation, we could claim it here beforehand)
     allocated_data->hold_count = 0;
 
-    header_word proposed_header = {.expanded_data = allocated_data};
+    header_word proposed_header = allocated_data->index << 1;
 
     // try to put it in- loop again if CAS fails
     if (__atomic_compare_exchange(shared_header, &fetched_header, &proposed_header, false, __ATOMIC_ACQ_REL,
@@ -49,9 +47,8 @@ DEFINE_ASYNC(monitor_acquire) {
 
   // now, a monitor is guaranteed to exist
   for (;;) {
-    monitor_data *lock = __atomic_load_n(shared_header.expanded_data, __ATOMIC_ACQUIRE); // must refetch
-    assert(!((u64)lock & IS_MARK_WORD) && "Monitor data does not exist"); // weird, because we just set it up above
-    assert(lock);
+    monitor_data *lock = inspect_monitor(args->thread->vm, __atomic_load_n(shared_header, __ATOMIC_ACQUIRE)); // refetch
+    assert(lock && "Monitor data does not exist"); // weird, because we just set it up above
     s32 read_tid = NOT_HELD_TID;
 
     // try to acquire mutex- loop again if CAS fails
@@ -92,11 +89,11 @@ DEFINE_ASYNC(monitor_reacquire_hold_count) {
   assert((uintptr_t)shared_header % 8 == 0); // should be aligned due to how bump_allocate works
   header_word fetched_header;
   __atomic_load(shared_header, &fetched_header, __ATOMIC_ACQUIRE);
-  assert(inspect_monitor(&fetched_header) != nullptr);
+  assert(inspect_monitor(args->thread->vm, fetched_header) != nullptr);
 
   // a monitor should be guaranteed to exist
   for (;;) {
-    monitor_data *lock = __atomic_load_n(shared_header.expanded_data, __ATOMIC_ACQUIRE); // must refetch
+    monitor_data *lock = inspect_monitor(args->thread->vm, __atomic_load_n(shared_header, __ATOMIC_ACQUIRE)); // refetch
     assert(lock);
     s32 read_tid = NOT_HELD_TID;
 
@@ -132,7 +129,7 @@ u32 current_thread_hold_count(vm_thread *thread, obj_header *obj) {
   // no handles necessary because no GC (i hope)
   header_word fetched_header;
   __atomic_load(&obj->header_word, &fetched_header, __ATOMIC_ACQUIRE);
-  monitor_data *lock = inspect_monitor(&fetched_header);
+  monitor_data *lock = inspect_monitor(thread->vm, fetched_header);
   if (unlikely(!lock))
     return 0;
 
@@ -146,7 +143,7 @@ u32 monitor_release_all_hold_count(vm_thread *thread, obj_header *obj) {
   // no handles necessary because no GC (i hope)
   header_word fetched_header;
   __atomic_load(&obj->header_word, &fetched_header, __ATOMIC_ACQUIRE);
-  monitor_data *lock = inspect_monitor(&fetched_header);
+  monitor_data *lock = inspect_monitor(thread->vm, fetched_header);
 
   // todo: error code enum? or just always cause an InternalError/IllegalMonitorStateException
   if (unlikely(!lock))
@@ -173,7 +170,7 @@ int monitor_release(vm_thread *thread, obj_header *obj) {
   // no handles necessary because no GC (i hope)
   header_word fetched_header;
   __atomic_load(&obj->header_word, &fetched_header, __ATOMIC_ACQUIRE);
-  monitor_data *lock = inspect_monitor(&fetched_header);
+  monitor_data *lock = inspect_monitor(thread->vm, fetched_header);
 
   if (unlikely(!lock))
     return -1;
@@ -136,7 +136,7 @@ extern native_t *natives;
   DEFINE_ASYNC_(, empty, binding_name) {                                                                               \
     /* inline cache here? */                                                                                           \
     cp_method *method =                                                                                                \
-        method_lookup(self->args.receiver->descriptor, STR(method_name), STR(method_descriptor), true, true);          \
+        method_lookup(obj_class(self->args.receiver), STR(method_name), STR(method_descriptor), true, true);           \
     DCHECK(method);                                                                                                    \
     DCHECK((sizeof(self->args) - sizeof(vm_thread *)) / sizeof(stack_value) == method->descriptor->args_count + 1);    \
     DCHECK((sizeof(self->args) - sizeof(vm_thread *)) % sizeof(stack_value) == 0);                                     \
@@ -148,7 +148,7 @@ extern native_t *natives;
 
 #define CallMethod(receiver, name, desc, result, ...)                                                                  \
   do {                                                                                                                 \
-    cp_method *method = method_lookup(receiver->descriptor, STR(name), STR(desc), true, true);                         \
+    cp_method *method = method_lookup(obj_class(receiver), STR(name), STR(desc), true, true);                          \
     DCHECK(method);                                                                                                    \
     stack_value args[] = {receiver, __VA_ARGS__};                                                                      \
     DCHECK((sizeof(args) / sizeof(args[0])) == method->descriptor.args_count);                                         \
@@ -126,63 +126,118 @@ oom:
   return result;
 }
 
-static object lookup_interned_jstring(vm_thread *thread, object s) {
-  object raw = RawStringData(thread, s);
-
-  u8 *data = ArrayData(raw);
-  s32 len = ArrayLength(raw);
-
-  return hash_table_lookup(&thread->vm->interned_strings, (char const *)data, len);
+static u32 interned_string_hash(string_coder_kind coder, const u8 *bytes, s32 len) {
+  return fxhash_string((const char *)bytes, len) ^ coder;
 }
 
-static void insert_interned_jstring(vm_thread *thread, object s) {
-  object raw = RawStringData(thread, s);
-
-  u8 *data = ArrayData(raw);
-  s32 len = ArrayLength(raw);
+// Index of the slot holding the String with the given payload, or else of the empty slot where it would go. The
+// table must have at least one empty slot.
+static u32 probe_interned_strings(const interned_string_table *tbl, u32 hash, string_coder_kind coder,
+                                  const u8 *bytes, s32 len) {
+  u32 mask = tbl->capacity - 1;
+  for (u32 i = hash & mask;; i = (i + 1) & mask) {
+    struct native_String *entry = (void *)tbl->strings[i];
+    if (!entry || (tbl->hashes[i] == hash && entry->coder == coder && ArrayLength(entry->value) == len &&
+                   memcmp(ArrayData(entry->value), bytes, len) == 0))
+      return i;
+  }
+}
 
-  (void)hash_table_insert(&thread->vm->interned_strings, (char const *)data, len, s);
+void rehash_interned_strings(interned_string_table *tbl, u32 count) {
+  u32 capacity = 16;
+  while (capacity < 2 * count) {
+    capacity *= 2;
+  }
+  obj_header **strings = calloc(capacity, sizeof(obj_header *));
+  u32 *hashes = calloc(capacity, sizeof(u32));
+  for (u32 i = 0; i < tbl->capacity; ++i) {
+    if (tbl->strings[i]) {
+      u32 j = tbl->hashes[i] & (capacity - 1);
+      while (strings[j]) {
+        j = (j + 1) & (capacity - 1);
+      }
+      strings[j] = tbl->strings[i];
+      hashes[j] = tbl->hashes[i];
+    }
+  }
+  free(tbl->strings);
+  free(tbl->hashes);
+  tbl->strings = strings;
+  tbl->hashes = hashes;
+  tbl->capacity = capacity;
 }
 
-object MakeJStringFromModifiedUTF8(vm_thread *thread, slice data, bool intern) {
-  object obj = make_jstring_modified_utf8(thread, data);
-  if (!obj) {
-    DCHECK(thread->current_exception);
-    return nullptr;
+// Find the interned String with the given payload. If there is none, then if `intern` is set, put `str` (which must
+// have that payload) in its place, or else return nullptr.
+static object find_or_intern(vm *vm, string_coder_kind coder, const u8 *bytes, s32 len, object str) {
+  interned_string_table *tbl = &vm->interned_strings;
+  if ((tbl->count + 1) * 4 > tbl->capacity * 3) {
+    rehash_interned_strings(tbl, tbl->count + 1);
+  }
+  u32 hash = interned_string_hash(coder, bytes, len);
+  u32 i = probe_interned_strings(tbl, hash, coder, bytes, len);
+  if (!tbl->strings[i] && str) {
+    tbl->strings[i] = str;
+    tbl->hashes[i] = hash;
+    tbl->count++;
   }
+  return tbl->strings[i];
+}
 
-  object interned = lookup_interned_jstring(thread, obj);
+// Returns the interned String with the given payload if there is one, and otherwise a new String (interned if
+// `intern` is set). `bytes` must not point into the heap, since allocating the String may trigger a GC.
+static object make_jstring_from_payload(vm_thread *thread, string_coder_kind coder, const u8 *bytes, s32 len,
+                                        bool intern) {
+  object interned = find_or_intern(thread->vm, coder, bytes, len, nullptr);
   if (interned)
     return interned;
 
-  if (intern) {
-    insert_interned_jstring(thread, obj);
+  object obj = MakeJStringFromData(thread, (slice){.chars = (char *)bytes, .len = len}, coder);
+  if (obj && intern) {
+    (void)find_or_intern(thread->vm, coder, bytes, len, obj);
   }
-
   return obj;
 }
-obj_header *MakeJStringFromCString(vm_thread *thread, char const *data, bool intern) {
-  object obj = make_jstring_cstr(thread, data);
-  if (!obj)
-    return nullptr;
 
-  object interned = lookup_interned_jstring(thread, obj);
-  if (interned)
-    return interned;
+object MakeJStringFromModifiedUTF8(vm_thread *thread, slice data, bool intern) {
+  u16 *chars;
+  int len;
+  if (convert_modified_utf8_to_chars(data.chars, (int)data.len, &chars, &len) == -1)
+    return nullptr;
 
-  if (intern) {
-    insert_interned_jstring(thread, obj);
+  // Look up (and build) the String by its compact payload
+  object obj;
+  if (do_latin1(chars, len)) {
+    u8 *latin1 = (u8 *)chars;
+    for (int i = 0; i < len; ++i) {
+      latin1[i] = (u8)chars[i];
+    }
+    obj = make_jstring_from_payload(thread, STRING_CODER_LATIN1, latin1, len, intern);
+  } else {
+    obj = make_jstring_from_payload(thread, STRING_CODER_UTF16, (u8 *)chars, 2 * len, intern);
   }
-
+  free(chars);
+  DCHECK(obj || thread->current_exception);
   return obj;
 }
 
+obj_header *MakeJStringFromCString(vm_thread *thread, char const *data, bool intern) {
+  size_t len = strlen(data);
+  DCHECK(len < INT32_MAX);
+  return make_jstring_from_payload(thread, STRING_CODER_LATIN1, (const u8 *)data, (s32)len, intern);
+}
+
 obj_header *MakeJStringFromData(vm_thread *thread, slice data, string_coder_kind encoding) {
-  handle *str = make_handle(thread, new_object(thread, cached_classes(thread->vm)->string));
+  // Interned strings are created this way very early at VM boot, so we can't necessarily use the cache.
+  classdesc *String = thread->vm->_cached_classdescs ? cached_classes(thread->vm)->string
+                                                     : bootstrap_lookup_class(thread, STR("java/lang/String"));
+  handle *str = make_handle(thread, new_object(thread, String));
 
 #define S ((struct native_String *)str->obj)
 
   obj_header *result = nullptr;
+  if (!S)
+    goto oom;
 
   DCHECK(data.len < INT32_MAX);
   s32 len = (s32)data.len;
@@ -201,29 +256,22 @@ oom:
 }
 
 obj_header *InternJString(vm_thread *thread, object s) {
-  object lookup_result = lookup_interned_jstring(thread, s);
-  if (lookup_result)
-    return lookup_result;
-
   object raw = RawStringData(thread, s);
-
-  u8 *data = ArrayData(raw);
-  s32 len = ArrayLength(raw);
-
-  (void)hash_table_insert(&thread->vm->interned_strings, (char const *)data, len, s);
-  return s;
+  return find_or_intern(thread->vm, ((struct native_String *)s)->coder, ArrayData(raw), ArrayLength(raw), s);
 }
 
 u64 hash_code_rng = 0;
 
 s32 get_object_hash_code(vm *vm, object o) {
-  u32 *hc = &get_mark_word(vm, &o->header_word)->data[1];
-  if (*hc == 0) {
-    // Hash not yet computed -- make it always nonzero
-    while (!((*hc = ObjNextHashCode())))
+  u32 *word = get_mark_word(vm, &o->header_word);
+  u32 hc = *word >> MARK_WORD_HASH_SHIFT;
+  if (hc == 0) {
+    // Hash not yet computed -- make it always nonzero. It has to fit alongside the flag bits.
+    while (!((hc = ObjNextHashCode() >> MARK_WORD_HASH_SHIFT)))
       ;
+    *word = hc << MARK_WORD_HASH_SHIFT | IS_MARK_WORD;
   }
-  return (s32)*hc;
+  return (s32)hc;
 }
 
 u64 ObjNextHashCode() {
@@ -18,12 +18,14 @@ obj_header *MakeJStringFromModifiedUTF8(vm_thread *thread, slice data, bool inte
 obj_header *MakeJStringFromCString(vm_thread *thread, char const *data, bool intern);
 obj_header *MakeJStringFromData(vm_thread *thread, slice data, string_coder_kind encoding);
 obj_header *InternJString(vm_thread *thread, obj_header *str);
+// Rebuild the interned string table, sized for `count` entries. Used by the GC after it removes dead entries.
+void rehash_interned_strings(interned_string_table *tbl, u32 count);
 
 /// Helper for java.lang.String#length
 static inline int JavaStringLength(vm_thread *thread, obj_header *string) {
-  DCHECK(utf8_equals(string->descriptor->name, "java/lang/String"));
+  DCHECK(utf8_equals(obj_class(string)->name, "java/lang/String"));
 
-  auto method = method_lookup(string->descriptor, STR("length"), STR("()I"), false, false);
+  auto method = method_lookup(obj_class(string), STR("length"), STR("()I"), false, false);
   stack_value args[1];
   stack_value result = call_interpreter_synchronous(thread, method, args);
 
@@ -33,7 +35,7 @@ static inline int JavaStringLength(vm_thread *thread, obj_header *string) {
 /// Extracts the inner array of the given java.lang.String.
 /// The data are either UTF-16 or latin1 encoded.
 static inline obj_header *RawStringData([[maybe_unused]] vm_thread const *thread, obj_header const *string) {
-  DCHECK(utf8_equals(string->descriptor->name, "java/lang/String"));
+  DCHECK(utf8_equals(obj_class(string)->name, "java/lang/String"));
   return ((struct native_String *)string)->value;
 }
 
@@ -42,8 +44,8 @@ static inline object AllocateObject(vm_thread *thread, classdesc *descriptor, si
   DCHECK(descriptor->state >= CD_STATE_LINKED); // important to know the size
   object obj = (object)bump_allocate(thread, allocation_size);
   if (obj) {
-    obj->header_word.mark_word.data[0] = IS_MARK_WORD;
-    obj->descriptor = descriptor;
+    obj->header_word = IS_MARK_WORD;
+    obj->class_ref = encode_class_ref(descriptor);
     DCHECK(size_of_object(obj) <= allocation_size);
   }
   return obj;
@@ -53,14 +55,14 @@ static inline object AllocateObject(vm_thread *thread, classdesc *descriptor, si
 s32 get_object_hash_code(vm *vm, object o);
 
 [[maybe_unused]] static void __obj_store_field(obj_header *thing, slice field_name, stack_value value, slice desc) {
-  cp_field *field = field_lookup(thing->descriptor, field_name, desc);
+  cp_field *field = field_lookup(obj_class(thing), field_name, desc);
   DCHECK(field);
   DCHECK(!(field->access_flags & ACCESS_STATIC));
   set_field(thing, field, value);
 }
 
 [[maybe_unused]] static stack_value __obj_load_field(obj_header *thing, slice field_name, slice desc) {
-  cp_field *field = field_lookup(thing->descriptor, field_name, desc);
+  cp_field *field = field_lookup(obj_class(thing), field_name, desc);
   DCHECK(field);
   DCHECK(!(field->access_flags & ACCESS_STATIC));
   return get_field(thing, field);
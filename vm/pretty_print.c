@@ -239,12 +239,25 @@ const char *insn_code_to_string(insn_code_kind code) {
     CASE(putstatic_D)
     CASE(putstatic_L)
     CASE(putstatic_Z)
+    CASE(getfield_N)
+    CASE(putfield_N)
     CASE(invokesigpoly)
     CASE(pow)
     CASE(sin)
     CASE(cos)
     CASE(tan)
     CASE(sqrt)
+    CASE(aload_getfield_I)
+    CASE(aload_getfield_L)
+    CASE(aload_arraylength)
+    CASE(iload_iload_iadd)
+    CASE(iinc_goto)
+    CASE(iload_if_icmpeq)
+    CASE(iload_if_icmpne)
+    CASE(iload_if_icmplt)
+    CASE(iload_if_icmpge)
+    CASE(iload_if_icmpgt)
+    CASE(iload_if_icmple)
   }
   printf("Unknown code: %d\n", code);
   UNREACHABLE();
@@ -382,30 +395,31 @@ heap_string insn_to_string(const bytecode_insn *insn, int insn_index) {
   int write = 0;
   write = build_str(&result, write, "%04d = pc %04d: ", insn_index, insn->original_pc);
   write = build_str(&result, write, "%s ", insn_code_to_string(insn->kind));
-  if (insn->kind <= insn_swap) {
+  insn_code_kind kind = unfused_insn_kind(insn->kind); // superinstructions show the operands of their first insn
+  if (kind <= insn_swap) {
     // no operands
-  } else if (insn->kind == insn_invokeinterface) {
+  } else if (kind == insn_invokeinterface) {
     // indexes into constant pool
     char *cp_str = cp_entry_to_string(insn->cp);
     build_str(&result, write, "%s", cp_str);
     free(cp_str);
-  } else if (insn->kind <= insn_astore) {
+  } else if (kind <= insn_astore) {
     // indexes into local variables
     build_str(&result, write, "#%d", insn->index);
-  } else if (insn->kind <= insn_ifnull) {
+  } else if (kind <= insn_ifnull) {
     // indexes into the instruction array
     build_str(&result, write, "inst %d", insn->index);
-  } else if (insn->kind == insn_lconst || insn->kind == insn_iconst) {
+  } else if (kind == insn_lconst || kind == insn_iconst) {
     build_str(&result, write, "%" PRId64, insn->integer_imm);
-  } else if (insn->kind == insn_dconst || insn->kind == insn_fconst) {
+  } else if (kind == insn_dconst || kind == insn_fconst) {
     build_str(&result, write, "%.15g", insn->f_imm);
-  } else if (insn->kind == insn_tableswitch) {
+  } else if (kind == insn_tableswitch) {
     write = build_str(&result, write, "[ default -> %d", insn->tableswitch->default_target);
     for (int i = 0, j = insn->tableswitch->low; i < insn->tableswitch->targets_count; ++i, ++j) {
       write = build_str(&result, write, ", %d -> %d", j, insn->tableswitch->targets[i]);
     }
     build_str(&result, write, " ]");
-  } else if (insn->kind == insn_lookupswitch) {
+  } else if (kind == insn_lookupswitch) {
     write = build_str(&result, write, "[ default -> %d", insn->lookupswitch->default_target);
     for (int i = 0; i < insn->lookupswitch->targets_count; ++i) {
       write = build_str(&result, write, ", %d -> %d", insn->lookupswitch->keys[i], insn->lookupswitch->targets[i]);
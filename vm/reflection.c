@@ -87,7 +87,7 @@ DEFINE_ASYNC(reflect_initialize_constructor) {
     slice desc = method->descriptor->args[i].unparsed;
     AWAIT(load_class_of_field_descriptor, thread, method->my_class->classloader, desc);
     struct native_Class *type = (void *)get_class_mirror(thread, get_async_result(load_class_of_field_descriptor));
-    ((struct native_Class **)ArrayData(C->parameterTypes))[i] = type;
+    ReferenceArrayStore(C->parameterTypes, i, (object)type);
   }
 
 #undef C
@@ -157,7 +157,7 @@ DEFINE_ASYNC(reflect_initialize_method) {
     object mirror = (void *)get_class_mirror(thread, get_async_result(load_class_of_field_descriptor));
     if (!mirror)
       goto oom;
-    ((void **)ArrayData(M->parameterTypes))[i] = mirror;
+    ReferenceArrayStore(M->parameterTypes, i, mirror);
   }
 
   slice ret_desc = method->descriptor->return_type.unparsed;
@@ -3,6 +3,7 @@
 #include "roundrobin_scheduler.h"
 
 #include "exceptions.h"
+#include "jit_queue.h"
 
 typedef struct {
   call_interpreter_t call;
@@ -225,8 +226,11 @@ scheduler_status_t rr_scheduler_step(rr_scheduler *scheduler) {
 
   thread->fuel = 200000;
 
-  // If the thread is sleeping, check if it's time to wake up
+  // If the thread is sleeping, check if it's time to wake up. Every thread is sleeping, so without compiler threads,
+  // this is the time to compile what the JIT queue has waiting.
   if (is_sleeping(info, time)) {
+    u64 idle_us = rr_scheduler_may_sleep_us(scheduler);
+    jit_queue_run(scheduler->vm, idle_us < MICROSECONDS_TO_RUN ? idle_us : MICROSECONDS_TO_RUN);
     return SCHEDULER_RESULT_MORE;
   }
 
@@ -263,6 +267,9 @@ scheduler_status_t rr_scheduler_step(rr_scheduler *scheduler) {
     info->wakeup_info = (void *)fut.wakeup;
   }
 
+  // Also compile a little between time slices, so that methods get compiled when no thread ever sleeps
+  jit_queue_run(scheduler->vm, MICROSECONDS_TO_RUN / 10);
+
   return (arrlen(impl->round_robin) == 0 || only_daemons_running(impl->round_robin)) ? SCHEDULER_RESULT_DONE
                                                                                      : SCHEDULER_RESULT_MORE;
 }
@@ -337,6 +344,16 @@ void rr_scheduler_enumerate_gc_roots(rr_scheduler *scheduler, object **stbds_vec
   }
 }
 
+void rr_scheduler_enumerate_waited_objects(rr_scheduler *scheduler, object **objects) {
+  impl *I = scheduler->_impl;
+  for (int i = 0; i < arrlen(I->round_robin); i++) {
+    rr_wakeup_info *wakeup_info = I->round_robin[i]->wakeup_info;
+    if (wakeup_info && (wakeup_info->kind == RR_MONITOR_ENTER_WAITING || wakeup_info->kind == RR_MONITOR_WAIT)) {
+      arrput(*objects, wakeup_info->monitor_wakeup.monitor->obj);
+    }
+  }
+}
+
 execution_record *rr_scheduler_run(rr_scheduler *scheduler, call_interpreter_t call) {
   vm_thread *thread = call.args.thread;
   thread_info *info = get_or_create_thread_info(scheduler->_impl, thread);
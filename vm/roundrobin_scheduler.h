@@ -81,6 +81,8 @@ typedef struct {
 execution_record *rr_scheduler_run(rr_scheduler *scheduler, call_interpreter_t call);
 void free_execution_record(execution_record *record);
 void rr_scheduler_enumerate_gc_roots(rr_scheduler *scheduler, object **stbds_vector);
+// Append the objects whose monitors threads are waiting to enter, or to be notified on, to the stb_ds array *objects
+void rr_scheduler_enumerate_waited_objects(rr_scheduler *scheduler, object **objects);
 
 void monitor_notify_one(rr_scheduler *scheduler, obj_header *monitor);
 void monitor_notify_all(rr_scheduler *scheduler, obj_header *monitor);
@@ -0,0 +1,470 @@
+// Core of the SSA intermediate representation (see ssa.h): creating and editing functions, control flow analyses,
+// verification and printing.
+
+#include "ssa.h"
+
+#include <analysis.h>
+
+int ssa_new_block(ssa_function *fn) {
+  ssa_block block = {0};
+  block.idom = block.loop_header = block.loop_parent = block.rpo = -1;
+  arrput(fn->blocks, block);
+  return (int)arrlen(fn->blocks) - 1;
+}
+
+int ssa_new_insn(ssa_function *fn, int block, ssa_op op, type_kind type) {
+  ssa_insn insn = {0};
+  insn.op = op;
+  insn.type = type;
+  insn.block = block;
+  insn.state = -1;
+  arrput(fn->insns, insn);
+  int index = (int)arrlen(fn->insns) - 1;
+  if (block >= 0)
+    arrput(fn->blocks[block].insns, index);
+  return index;
+}
+
+int ssa_new_const(ssa_function *fn, int block, type_kind type, s64 imm) {
+  int c = ssa_new_insn(fn, block, SSA_CONST, type);
+  fn->insns[c].imm = imm;
+  return c;
+}
+
+void ssa_move_before_terminator(ssa_function *fn, int block) {
+  int *insns = fn->blocks[block].insns;
+  int n = (int)arrlen(insns);
+  DCHECK(n >= 2);
+  int moved = insns[n - 1];
+  insns[n - 1] = insns[n - 2];
+  insns[n - 2] = moved;
+}
+
+void ssa_add_edge(ssa_function *fn, int from, int to) {
+  arrput(fn->blocks[from].succs, to);
+  arrput(fn->blocks[to].preds, from);
+}
+
+bool ssa_has_side_effects(const ssa_insn *insn) {
+  switch (insn->op) {
+  case SSA_STORE_FIELD:
+  case SSA_STORE_STATIC:
+  case SSA_STORE_ELEMENT:
+  case SSA_WRITE_BARRIER:
+  case SSA_NULL_CHECK:
+  case SSA_BOUNDS_CHECK:
+  case SSA_ZERO_CHECK:
+  case SSA_CLASS_CHECK:
+  case SSA_CAST_CHECK:
+  case SSA_STORE_CHECK:
+  case SSA_FUEL_CHECK:
+  case SSA_INVOKE:
+  case SSA_NEW:
+  case SSA_NEWARRAY:
+  case SSA_ANEWARRAY:
+  case SSA_GOTO:
+  case SSA_BRANCH:
+  case SSA_SWITCH:
+  case SSA_RETURN:
+  case SSA_DEOPT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ssa_is_safepoint(const ssa_insn *insn) {
+  return insn->op == SSA_INVOKE || insn->op == SSA_NEW || insn->op == SSA_NEWARRAY || insn->op == SSA_ANEWARRAY;
+}
+
+// Removes the index'th predecessor of the block, and the corresponding argument of its phis
+static void remove_pred(ssa_function *fn, int block, int index) {
+  ssa_block *b = fn->blocks + block;
+  arrdel(b->preds, index);
+  for (int i = 0; i < arrlen(b->insns); ++i) {
+    ssa_insn *phi = fn->insns + b->insns[i];
+    if (phi->op != SSA_PHI)
+      break;
+    arrdel(phi->args, index);
+  }
+}
+
+void ssa_compute_rpo(ssa_function *fn) {
+  int block_count = (int)arrlen(fn->blocks);
+  for (int i = 0; i < block_count; ++i)
+    fn->blocks[i].rpo = -1;
+
+  // Iterative depth-first search, recording the postorder
+  int *postorder = nullptr, *stack = nullptr, *next_succ = calloc(block_count, sizeof(int));
+  bool *visited = calloc(block_count, sizeof(bool));
+  arrput(stack, 0);
+  visited[0] = true;
+  while (arrlen(stack)) {
+    int b = arrlast(stack);
+    ssa_block *block = fn->blocks + b;
+    if (next_succ[b] < arrlen(block->succs)) {
+      int s = block->succs[next_succ[b]++];
+      if (!visited[s]) {
+        visited[s] = true;
+        arrput(stack, s);
+      }
+    } else {
+      arrput(postorder, b);
+      (void)arrpop(stack);
+    }
+  }
+
+  arrsetlen(fn->rpo, 0);
+  for (int i = (int)arrlen(postorder) - 1; i >= 0; --i) {
+    fn->blocks[postorder[i]].rpo = (int)arrlen(fn->rpo);
+    arrput(fn->rpo, postorder[i]);
+  }
+
+  // Remove the unreachable blocks, and their edges into reachable ones
+  for (int b = 0; b < block_count; ++b) {
+    ssa_block *block = fn->blocks + b;
+    if (visited[b] || block->removed)
+      continue;
+    for (int i = 0; i < arrlen(block->succs); ++i) {
+      int s = block->succs[i];
+      if (!visited[s])
+        continue;
+      for (int j = 0; j < arrlen(fn->blocks[s].preds); ++j) {
+        if (fn->blocks[s].preds[j] == b) {
+          remove_pred(fn, s, j);
+          break;
+        }
+      }
+    }
+    for (int i = 0; i < arrlen(block->insns); ++i)
+      fn->insns[block->insns[i]].block = -1;
+    arrsetlen(block->insns, 0);
+    arrsetlen(block->preds, 0);
+    arrsetlen(block->succs, 0);
+    block->removed = true;
+  }
+
+  arrfree(postorder);
+  arrfree(stack);
+  free(next_succ);
+  free(visited);
+}
+
+void ssa_compute_dominators(ssa_function *fn) {
+  // Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+  for (int i = 0; i < arrlen(fn->blocks); ++i)
+    fn->blocks[i].idom = -1;
+  fn->blocks[0].idom = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < arrlen(fn->rpo); ++i) {
+      ssa_block *block = fn->blocks + fn->rpo[i];
+      int idom = -1;
+      for (int j = 0; j < arrlen(block->preds); ++j) {
+        int p = block->preds[j];
+        if (fn->blocks[p].idom == -1) // not processed yet
+          continue;
+        if (idom == -1) {
+          idom = p;
+          continue;
+        }
+        int a = p, b = idom;
+        while (a != b) {
+          while (fn->blocks[a].rpo > fn->blocks[b].rpo)
+            a = fn->blocks[a].idom;
+          while (fn->blocks[b].rpo > fn->blocks[a].rpo)
+            b = fn->blocks[b].idom;
+        }
+        idom = a;
+      }
+      if (block->idom != idom) {
+        block->idom = idom;
+        changed = true;
+      }
+    }
+  }
+  fn->blocks[0].idom = -1;
+}
+
+bool ssa_dominates(const ssa_function *fn, int a, int b) {
+  // The dominator tree is shallow in practice
+  while (b != -1 && fn->blocks[b].rpo >= fn->blocks[a].rpo) {
+    if (a == b)
+      return true;
+    b = fn->blocks[b].idom;
+  }
+  return false;
+}
+
+bool ssa_find_loops(ssa_function *fn) {
+  for (int i = 0; i < arrlen(fn->blocks); ++i) {
+    ssa_block *block = fn->blocks + i;
+    block->loop_header = block->loop_parent = -1;
+    block->loop_depth = 0;
+  }
+
+  // Headers come before the headers of the loops nested in them in reverse postorder, so the innermost loop of each
+  // block is the one found last
+  int *worklist = nullptr;
+  bool *in_loop = calloc(arrlen(fn->blocks), sizeof(bool));
+  bool reducible = true;
+  for (int i = 0; i < arrlen(fn->rpo) && reducible; ++i) {
+    int h = fn->rpo[i];
+    ssa_block *header = fn->blocks + h;
+    for (int j = 0; j < arrlen(header->preds); ++j) {
+      int p = header->preds[j];
+      if (fn->blocks[p].rpo < i)
+        continue;
+      if (!ssa_dominates(fn, h, p)) { // a retreating edge that isn't a back edge
+        reducible = false;
+        break;
+      }
+      arrput(worklist, p);
+    }
+    if (!arrlen(worklist) || !reducible)
+      continue;
+
+    // The natural loop: the header and every block that reaches a back edge without going through the header
+    in_loop[h] = true;
+    int *body = nullptr;
+    arrput(body, h);
+    while (arrlen(worklist)) {
+      int b = arrpop(worklist);
+      if (in_loop[b])
+        continue;
+      in_loop[b] = true;
+      arrput(body, b);
+      for (int j = 0; j < arrlen(fn->blocks[b].preds); ++j)
+        arrput(worklist, fn->blocks[b].preds[j]);
+    }
+    header->loop_parent = header->loop_header;
+    for (int j = 0; j < arrlen(body); ++j) {
+      ssa_block *block = fn->blocks + body[j];
+      block->loop_header = h;
+      block->loop_depth++;
+      in_loop[body[j]] = false;
+    }
+    arrfree(body);
+  }
+  arrfree(worklist);
+  free(in_loop);
+  return reducible;
+}
+
+void ssa_split_critical_edges(ssa_function *fn) {
+  int block_count = (int)arrlen(fn->blocks);
+  for (int b = 0; b < block_count; ++b) {
+    if (fn->blocks[b].removed || arrlen(fn->blocks[b].succs) < 2)
+      continue;
+    for (int i = 0; i < arrlen(fn->blocks[b].succs); ++i) {
+      int s = fn->blocks[b].succs[i];
+      if (arrlen(fn->blocks[s].preds) < 2)
+        continue;
+      int split = ssa_new_block(fn);
+      ssa_new_insn(fn, split, SSA_GOTO, TYPE_KIND_VOID);
+      arrput(fn->blocks[split].preds, b);
+      arrput(fn->blocks[split].succs, s);
+      fn->blocks[b].succs[i] = split;
+      // Duplicate edges carry the same phi arguments, so any occurrence of b that hasn't been split yet will do
+      ssa_block *succ = fn->blocks + s;
+      for (int j = 0; j < arrlen(succ->preds); ++j) {
+        if (succ->preds[j] == b) {
+          succ->preds[j] = split;
+          break;
+        }
+      }
+    }
+  }
+}
+
+static bool is_terminator(ssa_op op) { return op >= SSA_GOTO; }
+
+static int expected_succs(const ssa_insn *term) {
+  switch (term->op) {
+  case SSA_GOTO:
+    return 1;
+  case SSA_BRANCH:
+    return 2;
+  case SSA_SWITCH:
+    return term->insn->kind == insn_tableswitch ? term->insn->tableswitch->targets_count + 1
+                                                 : term->insn->lookupswitch->targets_count + 1;
+  default:
+    return 0;
+  }
+}
+
+static int count(const int *array, int value) {
+  int n = 0;
+  for (int i = 0; i < arrlen(array); ++i)
+    n += array[i] == value;
+  return n;
+}
+
+// Whether the value is defined, and available at the end of block `at` (or at its `index`'th instruction)
+static bool available(const ssa_function *fn, int value, int at, int index) {
+  if (value < 0 || value >= arrlen(fn->insns))
+    return false;
+  const ssa_insn *def = fn->insns + value;
+  if (def->block < 0 || def->type == TYPE_KIND_VOID)
+    return false;
+  if (def->block != at)
+    return ssa_dominates(fn, def->block, at);
+  if (index < 0)
+    return true;
+  const int *insns = fn->blocks[at].insns;
+  for (int i = 0; i < index; ++i)
+    if (insns[i] == value)
+      return true;
+  return false;
+}
+
+const char *ssa_verify(ssa_function *fn) {
+  ssa_compute_rpo(fn);
+  ssa_compute_dominators(fn);
+  for (int b = 0; b < arrlen(fn->blocks); ++b) {
+    const ssa_block *block = fn->blocks + b;
+    if (block->removed)
+      continue;
+    int n = (int)arrlen(block->insns);
+    if (n == 0 || !is_terminator(fn->insns[block->insns[n - 1]].op))
+      return "block doesn't end in a terminator";
+    if (arrlen(block->succs) != expected_succs(fn->insns + block->insns[n - 1]))
+      return "wrong number of successors";
+    for (int i = 0; i < arrlen(block->succs); ++i) {
+      int s = block->succs[i];
+      if (fn->blocks[s].removed || count(block->succs, s) != count(fn->blocks[s].preds, b))
+        return "successors and predecessors disagree";
+    }
+    for (int i = 0; i < arrlen(block->preds); ++i)
+      if (count(fn->blocks[block->preds[i]].succs, b) != count(block->preds, block->preds[i]))
+        return "successors and predecessors disagree";
+
+    bool phis_done = false;
+    for (int i = 0; i < n; ++i) {
+      const ssa_insn *insn = fn->insns + block->insns[i];
+      if (insn->block != b)
+        return "instruction in the wrong block";
+      if (is_terminator(insn->op) != (i == n - 1))
+        return "terminator in the middle of a block";
+      if (insn->op == SSA_PHI) {
+        if (phis_done)
+          return "phi after other instructions";
+        if (arrlen(insn->args) != arrlen(block->preds))
+          return "phi arguments don't match the predecessors";
+        for (int j = 0; j < arrlen(insn->args); ++j) {
+          if (!available(fn, insn->args[j], block->preds[j], -1))
+            return "phi argument not available in the predecessor";
+          if (fn->insns[insn->args[j]].type != insn->type)
+            return "phi argument of the wrong type";
+        }
+        continue;
+      }
+      phis_done = true;
+      for (int j = 0; j < arrlen(insn->args); ++j)
+        if (!available(fn, insn->args[j], b, i))
+          return "argument doesn't dominate its use";
+      for (int state = insn->state; state != -1; state = fn->states[state].parent) {
+        const ssa_frame_state *s = fn->states + state;
+        for (int j = 0; j < s->stack + s->locals; ++j)
+          if (s->values[j] != -1 && !available(fn, s->values[j], b, i))
+            return "frame state value doesn't dominate its use";
+      }
+    }
+  }
+  return nullptr;
+}
+
+static const char *op_names[] = {
+    "const", "param", "phi", "add", "sub", "mul", "div", "rem", "and", "or", "xor", "shl", "shr", "ushr", "neg",
+    "fadd", "fsub", "fmul", "fdiv", "fneg", "sqrt", "math", "convert", "lcmp", "fcmp", "load_field", "load_static",
+    "load_element", "array_length", "instanceof", "store_field", "store_static", "store_element", "write_barrier",
+    "null_check", "bounds_check", "zero_check", "class_check", "cast_check", "store_check", "fuel_check", "invoke",
+    "new", "newarray", "anewarray", "goto", "branch", "switch", "return", "deopt"};
+
+static const char *cond_names[] = {"eq", "ne", "lt", "ge", "gt", "le"};
+
+static void dump_state(FILE *out, const ssa_function *fn, int state) {
+  for (; state != -1; state = fn->states[state].parent) {
+    const ssa_frame_state *s = fn->states + state;
+    fprintf(out, " [%.*s@%d", fmt_slice(s->method->name), s->pc);
+    for (int j = 0; j < s->stack + s->locals; ++j) {
+      fprintf(out, j == s->stack ? " |" : "");
+      if (s->values[j] == -1)
+        fprintf(out, " _");
+      else
+        fprintf(out, " v%d", s->values[j]);
+    }
+    fprintf(out, "]");
+  }
+}
+
+void ssa_dump(FILE *out, const ssa_function *fn) {
+  fprintf(out, "%.*s.%.*s%.*s (%d inlined)\n", fmt_slice(fn->method->my_class->name), fmt_slice(fn->method->name),
+          fmt_slice(fn->method->unparsed_descriptor), fn->inlined);
+  for (int r = 0; r < arrlen(fn->rpo); ++r) {
+    int b = fn->rpo[r];
+    const ssa_block *block = fn->blocks + b;
+    fprintf(out, "b%d (idom b%d, loop b%d, depth %d) preds", b, block->idom, block->loop_header, block->loop_depth);
+    for (int i = 0; i < arrlen(block->preds); ++i)
+      fprintf(out, " b%d", block->preds[i]);
+    fprintf(out, " succs");
+    for (int i = 0; i < arrlen(block->succs); ++i)
+      fprintf(out, " b%d", block->succs[i]);
+    fprintf(out, "\n");
+    for (int i = 0; i < arrlen(block->insns); ++i) {
+      const ssa_insn *insn = fn->insns + block->insns[i];
+      fprintf(out, "  ");
+      if (insn->type != TYPE_KIND_VOID)
+        fprintf(out, "v%d:%c = ", block->insns[i], type_kind_to_char(insn->type));
+      fprintf(out, "%s", op_names[insn->op]);
+      if (insn->op == SSA_BRANCH)
+        fprintf(out, ".%s", cond_names[insn->cond]);
+      for (int j = 0; j < arrlen(insn->args); ++j)
+        fprintf(out, "%s v%d", j ? "," : "", insn->args[j]);
+      switch (insn->op) {
+      case SSA_CONST:
+      case SSA_PARAM:
+        fprintf(out, " %lld", (long long)insn->imm);
+        break;
+      case SSA_LOAD_FIELD:
+      case SSA_STORE_FIELD:
+        fprintf(out, " +%d", insn->offset);
+        break;
+      case SSA_NEW:
+      case SSA_INSTANCEOF:
+      case SSA_CLASS_CHECK:
+      case SSA_CAST_CHECK:
+        fprintf(out, " %.*s", fmt_slice(insn->classdesc->name));
+        break;
+      case SSA_INVOKE:
+      case SSA_CONVERT:
+        fprintf(out, " %s", insn_code_to_string(insn->op == SSA_INVOKE ? insn->insn->kind : insn->conversion));
+        break;
+      default:
+        break;
+      }
+      dump_state(out, fn, insn->state);
+      fprintf(out, "\n");
+    }
+  }
+}
+
+void ssa_free(ssa_function *fn) {
+  if (!fn)
+    return;
+  for (int i = 0; i < arrlen(fn->insns); ++i)
+    arrfree(fn->insns[i].args);
+  for (int i = 0; i < arrlen(fn->blocks); ++i) {
+    arrfree(fn->blocks[i].insns);
+    arrfree(fn->blocks[i].preds);
+    arrfree(fn->blocks[i].succs);
+  }
+  for (int i = 0; i < arrlen(fn->states); ++i)
+    arrfree(fn->states[i].values);
+  arrfree(fn->insns);
+  arrfree(fn->blocks);
+  arrfree(fn->states);
+  arrfree(fn->rpo);
+  free(fn);
+}
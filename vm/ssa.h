@@ -0,0 +1,202 @@
+//
+// SSA intermediate representation used by the optimizing JIT.
+//
+// A method is built (ssa_build.c) into a control flow graph of blocks of instructions, each of which defines at most
+// one value, named by the instruction's index. Small callees are inlined into it. Optimizations (ssa_opt.c) then run
+// on the graph before a backend (x86_opt_jit.c) turns it into machine code.
+//
+// The IR is speculative. Anything the optimizing tier doesn't handle, and every check that fails (a null pointer, an
+// index out of bounds, a division by zero, a failed cast, an inline cache guard, the thread having to yield), leaves
+// the compiled code: a deoptimization stores the values of the locals and stack slots, as recorded by the instruction's
+// frame state, into the interpreter frames of the method and any callees inlined at that point, and the interpreter
+// carries on from there. This is how exceptions are thrown, too.
+//
+// Compiled code only keeps values in the frame at safepoints (calls and allocations), where the frame state of the
+// instruction is stored into the frame before it and references are reloaded from the frame after it, because the
+// collector may have moved them. There are no safepoints in inlined code.
+//
+
+#ifndef SSA_H
+#define SSA_H
+
+#include "bjvm.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum : u8 {
+  // Values
+  SSA_CONST, // imm holds the bits of the value (floats in the low 32 bits)
+  SSA_PARAM, // the imm'th argument
+  SSA_PHI,   // one argument per predecessor of the block
+  // Integer arithmetic on ints and longs, with Java's semantics (division of MIN_VALUE by -1 overflows, shifts are
+  // masked). Division and remainder don't check for zero, see SSA_ZERO_CHECK.
+  SSA_ADD,
+  SSA_SUB,
+  SSA_MUL,
+  SSA_DIV,
+  SSA_REM,
+  SSA_AND,
+  SSA_OR,
+  SSA_XOR,
+  SSA_SHL,
+  SSA_SHR,
+  SSA_USHR,
+  SSA_NEG,
+  // Floating point arithmetic on floats and doubles
+  SSA_FADD,
+  SSA_FSUB,
+  SSA_FMUL,
+  SSA_FDIV,
+  SSA_FNEG,
+  SSA_SQRT,
+  SSA_MATH,    // calls the C function fn (fmod, fmodf, sin, cos, tan or pow) on the arguments
+  SSA_CONVERT, // the conversion instruction `conversion` (i2l, d2i, i2b...)
+  SSA_LCMP,    // -1, 0 or 1
+  SSA_FCMP,    // -1, 0 or 1, or nan_result if either argument is NaN
+  // Loads. Field loads read at the byte offset `offset` of a non-null object; static loads at `address`.
+  SSA_LOAD_FIELD,
+  SSA_LOAD_STATIC,
+  SSA_LOAD_ELEMENT, // array, index (already checked)
+  SSA_ARRAY_LENGTH, // of a non-null array
+  SSA_INSTANCEOF,   // 1 if the argument is a non-null instance of `classdesc`, otherwise 0
+  // Stores, of the last argument
+  SSA_STORE_FIELD,
+  SSA_STORE_STATIC,
+  SSA_STORE_ELEMENT,
+  SSA_WRITE_BARRIER, // after a reference is stored into the object
+  // Checks, which deoptimize to the frame state `state` if they fail
+  SSA_NULL_CHECK,   // the argument is not null
+  SSA_BOUNDS_CHECK, // 0 <= index < length
+  SSA_ZERO_CHECK,   // the int or long is not zero
+  SSA_CLASS_CHECK,  // the non-null argument's class is exactly `classdesc` (an inline cache guard)
+  SSA_CAST_CHECK,   // the argument is null or an instance of `classdesc`
+  SSA_STORE_CHECK,  // array, value: the value may be stored into the reference array
+  SSA_FUEL_CHECK,   // the thread doesn't need to yield (at loop headers)
+  // Safepoints. `state` is the frame state stored into the frame before the instruction.
+  SSA_INVOKE,   // the call `insn`, whose arguments are the top of the stack in `state`
+  SSA_NEW,      // an instance of `classdesc`
+  SSA_NEWARRAY, // of `array_type`, with the length given by the argument
+  SSA_ANEWARRAY,
+  // Terminators, the last instruction of each block
+  SSA_GOTO,
+  SSA_BRANCH, // compares the two arguments: to the first successor if `cond` holds, otherwise to the second
+  SSA_SWITCH, // the tableswitch or lookupswitch `insn` on the argument: one successor per target, then the default
+  SSA_RETURN, // with the argument, if any
+  SSA_DEOPT,  // unconditionally, to the frame state `state`
+} ssa_op;
+
+typedef enum : u8 { SSA_EQ, SSA_NE, SSA_LT, SSA_GE, SSA_GT, SSA_LE } ssa_cond;
+
+typedef struct {
+  ssa_op op;
+  // Type of the value: TYPE_KIND_INT (also for booleans, bytes, chars and shorts), LONG, FLOAT, DOUBLE or REFERENCE,
+  // or TYPE_KIND_VOID if the instruction defines no value
+  type_kind type;
+  // Loads and stores: the type in memory (e.g. TYPE_KIND_BYTE). BRANCH: the type of the arguments.
+  type_kind mem_type;
+  // LOAD_FIELD and STORE_FIELD: the field holds a heap_ref (see cp_field.compressed), as reference array elements do
+  bool compressed;
+  ssa_cond cond;  // BRANCH
+  s8 nan_result;  // FCMP, and BRANCH on floats and doubles: the result of the comparison if either argument is NaN
+  int block;      // containing block, or -1 once the instruction has been removed
+  int *args;      // stb_ds array of values
+  int state;      // frame state, or -1
+  // CLASS_CHECK: encode_class_ref(classdesc), looked up when the SSA form is built, on the thread which asked for the
+  // compilation, since it may register the class
+  u32 class_ref;
+  union {
+    s64 imm;
+    s32 offset;
+    void *address;
+    classdesc *classdesc;
+    const bytecode_insn *insn;
+    insn_code_kind conversion;
+    void *fn;
+    type_kind array_type;
+  };
+} ssa_insn;
+
+typedef struct {
+  int *insns; // stb_ds array: phis first, then a terminator last
+  int *preds; // stb_ds array, which may contain duplicates (like the successors of a switch)
+  int *succs; // stb_ds array
+  int idom;   // immediate dominator, or -1 for the entry block (see ssa_compute_dominators)
+  int loop_header; // header of the innermost loop containing the block, or -1 (see ssa_find_loops)
+  int loop_parent; // if the block is a loop header, the header of the enclosing loop, or -1
+  int loop_depth;
+  int rpo; // index in reverse postorder, or -1 if unreachable
+  bool removed;
+} ssa_block;
+
+// The state of the interpreter frame of a method at an instruction: which value is in each stack and local slot
+typedef struct {
+  cp_method *method;
+  int pc;
+  int parent; // if the method was inlined, the frame state of its caller at the call, otherwise -1
+  int stack, locals;
+  int *values; // the stack slots then the locals, as in stack_summary; -1 if a slot has no value
+} ssa_frame_state;
+
+typedef struct {
+  cp_method *method;
+  ssa_insn *insns;         // stb_ds array
+  ssa_block *blocks;       // stb_ds array; block 0 is the entry block
+  ssa_frame_state *states; // stb_ds array
+  int *rpo;                // stb_ds array of the reachable blocks, in reverse postorder
+  int inlined;             // number of calls inlined
+} ssa_function;
+
+// Builds the method's SSA form, inlining small monomorphic callees and removing trivial phis. Returns nullptr if the
+// method can't be compiled with the optimizing tier.
+ssa_function *ssa_build(cp_method *method);
+// Optimizes the function: global value numbering, elimination of redundant null and bounds checks, loop-invariant
+// code motion and dead code elimination. Returns false if the function can't be compiled.
+bool ssa_optimize(ssa_function *fn);
+void ssa_free(ssa_function *fn);
+
+// Creating and editing functions (ssa.c)
+
+int ssa_new_block(ssa_function *fn);
+// Appends an instruction to the block (or creates it detached, if block is -1), returning its index
+int ssa_new_insn(ssa_function *fn, int block, ssa_op op, type_kind type);
+int ssa_new_const(ssa_function *fn, int block, type_kind type, s64 imm);
+// Moves the last instruction of the block to just before its terminator
+void ssa_move_before_terminator(ssa_function *fn, int block);
+void ssa_add_edge(ssa_function *fn, int from, int to);
+// The terminator of the block
+static inline ssa_insn *ssa_terminator(const ssa_function *fn, int block) {
+  const ssa_block *b = fn->blocks + block;
+  return fn->insns + b->insns[arrlen(b->insns) - 1];
+}
+static inline bool ssa_is_constant(const ssa_function *fn, int value) { return fn->insns[value].op == SSA_CONST; }
+// Whether the instruction must stay even if its value is unused
+bool ssa_has_side_effects(const ssa_insn *insn);
+bool ssa_is_safepoint(const ssa_insn *insn);
+
+// Analyses, which refresh the fields of the blocks
+
+// Removes unreachable blocks and computes fn->rpo and each block's rpo index
+void ssa_compute_rpo(ssa_function *fn);
+// Computes each block's idom (Cooper, Harvey and Kennedy's algorithm), after ssa_compute_rpo
+void ssa_compute_dominators(ssa_function *fn);
+bool ssa_dominates(const ssa_function *fn, int a, int b);
+// Computes each block's loop header and depth, after ssa_compute_dominators. Returns false if the control flow graph
+// is irreducible.
+bool ssa_find_loops(ssa_function *fn);
+// Inserts an empty block on every edge from a block with several successors to a block with several predecessors, so
+// that phis can be resolved with moves at the end of predecessors
+void ssa_split_critical_edges(ssa_function *fn);
+
+// Returns nullptr if the function is well formed, or else a description of the first problem found
+const char *ssa_verify(ssa_function *fn);
+void ssa_dump(FILE *out, const ssa_function *fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SSA_H
@@ -0,0 +1,1112 @@
+// Building the SSA form of a method (see ssa.h).
+//
+// Each basic block is interpreted abstractly, tracking which SSA value is in each stack slot and local, starting from
+// the values at the end of its predecessor if it has only one which was built already, or else from a phi for every
+// slot that analysis gave a type at the start of the block. Phis get their arguments once all blocks are built, and
+// those which turn out to merge a single value are removed.
+//
+// Calls of small methods without loops or safepoints (allocations and calls that can't be inlined themselves) are
+// inlined when the callee is known: static and special calls, and virtual and interface calls whose inline cache has
+// only seen one class, which is guarded by a class check.
+
+#include "ssa.h"
+
+#include <analysis.h>
+#include <math.h>
+
+// Callees with at most this many instructions may be inlined, up to this depth
+#define MAX_INLINE_INSNS 35
+#define MAX_INLINE_DEPTH 2
+// Instructions which may be inlined into one method in total
+#define INLINE_BUDGET 300
+
+// A phi created at the start of a block, whose arguments are filled in once all blocks are built
+typedef struct {
+  int block;
+  int slot;
+  int phi;
+} pending_phi;
+
+// The method being built: the compiled method, or a callee being inlined into it
+typedef struct scope {
+  cp_method *method;
+  code_analysis *analysis;
+  struct scope *caller;
+  int caller_state; // frame state of the caller at the call, or -1
+  int depth;        // of inlining
+
+  int *bb_blocks; // the SSA block of each basic block
+  int *bb_at;     // the basic block starting at each instruction, or -1
+  pending_phi *phis;
+
+  // The value in each stack slot, then in each local, or -1
+  int *values;
+  int max_stack;
+  int sd;
+
+  int pc;
+  int state, state_pc; // the frame state at state_pc, once it has been needed
+  int block;           // the block being appended to, or -1 if the rest of the basic block is unreachable
+  int last_compare;    // LCMP or FCMP pushed by the previous instruction, or -1
+
+  // Inlined methods: blocks ending in a return, and the returned values
+  int *return_blocks;
+  int *return_values;
+} scope;
+
+typedef struct {
+  ssa_function *fn;
+  int **exits; // for each block that branches, the values of its scope's slots at its end (for phis)
+  int budget;  // instructions which may still be inlined
+  bool failed;
+} builder;
+
+static type_kind representable(type_kind kind) {
+  switch (kind) {
+  case TYPE_KIND_BOOLEAN:
+  case TYPE_KIND_BYTE:
+  case TYPE_KIND_CHAR:
+  case TYPE_KIND_SHORT:
+    return TYPE_KIND_INT;
+  default:
+    return kind;
+  }
+}
+
+static int *local(scope *sc, int i) { return sc->values + sc->max_stack + i; }
+static void push(scope *sc, int value) { sc->values[sc->sd++] = value; }
+static int pop(scope *sc) { return sc->values[--sc->sd]; }
+
+// The state of the frame before the current instruction. Must be called before the instruction pushes anything or
+// stores into a local.
+static int frame_state(builder *b, scope *sc) {
+  if (sc->state_pc == sc->pc)
+    return sc->state;
+  int sd = sc->analysis->insn_index_to_sd[sc->pc], max_locals = sc->method->code->max_locals;
+  ssa_frame_state state = {sc->method, sc->pc, sc->caller_state, sd, max_locals, nullptr};
+  arrsetlen(state.values, sd + max_locals);
+  for (int i = 0; i < sd; ++i)
+    state.values[i] = sc->values[i];
+  for (int i = 0; i < max_locals; ++i)
+    state.values[sd + i] = *local(sc, i);
+  arrput(b->fn->states, state);
+  sc->state_pc = sc->pc;
+  return sc->state = (int)arrlen(b->fn->states) - 1;
+}
+
+static int emit(builder *b, scope *sc, ssa_op op, type_kind type, int argc, ...) {
+  int v = ssa_new_insn(b->fn, sc->block, op, type);
+  va_list list;
+  va_start(list, argc);
+  for (int i = 0; i < argc; ++i)
+    arrput(b->fn->insns[v].args, va_arg(list, int));
+  va_end(list);
+  return v;
+}
+
+static int constant(builder *b, scope *sc, type_kind type, s64 imm) { return ssa_new_const(b->fn, sc->block, type, imm); }
+
+static int check(builder *b, scope *sc, ssa_op op, int arg) {
+  int state = frame_state(b, sc);
+  int v = emit(b, sc, op, TYPE_KIND_VOID, 1, arg);
+  b->fn->insns[v].state = state;
+  return v;
+}
+
+static int block_at(const scope *sc, int pc) { return sc->bb_blocks[sc->bb_at[pc]]; }
+
+// Ends the current block, after its terminator and outgoing edges, recording the values for the successors' phis
+static void end_block(builder *b, scope *sc) {
+  while (arrlen(b->exits) < arrlen(b->fn->blocks))
+    arrput(b->exits, nullptr);
+  int slots = sc->max_stack + sc->method->code->max_locals;
+  int *exit = malloc(slots * sizeof(int));
+  memcpy(exit, sc->values, slots * sizeof(int));
+  b->exits[sc->block] = exit;
+  sc->block = -1;
+}
+
+static void jump_to(builder *b, scope *sc, int target_pc) {
+  emit(b, sc, SSA_GOTO, TYPE_KIND_VOID, 0);
+  ssa_add_edge(b->fn, sc->block, block_at(sc, target_pc));
+  end_block(b, sc);
+}
+
+// Leaves the compiled code for the interpreter at the current instruction
+static void deopt(builder *b, scope *sc) {
+  int state = frame_state(b, sc);
+  int v = emit(b, sc, SSA_DEOPT, TYPE_KIND_VOID, 0);
+  b->fn->insns[v].state = state;
+  sc->block = -1;
+}
+
+static void branch(builder *b, scope *sc, const bytecode_insn *insn, int lhs, int rhs, type_kind type, ssa_cond cond,
+                   bool nan_result) {
+  int v = emit(b, sc, SSA_BRANCH, TYPE_KIND_VOID, 2, lhs, rhs);
+  ssa_insn *br = b->fn->insns + v;
+  br->mem_type = type;
+  br->cond = cond;
+  br->nan_result = nan_result;
+  ssa_add_edge(b->fn, sc->block, block_at(sc, insn->index));
+  ssa_add_edge(b->fn, sc->block, block_at(sc, sc->pc + 1));
+  end_block(b, sc);
+}
+
+static bool cond_holds(ssa_cond cond, int cmp) {
+  switch (cond) {
+  case SSA_EQ:
+    return cmp == 0;
+  case SSA_NE:
+    return cmp != 0;
+  case SSA_LT:
+    return cmp < 0;
+  case SSA_GE:
+    return cmp >= 0;
+  case SSA_GT:
+    return cmp > 0;
+  case SSA_LE:
+    return cmp <= 0;
+  }
+  UNREACHABLE();
+}
+
+static void lower_if(builder *b, scope *sc, const bytecode_insn *insn, insn_code_kind kind, int last_compare) {
+  static const ssa_cond conds[] = {SSA_EQ, SSA_NE, SSA_LT, SSA_GE, SSA_GT, SSA_LE};
+  if (kind >= insn_ifeq && kind <= insn_ifle) {
+    ssa_cond cond = conds[kind - insn_ifeq];
+    int value = pop(sc);
+    if (value == last_compare) { // lcmp, fcmp<op> or dcmp<op>, then a branch on the result: compare directly
+      const ssa_insn *cmp = b->fn->insns + value;
+      type_kind type = b->fn->insns[cmp->args[0]].type;
+      branch(b, sc, insn, cmp->args[0], cmp->args[1], type, cond, cmp->op == SSA_FCMP && cond_holds(cond, cmp->nan_result));
+    } else {
+      branch(b, sc, insn, value, constant(b, sc, TYPE_KIND_INT, 0), TYPE_KIND_INT, cond, false);
+    }
+    return;
+  }
+  if (kind == insn_ifnull || kind == insn_ifnonnull) {
+    int value = pop(sc);
+    int null = constant(b, sc, TYPE_KIND_REFERENCE, 0);
+    branch(b, sc, insn, value, null, TYPE_KIND_REFERENCE, kind == insn_ifnull ? SSA_EQ : SSA_NE, false);
+    return;
+  }
+  int rhs = pop(sc), lhs = pop(sc);
+  if (kind == insn_if_acmpeq || kind == insn_if_acmpne)
+    branch(b, sc, insn, lhs, rhs, TYPE_KIND_REFERENCE, kind == insn_if_acmpeq ? SSA_EQ : SSA_NE, false);
+  else
+    branch(b, sc, insn, lhs, rhs, TYPE_KIND_INT, conds[kind - insn_if_icmpeq], false);
+}
+
+static void lower_switch(builder *b, scope *sc, const bytecode_insn *insn) {
+  int v = emit(b, sc, SSA_SWITCH, TYPE_KIND_VOID, 1, pop(sc));
+  b->fn->insns[v].insn = insn;
+  const int *targets;
+  int count, default_target;
+  if (insn->kind == insn_tableswitch) {
+    targets = insn->tableswitch->targets, count = insn->tableswitch->targets_count;
+    default_target = insn->tableswitch->default_target;
+  } else {
+    targets = insn->lookupswitch->targets, count = insn->lookupswitch->targets_count;
+    default_target = insn->lookupswitch->default_target;
+  }
+  for (int i = 0; i < count; ++i)
+    ssa_add_edge(b->fn, sc->block, block_at(sc, targets[i]));
+  ssa_add_edge(b->fn, sc->block, block_at(sc, default_target));
+  end_block(b, sc);
+}
+
+static void lower_stack_manipulation(scope *sc, insn_code_kind kind) {
+  // As in the baseline JITs: each form replaces the top `inputs` slots with the given sequence of them
+  int inputs;
+  const char *outputs;
+  switch (kind) {
+  case insn_dup:
+    inputs = 1, outputs = "00";
+    break;
+  case insn_dup_x1:
+    inputs = 2, outputs = "101";
+    break;
+  case insn_dup_x2:
+    inputs = 3, outputs = "2012";
+    break;
+  case insn_dup2:
+    inputs = 2, outputs = "0101";
+    break;
+  case insn_dup2_x1:
+    inputs = 3, outputs = "12012";
+    break;
+  case insn_dup2_x2:
+    inputs = 4, outputs = "230123";
+    break;
+  case insn_swap:
+    inputs = 2, outputs = "10";
+    break;
+  default:
+    UNREACHABLE();
+  }
+  int in[4];
+  sc->sd -= inputs;
+  memcpy(in, sc->values + sc->sd, inputs * sizeof(int));
+  for (int i = 0; outputs[i]; ++i)
+    push(sc, in[outputs[i] - '0']);
+}
+
+static type_kind conversion_result(insn_code_kind kind) {
+  switch (kind) {
+  case insn_i2l:
+  case insn_f2l:
+  case insn_d2l:
+    return TYPE_KIND_LONG;
+  case insn_i2f:
+  case insn_l2f:
+  case insn_d2f:
+    return TYPE_KIND_FLOAT;
+  case insn_i2d:
+  case insn_l2d:
+  case insn_f2d:
+    return TYPE_KIND_DOUBLE;
+  default:
+    return TYPE_KIND_INT;
+  }
+}
+
+static type_kind array_element_type(insn_code_kind kind) {
+  switch (kind) {
+  case insn_baload:
+  case insn_bastore:
+    return TYPE_KIND_BYTE;
+  case insn_caload:
+  case insn_castore:
+    return TYPE_KIND_CHAR;
+  case insn_saload:
+  case insn_sastore:
+    return TYPE_KIND_SHORT;
+  case insn_iaload:
+  case insn_iastore:
+    return TYPE_KIND_INT;
+  case insn_laload:
+  case insn_lastore:
+    return TYPE_KIND_LONG;
+  case insn_faload:
+  case insn_fastore:
+    return TYPE_KIND_FLOAT;
+  case insn_daload:
+  case insn_dastore:
+    return TYPE_KIND_DOUBLE;
+  default:
+    return TYPE_KIND_REFERENCE;
+  }
+}
+
+// Checks the array and index, returning the array
+static int checked_element(builder *b, scope *sc, int array, int index) {
+  check(b, sc, SSA_NULL_CHECK, array);
+  int length = emit(b, sc, SSA_ARRAY_LENGTH, TYPE_KIND_INT, 1, array);
+  int bounds = check(b, sc, SSA_BOUNDS_CHECK, index);
+  arrput(b->fn->insns[bounds].args, length);
+  return array;
+}
+
+static void lower_array_access(builder *b, scope *sc, insn_code_kind kind) {
+  type_kind type = array_element_type(kind);
+  bool is_load = kind == insn_baload || kind == insn_caload || kind == insn_saload || kind == insn_iaload ||
+                 kind == insn_laload || kind == insn_faload || kind == insn_daload || kind == insn_aaload;
+  int value = is_load ? -1 : pop(sc);
+  int index = pop(sc), array = pop(sc);
+  checked_element(b, sc, array, index);
+  if (is_load) {
+    int v = emit(b, sc, SSA_LOAD_ELEMENT, representable(type), 2, array, index);
+    b->fn->insns[v].mem_type = type;
+    push(sc, v);
+    return;
+  }
+  if (kind == insn_aastore) {
+    int store_check = check(b, sc, SSA_STORE_CHECK, array);
+    arrput(b->fn->insns[store_check].args, value);
+  }
+  int v = emit(b, sc, SSA_STORE_ELEMENT, TYPE_KIND_VOID, 3, array, index, value);
+  b->fn->insns[v].mem_type = type;
+  if (kind == insn_aastore)
+    emit(b, sc, SSA_WRITE_BARRIER, TYPE_KIND_VOID, 1, array);
+}
+
+static void lower_field_access(builder *b, scope *sc, const bytecode_insn *insn, insn_code_kind kind) {
+  bool compressed = kind == insn_getfield_N || kind == insn_putfield_N;
+  type_kind type = compressed ? TYPE_KIND_REFERENCE : resolved_field_type(kind);
+  int v;
+  if ((kind >= insn_getfield_B && kind <= insn_getfield_L) || kind == insn_getfield_N) {
+    int obj = pop(sc);
+    check(b, sc, SSA_NULL_CHECK, obj);
+    v = emit(b, sc, SSA_LOAD_FIELD, representable(type), 1, obj);
+    b->fn->insns[v].offset = (s32)(intptr_t)insn->ic2;
+    b->fn->insns[v].compressed = compressed;
+    push(sc, v);
+  } else if ((kind >= insn_putfield_B && kind <= insn_putfield_L) || kind == insn_putfield_N) {
+    int value = pop(sc), obj = pop(sc);
+    check(b, sc, SSA_NULL_CHECK, obj);
+    v = emit(b, sc, SSA_STORE_FIELD, TYPE_KIND_VOID, 2, obj, value);
+    b->fn->insns[v].offset = (s32)(intptr_t)insn->ic2;
+    b->fn->insns[v].compressed = compressed;
+    if (type == TYPE_KIND_REFERENCE)
+      emit(b, sc, SSA_WRITE_BARRIER, TYPE_KIND_VOID, 1, obj);
+  } else if (kind >= insn_getstatic_B && kind <= insn_getstatic_L) {
+    v = emit(b, sc, SSA_LOAD_STATIC, representable(type), 0);
+    b->fn->insns[v].address = insn->ic;
+    push(sc, v);
+  } else {
+    v = emit(b, sc, SSA_STORE_STATIC, TYPE_KIND_VOID, 1, pop(sc));
+    b->fn->insns[v].address = insn->ic;
+  }
+  b->fn->insns[v].mem_type = type;
+}
+
+// Strings and class mirrors which the interpreter has already created. Returns false if the constant isn't one.
+static bool lower_ldc(builder *b, scope *sc, const bytecode_insn *insn) {
+  cp_entry *ent = insn->cp;
+  void *cell = ent->kind == CP_KIND_STRING  ? (void *)&ent->string.interned
+               : ent->kind == CP_KIND_CLASS ? (void *)&ent->class_info.vm_object
+                                            : nullptr;
+  if (!cell)
+    return false;
+  int v = emit(b, sc, SSA_LOAD_STATIC, TYPE_KIND_REFERENCE, 0);
+  b->fn->insns[v].address = cell;
+  b->fn->insns[v].mem_type = TYPE_KIND_REFERENCE;
+  check(b, sc, SSA_NULL_CHECK, v);
+  push(sc, v);
+  return true;
+}
+
+// Returns false if the intrinsic is left to the interpreter
+static bool lower_math_intrinsic(builder *b, scope *sc, insn_code_kind kind) {
+  int argc = kind == insn_pow ? 2 : 1;
+  int *args = sc->values + sc->sd - argc;
+  type_kind type = b->fn->insns[args[0]].type;
+  if (kind == insn_sqrt) {
+    push(sc, emit(b, sc, SSA_SQRT, type, 1, pop(sc)));
+    return true;
+  }
+  if (type != TYPE_KIND_DOUBLE || b->fn->insns[args[argc - 1]].type != TYPE_KIND_DOUBLE)
+    return false;
+  double (*fn)(double) = kind == insn_sin ? sin : kind == insn_cos ? cos : tan;
+  int v = argc == 2 ? emit(b, sc, SSA_MATH, TYPE_KIND_DOUBLE, 2, args[0], args[1])
+                    : emit(b, sc, SSA_MATH, TYPE_KIND_DOUBLE, 1, args[0]);
+  b->fn->insns[v].fn = kind == insn_pow ? (void *)pow : (void *)fn;
+  sc->sd -= argc;
+  push(sc, v);
+  return true;
+}
+
+// Inlining
+
+static bool is_invoke(insn_code_kind kind) {
+  return (kind >= insn_invokevirtual && kind <= insn_invokestatic) || kind == insn_invokedynamic ||
+         kind == insn_invokeinterface || (kind >= insn_invokevtable_monomorphic && kind <= insn_invokesigpoly);
+}
+
+// The method called by an instruction, if it is always the same or guarded by the inline cache
+static cp_method *known_target(const bytecode_insn *insn) {
+  switch (insn->kind) {
+  case insn_invokestatic_resolved:
+  case insn_invokespecial_resolved:
+  case insn_invokevtable_monomorphic:
+  case insn_invokeitable_monomorphic:
+    return insn->ic;
+  default:
+    return nullptr;
+  }
+}
+
+// The number of instructions that inlining the method would add, including its own inlined callees, or -1 if it can't
+// be inlined
+static int inlining_cost(const cp_method *method, int depth) {
+  const attribute_code *code = method->code;
+  if (depth > MAX_INLINE_DEPTH || !code || !method->code_analysis || method->is_signature_polymorphic ||
+      (method->access_flags & (ACCESS_NATIVE | ACCESS_SYNCHRONIZED)) || code->insn_count > MAX_INLINE_INSNS ||
+      (code->exception_table && code->exception_table->entries_count > 0))
+    return -1;
+  int cost = code->insn_count;
+  for (int i = 0; i < code->insn_count; ++i) {
+    const bytecode_insn *insn = code->code + i;
+    insn_code_kind kind = unfused_insn_kind(insn->kind);
+    const int *targets = nullptr;
+    int count = 0;
+    switch (kind) {
+    case insn_goto ... insn_ifnull:
+      if (kind == insn_jsr || insn->index <= i)
+        return -1; // no loops
+      break;
+    case insn_tableswitch:
+      targets = insn->tableswitch->targets, count = insn->tableswitch->targets_count;
+      if (insn->tableswitch->default_target <= i)
+        return -1;
+      break;
+    case insn_lookupswitch:
+      targets = insn->lookupswitch->targets, count = insn->lookupswitch->targets_count;
+      if (insn->lookupswitch->default_target <= i)
+        return -1;
+      break;
+    case insn_ret:
+    case insn_new:
+    case insn_new_resolved:
+    case insn_newarray:
+    case insn_anewarray:
+    case insn_anewarray_resolved:
+    case insn_multianewarray:
+      return -1; // safepoints
+    default:
+      if (is_invoke(kind)) {
+        cp_method *target = known_target(insn);
+        int callee_cost = target ? inlining_cost(target, depth + 1) : -1;
+        if (callee_cost < 0)
+          return -1;
+        cost += callee_cost;
+      }
+      break;
+    }
+    for (int j = 0; j < count; ++j)
+      if (targets[j] <= i)
+        return -1;
+  }
+  return cost;
+}
+
+static void build_scope(builder *b, scope *sc);
+
+static void init_scope(scope *sc, cp_method *method, scope *caller, int caller_state, int block) {
+  attribute_code *code = method->code;
+  scan_basic_blocks(code, method->code_analysis);
+  *sc = (scope){.method = method,
+                .analysis = method->code_analysis,
+                .caller = caller,
+                .caller_state = caller_state,
+                .depth = caller ? caller->depth + 1 : 0,
+                .max_stack = code->max_stack,
+                .state = -1,
+                .state_pc = -1,
+                .block = block,
+                .last_compare = -1};
+  sc->values = malloc((code->max_stack + code->max_locals) * sizeof(int));
+  for (int i = 0; i < code->max_stack + code->max_locals; ++i)
+    sc->values[i] = -1;
+}
+
+static void free_scope(scope *sc) {
+  free(sc->values);
+  free(sc->bb_blocks);
+  free(sc->bb_at);
+  arrfree(sc->phis);
+  arrfree(sc->return_blocks);
+  arrfree(sc->return_values);
+}
+
+static void inline_call(builder *b, scope *sc, const bytecode_insn *insn, cp_method *callee, int cost) {
+  int argc = method_argc(callee);
+  int call_state = frame_state(b, sc);
+  int *args = sc->values + sc->sd - argc;
+  if (insn->kind != insn_invokestatic_resolved) {
+    check(b, sc, SSA_NULL_CHECK, args[0]);
+    if (insn->kind != insn_invokespecial_resolved) {
+      int guard = check(b, sc, SSA_CLASS_CHECK, args[0]);
+      b->fn->insns[guard].classdesc = insn->ic2;
+      b->fn->insns[guard].class_ref = encode_class_ref(insn->ic2);
+    }
+  }
+
+  scope inlined;
+  init_scope(&inlined, callee, sc, call_state, sc->block);
+  memcpy(local(&inlined, 0), args, argc * sizeof(int));
+  sc->sd -= argc;
+  if (!sc->caller) // the cost includes the callee's own inlined calls
+    b->budget -= cost;
+  b->fn->inlined++;
+  build_scope(b, &inlined);
+
+  // Continue after the callee's return, or where its returns meet
+  int returns = (int)arrlen(inlined.return_blocks);
+  int result = -1;
+  if (returns == 0) {
+    sc->block = -1;
+  } else if (returns == 1) {
+    sc->block = inlined.return_blocks[0];
+    result = inlined.return_values[0];
+  } else {
+    int join = ssa_new_block(b->fn);
+    for (int i = 0; i < returns; ++i) {
+      int from = inlined.return_blocks[i];
+      ssa_new_insn(b->fn, from, SSA_GOTO, TYPE_KIND_VOID);
+      ssa_add_edge(b->fn, from, join);
+    }
+    sc->block = join;
+    if (inlined.return_values[0] != -1) {
+      result = emit(b, sc, SSA_PHI, b->fn->insns[inlined.return_values[0]].type, 0);
+      for (int i = 0; i < returns; ++i)
+        arrput(b->fn->insns[result].args, inlined.return_values[i]);
+    }
+  }
+  if (result != -1)
+    push(sc, result);
+  free_scope(&inlined);
+}
+
+static void lower_invoke(builder *b, scope *sc, const bytecode_insn *insn) {
+  cp_method *target = known_target(insn);
+  int cost = target && sc->depth < MAX_INLINE_DEPTH ? inlining_cost(target, sc->depth + 1) : -1;
+  // Calls in inlined methods were accounted for by their caller's cost (and must be inlined: they can't be safepoints)
+  if (cost >= 0 && (sc->caller || cost <= b->budget)) {
+    inline_call(b, sc, insn, target, cost);
+    return;
+  }
+  if (target && target->is_signature_polymorphic) {
+    deopt(b, sc);
+    return;
+  }
+  int state = frame_state(b, sc);
+  int sd_after = sc->sd - insn->args + insn->returns;
+  type_kind type = insn->returns ? insn_stack_state(sc->analysis, sc->pc + 1)->entries[sd_after - 1] : TYPE_KIND_VOID;
+  int v = emit(b, sc, SSA_INVOKE, type, 0);
+  b->fn->insns[v].state = state;
+  b->fn->insns[v].insn = insn;
+  sc->sd -= insn->args;
+  if (insn->returns)
+    push(sc, v);
+}
+
+static void lower_return(builder *b, scope *sc, insn_code_kind kind) {
+  int value = kind == insn_return ? -1 : pop(sc);
+  if (sc->caller) {
+    arrput(sc->return_blocks, sc->block);
+    arrput(sc->return_values, value);
+  } else if (value == -1) {
+    emit(b, sc, SSA_RETURN, TYPE_KIND_VOID, 0);
+  } else {
+    emit(b, sc, SSA_RETURN, TYPE_KIND_VOID, 1, value);
+  }
+  sc->block = -1;
+}
+
+static ssa_op int_op(insn_code_kind kind) {
+  switch (kind) {
+  case insn_iadd:
+  case insn_ladd:
+    return SSA_ADD;
+  case insn_isub:
+  case insn_lsub:
+    return SSA_SUB;
+  case insn_imul:
+  case insn_lmul:
+    return SSA_MUL;
+  case insn_idiv:
+  case insn_ldiv:
+    return SSA_DIV;
+  case insn_irem:
+  case insn_lrem:
+    return SSA_REM;
+  case insn_iand:
+  case insn_land:
+    return SSA_AND;
+  case insn_ior:
+  case insn_lor:
+    return SSA_OR;
+  case insn_ixor:
+  case insn_lxor:
+    return SSA_XOR;
+  case insn_ishl:
+  case insn_lshl:
+    return SSA_SHL;
+  case insn_ishr:
+  case insn_lshr:
+    return SSA_SHR;
+  case insn_iushr:
+  case insn_lushr:
+    return SSA_USHR;
+  case insn_fadd:
+  case insn_dadd:
+    return SSA_FADD;
+  case insn_fsub:
+  case insn_dsub:
+    return SSA_FSUB;
+  case insn_fmul:
+  case insn_dmul:
+    return SSA_FMUL;
+  default:
+    return SSA_FDIV;
+  }
+}
+
+static void lower_instruction(builder *b, scope *sc, const bytecode_insn *insn) {
+  ssa_function *fn = b->fn;
+  insn_code_kind kind = unfused_insn_kind(insn->kind);
+  int last_compare = sc->last_compare;
+  sc->last_compare = -1;
+  int v;
+  switch (kind) {
+  case insn_nop:
+    break;
+  case insn_pop:
+    sc->sd--;
+    break;
+  case insn_pop2:
+    sc->sd -= 2;
+    break;
+  case insn_aconst_null:
+    push(sc, constant(b, sc, TYPE_KIND_REFERENCE, 0));
+    break;
+  case insn_iconst:
+    push(sc, constant(b, sc, TYPE_KIND_INT, (s32)insn->integer_imm));
+    break;
+  case insn_lconst:
+    push(sc, constant(b, sc, TYPE_KIND_LONG, insn->integer_imm));
+    break;
+  case insn_fconst: {
+    u32 bits;
+    memcpy(&bits, &insn->f_imm, sizeof(bits));
+    push(sc, constant(b, sc, TYPE_KIND_FLOAT, bits));
+    break;
+  }
+  case insn_dconst: {
+    s64 bits;
+    memcpy(&bits, &insn->d_imm, sizeof(bits));
+    push(sc, constant(b, sc, TYPE_KIND_DOUBLE, bits));
+    break;
+  }
+  case insn_iload:
+  case insn_lload:
+  case insn_fload:
+  case insn_dload:
+  case insn_aload:
+    push(sc, *local(sc, insn->index));
+    break;
+  case insn_istore:
+  case insn_lstore:
+  case insn_fstore:
+  case insn_dstore:
+  case insn_astore:
+    *local(sc, insn->index) = pop(sc);
+    break;
+  case insn_iinc:
+    v = constant(b, sc, TYPE_KIND_INT, insn->iinc.const_);
+    *local(sc, insn->iinc.index) = emit(b, sc, SSA_ADD, TYPE_KIND_INT, 2, *local(sc, insn->iinc.index), v);
+    break;
+  case insn_iadd:
+  case insn_isub:
+  case insn_imul:
+  case insn_iand:
+  case insn_ior:
+  case insn_ixor:
+  case insn_ishl:
+  case insn_ishr:
+  case insn_iushr:
+  case insn_ladd:
+  case insn_lsub:
+  case insn_lmul:
+  case insn_land:
+  case insn_lor:
+  case insn_lxor:
+  case insn_lshl:
+  case insn_lshr:
+  case insn_lushr:
+  case insn_fadd:
+  case insn_fsub:
+  case insn_fmul:
+  case insn_fdiv:
+  case insn_dadd:
+  case insn_dsub:
+  case insn_dmul:
+  case insn_ddiv: {
+    int rhs = pop(sc), lhs = pop(sc);
+    push(sc, emit(b, sc, int_op(kind), fn->insns[lhs].type, 2, lhs, rhs));
+    break;
+  }
+  case insn_idiv:
+  case insn_irem:
+  case insn_ldiv:
+  case insn_lrem: {
+    int rhs = pop(sc), lhs = pop(sc);
+    check(b, sc, SSA_ZERO_CHECK, rhs);
+    push(sc, emit(b, sc, int_op(kind), fn->insns[lhs].type, 2, lhs, rhs));
+    break;
+  }
+  case insn_frem:
+  case insn_drem: {
+    int rhs = pop(sc), lhs = pop(sc);
+    v = emit(b, sc, SSA_MATH, fn->insns[lhs].type, 2, lhs, rhs);
+    fn->insns[v].fn = kind == insn_drem ? (void *)fmod : (void *)fmodf;
+    push(sc, v);
+    break;
+  }
+  case insn_ineg:
+  case insn_lneg:
+  case insn_fneg:
+  case insn_dneg:
+    v = pop(sc);
+    push(sc, emit(b, sc, kind == insn_ineg || kind == insn_lneg ? SSA_NEG : SSA_FNEG, fn->insns[v].type, 1, v));
+    break;
+  case insn_i2l:
+  case insn_l2i:
+  case insn_i2b:
+  case insn_i2s:
+  case insn_i2c:
+  case insn_i2f:
+  case insn_l2f:
+  case insn_i2d:
+  case insn_l2d:
+  case insn_f2d:
+  case insn_d2f:
+  case insn_f2i:
+  case insn_f2l:
+  case insn_d2i:
+  case insn_d2l:
+    v = emit(b, sc, SSA_CONVERT, conversion_result(kind), 1, pop(sc));
+    fn->insns[v].conversion = kind;
+    push(sc, v);
+    break;
+  case insn_sqrt:
+  case insn_sin:
+  case insn_cos:
+  case insn_tan:
+  case insn_pow:
+    if (!lower_math_intrinsic(b, sc, kind))
+      deopt(b, sc);
+    break;
+  case insn_lcmp:
+  case insn_fcmpl:
+  case insn_fcmpg:
+  case insn_dcmpl:
+  case insn_dcmpg: {
+    int rhs = pop(sc), lhs = pop(sc);
+    v = emit(b, sc, kind == insn_lcmp ? SSA_LCMP : SSA_FCMP, TYPE_KIND_INT, 2, lhs, rhs);
+    fn->insns[v].nan_result = kind == insn_fcmpg || kind == insn_dcmpg ? 1 : -1;
+    push(sc, sc->last_compare = v);
+    break;
+  }
+  case insn_goto:
+    jump_to(b, sc, insn->index);
+    break;
+  case insn_if_acmpeq ... insn_ifnull:
+    lower_if(b, sc, insn, kind, last_compare);
+    break;
+  case insn_tableswitch:
+  case insn_lookupswitch:
+    lower_switch(b, sc, insn);
+    break;
+  case insn_dup:
+  case insn_dup_x1:
+  case insn_dup_x2:
+  case insn_dup2:
+  case insn_dup2_x1:
+  case insn_dup2_x2:
+  case insn_swap:
+    lower_stack_manipulation(sc, kind);
+    break;
+  case insn_getfield_B ... insn_putstatic_L:
+  case insn_getfield_N:
+  case insn_putfield_N:
+    lower_field_access(b, sc, insn, kind);
+    break;
+  case insn_arraylength:
+    v = pop(sc);
+    check(b, sc, SSA_NULL_CHECK, v);
+    push(sc, emit(b, sc, SSA_ARRAY_LENGTH, TYPE_KIND_INT, 1, v));
+    break;
+  case insn_baload:
+  case insn_caload:
+  case insn_saload:
+  case insn_iaload:
+  case insn_laload:
+  case insn_faload:
+  case insn_daload:
+  case insn_aaload:
+  case insn_bastore:
+  case insn_castore:
+  case insn_sastore:
+  case insn_iastore:
+  case insn_lastore:
+  case insn_fastore:
+  case insn_dastore:
+  case insn_aastore:
+    lower_array_access(b, sc, kind);
+    break;
+  case insn_new_resolved:
+  case insn_newarray:
+  case insn_anewarray_resolved: {
+    int state = frame_state(b, sc);
+    if (kind == insn_new_resolved) {
+      v = emit(b, sc, SSA_NEW, TYPE_KIND_REFERENCE, 0);
+      fn->insns[v].classdesc = insn->classdesc;
+    } else if (kind == insn_newarray) {
+      v = emit(b, sc, SSA_NEWARRAY, TYPE_KIND_REFERENCE, 1, pop(sc));
+      fn->insns[v].array_type = insn->array_type;
+    } else {
+      v = emit(b, sc, SSA_ANEWARRAY, TYPE_KIND_REFERENCE, 1, pop(sc));
+      fn->insns[v].classdesc = insn->classdesc;
+    }
+    fn->insns[v].state = state;
+    push(sc, v);
+    break;
+  }
+  case insn_checkcast_resolved:
+    v = check(b, sc, SSA_CAST_CHECK, sc->values[sc->sd - 1]);
+    fn->insns[v].classdesc = insn->classdesc;
+    break;
+  case insn_instanceof_resolved:
+    v = emit(b, sc, SSA_INSTANCEOF, TYPE_KIND_INT, 1, pop(sc));
+    fn->insns[v].classdesc = insn->classdesc;
+    push(sc, v);
+    break;
+  case insn_ldc:
+    if (!lower_ldc(b, sc, insn))
+      deopt(b, sc);
+    break;
+  case insn_invokestatic_resolved:
+  case insn_invokespecial_resolved:
+  case insn_invokevtable_monomorphic:
+  case insn_invokevtable_polymorphic:
+  case insn_invokeitable_monomorphic:
+  case insn_invokeitable_polymorphic:
+    lower_invoke(b, sc, insn);
+    break;
+  case insn_return:
+  case insn_ireturn:
+  case insn_lreturn:
+  case insn_freturn:
+  case insn_dreturn:
+  case insn_areturn:
+    lower_return(b, sc, kind);
+    break;
+  default:
+    // Everything else is left to the interpreter: unresolved instructions, athrow, monitors, multianewarray,
+    // invokedynamic and subroutines
+    deopt(b, sc);
+    break;
+  }
+}
+
+// Sets up the values at the start of the basic block, returning false if it turns out to be unreachable
+static bool enter_block(builder *b, scope *sc, int bb_i) {
+  const basic_block *bb = sc->analysis->blocks + bb_i;
+  const ssa_block *block = b->fn->blocks + sc->bb_blocks[bb_i];
+  bool preds_built = true;
+  for (int i = 0; i < arrlen(bb->prev); ++i)
+    preds_built &= bb->prev[i] < bb_i;
+  if (preds_built && arrlen(block->preds) == 0)
+    return false;
+
+  const stack_summary *ss = insn_stack_state(sc->analysis, bb->start_index);
+  sc->block = sc->bb_blocks[bb_i];
+  sc->sd = ss->stack;
+  if (preds_built && arrlen(block->preds) == 1) {
+    const int *exit = b->exits[block->preds[0]];
+    memcpy(sc->values, exit, (sc->max_stack + sc->method->code->max_locals) * sizeof(int));
+  } else {
+    for (int i = 0; i < ss->stack + ss->locals; ++i) {
+      int slot = i < ss->stack ? i : sc->max_stack + i - ss->stack;
+      sc->values[slot] = -1;
+      if (ss->entries[i] != TYPE_KIND_VOID) {
+        int phi = ssa_new_insn(b->fn, sc->block, SSA_PHI, ss->entries[i]);
+        sc->values[slot] = phi;
+        arrput(sc->phis, ((pending_phi){sc->block, slot, phi}));
+      }
+    }
+  }
+
+  // Slots without a type are dead, and ones with a type must hold a value of that type
+  for (int i = 0; i < ss->stack + ss->locals; ++i) {
+    int *value = sc->values + (i < ss->stack ? i : sc->max_stack + i - ss->stack);
+    if (ss->entries[i] == TYPE_KIND_VOID)
+      *value = -1;
+    else if (*value == -1 || b->fn->insns[*value].type != ss->entries[i])
+      b->failed = true;
+  }
+  return true;
+}
+
+static void fill_phis(builder *b, scope *sc) {
+  for (int i = 0; i < arrlen(sc->phis); ++i) {
+    pending_phi *p = sc->phis + i;
+    const ssa_block *block = b->fn->blocks + p->block;
+    for (int j = 0; j < arrlen(block->preds); ++j) {
+      const int *exit = b->exits[block->preds[j]];
+      int value = exit[p->slot];
+      if (value == -1 || b->fn->insns[value].type != b->fn->insns[p->phi].type) {
+        b->failed = true;
+        return;
+      }
+      arrput(b->fn->insns[p->phi].args, value);
+    }
+  }
+}
+
+static void build_scope(builder *b, scope *sc) {
+  const attribute_code *code = sc->method->code;
+  const code_analysis *analy = sc->analysis;
+  sc->bb_blocks = malloc(analy->block_count * sizeof(int));
+  sc->bb_at = malloc(code->insn_count * sizeof(int));
+  for (int i = 0; i < code->insn_count; ++i)
+    sc->bb_at[i] = -1;
+  for (int i = 0; i < analy->block_count; ++i) {
+    sc->bb_at[analy->blocks[i].start_index] = i;
+    sc->bb_blocks[i] = ssa_new_block(b->fn);
+  }
+
+  // The entry block continues the current block, unless it is a loop header
+  if (arrlen(analy->blocks[0].prev) == 0) {
+    sc->bb_blocks[0] = sc->block;
+  } else {
+    emit(b, sc, SSA_GOTO, TYPE_KIND_VOID, 0);
+    ssa_add_edge(b->fn, sc->block, sc->bb_blocks[0]);
+    end_block(b, sc);
+  }
+
+  for (int bb_i = 0; bb_i < analy->block_count && !b->failed; ++bb_i) {
+    const basic_block *bb = analy->blocks + bb_i;
+    if (sc->bb_blocks[bb_i] != sc->block && !enter_block(b, sc, bb_i))
+      continue;
+
+    // Backward branches check the fuel, as in the baseline JIT (inlined methods have no loops)
+    bool loop_header = false;
+    for (int i = 0; i < arrlen(bb->prev); ++i)
+      loop_header |= bb->prev[i] >= bb_i;
+    sc->pc = bb->start_index;
+    if (loop_header && !sc->caller) {
+      int state = frame_state(b, sc);
+      int check = emit(b, sc, SSA_FUEL_CHECK, TYPE_KIND_VOID, 0);
+      b->fn->insns[check].state = state;
+    }
+
+    for (int i = 0; i < bb->insn_count && sc->block != -1; ++i) {
+      sc->pc = bb->start_index + i;
+      sc->sd = analy->insn_index_to_sd[sc->pc];
+      lower_instruction(b, sc, code->code + sc->pc);
+    }
+    if (sc->block != -1) // falls through into the next block
+      jump_to(b, sc, bb->start_index + bb->insn_count);
+  }
+  if (!b->failed)
+    fill_phis(b, sc);
+}
+
+// Phis whose arguments are all the same value (or the phi itself) are replaced by that value
+static void remove_trivial_phis(ssa_function *fn) {
+  int n = (int)arrlen(fn->insns);
+  int *forward = malloc(n * sizeof(int));
+  for (int i = 0; i < n; ++i)
+    forward[i] = i;
+#define RESOLVE(v)                                                                                                     \
+  do {                                                                                                                 \
+    while (forward[v] != v)                                                                                            \
+      v = forward[v];                                                                                                  \
+  } while (0)
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 0; b < arrlen(fn->blocks); ++b) {
+      ssa_block *block = fn->blocks + b;
+      for (int i = 0; i < arrlen(block->insns); ++i) {
+        int p = block->insns[i];
+        ssa_insn *phi = fn->insns + p;
+        if (phi->op != SSA_PHI)
+          break;
+        int same = -1;
+        bool trivial = true;
+        for (int j = 0; j < arrlen(phi->args) && trivial; ++j) {
+          int arg = phi->args[j];
+          RESOLVE(arg);
+          phi->args[j] = arg;
+          if (arg == p || arg == same)
+            continue;
+          trivial = same == -1;
+          same = arg;
+        }
+        if (!trivial || same == -1)
+          continue;
+        forward[p] = same;
+        phi->block = -1;
+        arrdel(block->insns, i);
+        --i;
+        changed = true;
+      }
+    }
+  }
+
+  for (int i = 0; i < n; ++i) {
+    ssa_insn *insn = fn->insns + i;
+    for (int j = 0; j < arrlen(insn->args); ++j)
+      RESOLVE(insn->args[j]);
+  }
+  for (int i = 0; i < arrlen(fn->states); ++i) {
+    ssa_frame_state *state = fn->states + i;
+    for (int j = 0; j < state->stack + state->locals; ++j)
+      if (state->values[j] != -1)
+        RESOLVE(state->values[j]);
+  }
+#undef RESOLVE
+  free(forward);
+}
+
+// Merges blocks ending in a goto with their successor, if they are its only predecessor
+static void merge_blocks(ssa_function *fn) {
+  for (int b = 0; b < arrlen(fn->blocks); ++b) {
+    ssa_block *block = fn->blocks + b;
+    while (!block->removed && ssa_terminator(fn, b)->op == SSA_GOTO) {
+      int s = block->succs[0];
+      ssa_block *succ = fn->blocks + s;
+      if (s == b || arrlen(succ->preds) != 1)
+        break;
+      fn->insns[arrpop(block->insns)].block = -1;
+      for (int i = 0; i < arrlen(succ->insns); ++i) {
+        fn->insns[succ->insns[i]].block = b;
+        arrput(block->insns, succ->insns[i]);
+      }
+      arrfree(block->succs);
+      block->succs = succ->succs;
+      succ->succs = nullptr;
+      for (int i = 0; i < arrlen(block->succs); ++i) {
+        ssa_block *next = fn->blocks + block->succs[i];
+        for (int j = 0; j < arrlen(next->preds); ++j)
+          if (next->preds[j] == s)
+            next->preds[j] = b;
+      }
+      arrsetlen(succ->insns, 0);
+      arrsetlen(succ->preds, 0);
+      succ->removed = true;
+    }
+  }
+}
+
+ssa_function *ssa_build(cp_method *method) {
+  // As with the baseline JIT, exceptions always leave compiled code, and the interpreter can't pick up a synchronized
+  // method halfway through
+  attribute_code *code = method->code;
+  if (!code || !method->code_analysis || method->is_signature_polymorphic ||
+      (method->access_flags & ACCESS_SYNCHRONIZED) ||
+      (code->exception_table && code->exception_table->entries_count > 0))
+    return nullptr;
+
+  ssa_function *fn = calloc(1, sizeof(ssa_function));
+  fn->method = method;
+  builder b = {.fn = fn, .budget = INLINE_BUDGET};
+  scope sc;
+  init_scope(&sc, method, nullptr, -1, ssa_new_block(fn));
+  const stack_summary *entry = insn_stack_state(sc.analysis, 0);
+  for (int i = 0; i < method_argc(method); ++i) {
+    int param = ssa_new_insn(fn, 0, SSA_PARAM, entry->entries[entry->stack + i]);
+    fn->insns[param].imm = i;
+    *local(&sc, i) = param;
+  }
+  build_scope(&b, &sc);
+  free_scope(&sc);
+  for (int i = 0; i < arrlen(b.exits); ++i)
+    free(b.exits[i]);
+  arrfree(b.exits);
+  if (b.failed) {
+    ssa_free(fn);
+    return nullptr;
+  }
+
+  ssa_compute_rpo(fn);
+  remove_trivial_phis(fn);
+  merge_blocks(fn);
+  ssa_compute_rpo(fn);
+  return fn;
+}
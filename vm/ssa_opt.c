@@ -0,0 +1,692 @@
+// Optimizations of the SSA form (see ssa.h).
+//
+// Global value numbering walks the blocks in reverse postorder, reusing an earlier computation of the same pure
+// operation or check if its block dominates the current one. Loads are reused within extended basic blocks until a
+// store that may alias them, or a safepoint. Checks are also removed when facts established by dominating branches and
+// checks show that they can't fail: a null check of a value known to be non-null, or a bounds check of an index known to
+// be non-negative and less than the length, which covers the common loops over an array.
+//
+// Loop-invariant code motion then moves computations that don't depend on the loop into its preheader, and dead code
+// elimination removes whatever is left unused.
+
+#include "ssa.h"
+
+typedef enum {
+  FACT_NON_NULL,     // a != null
+  FACT_NON_NEGATIVE, // a >= 0
+  FACT_LESS_THAN,    // a < b (as ints)
+} fact_kind;
+
+// A fact which holds in the block and every block it dominates
+typedef struct {
+  fact_kind kind;
+  int a, b;
+  int block;
+} fact;
+
+typedef struct {
+  ssa_function *fn;
+  int *replacement; // stb_ds array: for each instruction, the value replacing it (or itself)
+  // Hash table of the pure operations and checks that have been kept, chained through `chain`
+  int *buckets;
+  int bucket_mask;
+  int *chain; // stb_ds array
+  fact *facts;
+  int **loads; // for each block, the loads and stores whose values are known at its end
+} optimizer;
+
+// Ops which compute a value from their arguments alone
+static bool is_pure(ssa_op op) {
+  return (op >= SSA_ADD && op <= SSA_FCMP) || op == SSA_ARRAY_LENGTH || op == SSA_INSTANCEOF || op == SSA_CONST;
+}
+
+static bool is_check(ssa_op op) { return op >= SSA_NULL_CHECK && op <= SSA_STORE_CHECK; }
+
+static bool is_load(ssa_op op) { return op >= SSA_LOAD_FIELD && op <= SSA_LOAD_ELEMENT; }
+
+// Whether loading what was stored gives the same value, without narrowing it
+static bool is_full_width(type_kind type) {
+  return type != TYPE_KIND_BOOLEAN && type != TYPE_KIND_BYTE && type != TYPE_KIND_CHAR && type != TYPE_KIND_SHORT;
+}
+
+static int resolve(optimizer *opt, int v) {
+  while (opt->replacement[v] != v)
+    v = opt->replacement[v];
+  return v;
+}
+
+// Value numbering
+
+static u32 hash_insn(const ssa_insn *insn) {
+  u64 h = insn->op * 31 + insn->type;
+  h = h * 0x9E3779B97F4A7C15ull + (u64)insn->imm;
+  h = h * 31 + insn->mem_type * 7 + insn->cond;
+  for (int i = 0; i < arrlen(insn->args); ++i)
+    h = h * 0x9E3779B97F4A7C15ull + (u64)insn->args[i];
+  return (u32)(h ^ h >> 32);
+}
+
+static bool same_insn(const ssa_insn *a, const ssa_insn *b) {
+  if (a->op != b->op || a->type != b->type || a->mem_type != b->mem_type || a->cond != b->cond ||
+      a->nan_result != b->nan_result || a->imm != b->imm || arrlen(a->args) != arrlen(b->args))
+    return false;
+  for (int i = 0; i < arrlen(a->args); ++i)
+    if (a->args[i] != b->args[i])
+      return false;
+  return true;
+}
+
+// An equivalent instruction which is available at the start of the block, or -1
+static int lookup(optimizer *opt, int v, int block) {
+  const ssa_insn *insn = opt->fn->insns + v;
+  for (int c = opt->buckets[hash_insn(insn) & opt->bucket_mask]; c != -1; c = opt->chain[c]) {
+    const ssa_insn *candidate = opt->fn->insns + c;
+    if (same_insn(candidate, insn) && ssa_dominates(opt->fn, candidate->block, block))
+      return c;
+  }
+  return -1;
+}
+
+static void insert(optimizer *opt, int v) {
+  while (arrlen(opt->chain) <= v)
+    arrput(opt->chain, -1);
+  int *bucket = opt->buckets + (hash_insn(opt->fn->insns + v) & opt->bucket_mask);
+  opt->chain[v] = *bucket;
+  *bucket = v;
+}
+
+static int get_constant(optimizer *opt, type_kind type, s64 imm) {
+  ssa_insn key = {.op = SSA_CONST, .type = type, .imm = imm, .block = 0};
+  for (int c = opt->buckets[hash_insn(&key) & opt->bucket_mask]; c != -1; c = opt->chain[c])
+    if (same_insn(opt->fn->insns + c, &key))
+      return c;
+  int c = ssa_new_const(opt->fn, 0, type, imm);
+  ssa_move_before_terminator(opt->fn, 0);
+  arrput(opt->replacement, c);
+  insert(opt, c);
+  return c;
+}
+
+// Moves the constants to the entry block, after the parameters, so that they dominate all their uses and each appears
+// only once
+static void gather_constants(optimizer *opt) {
+  ssa_function *fn = opt->fn;
+  int *entry = nullptr, *constants = nullptr;
+  for (int r = 0; r < arrlen(fn->rpo); ++r) {
+    ssa_block *block = fn->blocks + fn->rpo[r];
+    int kept = 0;
+    for (int i = 0; i < arrlen(block->insns); ++i) {
+      int v = block->insns[i];
+      ssa_insn *insn = fn->insns + v;
+      if (insn->op != SSA_CONST) {
+        block->insns[kept++] = v;
+        continue;
+      }
+      insn->block = 0;
+      int existing = lookup(opt, v, 0);
+      if (existing != -1) {
+        opt->replacement[v] = existing;
+        insn->block = -1;
+      } else {
+        insert(opt, v);
+        arrput(constants, v);
+      }
+    }
+    arrsetlen(block->insns, kept);
+  }
+  ssa_block *block = fn->blocks;
+  int params = 0;
+  while (params < arrlen(block->insns) && fn->insns[block->insns[params]].op == SSA_PARAM)
+    ++params;
+  for (int i = 0; i < params; ++i)
+    arrput(entry, block->insns[i]);
+  for (int i = 0; i < arrlen(constants); ++i)
+    arrput(entry, constants[i]);
+  for (int i = params; i < arrlen(block->insns); ++i)
+    arrput(entry, block->insns[i]);
+  arrfree(block->insns);
+  block->insns = entry;
+  arrfree(constants);
+}
+
+// The value of an integer operation on constants, or -1 if it can't be folded
+static int fold(optimizer *opt, const ssa_insn *insn) {
+  ssa_function *fn = opt->fn;
+  if ((insn->type != TYPE_KIND_INT && insn->type != TYPE_KIND_LONG) || insn->op > SSA_NEG || insn->op == SSA_DIV ||
+      insn->op == SSA_REM)
+    return -1;
+  for (int i = 0; i < arrlen(insn->args); ++i)
+    if (!ssa_is_constant(fn, insn->args[i]))
+      return -1;
+  bool is_long = insn->type == TYPE_KIND_LONG;
+  u64 a = fn->insns[insn->args[0]].imm, b = arrlen(insn->args) > 1 ? fn->insns[insn->args[1]].imm : 0;
+  int shift = (int)(b & (is_long ? 63 : 31));
+  u64 result;
+  switch (insn->op) {
+  case SSA_ADD:
+    result = a + b;
+    break;
+  case SSA_SUB:
+    result = a - b;
+    break;
+  case SSA_MUL:
+    result = a * b;
+    break;
+  case SSA_AND:
+    result = a & b;
+    break;
+  case SSA_OR:
+    result = a | b;
+    break;
+  case SSA_XOR:
+    result = a ^ b;
+    break;
+  case SSA_SHL:
+    result = a << shift;
+    break;
+  case SSA_SHR:
+    result = is_long ? (u64)((s64)a >> shift) : (u64)(s64)((s32)a >> shift);
+    break;
+  case SSA_USHR:
+    result = is_long ? a >> shift : (u32)a >> shift;
+    break;
+  case SSA_NEG:
+    result = -a;
+    break;
+  default:
+    return -1;
+  }
+  // Int constants are kept sign-extended
+  return get_constant(opt, insn->type, is_long ? (s64)result : (s32)result);
+}
+
+// Facts
+
+static void add_fact(optimizer *opt, fact_kind kind, int a, int b, int block) {
+  arrput(opt->facts, ((fact){kind, a, b, block}));
+}
+
+static bool known(const optimizer *opt, fact_kind kind, int a, int b, int block) {
+  for (int i = 0; i < arrlen(opt->facts); ++i) {
+    const fact *f = opt->facts + i;
+    if (f->kind == kind && f->a == a && (b == -1 || f->b == b) && ssa_dominates(opt->fn, f->block, block))
+      return true;
+  }
+  return false;
+}
+
+// Whether the int is known to be >= 0 at the end of the block. Phis are assumed to be non-negative while their
+// arguments are looked at, which proves it for induction variables that only grow while they are less than something.
+static bool non_negative(const optimizer *opt, int v, int block, int **assumed, int depth) {
+  const ssa_function *fn = opt->fn;
+  const ssa_insn *insn = fn->insns + v;
+  if (insn->type != TYPE_KIND_INT || depth > 8)
+    return false;
+  if (known(opt, FACT_NON_NEGATIVE, v, -1, block))
+    return true;
+  switch (insn->op) {
+  case SSA_CONST:
+    return insn->imm >= 0;
+  case SSA_ARRAY_LENGTH:
+    return true;
+  case SSA_AND:
+    return non_negative(opt, insn->args[0], block, assumed, depth + 1) ||
+           non_negative(opt, insn->args[1], block, assumed, depth + 1);
+  case SSA_USHR:
+    return ssa_is_constant(fn, insn->args[1]) && (fn->insns[insn->args[1]].imm & 31) != 0;
+  case SSA_ADD: {
+    // x + 0, or x + 1 when x is less than something, so can't overflow
+    int x = insn->args[0], c = insn->args[1];
+    if (!ssa_is_constant(fn, c) || fn->insns[c].imm < 0 || fn->insns[c].imm > 1)
+      return false;
+    return non_negative(opt, x, block, assumed, depth + 1) &&
+           (fn->insns[c].imm == 0 || known(opt, FACT_LESS_THAN, x, -1, block));
+  }
+  case SSA_PHI: {
+    for (int i = 0; i < arrlen(*assumed); ++i)
+      if ((*assumed)[i] == v)
+        return true;
+    arrput(*assumed, v);
+    bool result = true;
+    const ssa_block *phi_block = fn->blocks + insn->block;
+    for (int i = 0; i < arrlen(insn->args) && result; ++i)
+      result = non_negative(opt, insn->args[i], phi_block->preds[i], assumed, depth + 1);
+    (void)arrpop(*assumed);
+    return result;
+  }
+  default:
+    return false;
+  }
+}
+
+static bool is_non_null(const optimizer *opt, int v, int block) {
+  const ssa_function *fn = opt->fn;
+  const ssa_insn *insn = fn->insns + v;
+  if (insn->op == SSA_NEW || insn->op == SSA_NEWARRAY || insn->op == SSA_ANEWARRAY)
+    return true;
+  if (insn->op == SSA_PARAM && insn->imm == 0 && !(fn->method->access_flags & ACCESS_STATIC))
+    return true; // this
+  return known(opt, FACT_NON_NULL, v, -1, block);
+}
+
+// Whether the check can't fail at its position in the block
+static bool check_is_redundant(optimizer *opt, const ssa_insn *insn, int block) {
+  const ssa_function *fn = opt->fn;
+  int arg = insn->args[0];
+  switch (insn->op) {
+  case SSA_NULL_CHECK:
+    return is_non_null(opt, arg, block);
+  case SSA_ZERO_CHECK:
+    return ssa_is_constant(fn, arg) && fn->insns[arg].imm != 0;
+  case SSA_CAST_CHECK:
+    return ssa_is_constant(fn, arg); // null
+  case SSA_BOUNDS_CHECK: {
+    if (!known(opt, FACT_LESS_THAN, arg, insn->args[1], block))
+      return false;
+    int *assumed = nullptr;
+    bool result = non_negative(opt, arg, block, &assumed, 0);
+    arrfree(assumed);
+    return result;
+  }
+  default:
+    return false;
+  }
+}
+
+// What a check establishes for the code after it
+static void add_check_facts(optimizer *opt, const ssa_insn *insn, int block) {
+  if (insn->op == SSA_NULL_CHECK || insn->op == SSA_CLASS_CHECK) {
+    add_fact(opt, FACT_NON_NULL, insn->args[0], -1, block);
+  } else if (insn->op == SSA_BOUNDS_CHECK) {
+    add_fact(opt, FACT_NON_NEGATIVE, insn->args[0], -1, block);
+    add_fact(opt, FACT_LESS_THAN, insn->args[0], insn->args[1], block);
+  }
+}
+
+static ssa_cond negate_cond(ssa_cond cond) {
+  static const ssa_cond negated[] = {SSA_NE, SSA_EQ, SSA_GE, SSA_LT, SSA_LE, SSA_GT};
+  return negated[cond];
+}
+
+// What a branch establishes for successors which can only be reached through it
+static void add_branch_facts(optimizer *opt, int block) {
+  const ssa_function *fn = opt->fn;
+  const ssa_insn *branch = ssa_terminator(fn, block);
+  int a = branch->args[0], b = branch->args[1];
+  bool b_is_zero = ssa_is_constant(fn, b) && fn->insns[b].imm == 0;
+  for (int i = 0; i < 2; ++i) {
+    int succ = fn->blocks[block].succs[i];
+    if (arrlen(fn->blocks[succ].preds) != 1)
+      continue;
+    ssa_cond cond = i == 0 ? branch->cond : negate_cond(branch->cond);
+    if (branch->mem_type == TYPE_KIND_REFERENCE) {
+      if (cond == SSA_NE && b_is_zero)
+        add_fact(opt, FACT_NON_NULL, a, -1, succ);
+    } else if (branch->mem_type == TYPE_KIND_INT) {
+      if (cond == SSA_LT)
+        add_fact(opt, FACT_LESS_THAN, a, b, succ);
+      else if (cond == SSA_GT)
+        add_fact(opt, FACT_LESS_THAN, b, a, succ);
+      if ((cond == SSA_GE || cond == SSA_GT) && b_is_zero)
+        add_fact(opt, FACT_NON_NEGATIVE, a, -1, succ);
+    }
+  }
+}
+
+// Loads
+
+// The value that the load would produce, from an earlier load or store still in `loads`, or -1
+static int known_load(const optimizer *opt, const int *loads, const ssa_insn *load) {
+  const ssa_function *fn = opt->fn;
+  for (int i = (int)arrlen(loads) - 1; i >= 0; --i) {
+    const ssa_insn *other = fn->insns + loads[i];
+    if (other->mem_type != load->mem_type || other->imm != load->imm)
+      continue;
+    switch (other->op) {
+    case SSA_LOAD_FIELD:
+    case SSA_LOAD_STATIC:
+    case SSA_LOAD_ELEMENT:
+      if (other->op == load->op && same_insn(other, load))
+        return loads[i];
+      break;
+    case SSA_STORE_FIELD:
+      if (load->op == SSA_LOAD_FIELD && other->args[0] == load->args[0] && is_full_width(load->mem_type))
+        return other->args[1];
+      break;
+    case SSA_STORE_STATIC:
+      if (load->op == SSA_LOAD_STATIC && is_full_width(load->mem_type))
+        return other->args[0];
+      break;
+    case SSA_STORE_ELEMENT:
+      if (load->op == SSA_LOAD_ELEMENT && other->args[0] == load->args[0] && other->args[1] == load->args[1] &&
+          is_full_width(load->mem_type))
+        return other->args[2];
+      break;
+    default:
+      break;
+    }
+  }
+  return -1;
+}
+
+// Whether a store might write what the load (or store) reads
+static bool may_alias(const ssa_insn *store, const ssa_insn *access) {
+  switch (store->op) {
+  case SSA_STORE_FIELD:
+    return (access->op == SSA_LOAD_FIELD || access->op == SSA_STORE_FIELD) && access->offset == store->offset;
+  case SSA_STORE_STATIC:
+    return (access->op == SSA_LOAD_STATIC || access->op == SSA_STORE_STATIC) && access->address == store->address;
+  case SSA_STORE_ELEMENT:
+    return access->op == SSA_LOAD_ELEMENT || access->op == SSA_STORE_ELEMENT;
+  default:
+    return true;
+  }
+}
+
+static void kill_loads(const optimizer *opt, int **loads, const ssa_insn *store) {
+  int kept = 0;
+  for (int i = 0; i < arrlen(*loads); ++i)
+    if (!may_alias(store, opt->fn->insns + (*loads)[i]))
+      (*loads)[kept++] = (*loads)[i];
+  arrsetlen(*loads, kept);
+}
+
+static void value_number(optimizer *opt) {
+  ssa_function *fn = opt->fn;
+  for (int r = 0; r < arrlen(fn->rpo); ++r) {
+    int b = fn->rpo[r];
+    ssa_block *block = fn->blocks + b;
+    int *loads = nullptr;
+    if (arrlen(block->preds) == 1 && fn->blocks[block->preds[0]].rpo < r) {
+      const int *pred_loads = opt->loads[block->preds[0]];
+      for (int i = 0; i < arrlen(pred_loads); ++i)
+        arrput(loads, pred_loads[i]);
+    }
+
+    int kept = 0;
+    for (int i = 0; i < arrlen(block->insns); ++i) {
+      int v = block->insns[i];
+      ssa_insn *insn = fn->insns + v;
+      for (int j = 0; j < arrlen(insn->args); ++j)
+        insn->args[j] = resolve(opt, insn->args[j]);
+
+      int replacement = -1;
+      bool remove = false;
+      if (is_pure(insn->op) && insn->op != SSA_CONST) {
+        replacement = fold(opt, insn);
+        insn = fn->insns + v; // folding may add a constant
+        if (replacement == -1)
+          replacement = lookup(opt, v, b);
+        if (replacement == -1)
+          insert(opt, v);
+      } else if (is_check(insn->op)) {
+        remove = check_is_redundant(opt, insn, b) || lookup(opt, v, b) != -1;
+        if (!remove) {
+          insert(opt, v);
+          add_check_facts(opt, insn, b);
+        }
+      } else if (is_load(insn->op)) {
+        replacement = known_load(opt, loads, insn);
+        if (replacement == -1)
+          arrput(loads, v);
+      } else if (insn->op == SSA_STORE_FIELD || insn->op == SSA_STORE_STATIC || insn->op == SSA_STORE_ELEMENT) {
+        kill_loads(opt, &loads, insn);
+        arrput(loads, v);
+      } else if (ssa_is_safepoint(insn)) {
+        arrsetlen(loads, 0);
+      } else if (insn->op == SSA_BRANCH) {
+        add_branch_facts(opt, b);
+      }
+
+      if (replacement != -1) {
+        opt->replacement[v] = replacement;
+        remove = true;
+      }
+      if (remove)
+        insn->block = -1;
+      else
+        block->insns[kept++] = v;
+    }
+    arrsetlen(block->insns, kept);
+    opt->loads[b] = loads;
+  }
+
+  // Phis may use values from later blocks, and frame states weren't updated as they went
+  for (int v = 0; v < arrlen(fn->insns); ++v) {
+    ssa_insn *insn = fn->insns + v;
+    for (int j = 0; j < arrlen(insn->args); ++j)
+      insn->args[j] = resolve(opt, insn->args[j]);
+  }
+  for (int s = 0; s < arrlen(fn->states); ++s) {
+    ssa_frame_state *state = fn->states + s;
+    for (int j = 0; j < state->stack + state->locals; ++j)
+      if (state->values[j] != -1)
+        state->values[j] = resolve(opt, state->values[j]);
+  }
+}
+
+// Loop-invariant code motion
+
+static bool in_loop(const ssa_function *fn, int block, int header) {
+  for (int h = fn->blocks[block].loop_header; h != -1; h = fn->blocks[h].loop_parent)
+    if (h == header)
+      return true;
+  return false;
+}
+
+// The block which enters the loop, which ends in a goto to the header, created if the header has one predecessor
+// outside the loop that can also go elsewhere. Returns -1 if it has several.
+static int preheader(ssa_function *fn, int header) {
+  int outside = -1;
+  for (int i = 0; i < arrlen(fn->blocks[header].preds); ++i) {
+    int p = fn->blocks[header].preds[i];
+    if (in_loop(fn, p, header))
+      continue;
+    if (outside != -1)
+      return -1;
+    outside = i;
+  }
+  if (outside == -1)
+    return -1;
+  int p = fn->blocks[header].preds[outside];
+  if (arrlen(fn->blocks[p].succs) == 1)
+    return p;
+
+  int pre = ssa_new_block(fn);
+  ssa_new_insn(fn, pre, SSA_GOTO, TYPE_KIND_VOID);
+  ssa_block *block = fn->blocks + pre, *h = fn->blocks + header;
+  arrput(block->preds, p);
+  arrput(block->succs, header);
+  for (int i = 0; i < arrlen(fn->blocks[p].succs); ++i) {
+    if (fn->blocks[p].succs[i] == header) {
+      fn->blocks[p].succs[i] = pre;
+      break;
+    }
+  }
+  h->preds[outside] = pre;
+  // Keep the analyses usable for the loops still to be processed
+  block->idom = p;
+  block->rpo = h->rpo;
+  block->loop_header = h->loop_parent;
+  block->loop_depth = h->loop_depth - 1;
+  h->idom = pre;
+  return pre;
+}
+
+typedef struct {
+  bool calls;      // invokes, which may store anything
+  bool safepoints; // where references are reloaded, so a reference can't live across them unless the frame has it
+  int *stores;     // stb_ds array
+  int *narrowed;   // stb_ds array: values whose class is checked in the loop
+} loop_effects;
+
+static bool is_hoistable(optimizer *opt, const loop_effects *effects, int v, int pre) {
+  const ssa_function *fn = opt->fn;
+  const ssa_insn *insn = fn->insns + v;
+  // Division traps on zero, which the check in the loop might not have ruled out
+  if (!is_pure(insn->op) && !is_load(insn->op))
+    return false;
+  if (insn->op == SSA_DIV || insn->op == SSA_REM || insn->op == SSA_LOAD_ELEMENT)
+    return false;
+  if (insn->type == TYPE_KIND_REFERENCE && effects->safepoints)
+    return false;
+  if (insn->op == SSA_ARRAY_LENGTH || insn->op == SSA_LOAD_FIELD) {
+    // The object must be known to be non-null before the loop, and of a class which has the field, so not narrowed
+    // by a check in the loop (e.g. guarding an inlined method)
+    int obj = insn->args[0];
+    if (!is_non_null(opt, obj, pre))
+      return false;
+    for (int i = 0; i < arrlen(effects->narrowed); ++i)
+      if (effects->narrowed[i] == obj)
+        return false;
+  }
+  if (is_load(insn->op)) {
+    if (effects->calls)
+      return false;
+    for (int i = 0; i < arrlen(effects->stores); ++i)
+      if (may_alias(fn->insns + effects->stores[i], insn))
+        return false;
+  }
+  return true;
+}
+
+static void hoist_loop_invariants(optimizer *opt) {
+  ssa_function *fn = opt->fn;
+  int *headers = nullptr;
+  for (int r = (int)arrlen(fn->rpo) - 1; r >= 0; --r) // inner loops first, so that their invariants can move further
+    if (fn->blocks[fn->rpo[r]].loop_header == fn->rpo[r])
+      arrput(headers, fn->rpo[r]);
+
+  for (int l = 0; l < arrlen(headers); ++l) {
+    int header = headers[l];
+    int pre = preheader(fn, header);
+    if (pre == -1)
+      continue;
+    int *body = nullptr;
+    loop_effects effects = {0};
+    for (int r = 0; r < arrlen(fn->rpo); ++r) {
+      int b = fn->rpo[r];
+      if (!in_loop(fn, b, header))
+        continue;
+      arrput(body, b);
+      for (int i = 0; i < arrlen(fn->blocks[b].insns); ++i) {
+        const ssa_insn *insn = fn->insns + fn->blocks[b].insns[i];
+        if (insn->op == SSA_STORE_FIELD || insn->op == SSA_STORE_STATIC || insn->op == SSA_STORE_ELEMENT)
+          arrput(effects.stores, fn->blocks[b].insns[i]);
+        else if (insn->op == SSA_CLASS_CHECK || insn->op == SSA_CAST_CHECK)
+          arrput(effects.narrowed, insn->args[0]);
+        effects.calls |= insn->op == SSA_INVOKE;
+        effects.safepoints |= ssa_is_safepoint(insn);
+      }
+    }
+
+    // In reverse postorder, so that operands are hoisted before their uses
+    for (int k = 0; k < arrlen(body); ++k) {
+      ssa_block *block = fn->blocks + body[k];
+      int kept = 0;
+      for (int i = 0; i < arrlen(block->insns); ++i) {
+        int v = block->insns[i];
+        const ssa_insn *insn = fn->insns + v;
+        bool invariant = is_hoistable(opt, &effects, v, pre);
+        for (int j = 0; j < arrlen(insn->args) && invariant; ++j)
+          invariant = !in_loop(fn, fn->insns[insn->args[j]].block, header);
+        if (!invariant) {
+          block->insns[kept++] = v;
+          continue;
+        }
+        ssa_block *pre_block = fn->blocks + pre;
+        arrins(pre_block->insns, arrlen(pre_block->insns) - 1, v);
+        fn->insns[v].block = pre;
+      }
+      arrsetlen(block->insns, kept);
+    }
+    arrfree(body);
+    arrfree(effects.stores);
+    arrfree(effects.narrowed);
+  }
+  arrfree(headers);
+}
+
+// Dead code elimination
+
+static void eliminate_dead_code(ssa_function *fn) {
+  int n = (int)arrlen(fn->insns);
+  bool *live = calloc(n, sizeof(bool));
+  int *worklist = nullptr;
+  for (int v = 0; v < n; ++v) {
+    if (fn->insns[v].block != -1 && ssa_has_side_effects(fn->insns + v)) {
+      live[v] = true;
+      arrput(worklist, v);
+    }
+  }
+  while (arrlen(worklist)) {
+    const ssa_insn *insn = fn->insns + arrpop(worklist);
+    for (int i = 0; i < arrlen(insn->args); ++i) {
+      if (!live[insn->args[i]]) {
+        live[insn->args[i]] = true;
+        arrput(worklist, insn->args[i]);
+      }
+    }
+    for (int s = insn->state; s != -1; s = fn->states[s].parent) {
+      const ssa_frame_state *state = fn->states + s;
+      for (int i = 0; i < state->stack + state->locals; ++i) {
+        int value = state->values[i];
+        if (value != -1 && !live[value]) {
+          live[value] = true;
+          arrput(worklist, value);
+        }
+      }
+    }
+  }
+  for (int b = 0; b < arrlen(fn->blocks); ++b) {
+    ssa_block *block = fn->blocks + b;
+    int kept = 0;
+    for (int i = 0; i < arrlen(block->insns); ++i) {
+      int v = block->insns[i];
+      if (live[v])
+        block->insns[kept++] = v;
+      else
+        fn->insns[v].block = -1;
+    }
+    arrsetlen(block->insns, kept);
+  }
+  arrfree(worklist);
+  free(live);
+}
+
+bool ssa_optimize(ssa_function *fn) {
+  ssa_compute_rpo(fn);
+  ssa_compute_dominators(fn);
+  if (!ssa_find_loops(fn))
+    return false;
+
+  optimizer opt = {.fn = fn};
+  int buckets = 64;
+  while (buckets < arrlen(fn->insns))
+    buckets *= 2;
+  opt.buckets = malloc(buckets * sizeof(int));
+  for (int i = 0; i < buckets; ++i)
+    opt.buckets[i] = -1;
+  opt.bucket_mask = buckets - 1;
+  for (int v = 0; v < arrlen(fn->insns); ++v)
+    arrput(opt.replacement, v);
+  int block_count = (int)arrlen(fn->blocks);
+  opt.loads = calloc(block_count, sizeof(int *));
+
+  gather_constants(&opt);
+  value_number(&opt);
+  hoist_loop_invariants(&opt);
+  eliminate_dead_code(fn);
+
+  for (int b = 0; b < block_count; ++b)
+    arrfree(opt.loads[b]);
+  free(opt.loads);
+  free(opt.buckets);
+  arrfree(opt.replacement);
+  arrfree(opt.chain);
+  arrfree(opt.facts);
+  ssa_compute_rpo(fn);
+  ssa_compute_dominators(fn);
+  ssa_find_loops(fn);
+  return true;
+}
@@ -2,6 +2,8 @@
 #include "bjvm.h"
 #include "classfile.h"
 
+#include <inttypes.h>
+
 static bool same_runtime_package(const classdesc *a, const classdesc *b) {
   // Find last slash in both names, and compare the strings up to that point.
   const char *as = strrchr(a->name.chars, '/');
@@ -189,6 +191,43 @@ static void setup_itables(classdesc *super, classdesc *cd) {
 }
 
 // TODO consider optimizing final methods out of the tables?
+static u32 next_interface_id = 1;
+
+static bool slots_collide(const itables *itables, u32 mask) {
+  u64 seen[4] = {0}; // mask < 256
+  for (int i = 0; i < arrlen(itables->interfaces); ++i) {
+    u32 slot = itables->interfaces[i]->interface_id & mask;
+    if (seen[slot / 64] & 1ULL << slot % 64)
+      return true;
+    seen[slot / 64] |= 1ULL << slot % 64;
+  }
+  return false;
+}
+
+// Hash the interfaces by their IDs. Tables of up to four times the next power of two above the interface count are
+// tried, and the smallest in which no two interfaces share a home slot is taken; otherwise the lookup probes.
+static void build_itable_slots(itables *itables) {
+  u32 count = arrlen(itables->interfaces), size = 1;
+  while (size < 2 * count)
+    size *= 2;
+  u32 chosen = size;
+  for (u32 candidate = size; candidate <= 4 * size && candidate <= 256; candidate *= 2) {
+    if (!slots_collide(itables, candidate - 1)) {
+      chosen = candidate;
+      break;
+    }
+  }
+  itables->slot_mask = chosen - 1;
+  itables->slots = calloc(chosen, sizeof(itable_slot));
+  CHECK(itables->slots, "Failed to allocate itable slots");
+  for (u32 i = 0; i < count; ++i) {
+    u32 slot = itables->interfaces[i]->interface_id & itables->slot_mask;
+    while (itables->slots[slot].interface)
+      slot = (slot + 1) & itables->slot_mask;
+    itables->slots[slot] = (itable_slot){itables->interfaces[i], itables->entries + i};
+  }
+}
+
 void set_up_function_tables(classdesc *cd) {
   vtable *vtable = &cd->vtable;
   DCHECK(!vtable->methods, "v-table already set up");
@@ -216,6 +255,7 @@ void set_up_function_tables(classdesc *cd) {
   // interface, only including the appropriate functions (i.e., functions which
   // are public and non-static).
   if (cd->access_flags & ACCESS_INTERFACE) {
+    cd->interface_id = __atomic_fetch_add(&next_interface_id, 1, __ATOMIC_RELAXED);
     itable itable = {cd};
     for (int i = 0; i < cd->methods_count; ++i) {
       cp_method *method = cd->methods + i;
@@ -229,6 +269,8 @@ void set_up_function_tables(classdesc *cd) {
     arrput(itables->entries, itable);
   }
 
+  build_itable_slots(&cd->itables);
+
   // Then push all new methods which are not represented in a vtable into the
   // class's vtable
   for (int i = 0; i < cd->methods_count; ++i) {
@@ -241,6 +283,7 @@ void set_up_function_tables(classdesc *cd) {
 }
 
 void free_function_tables(classdesc *classdesc) {
+  free(classdesc->itables.slots);
   arrfree(classdesc->vtable.methods);
   for (int i = 0; i < arrlen(classdesc->itables.entries); ++i) {
     arrfree(classdesc->itables.entries[i].methods);
@@ -254,18 +297,116 @@ cp_method *vtable_lookup(classdesc const *classdesc, size_t index) {
   return classdesc->vtable.methods[index];
 }
 
+itable *find_itable(classdesc const *cd, classdesc const *interface) {
+  const itables *itables = &cd->itables;
+  if (unlikely(!itables->slots))
+    return nullptr; // not linked, or a primitive class
+  for (u32 i = interface->interface_id & itables->slot_mask;; i = (i + 1) & itables->slot_mask) {
+    itable_slot slot = itables->slots[i];
+    if (slot.interface == interface)
+      return slot.entry;
+    if (!slot.interface)
+      return nullptr;
+  }
+}
+
 cp_method *itable_lookup(classdesc const *cd, classdesc const *interface, size_t index) {
-  for (int i = 0; i < arrlen(cd->itables.interfaces); ++i) {
-    if (cd->itables.interfaces[i] == interface) {
-      itable itable = cd->itables.entries[i];
-      DCHECK(index < arrlenu(itable.methods) && "itable index out of range");
-      itable_method_t m = itable.methods[index];
-      if (m & ITABLE_METHOD_BIT_INVALID) {
-        return nullptr;
+  itable *itable = find_itable(cd, interface);
+  if (!itable)
+    return nullptr;
+  DCHECK(index < arrlenu(itable->methods) && "itable index out of range");
+  itable_method_t m = itable->methods[index];
+  if (m & ITABLE_METHOD_BIT_INVALID) {
+    return nullptr;
+  }
+  return (cp_method *)m;
+}
+
+cp_method *polymorphic_cache_miss(polymorphic_cache *cache, classdesc *cd) {
+  cache->misses++;
+  cp_method *method = cache->interface ? itable_lookup(cd, cache->interface, cache->index)
+                                       : vtable_lookup(cd, cache->index);
+  if (!method || cache->megamorphic)
+    return method;
+  if (cache->count < POLYMORPHIC_CACHE_SIZE) {
+    cache->receivers[cache->count] = cd;
+    cache->targets[cache->count++] = method;
+  } else {
+    cache->megamorphic = true;
+    cache->count = 0;
+  }
+  return method;
+}
+
+void polymorphic_cache_forget(polymorphic_cache *cache, bool (*is_unloaded)(classdesc *cd)) {
+  int kept = 0;
+  for (int i = 0; i < cache->count; ++i) {
+    if (!is_unloaded(cache->receivers[i])) {
+      cache->receivers[kept] = cache->receivers[i];
+      cache->targets[kept++] = cache->targets[i];
+    }
+  }
+  cache->count = kept;
+}
+
+typedef struct {
+  const cp_method *method;
+  const bytecode_insn *insn;
+} call_site;
+
+static int compare_call_site_misses(const void *a, const void *b) {
+  const polymorphic_cache *x = ((const call_site *)a)->insn->ic, *y = ((const call_site *)b)->insn->ic;
+  return x->misses < y->misses ? 1 : x->misses > y->misses ? -1 : 0;
+}
+
+static void add_polymorphic_call_sites(call_site **sites, const classdesc *desc) {
+  for (int i = 0; i < desc->methods_count; ++i) {
+    const cp_method *method = desc->methods + i;
+    if (!method->code)
+      continue;
+    for (int j = 0; j < method->code->insn_count; ++j) {
+      const bytecode_insn *insn = method->code->code + j;
+      if (insn->kind == insn_invokevtable_polymorphic || insn->kind == insn_invokeitable_polymorphic) {
+        arrput(*sites, ((call_site){.method = method, .insn = insn}));
       }
-      cp_method *method = (cp_method *)m;
-      return method;
     }
   }
-  return nullptr;
-}
\ No newline at end of file
+}
+
+char *inline_cache_report(vm *vm) {
+  call_site *sites = nullptr;
+  for (int i = 0; i < arrlen(vm->active_classloaders); ++i) {
+    hash_table_iterator it = hash_table_get_iterator(&vm->active_classloaders[i]->loaded);
+    char *key;
+    size_t key_len;
+    classdesc *desc;
+    while (hash_table_iterator_has_next(it, &key, &key_len, (void **)&desc)) {
+      add_polymorphic_call_sites(&sites, desc);
+      hash_table_iterator_next(&it);
+    }
+  }
+  qsort(sites, arrlen(sites), sizeof(call_site), compare_call_site_misses);
+
+  string_builder out;
+  string_builder_init(&out);
+  string_builder_append(&out, "          hits        misses  receivers  call site\n");
+  for (int i = 0; i < arrlen(sites); ++i) {
+    const polymorphic_cache *cache = sites[i].insn->ic;
+    const cp_method *m = sites[i].method, *target = sites[i].insn->cp->methodref.resolved;
+    char receivers[16];
+    if (cache->megamorphic) {
+      snprintf(receivers, sizeof(receivers), "mega");
+    } else {
+      snprintf(receivers, sizeof(receivers), "%d", cache->count);
+    }
+    string_builder_append(&out, "%14" PRIu64 " %13" PRIu64 " %10s  %.*s.%.*s%.*s @ %d -> %.*s.%.*s\n", cache->hits,
+                          cache->misses, receivers, fmt_slice(m->my_class->name), fmt_slice(m->name),
+                          fmt_slice(m->unparsed_descriptor), sites[i].insn->original_pc,
+                          fmt_slice(target->my_class->name), fmt_slice(target->name));
+  }
+
+  char *result = strdup(out.data);
+  string_builder_free(&out);
+  arrfree(sites);
+  return result;
+}
@@ -52,10 +52,18 @@ typedef struct {
 } itable;
 
 typedef struct {
-  // Scan this vector for the interface in question ...
+  const classdesc *interface; // nullptr if the slot is empty
+  itable *entry;
+} itable_slot;
+
+typedef struct {
+  // The interfaces implemented, and the matching itables
   classdesc **interfaces;
-  // ... and look for the matching itable here
   itable *entries;
+  // Open-addressed table over the interfaces, for constant-time lookup: an interface's home slot is its interface_id
+  // & slot_mask, and collisions probe linearly. The table is made large enough that most classes have none.
+  itable_slot *slots;
+  u32 slot_mask;
 } itables;
 
 // Set up a class descriptor's itables and vtable, assuming all of its
@@ -69,11 +77,46 @@ void free_function_tables(classdesc *classdesc);
 // Look up a method in the vtable. No ranges are checked.
 cp_method *vtable_lookup(classdesc const *classdesc, size_t index);
 
+// Find the itable for the given interface, or nullptr if the class doesn't implement it.
+itable *find_itable(classdesc const *cd, classdesc const *interface);
+
 // Look up a method in the itables. No ranges are checked, but nullptr is
 // returned if the object does not actually implement the method, or if there
 // are multiple methods that could be called.
 cp_method *itable_lookup(classdesc const *cd, classdesc const *interface, size_t index);
 
+// Polymorphic inline cache, for an invokevirtual or invokeinterface call site which has seen more than one receiver
+// class. Receiver classes and their targets are cached until more than POLYMORPHIC_CACHE_SIZE distinct classes have
+// been seen, after which the call site is megamorphic: the cache is emptied and every call does a full lookup.
+#define POLYMORPHIC_CACHE_SIZE 4
+
+typedef struct polymorphic_cache {
+  classdesc *interface; // nullptr for invokevirtual
+  size_t index;         // into the vtable, or the interface's itable
+  int count;            // entries in use
+  bool megamorphic;
+  classdesc *receivers[POLYMORPHIC_CACHE_SIZE];
+  cp_method *targets[POLYMORPHIC_CACHE_SIZE];
+  // Calls whose receiver class was found in the cache, and calls which needed a full lookup
+  u64 hits, misses;
+} polymorphic_cache;
+
+cp_method *polymorphic_cache_miss(polymorphic_cache *cache, classdesc *cd);
+
+// Find the method to invoke on a receiver of class cd, or nullptr if it doesn't implement the interface method.
+static inline cp_method *polymorphic_cache_lookup(polymorphic_cache *cache, classdesc *cd) {
+  for (int i = 0; i < cache->count; ++i) {
+    if (cache->receivers[i] == cd) {
+      cache->hits++;
+      return cache->targets[i];
+    }
+  }
+  return polymorphic_cache_miss(cache, cd);
+}
+
+// Remove the entries whose receiver class is about to be unloaded
+void polymorphic_cache_forget(polymorphic_cache *cache, bool (*is_unloaded)(classdesc *cd));
+
 #ifdef __cplusplus
 }
 #endif
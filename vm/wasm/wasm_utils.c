@@ -788,20 +788,15 @@ wasm_instantiation_result *wasm_instantiate_module(wasm_module *module, const ch
           var module = new WebAssembly.Module(slice);
           var instance =
               new WebAssembly.Instance(module, {env : wasmExports, env2 : {memory : wasmMemory, table : wasmTable}});
-          let count = 0;
-          for (var exp in instance.exports)
-            count++;
-          require("fs").writeFileSync("debug/test" + UTF8ToString($2) + ".wasm", slice);
           return addFunction(instance.exports.run, 'iiii');
         } catch (e) {
-          // Exit Node.js
-          console.log(e);
-          require("fs").writeFileSync("debug/broken" + UTF8ToString($2) + ".wasm", slice);
-          process.exit(1);
+          // The caller falls back to the interpreter
+          console.log("Failed to instantiate JIT module for " + UTF8ToString($2) + ": " + e);
           return 0;
         }
       },
       (intptr_t)serialized.bytes, (intptr_t)(serialized.bytes + arrlen(serialized.bytes)), (intptr_t)debug_name);
+  arrfree(serialized.bytes);
   if (ptr) {
     result->status = WASM_INSTANTIATION_SUCCESS;
     result->run = (void *)ptr;
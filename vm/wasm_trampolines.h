@@ -24,6 +24,10 @@ typedef void *interpreter_trampoline;
 // (thread, method, arg1, arg2, ... argN) -> return value
 interpreter_trampoline get_wasm_interpreter_trampoline(wasm_value_type return_type, wasm_value_type *args, s32 argc);
 
+// Called by interpreter trampolines: runs the method in the interpreter, unless it has been compiled (perhaps by this
+// call, once it is hot enough). args must have room for at least one value, even if the method takes no arguments.
+stack_value jit_call_interpreter(vm_thread *thread, cp_method *method, stack_value *args);
+
 #ifdef __cplusplus
 }
 #endif
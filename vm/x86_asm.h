@@ -0,0 +1,309 @@
+//
+// An x86-64 assembler, shared by the baseline JIT (x86_jit.c) and the optimizing JIT (x86_opt_jit.c).
+//
+
+#ifndef X86_ASM_H
+#define X86_ASM_H
+
+#include "adt.h"
+#include "util.h"
+
+#include <string.h>
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7, XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15 };
+
+// Condition codes, as in the low nibble of jcc and setcc. Flipping the lowest bit negates the condition.
+typedef enum {
+  CC_B = 0x2,
+  CC_AE = 0x3,
+  CC_E = 0x4,
+  CC_NE = 0x5,
+  CC_BE = 0x6,
+  CC_A = 0x7,
+  CC_P = 0xA,
+  CC_NP = 0xB,
+  CC_L = 0xC,
+  CC_GE = 0xD,
+  CC_LE = 0xE,
+  CC_G = 0xF,
+  CC_ALWAYS = -1
+} condition;
+
+// Opcode extensions (the reg field of ModRM) of the group 1 (0x81, 0x83), group 2 (0xC1, 0xD3) and group 3 (0xF7)
+// instructions
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+enum { SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7 };
+enum { UNARY_NEG = 3, UNARY_IDIV = 7 };
+
+// Mandatory prefixes of the scalar SSE instructions
+enum { SSE_SINGLE = 0xF3, SSE_DOUBLE = 0xF2 };
+
+// Memory operand [base + index * scale + disp]
+typedef struct {
+  int base;
+  int index; // -1 if none
+  int scale;
+  s32 disp;
+} mem;
+
+// A 32-bit displacement to patch once the label's offset is known
+typedef struct {
+  int at;
+  int label;
+  int relative_to; // the displacement is the label's offset minus this offset
+} fixup;
+
+typedef struct {
+  u8 *buf;       // stb_ds array of machine code
+  int *labels;   // stb_ds array: offset of each label, or -1 if it hasn't been bound yet
+  fixup *fixups; // stb_ds array
+} x86_asm;
+
+static inline void x86_asm_free(x86_asm *as) {
+  arrfree(as->buf);
+  arrfree(as->labels);
+  arrfree(as->fixups);
+}
+
+static inline void emit8(x86_asm *as, int byte) { arrput(as->buf, (u8)byte); }
+
+static inline void emit16(x86_asm *as, u16 value) {
+  emit8(as, value);
+  emit8(as, value >> 8);
+}
+
+static inline void emit32(x86_asm *as, u32 value) {
+  for (int i = 0; i < 4; ++i)
+    emit8(as, (u8)(value >> 8 * i));
+}
+
+static inline void emit64(x86_asm *as, u64 value) {
+  emit32(as, (u32)value);
+  emit32(as, (u32)(value >> 32));
+}
+
+static inline int here(const x86_asm *as) { return (int)arrlen(as->buf); }
+
+// One to three opcode bytes, most significant first (e.g. 0x0FAF)
+static inline void emit_opcode(x86_asm *as, u32 opcode) {
+  if (opcode > 0xffff)
+    emit8(as, opcode >> 16);
+  if (opcode > 0xff)
+    emit8(as, opcode >> 8);
+  emit8(as, opcode);
+}
+
+static inline void emit_rex(x86_asm *as, bool w, int reg, int index, int base) {
+  int rex = w << 3 | (reg >> 3 & 1) << 2 | (index >> 3 & 1) << 1 | (base >> 3 & 1);
+  if (rex)
+    emit8(as, 0x40 | rex);
+}
+
+// The REX prefix is needed to address sil, dil, spl and bpl as byte registers
+static inline void emit_rex_byte(x86_asm *as, int reg, int base) {
+  int rex = (reg >> 3 & 1) << 2 | (base >> 3 & 1);
+  if (rex || (reg >= RSP && reg <= RDI) || (base >= RSP && base <= RDI))
+    emit8(as, 0x40 | rex);
+}
+
+// [prefix] [REX] opcode ModRM [SIB] disp, where `reg` is a register or an opcode extension
+static inline void op_mem(x86_asm *as, int prefix, bool w, u32 opcode, int reg, mem m) {
+  if (prefix)
+    emit8(as, prefix);
+  emit_rex(as, w, reg, m.index >= 0 ? m.index : 0, m.base);
+  emit_opcode(as, opcode);
+  // Always with a displacement, so that rbp and r13 need no special case
+  bool short_disp = m.disp >= INT8_MIN && m.disp <= INT8_MAX;
+  int mod = short_disp ? 1 : 2;
+  if (m.index >= 0 || (m.base & 7) == RSP) {
+    int scale_bits = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+    emit8(as, mod << 6 | (reg & 7) << 3 | 4);
+    emit8(as, scale_bits << 6 | (m.index >= 0 ? m.index & 7 : 4) << 3 | (m.base & 7));
+  } else {
+    emit8(as, mod << 6 | (reg & 7) << 3 | (m.base & 7));
+  }
+  if (short_disp)
+    emit8(as, m.disp);
+  else
+    emit32(as, (u32)m.disp);
+}
+
+// [prefix] [REX] opcode ModRM, with a register operand `rm`
+static inline void op_reg(x86_asm *as, int prefix, bool w, u32 opcode, int reg, int rm) {
+  if (prefix)
+    emit8(as, prefix);
+  emit_rex(as, w, reg, 0, rm);
+  emit_opcode(as, opcode);
+  emit8(as, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static inline mem at(int base, s32 disp) { return (mem){base, -1, 1, disp}; }
+
+static inline void mov_load(x86_asm *as, bool w, int reg, mem m) { op_mem(as, 0, w, 0x8B, reg, m); }
+static inline void mov_store(x86_asm *as, bool w, mem m, int reg) { op_mem(as, 0, w, 0x89, reg, m); }
+static inline void mov_rr(x86_asm *as, int dst, int src) { op_reg(as, 0, true, 0x8B, dst, src); }
+static inline void movsxd_rr(x86_asm *as, int dst, int src) { op_reg(as, 0, true, 0x63, dst, src); }
+static inline void test_rr(x86_asm *as, bool w, int a, int b) { op_reg(as, 0, w, 0x85, b, a); }
+
+static inline void mov_imm(x86_asm *as, int reg, u64 imm) {
+  if (imm <= UINT32_MAX) { // mov r32, imm32 zero-extends
+    emit_rex(as, false, 0, 0, reg);
+    emit8(as, 0xB8 + (reg & 7));
+    emit32(as, (u32)imm);
+  } else if ((s64)imm >= INT32_MIN && (s64)imm < 0) { // mov r64, simm32
+    op_reg(as, 0, true, 0xC7, 0, reg);
+    emit32(as, (u32)imm);
+  } else {
+    emit_rex(as, true, 0, 0, reg);
+    emit8(as, 0xB8 + (reg & 7));
+    emit64(as, imm);
+  }
+}
+
+// Group 1 instruction with an immediate operand, on a register
+static inline void alu_imm(x86_asm *as, bool w, int ext, int reg, s32 imm) {
+  bool short_imm = imm >= INT8_MIN && imm <= INT8_MAX;
+  op_reg(as, 0, w, short_imm ? 0x83 : 0x81, ext, reg);
+  if (short_imm)
+    emit8(as, imm);
+  else
+    emit32(as, (u32)imm);
+}
+
+// Group 1 instruction with an immediate operand, on memory
+static inline void alu_imm_mem(x86_asm *as, bool w, int ext, mem m, s32 imm) {
+  bool short_imm = imm >= INT8_MIN && imm <= INT8_MAX;
+  op_mem(as, 0, w, short_imm ? 0x83 : 0x81, ext, m);
+  if (short_imm)
+    emit8(as, imm);
+  else
+    emit32(as, (u32)imm);
+}
+
+// Store a 64-bit constant. Clobbers rax.
+static inline void store_imm(x86_asm *as, mem m, s64 imm) {
+  if (imm >= INT32_MIN && imm <= INT32_MAX) {
+    op_mem(as, 0, true, 0xC7, 0, m);
+    emit32(as, (u32)imm);
+  } else {
+    mov_imm(as, RAX, (u64)imm);
+    mov_store(as, true, m, RAX);
+  }
+}
+
+// Decompress the heap_ref (see bjvm.h) zero-extended in reg: null stays null, and anything else becomes
+// base + ref * 8. Clobbers scratch.
+static inline void decompress_ref(x86_asm *as, int reg, int scratch, u64 base) {
+  mov_imm(as, scratch, base);
+  op_mem(as, 0, true, 0x8D, scratch, (mem){scratch, reg, 8, 0}); // lea scratch, [scratch + reg * 8]
+  test_rr(as, false, reg, reg);
+  op_reg(as, 0, true, 0x0F45, reg, scratch); // cmovne reg, scratch
+}
+
+// Compress the reference in reg to a heap_ref in its low 32 bits: (reg - base) >> 3, whose low 32 bits are 0 for null
+// since base is aligned to 32 GiB. Clobbers scratch.
+static inline void compress_ref(x86_asm *as, int reg, int scratch, u64 base) {
+  mov_imm(as, scratch, base);
+  op_reg(as, 0, true, 0x2B, reg, scratch); // sub reg, scratch
+  op_reg(as, 0, true, 0xC1, SHIFT_SHR, reg);
+  emit8(as, 3);
+}
+
+// movq between a general-purpose and an XMM register
+static inline void movq_to_xmm(x86_asm *as, int xmm, int reg) { op_reg(as, 0x66, true, 0x0F6E, xmm, reg); }
+static inline void movq_from_xmm(x86_asm *as, int reg, int xmm) { op_reg(as, 0x66, true, 0x0F7E, xmm, reg); }
+
+// setcc into the low byte of the register, then zero-extend it
+static inline void setcc_zx(x86_asm *as, condition cc, int reg) {
+  emit_rex_byte(as, 0, reg);
+  emit_opcode(as, 0x0F90 | cc);
+  emit8(as, 0xC0 | (reg & 7));
+  op_reg(as, 0, false, 0x0FB6, reg, reg); // movzx
+}
+
+static inline void push(x86_asm *as, int reg) {
+  emit_rex(as, false, 0, 0, reg);
+  emit8(as, 0x50 + (reg & 7));
+}
+
+static inline void pop(x86_asm *as, int reg) {
+  emit_rex(as, false, 0, 0, reg);
+  emit8(as, 0x58 + (reg & 7));
+}
+
+// Clobbers rax
+static inline void call(x86_asm *as, const void *fn) {
+  mov_imm(as, RAX, (uintptr_t)fn);
+  op_reg(as, 0, false, 0xFF, 2, RAX);
+}
+
+// Labels and branches
+
+static inline int new_label(x86_asm *as) {
+  arrput(as->labels, -1);
+  return (int)arrlen(as->labels) - 1;
+}
+
+static inline void bind(x86_asm *as, int label) {
+  DCHECK(as->labels[label] == -1);
+  as->labels[label] = here(as);
+}
+
+static inline void emit_label_disp(x86_asm *as, int label, int relative_to) {
+  arrput(as->fixups, ((fixup){here(as), label, relative_to}));
+  emit32(as, 0);
+}
+
+// jmp or jcc to the label
+static inline void jump(x86_asm *as, condition cc, int label) {
+  if (cc == CC_ALWAYS) {
+    emit8(as, 0xE9);
+  } else {
+    emit8(as, 0x0F);
+    emit8(as, 0x80 | cc);
+  }
+  emit_label_disp(as, label, here(as) + 4);
+}
+
+static inline condition negate(condition cc) { return cc ^ 1; }
+
+// lea reg, [rip + label]
+static inline void lea_label(x86_asm *as, int reg, int label) {
+  emit_rex(as, true, reg, 0, 0);
+  emit8(as, 0x8D);
+  emit8(as, (reg & 7) << 3 | 5);
+  emit_label_disp(as, label, here(as) + 4);
+}
+
+// Jump through a table of `count` targets indexed by eax - low, or to the default target if out of range. Clobbers
+// rax and rcx.
+static inline void jump_table(x86_asm *as, int low, int count, const int *targets, int default_target) {
+  alu_imm(as, false, ALU_SUB, RAX, low);
+  alu_imm(as, false, ALU_CMP, RAX, count);
+  jump(as, CC_AE, default_target);
+  int table = new_label(as);
+  lea_label(as, RCX, table);
+  op_mem(as, 0, true, 0x63, RAX, (mem){RCX, RAX, 4, 0}); // movsxd rax, [rcx + rax * 4]
+  op_reg(as, 0, true, 0x03, RAX, RCX);                    // add rax, rcx
+  op_reg(as, 0, false, 0xFF, 4, RAX);                     // jmp rax
+  bind(as, table);
+  int start = here(as);
+  for (int i = 0; i < count; ++i)
+    emit_label_disp(as, targets[i], start);
+}
+
+// Patch the displacements, returning false if one refers to code that wasn't emitted
+static inline bool patch_fixups(x86_asm *as) {
+  for (int i = 0; i < arrlen(as->fixups); ++i) {
+    fixup *f = as->fixups + i;
+    int offset = as->labels[f->label];
+    if (offset < 0)
+      return false;
+    s32 disp = offset - f->relative_to;
+    memcpy(as->buf + f->at, &disp, sizeof(disp));
+  }
+  return true;
+}
+
+#endif // X86_ASM_H
@@ -0,0 +1,1516 @@
+// The baseline JIT for x86-64 Linux.
+//
+// A template compiler: every instruction becomes a fixed sequence of machine code which loads its operands from the
+// frame, computes the result and stores it back into the frame. The frame is laid out like an interpreter frame and
+// always holds the whole state of the method, so the program counter is all that needs to be stored before anything
+// that may collect garbage, walk the stack or throw (a "safepoint"). Checks come before any side effects, so that at a
+// failed check the frame is still in the state before the instruction, which is what the interpreter expects when it
+// takes over the frame (a deoptimization) or what an exception's stack trace needs.
+//
+// Compiled code is called like a jit_trampoline: (unused, thread, method, args), with the return value written to
+// args[0]. Within it, rbx holds the thread, r12 the arguments and r13 the frame; they are callee-saved, so runtime
+// helpers are plain C functions.
+//
+// Calls go through x86_jit_runtime_invoke, which runs the callee's compiled code directly, or runs a synchronous
+// native. Anything else (a method that hasn't been compiled, or that may suspend) is left to the interpreter: the
+// callee's frame is pushed, and the caller's frame is handed to the interpreter too, which runs both to completion.
+// There is no on-stack replacement, so an invocation that was handed over stays in the interpreter until it returns.
+
+#include "x86_jit.h"
+
+#ifdef X86_JIT_SUPPORTED
+
+#include <analysis.h>
+#include <arrays.h>
+#include <exceptions.h>
+#include <gc.h>
+#include <jit_allocator.h>
+#include <jit_queue.h>
+#include <math.h>
+#include <objects.h>
+#include <stddef.h>
+#include <vtable.h>
+#include <wasm_trampolines.h>
+#include <x86_asm.h>
+
+// Out-of-line code reached when a check fails: it stores the program counter and continues at a shared tail
+typedef struct {
+  int label;
+  int pc;
+  int tail;
+  int resume; // for fuel checks, the label to return to if the thread doesn't need to yield; otherwise -1
+  bool tier_up; // instead, ask for the optimizing tier and resume
+} slow_path;
+
+typedef struct {
+  cp_method *method;
+  code_analysis *analysis;
+  dumb_jit_result *result;
+  const bytecode_insn *insns; // the method's instructions, or a copy of them (see x86_jit_compile_copy)
+  dumb_jit_options options;
+
+  x86_asm as; // label i < insn_count is instruction i
+  slow_path *slow_paths; // stb_ds array
+
+  int pc; // instruction being compiled
+  int sd; // stack depth before it
+
+  // Shared tails
+  int leave;         // return to the caller, leaving the frame as it is
+  int pop_and_leave; // pop the frame and return (after a return instruction, or with a pending exception)
+  int deopt;         // hand the frame to the interpreter
+  int deopt_counted; // hand the frame to the interpreter, counting towards recompilation
+  int throw_npe, throw_oob, throw_div0;
+} x86_ctx;
+
+static mem slot(const x86_ctx *ctx, int i) {
+  (void)ctx;
+  return at(R13, (s32)(offsetof(stack_frame, stack) + i * sizeof(stack_value)));
+}
+
+static mem local(const x86_ctx *ctx, int i) {
+  return at(R13, -(s32)((ctx->method->code->max_locals - i) * sizeof(stack_value)));
+}
+
+// Branches
+
+// Jump to a shared tail if the condition holds, storing the program counter on the way
+static void jump_slow(x86_ctx *ctx, condition cc, int tail) {
+  slow_path path = {new_label(&ctx->as), ctx->pc, tail, -1, false};
+  arrput(ctx->slow_paths, path);
+  jump(&ctx->as, cc, path.label);
+}
+
+static void store_pc(x86_ctx *ctx, int pc) {
+  op_mem(&ctx->as, 0x66, false, 0xC7, 0, at(R13, offsetof(stack_frame, program_counter)));
+  emit16(&ctx->as, (u16)pc);
+}
+
+// Sign-extend the int in eax (unless it is a long) and store it into the stack slot
+static void store_int(x86_ctx *ctx, bool is_long, int i) {
+  if (!is_long)
+    movsxd_rr(&ctx->as, RAX, RAX);
+  mov_store(&ctx->as, true, slot(ctx, i), RAX);
+}
+
+// Leave with a pending exception if the thread has one
+static void check_exception(x86_ctx *ctx) {
+  alu_imm_mem(&ctx->as, true, ALU_CMP, at(RBX, offsetof(vm_thread, current_exception)), 0);
+  jump(&ctx->as, CC_NE, ctx->pop_and_leave);
+}
+
+// Count down towards compiling the method with the optimizing tier, on entry and at backward branches
+static void tier_up_check(x86_ctx *ctx) {
+  if (!ctx->options.tier_up)
+    return;
+  mov_imm(&ctx->as, RAX, (uintptr_t)&ctx->result->tier_up_countdown);
+  alu_imm_mem(&ctx->as, false, ALU_SUB, at(RAX, 0), 1);
+  slow_path path = {new_label(&ctx->as), ctx->pc, -1, new_label(&ctx->as), true};
+  arrput(ctx->slow_paths, path);
+  jump(&ctx->as, CC_B, path.label); // the countdown was 0
+  bind(&ctx->as, path.resume);
+}
+
+// At backward branches: decrement the thread's fuel, and check whether the thread should yield once it runs out
+static void fuel_check(x86_ctx *ctx) {
+  alu_imm_mem(&ctx->as, false, ALU_SUB, at(RBX, offsetof(vm_thread, fuel)), 1);
+  slow_path path = {new_label(&ctx->as), ctx->pc, ctx->deopt, new_label(&ctx->as), false};
+  arrput(ctx->slow_paths, path);
+  jump(&ctx->as, CC_B, path.label); // the fuel was 0
+  bind(&ctx->as, path.resume);
+  tier_up_check(ctx);
+}
+
+// Branch to the instruction if the condition holds. Backward branches check the fuel first.
+static void branch(x86_ctx *ctx, condition cc, int target) {
+  if (target > ctx->pc) {
+    jump(&ctx->as, cc, target);
+    return;
+  }
+  int skip = -1;
+  if (cc != CC_ALWAYS) {
+    skip = new_label(&ctx->as);
+    jump(&ctx->as, negate(cc), skip);
+  }
+  fuel_check(ctx);
+  jump(&ctx->as, CC_ALWAYS, target);
+  if (skip >= 0)
+    bind(&ctx->as, skip);
+}
+
+// Runtime helpers (those declared in x86_jit.h are shared with the optimizing tier)
+
+stack_frame *x86_jit_runtime_push_frame(vm_thread *thread, cp_method *method, stack_value *args) {
+  stack_frame *frame = push_plain_frame(thread, method, args, method_argc(method));
+  if (frame) {
+    frame->kind = FRAME_KIND_COMPILED;
+  }
+  return frame;
+}
+
+static void x86_jit_runtime_deopt(stack_frame *frame, dumb_jit_result *code) {
+  frame->kind = FRAME_KIND_INTERPRETER;
+  dumb_jit_count_deopt(frame->method, code);
+}
+
+// The baseline code has run for long enough: compile the method with the optimizing tier, which is used from the next
+// call on (there is no on-stack replacement)
+static void x86_jit_runtime_tier_up(vm_thread *thread, cp_method *method, dumb_jit_result *code) {
+  code->tier_up_countdown = INT_MAX;
+  if (method->jit_info == code)
+    jit_tier_up(thread, method);
+}
+
+// Whether the thread should yield, in which case the interpreter takes over the frame with no fuel left
+bool x86_jit_runtime_out_of_fuel(vm_thread *thread) {
+  thread->fuel = 200000; // as in refuel_check
+  jit_queue_install(thread->vm);
+  if (thread->stack.synchronous_depth)
+    return false;
+  if (thread->yield_at_time != 0 && get_unix_us() >= thread->yield_at_time) {
+    thread->fuel = 0;
+    return true;
+  }
+  return false;
+}
+
+// The target of the call, or nullptr if it should be left to the interpreter (which also throws if the receiver is
+// null, and updates the inline cache if it missed). Looks at the instruction as it is now, since the interpreter may
+// have rewritten it since the code was compiled.
+static cp_method *invoke_target(const bytecode_insn *insn, stack_value *args) {
+  switch (insn->kind) {
+  case insn_invokestatic_resolved:
+    return insn->ic;
+  case insn_invokespecial_resolved:
+    return args[0].obj ? insn->ic : nullptr;
+  case insn_invokevtable_monomorphic:
+  case insn_invokeitable_monomorphic:
+    return args[0].obj && obj_class(args[0].obj) == insn->ic2 ? insn->ic : nullptr;
+  case insn_invokevtable_polymorphic:
+  case insn_invokeitable_polymorphic:
+    return args[0].obj ? polymorphic_cache_lookup(insn->ic, obj_class(args[0].obj)) : nullptr;
+  default:
+    return nullptr;
+  }
+}
+
+// Returns whether the caller's frame now belongs to the interpreter, in which case the compiled code returns at once.
+// Otherwise the result (if any) is in args[0], or there is a pending exception.
+bool x86_jit_runtime_invoke(vm_thread *thread, stack_frame *frame, const bytecode_insn *insn, stack_value *args) {
+  cp_method *method = invoke_target(insn, args);
+  if (!method || method->is_signature_polymorphic) {
+    frame->kind = FRAME_KIND_INTERPRETER;
+    return true;
+  }
+
+  jit_count_call(thread, method);
+  if (method->jit_available) {
+    ((jit_trampoline)method->trampoline)(method->jit_entry, thread, method, args);
+    if (thread->stack.top != frame) { // the callee was handed to the interpreter
+      frame->kind = FRAME_KIND_INTERPRETER;
+      return true;
+    }
+    return false;
+  }
+
+  native_callback *native = method->native_handle;
+  if ((method->access_flags & ACCESS_NATIVE) && !(method->access_flags & ACCESS_SYNCHRONIZED) && native &&
+      native->async_ctx_bytes == 0) {
+    // Synchronous natives can't suspend, so they're run right away
+    stack_value result = call_interpreter_synchronous(thread, method, args);
+    if (insn->returns && !thread->current_exception)
+      args[0] = result;
+    return false;
+  }
+
+  if (!push_frame(thread, method, args, insn->args))
+    return false; // StackOverflowError
+  frame->kind = FRAME_KIND_INTERPRETER;
+  return true;
+}
+
+void x86_jit_runtime_write_barrier(vm_thread *thread, obj_header *holder) {
+  gc_write_barrier(thread->vm, holder);
+}
+
+// Returns whether an exception was thrown
+static bool x86_jit_runtime_aastore(vm_thread *thread, obj_header *array, s32 index, obj_header *value) {
+  if (!array) {
+    raise_null_pointer_exception(thread);
+    return true;
+  }
+  int length = ArrayLength(array);
+  if (index < 0 || index >= length) {
+    raise_array_index_oob_exception(thread, index, length);
+    return true;
+  }
+  if (value && !instanceof(obj_class(value), obj_class(array)->one_fewer_dim)) {
+    raise_array_store_exception(thread, obj_class(value)->name);
+    return true;
+  }
+  ReferenceArrayStore(array, index, value);
+  gc_write_barrier(thread->vm, array);
+  return false;
+}
+
+object x86_jit_runtime_new(vm_thread *thread, classdesc *cd) {
+  return AllocateObject(thread, cd, cd->instance_bytes);
+}
+
+object x86_jit_runtime_newarray(vm_thread *thread, type_kind array_type, s32 count) {
+  if (count < 0) {
+    raise_negative_array_size_exception(thread, count);
+    return nullptr;
+  }
+  return NewPrimitiveArray1D(thread, array_type, count);
+}
+
+object x86_jit_runtime_anewarray(vm_thread *thread, classdesc *type, s32 count) {
+  if (count < 0) {
+    raise_negative_array_size_exception(thread, count);
+    return nullptr;
+  }
+  return NewObjectArray1D(thread, type, count);
+}
+
+// Returns whether an exception was thrown
+static bool x86_jit_runtime_checkcast(vm_thread *thread, object o, classdesc *cd) {
+  if (instanceof(obj_class(o), cd))
+    return false;
+  raise_class_cast_exception(thread, obj_class(o), cd);
+  return true;
+}
+
+bool x86_jit_runtime_instanceof(object o, classdesc *cd) { return o && instanceof(obj_class(o), cd); }
+
+static void x86_jit_runtime_athrow(vm_thread *thread, object exception) {
+  if (exception)
+    thread->current_exception = exception;
+  else
+    raise_null_pointer_exception(thread);
+}
+
+s32 x86_jit_runtime_lookupswitch(const struct lookupswitch_data *data, s32 key) {
+  return lookupswitch_target(data, key);
+}
+
+// Java's rounding of NaNs and out-of-range values, where cvttsd2si returns the "integer indefinite" value. Floats
+// are converted to double first, which is exact.
+s32 x86_jit_runtime_d2i(double x) {
+  if (isnan(x))
+    return 0;
+  if (x >= 0x1p31)
+    return INT32_MAX;
+  if (x < -0x1p31)
+    return INT32_MIN;
+  return (s32)x;
+}
+
+s64 x86_jit_runtime_d2l(double x) {
+  if (isnan(x))
+    return 0;
+  if (x >= 0x1p63)
+    return INT64_MAX;
+  if (x < -0x1p63)
+    return INT64_MIN;
+  return (s64)x;
+}
+
+// Instructions
+
+static type_kind type_at(const x86_ctx *ctx, int stack_i) {
+  return insn_stack_state(ctx->analysis, ctx->pc)->entries[stack_i];
+}
+
+static void lower_constant(x86_ctx *ctx, const bytecode_insn *insn) {
+  mem dst = slot(ctx, ctx->sd);
+  switch (insn->kind) {
+  case insn_aconst_null:
+    store_imm(&ctx->as, dst, 0);
+    break;
+  case insn_iconst:
+    store_imm(&ctx->as, dst, (s32)insn->integer_imm);
+    break;
+  case insn_lconst:
+    store_imm(&ctx->as, dst, insn->integer_imm);
+    break;
+  case insn_fconst: {
+    u32 bits;
+    memcpy(&bits, &insn->f_imm, sizeof(bits));
+    op_mem(&ctx->as, 0, false, 0xC7, 0, dst);
+    emit32(&ctx->as, bits);
+    break;
+  }
+  case insn_dconst: {
+    s64 bits;
+    memcpy(&bits, &insn->d_imm, sizeof(bits));
+    store_imm(&ctx->as, dst, bits);
+    break;
+  }
+  default:
+    UNREACHABLE();
+  }
+}
+
+static void lower_local_load_store(x86_ctx *ctx, const bytecode_insn *insn, insn_code_kind kind) {
+  bool is_load = kind == insn_iload || kind == insn_lload || kind == insn_fload || kind == insn_dload ||
+                 kind == insn_aload;
+  mem from = is_load ? local(ctx, insn->index) : slot(ctx, ctx->sd - 1);
+  mem to = is_load ? slot(ctx, ctx->sd) : local(ctx, insn->index);
+  if (kind == insn_iload || kind == insn_istore)
+    op_mem(&ctx->as, 0, true, 0x63, RAX, from); // the upper half of an int local may be stale (see iinc)
+  else
+    mov_load(&ctx->as, true, RAX, from);
+  mov_store(&ctx->as, true, to, RAX);
+}
+
+static void lower_int_binop(x86_ctx *ctx, insn_code_kind kind) {
+  bool is_long = kind == insn_ladd || kind == insn_lsub || kind == insn_lmul || kind == insn_land ||
+                 kind == insn_lor || kind == insn_lxor;
+  u32 opcode;
+  switch (kind) {
+  case insn_iadd:
+  case insn_ladd:
+    opcode = 0x03;
+    break;
+  case insn_isub:
+  case insn_lsub:
+    opcode = 0x2B;
+    break;
+  case insn_imul:
+  case insn_lmul:
+    opcode = 0x0FAF;
+    break;
+  case insn_iand:
+  case insn_land:
+    opcode = 0x23;
+    break;
+  case insn_ior:
+  case insn_lor:
+    opcode = 0x0B;
+    break;
+  case insn_ixor:
+  case insn_lxor:
+    opcode = 0x33;
+    break;
+  default:
+    UNREACHABLE();
+  }
+  mov_load(&ctx->as, is_long, RAX, slot(ctx, ctx->sd - 2));
+  op_mem(&ctx->as, 0, is_long, opcode, RAX, slot(ctx, ctx->sd - 1));
+  store_int(ctx, is_long, ctx->sd - 2);
+}
+
+// x86 masks the shift count like Java does: to 5 bits for ints and 6 bits for longs
+static void lower_shift(x86_ctx *ctx, insn_code_kind kind) {
+  bool is_long = kind == insn_lshl || kind == insn_lshr || kind == insn_lushr;
+  int ext = kind == insn_ishl || kind == insn_lshl   ? SHIFT_SHL
+            : kind == insn_ishr || kind == insn_lshr ? SHIFT_SAR
+                                                     : SHIFT_SHR;
+  mov_load(&ctx->as, false, RCX, slot(ctx, ctx->sd - 1));
+  mov_load(&ctx->as, is_long, RAX, slot(ctx, ctx->sd - 2));
+  op_reg(&ctx->as, 0, is_long, 0xD3, ext, RAX);
+  store_int(ctx, is_long, ctx->sd - 2);
+}
+
+static void lower_neg(x86_ctx *ctx, bool is_long) {
+  mov_load(&ctx->as, is_long, RAX, slot(ctx, ctx->sd - 1));
+  op_reg(&ctx->as, 0, is_long, 0xF7, UNARY_NEG, RAX);
+  store_int(ctx, is_long, ctx->sd - 1);
+}
+
+static void lower_div_rem(x86_ctx *ctx, bool is_long, bool is_rem) {
+  mov_load(&ctx->as, is_long, RCX, slot(ctx, ctx->sd - 1));
+  test_rr(&ctx->as, is_long, RCX, RCX);
+  jump_slow(ctx, CC_E, ctx->throw_div0);
+  mov_load(&ctx->as, is_long, RAX, slot(ctx, ctx->sd - 2));
+
+  // idiv faults on MIN_VALUE / -1, where Java's quotient overflows to MIN_VALUE and the remainder is 0
+  int divide = new_label(&ctx->as), done = new_label(&ctx->as);
+  alu_imm(&ctx->as, is_long, ALU_CMP, RCX, -1);
+  jump(&ctx->as, CC_NE, divide);
+  if (is_rem)
+    mov_imm(&ctx->as, RAX, 0);
+  else
+    op_reg(&ctx->as, 0, is_long, 0xF7, UNARY_NEG, RAX);
+  jump(&ctx->as, CC_ALWAYS, done);
+
+  bind(&ctx->as, divide);
+  if (is_long)
+    emit8(&ctx->as, 0x48);
+  emit8(&ctx->as, 0x99); // cdq/cqo
+  op_reg(&ctx->as, 0, is_long, 0xF7, UNARY_IDIV, RCX);
+  if (is_rem)
+    mov_rr(&ctx->as, RAX, RDX);
+
+  bind(&ctx->as, done);
+  store_int(ctx, is_long, ctx->sd - 2);
+}
+
+static void lower_float_binop(x86_ctx *ctx, insn_code_kind kind) {
+  bool is_double = kind == insn_dadd || kind == insn_dsub || kind == insn_dmul || kind == insn_ddiv;
+  int prefix = is_double ? SSE_DOUBLE : SSE_SINGLE;
+  u32 opcode;
+  switch (kind) {
+  case insn_fadd:
+  case insn_dadd:
+    opcode = 0x0F58;
+    break;
+  case insn_fmul:
+  case insn_dmul:
+    opcode = 0x0F59;
+    break;
+  case insn_fsub:
+  case insn_dsub:
+    opcode = 0x0F5C;
+    break;
+  case insn_fdiv:
+  case insn_ddiv:
+    opcode = 0x0F5E;
+    break;
+  default:
+    UNREACHABLE();
+  }
+  op_mem(&ctx->as, prefix, false, 0x0F10, XMM0, slot(ctx, ctx->sd - 2));
+  op_mem(&ctx->as, prefix, false, opcode, XMM0, slot(ctx, ctx->sd - 1));
+  op_mem(&ctx->as, prefix, false, 0x0F11, XMM0, slot(ctx, ctx->sd - 2));
+}
+
+static void lower_frem_drem(x86_ctx *ctx, bool is_double) {
+  int prefix = is_double ? SSE_DOUBLE : SSE_SINGLE;
+  op_mem(&ctx->as, prefix, false, 0x0F10, XMM0, slot(ctx, ctx->sd - 2));
+  op_mem(&ctx->as, prefix, false, 0x0F10, XMM1, slot(ctx, ctx->sd - 1));
+  call(&ctx->as, is_double ? (void *)fmod : (void *)fmodf);
+  op_mem(&ctx->as, prefix, false, 0x0F11, XMM0, slot(ctx, ctx->sd - 2));
+}
+
+static void lower_float_neg(x86_ctx *ctx, bool is_double) {
+  if (is_double) {
+    op_mem(&ctx->as, 0, true, 0x0FBA, 7, slot(ctx, ctx->sd - 1)); // btc qword [slot], 63
+    emit8(&ctx->as, 63);
+  } else {
+    alu_imm_mem(&ctx->as, false, ALU_XOR, slot(ctx, ctx->sd - 1), INT32_MIN);
+  }
+}
+
+static void lower_float_to_integer(x86_ctx *ctx, bool from_double, bool to_long) {
+  int prefix = from_double ? SSE_DOUBLE : SSE_SINGLE;
+  mem value = slot(ctx, ctx->sd - 1);
+  op_mem(&ctx->as, prefix, to_long, 0x0F2C, RAX, value); // cvttss2si/cvttsd2si
+  if (to_long) {
+    mov_imm(&ctx->as, RCX, (u64)INT64_MIN);
+    op_reg(&ctx->as, 0, true, 0x3B, RAX, RCX);
+  } else {
+    alu_imm(&ctx->as, false, ALU_CMP, RAX, INT32_MIN);
+  }
+  int done = new_label(&ctx->as);
+  jump(&ctx->as, CC_NE, done);
+  if (from_double)
+    op_mem(&ctx->as, SSE_DOUBLE, false, 0x0F10, XMM0, value);
+  else
+    op_mem(&ctx->as, SSE_SINGLE, false, 0x0F5A, XMM0, value); // cvtss2sd
+  call(&ctx->as, to_long ? (void *)x86_jit_runtime_d2l : (void *)x86_jit_runtime_d2i);
+  bind(&ctx->as, done);
+  store_int(ctx, to_long, ctx->sd - 1);
+}
+
+static void lower_conversion(x86_ctx *ctx, insn_code_kind kind) {
+  mem value = slot(ctx, ctx->sd - 1);
+  switch (kind) {
+  case insn_i2l:
+    op_mem(&ctx->as, 0, true, 0x63, RAX, value);
+    store_int(ctx, true, ctx->sd - 1);
+    break;
+  case insn_l2i:
+    mov_load(&ctx->as, false, RAX, value);
+    store_int(ctx, false, ctx->sd - 1);
+    break;
+  case insn_i2b:
+    op_mem(&ctx->as, 0, false, 0x0FBE, RAX, value); // movsx
+    store_int(ctx, false, ctx->sd - 1);
+    break;
+  case insn_i2s:
+    op_mem(&ctx->as, 0, false, 0x0FBF, RAX, value); // movsx
+    store_int(ctx, false, ctx->sd - 1);
+    break;
+  case insn_i2c:
+    op_mem(&ctx->as, 0, false, 0x0FB7, RAX, value); // movzx
+    store_int(ctx, false, ctx->sd - 1);
+    break;
+  case insn_i2f:
+  case insn_l2f:
+    op_mem(&ctx->as, SSE_SINGLE, kind == insn_l2f, 0x0F2A, XMM0, value); // cvtsi2ss
+    op_mem(&ctx->as, SSE_SINGLE, false, 0x0F11, XMM0, value);
+    break;
+  case insn_i2d:
+  case insn_l2d:
+    op_mem(&ctx->as, SSE_DOUBLE, kind == insn_l2d, 0x0F2A, XMM0, value); // cvtsi2sd
+    op_mem(&ctx->as, SSE_DOUBLE, false, 0x0F11, XMM0, value);
+    break;
+  case insn_f2d:
+    op_mem(&ctx->as, SSE_SINGLE, false, 0x0F5A, XMM0, value); // cvtss2sd
+    op_mem(&ctx->as, SSE_DOUBLE, false, 0x0F11, XMM0, value);
+    break;
+  case insn_d2f:
+    op_mem(&ctx->as, SSE_DOUBLE, false, 0x0F5A, XMM0, value); // cvtsd2ss
+    op_mem(&ctx->as, SSE_SINGLE, false, 0x0F11, XMM0, value);
+    break;
+  case insn_f2i:
+  case insn_f2l:
+  case insn_d2i:
+  case insn_d2l:
+    lower_float_to_integer(ctx, kind == insn_d2i || kind == insn_d2l, kind == insn_f2l || kind == insn_d2l);
+    break;
+  default:
+    UNREACHABLE();
+  }
+}
+
+// The Math intrinsics. Returns false if the operands aren't doubles, which is left to the interpreter.
+static bool lower_math_intrinsic(x86_ctx *ctx, insn_code_kind kind) {
+  int sd = ctx->sd;
+  if (kind == insn_sqrt) {
+    int prefix = type_at(ctx, sd - 1) == TYPE_KIND_FLOAT ? SSE_SINGLE : SSE_DOUBLE;
+    op_mem(&ctx->as, prefix, false, 0x0F51, XMM0, slot(ctx, sd - 1));
+    op_mem(&ctx->as, prefix, false, 0x0F11, XMM0, slot(ctx, sd - 1));
+    return true;
+  }
+  int argc = kind == insn_pow ? 2 : 1;
+  for (int i = 0; i < argc; ++i) {
+    if (type_at(ctx, sd - argc + i) != TYPE_KIND_DOUBLE)
+      return false;
+    op_mem(&ctx->as, SSE_DOUBLE, false, 0x0F10, XMM0 + i, slot(ctx, sd - argc + i));
+  }
+  double (*fn)(double) = kind == insn_sin ? sin : kind == insn_cos ? cos : tan;
+  call(&ctx->as, kind == insn_pow ? (void *)pow : (void *)fn);
+  op_mem(&ctx->as, SSE_DOUBLE, false, 0x0F11, XMM0, slot(ctx, sd - argc));
+  return true;
+}
+
+static void lower_compare(x86_ctx *ctx, insn_code_kind kind) {
+  mem a = slot(ctx, ctx->sd - 2), b = slot(ctx, ctx->sd - 1);
+  if (kind == insn_lcmp) {
+    mov_load(&ctx->as, true, RAX, a);
+    op_mem(&ctx->as, 0, true, 0x3B, RAX, b);
+    op_reg(&ctx->as, 0, false, 0x0F90 | CC_G, 0, RCX); // setg cl
+    op_reg(&ctx->as, 0, false, 0x0F90 | CC_L, 0, RDX); // setl dl
+    op_reg(&ctx->as, 0, false, 0x0FB6, RAX, RCX);      // movzx eax, cl
+    op_reg(&ctx->as, 0, false, 0x0FB6, RCX, RDX);      // movzx ecx, dl
+    op_reg(&ctx->as, 0, false, 0x2B, RAX, RCX);        // sub eax, ecx
+    store_int(ctx, false, ctx->sd - 2);
+    return;
+  }
+
+  // fcmpg and dcmpg give 1 when either operand is NaN, fcmpl and dcmpl give -1
+  bool is_double = kind == insn_dcmpg || kind == insn_dcmpl;
+  bool g_variant = kind == insn_fcmpg || kind == insn_dcmpg;
+  int prefix = is_double ? SSE_DOUBLE : SSE_SINGLE;
+  int done = new_label(&ctx->as);
+  op_mem(&ctx->as, prefix, false, 0x0F10, XMM0, a);
+  op_mem(&ctx->as, is_double ? 0x66 : 0, false, 0x0F2E, XMM0, b); // ucomiss/ucomisd
+  // The moves leave the flags alone
+  mov_imm(&ctx->as, RAX, (u32)(g_variant ? 1 : -1));
+  jump(&ctx->as, CC_P, done);
+  mov_imm(&ctx->as, RAX, 0);
+  op_reg(&ctx->as, 0, false, 0x0F90 | CC_A, 0, RAX); // seta al: 1 if greater
+  op_reg(&ctx->as, 0, false, 0x1B, RCX, RCX);        // sbb ecx, ecx: -1 if less
+  op_reg(&ctx->as, 0, false, 0x0B, RAX, RCX);        // or eax, ecx
+  bind(&ctx->as, done);
+  store_int(ctx, false, ctx->sd - 2);
+}
+
+static void lower_branch(x86_ctx *ctx, const bytecode_insn *insn, insn_code_kind kind) {
+  int sd = ctx->sd;
+  condition cc;
+  switch (kind) {
+  case insn_goto:
+    branch(ctx, CC_ALWAYS, insn->index);
+    return;
+  case insn_ifeq:
+  case insn_ifne:
+  case insn_iflt:
+  case insn_ifge:
+  case insn_ifgt:
+  case insn_ifle:
+    alu_imm_mem(&ctx->as, false, ALU_CMP, slot(ctx, sd - 1), 0);
+    break;
+  case insn_ifnull:
+  case insn_ifnonnull:
+    alu_imm_mem(&ctx->as, true, ALU_CMP, slot(ctx, sd - 1), 0);
+    break;
+  case insn_if_acmpeq:
+  case insn_if_acmpne:
+    mov_load(&ctx->as, true, RAX, slot(ctx, sd - 2));
+    op_mem(&ctx->as, 0, true, 0x3B, RAX, slot(ctx, sd - 1));
+    break;
+  default:
+    mov_load(&ctx->as, false, RAX, slot(ctx, sd - 2));
+    op_mem(&ctx->as, 0, false, 0x3B, RAX, slot(ctx, sd - 1));
+    break;
+  }
+  switch (kind) {
+  case insn_ifeq:
+  case insn_ifnull:
+  case insn_if_acmpeq:
+  case insn_if_icmpeq:
+    cc = CC_E;
+    break;
+  case insn_ifne:
+  case insn_ifnonnull:
+  case insn_if_acmpne:
+  case insn_if_icmpne:
+    cc = CC_NE;
+    break;
+  case insn_iflt:
+  case insn_if_icmplt:
+    cc = CC_L;
+    break;
+  case insn_ifge:
+  case insn_if_icmpge:
+    cc = CC_GE;
+    break;
+  case insn_ifgt:
+  case insn_if_icmpgt:
+    cc = CC_G;
+    break;
+  case insn_ifle:
+  case insn_if_icmple:
+    cc = CC_LE;
+    break;
+  default:
+    UNREACHABLE();
+  }
+  branch(ctx, cc, insn->index);
+}
+
+static bool has_backward_target(const x86_ctx *ctx, const int *targets, int count, int default_target) {
+  bool backward = default_target <= ctx->pc;
+  for (int i = 0; i < count; ++i)
+    backward |= targets[i] <= ctx->pc;
+  return backward;
+}
+
+static void lower_tableswitch(x86_ctx *ctx, const bytecode_insn *insn) {
+  const struct tableswitch_data *data = insn->tableswitch;
+  if (has_backward_target(ctx, data->targets, data->targets_count, data->default_target))
+    fuel_check(ctx);
+  mov_load(&ctx->as, false, RAX, slot(ctx, ctx->sd - 1));
+  jump_table(&ctx->as, data->low, data->targets_count, data->targets, data->default_target);
+}
+
+// Uses the strategy that analysis chose for the interpreter
+static void lower_lookupswitch(x86_ctx *ctx, const bytecode_insn *insn) {
+  const struct lookupswitch_data *data = insn->lookupswitch;
+  if (has_backward_target(ctx, data->targets, data->targets_count, data->default_target))
+    fuel_check(ctx);
+  switch (data->strategy) {
+  case LOOKUPSWITCH_LINEAR:
+    mov_load(&ctx->as, false, RAX, slot(ctx, ctx->sd - 1));
+    for (int i = 0; i < data->keys_count; ++i) {
+      alu_imm(&ctx->as, false, ALU_CMP, RAX, data->keys[i]);
+      jump(&ctx->as, CC_E, data->targets[i]);
+    }
+    break;
+  case LOOKUPSWITCH_TABLE:
+    mov_load(&ctx->as, false, RAX, slot(ctx, ctx->sd - 1));
+    jump_table(&ctx->as, data->low, (int)data->table_size, data->table, data->default_target);
+    return;
+  default:
+    // Find the target's instruction index, then compare against each distinct target
+    mov_imm(&ctx->as, RDI, (uintptr_t)data);
+    mov_load(&ctx->as, false, RSI, slot(ctx, ctx->sd - 1));
+    call(&ctx->as, x86_jit_runtime_lookupswitch);
+    for (int i = 0; i < data->targets_count; ++i) {
+      bool seen = data->targets[i] == data->default_target;
+      for (int j = 0; j < i && !seen; ++j)
+        seen = data->targets[j] == data->targets[i];
+      if (seen)
+        continue;
+      alu_imm(&ctx->as, false, ALU_CMP, RAX, data->targets[i]);
+      jump(&ctx->as, CC_E, data->targets[i]);
+    }
+    break;
+  }
+  jump(&ctx->as, CC_ALWAYS, data->default_target);
+}
+
+// gc_write_barrier for the object in rax, with the common case (marking a card) inline
+static void lower_write_barrier(x86_ctx *ctx) {
+  static_assert((CARD_BYTES & (CARD_BYTES - 1)) == 0);
+  int not_old = new_label(&ctx->as), done = new_label(&ctx->as);
+  mov_load(&ctx->as, true, RCX, at(RBX, offsetof(vm_thread, vm)));
+  mov_rr(&ctx->as, RDX, RAX);
+  op_mem(&ctx->as, 0, true, 0x2B, RDX, at(RCX, offsetof(vm, heap))); // offset of the holder in the heap
+  op_mem(&ctx->as, 0, true, 0x3B, RDX, at(RCX, offsetof(vm, young_start)));
+  jump(&ctx->as, CC_AE, not_old);
+  op_reg(&ctx->as, 0, true, 0xC1, SHIFT_SHR, RDX);
+  emit8(&ctx->as, __builtin_ctz(CARD_BYTES));
+  op_mem(&ctx->as, 0, true, 0x03, RDX, at(RCX, offsetof(vm, card_table)));
+  op_mem(&ctx->as, 0, false, 0xC6, 0, at(RDX, 0)); // mov byte [rdx], 1
+  emit8(&ctx->as, 1);
+  jump(&ctx->as, CC_ALWAYS, done);
+
+  // Large objects live outside the heap
+  bind(&ctx->as, not_old);
+  op_mem(&ctx->as, 0, true, 0x3B, RDX, at(RCX, offsetof(vm, heap_capacity)));
+  jump(&ctx->as, CC_B, done);
+  mov_rr(&ctx->as, RSI, RAX);
+  mov_rr(&ctx->as, RDI, RBX);
+  call(&ctx->as, x86_jit_runtime_write_barrier);
+  bind(&ctx->as, done);
+}
+
+// Load a field or array element of the given type from memory into rcx, extended to 64 bits like the interpreter does
+static void load_typed(x86_ctx *ctx, type_kind type, mem m) {
+  switch (type) {
+  case TYPE_KIND_BOOLEAN:
+  case TYPE_KIND_BYTE:
+    op_mem(&ctx->as, 0, true, 0x0FBE, RCX, m); // movsx
+    break;
+  case TYPE_KIND_CHAR:
+    op_mem(&ctx->as, 0, false, 0x0FB7, RCX, m); // movzx
+    break;
+  case TYPE_KIND_SHORT:
+    op_mem(&ctx->as, 0, true, 0x0FBF, RCX, m); // movsx
+    break;
+  case TYPE_KIND_INT:
+    op_mem(&ctx->as, 0, true, 0x63, RCX, m); // movsxd
+    break;
+  case TYPE_KIND_FLOAT:
+    mov_load(&ctx->as, false, RCX, m);
+    break;
+  default:
+    mov_load(&ctx->as, true, RCX, m);
+    break;
+  }
+}
+
+// Store the low bits of rcx into a field or array element of the given type
+static void store_typed(x86_ctx *ctx, type_kind type, mem m) {
+  switch (type) {
+  case TYPE_KIND_BOOLEAN:
+  case TYPE_KIND_BYTE:
+    op_mem(&ctx->as, 0, false, 0x88, RCX, m);
+    break;
+  case TYPE_KIND_CHAR:
+  case TYPE_KIND_SHORT:
+    op_mem(&ctx->as, 0x66, false, 0x89, RCX, m);
+    break;
+  case TYPE_KIND_INT:
+  case TYPE_KIND_FLOAT:
+    mov_store(&ctx->as, false, m, RCX);
+    break;
+  default:
+    mov_store(&ctx->as, true, m, RCX);
+    break;
+  }
+}
+
+// Load a heap_ref (see bjvm.h) from memory into rcx, decompressed. Clobbers rdx.
+static void load_heap_ref(x86_ctx *ctx, mem m) {
+#if COMPRESSED_REFS
+  mov_load(&ctx->as, false, RCX, m);
+  decompress_ref(&ctx->as, RCX, RDX, compressed_heap_base);
+#else
+  mov_load(&ctx->as, true, RCX, m);
+#endif
+}
+
+// Store the reference in rcx into a heap_ref in memory, which mustn't be addressed through rdx. Clobbers rcx and rdx.
+static void store_heap_ref(x86_ctx *ctx, mem m) {
+#if COMPRESSED_REFS
+  compress_ref(&ctx->as, RCX, RDX, compressed_heap_base);
+  mov_store(&ctx->as, false, m, RCX);
+#else
+  mov_store(&ctx->as, true, m, RCX);
+#endif
+}
+
+static void lower_get_put_resolved(x86_ctx *ctx, const bytecode_insn *insn, insn_code_kind kind) {
+  bool compressed = kind == insn_getfield_N || kind == insn_putfield_N;
+  bool is_getfield = (kind >= insn_getfield_B && kind <= insn_getfield_L) || kind == insn_getfield_N;
+  bool is_putfield = (kind >= insn_putfield_B && kind <= insn_putfield_L) || kind == insn_putfield_N;
+  bool is_getstatic = kind >= insn_getstatic_B && kind <= insn_getstatic_L;
+  bool is_put = is_putfield || (kind >= insn_putstatic_B && kind <= insn_putstatic_L);
+  type_kind type = compressed ? TYPE_KIND_REFERENCE : resolved_field_type(kind);
+  int sd = ctx->sd;
+
+  mem field;
+  if (is_getfield || is_putfield) {
+    mov_load(&ctx->as, true, RAX, slot(ctx, sd - 1 - is_putfield));
+    test_rr(&ctx->as, true, RAX, RAX);
+    jump_slow(ctx, CC_E, ctx->throw_npe);
+    field = at(RAX, (s32)(intptr_t)insn->ic2);
+  } else {
+    mov_imm(&ctx->as, RAX, (uintptr_t)insn->ic);
+    field = at(RAX, 0);
+  }
+
+  if (is_put) {
+    mov_load(&ctx->as, true, RCX, slot(ctx, sd - 1));
+    if (compressed)
+      store_heap_ref(ctx, field);
+    else
+      store_typed(ctx, type, field);
+    if (is_putfield && type == TYPE_KIND_REFERENCE)
+      lower_write_barrier(ctx);
+  } else {
+    if (compressed)
+      load_heap_ref(ctx, field);
+    else
+      load_typed(ctx, type, field);
+    mov_store(&ctx->as, true, slot(ctx, is_getstatic ? sd : sd - 1), RCX);
+  }
+}
+
+static void lower_arraylength(x86_ctx *ctx) {
+  mov_load(&ctx->as, true, RAX, slot(ctx, ctx->sd - 1));
+  test_rr(&ctx->as, true, RAX, RAX);
+  jump_slow(ctx, CC_E, ctx->throw_npe);
+  op_mem(&ctx->as, 0, true, 0x63, RAX, at(RAX, kArrayLengthOffset));
+  mov_store(&ctx->as, true, slot(ctx, ctx->sd - 1), RAX);
+}
+
+static void lower_array_load_store(x86_ctx *ctx, insn_code_kind kind) {
+  type_kind type;
+  bool is_load = true;
+  switch (kind) {
+  case insn_bastore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_baload:
+    type = TYPE_KIND_BYTE;
+    break;
+  case insn_castore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_caload:
+    type = TYPE_KIND_CHAR;
+    break;
+  case insn_sastore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_saload:
+    type = TYPE_KIND_SHORT;
+    break;
+  case insn_iastore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_iaload:
+    type = TYPE_KIND_INT;
+    break;
+  case insn_lastore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_laload:
+    type = TYPE_KIND_LONG;
+    break;
+  case insn_fastore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_faload:
+    type = TYPE_KIND_FLOAT;
+    break;
+  case insn_dastore:
+    is_load = false;
+    [[fallthrough]];
+  case insn_daload:
+    type = TYPE_KIND_DOUBLE;
+    break;
+  case insn_aaload:
+    type = TYPE_KIND_REFERENCE;
+    break;
+  default:
+    UNREACHABLE();
+  }
+
+  int array_i = ctx->sd - (is_load ? 2 : 3);
+  mov_load(&ctx->as, true, RAX, slot(ctx, array_i));
+  test_rr(&ctx->as, true, RAX, RAX);
+  jump_slow(ctx, CC_E, ctx->throw_npe);
+  // Unsigned comparison, so negative indices are out of bounds too. throw_oob expects the index in ecx and the length
+  // in edx.
+  mov_load(&ctx->as, false, RCX, slot(ctx, array_i + 1));
+  mov_load(&ctx->as, false, RDX, at(RAX, kArrayLengthOffset));
+  op_reg(&ctx->as, 0, false, 0x3B, RCX, RDX);
+  jump_slow(ctx, CC_AE, ctx->throw_oob);
+
+  int size = type == TYPE_KIND_REFERENCE ? (int)sizeof(heap_ref) : sizeof_type_kind(type);
+  mem element = {RAX, RDX, size, kArrayDataOffset};
+  mov_rr(&ctx->as, RDX, RCX); // the index, zero-extended by the 32-bit load
+  if (is_load) {
+    if (type == TYPE_KIND_REFERENCE)
+      load_heap_ref(ctx, element);
+    else
+      load_typed(ctx, type, element);
+    mov_store(&ctx->as, true, slot(ctx, array_i), RCX);
+  } else {
+    mov_load(&ctx->as, true, RCX, slot(ctx, ctx->sd - 1));
+    store_typed(ctx, type, element);
+  }
+}
+
+static void lower_aastore(x86_ctx *ctx) {
+  int sd = ctx->sd;
+  store_pc(ctx, ctx->pc);
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_load(&ctx->as, true, RSI, slot(ctx, sd - 3));
+  mov_load(&ctx->as, false, RDX, slot(ctx, sd - 2));
+  mov_load(&ctx->as, true, RCX, slot(ctx, sd - 1));
+  call(&ctx->as, x86_jit_runtime_aastore);
+  test_rr(&ctx->as, false, RAX, RAX);
+  jump(&ctx->as, CC_NE, ctx->pop_and_leave);
+}
+
+static void lower_new_resolved(x86_ctx *ctx, const bytecode_insn *insn) {
+  store_pc(ctx, ctx->pc);
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_imm(&ctx->as, RSI, (uintptr_t)insn->classdesc);
+  call(&ctx->as, x86_jit_runtime_new);
+  test_rr(&ctx->as, true, RAX, RAX);
+  jump(&ctx->as, CC_E, ctx->pop_and_leave); // OutOfMemoryError
+  mov_store(&ctx->as, true, slot(ctx, ctx->sd), RAX);
+}
+
+static void lower_newarray(x86_ctx *ctx, const bytecode_insn *insn, insn_code_kind kind) {
+  bool is_primitive = kind == insn_newarray;
+  store_pc(ctx, ctx->pc);
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_imm(&ctx->as, RSI, is_primitive ? (u64)insn->array_type : (uintptr_t)insn->classdesc);
+  mov_load(&ctx->as, false, RDX, slot(ctx, ctx->sd - 1));
+  call(&ctx->as, is_primitive ? (void *)x86_jit_runtime_newarray : (void *)x86_jit_runtime_anewarray);
+  test_rr(&ctx->as, true, RAX, RAX);
+  jump(&ctx->as, CC_E, ctx->pop_and_leave);
+  mov_store(&ctx->as, true, slot(ctx, ctx->sd - 1), RAX);
+}
+
+static void lower_checkcast_resolved(x86_ctx *ctx, const bytecode_insn *insn) {
+  int done = new_label(&ctx->as);
+  mov_load(&ctx->as, true, RSI, slot(ctx, ctx->sd - 1));
+  test_rr(&ctx->as, true, RSI, RSI);
+  jump(&ctx->as, CC_E, done); // null passes
+  store_pc(ctx, ctx->pc);
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_imm(&ctx->as, RDX, (uintptr_t)insn->classdesc);
+  call(&ctx->as, x86_jit_runtime_checkcast);
+  test_rr(&ctx->as, false, RAX, RAX);
+  jump(&ctx->as, CC_NE, ctx->pop_and_leave);
+  bind(&ctx->as, done);
+}
+
+static void lower_instanceof_resolved(x86_ctx *ctx, const bytecode_insn *insn) {
+  mov_load(&ctx->as, true, RDI, slot(ctx, ctx->sd - 1));
+  mov_imm(&ctx->as, RSI, (uintptr_t)insn->classdesc);
+  call(&ctx->as, x86_jit_runtime_instanceof);
+  op_reg(&ctx->as, 0, false, 0x0FB6, RAX, RAX); // movzx eax, al
+  mov_store(&ctx->as, true, slot(ctx, ctx->sd - 1), RAX);
+}
+
+// Strings and class mirrors which the interpreter has already created
+static bool lower_ldc(x86_ctx *ctx, const bytecode_insn *insn) {
+  cp_entry *ent = insn->cp;
+  void *cell = ent->kind == CP_KIND_STRING  ? (void *)&ent->string.interned
+               : ent->kind == CP_KIND_CLASS ? (void *)&ent->class_info.vm_object
+                                            : nullptr;
+  if (!cell)
+    return false;
+  mov_imm(&ctx->as, RAX, (uintptr_t)cell);
+  mov_load(&ctx->as, true, RAX, at(RAX, 0));
+  test_rr(&ctx->as, true, RAX, RAX);
+  jump_slow(ctx, CC_E, ctx->deopt);
+  mov_store(&ctx->as, true, slot(ctx, ctx->sd), RAX);
+  return true;
+}
+
+static bool lower_invoke(x86_ctx *ctx, const bytecode_insn *insn, insn_code_kind kind) {
+  if ((kind == insn_invokestatic_resolved || kind == insn_invokespecial_resolved) &&
+      ((cp_method *)insn->ic)->is_signature_polymorphic)
+    return false;
+  store_pc(ctx, ctx->pc);
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_rr(&ctx->as, RSI, R13);
+  mov_imm(&ctx->as, RDX, (uintptr_t)(ctx->method->code->code + ctx->pc)); // the method's own, not a copy
+  op_mem(&ctx->as, 0, true, 0x8D, RCX, slot(ctx, ctx->sd - insn->args)); // lea
+  call(&ctx->as, x86_jit_runtime_invoke);
+  test_rr(&ctx->as, false, RAX, RAX);
+  jump(&ctx->as, CC_NE, ctx->leave);
+  check_exception(ctx);
+  return true;
+}
+
+static void lower_athrow(x86_ctx *ctx) {
+  store_pc(ctx, ctx->pc);
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_load(&ctx->as, true, RSI, slot(ctx, ctx->sd - 1));
+  call(&ctx->as, x86_jit_runtime_athrow);
+  // Methods with exception handlers aren't compiled, so it propagates to the caller
+  jump(&ctx->as, CC_ALWAYS, ctx->pop_and_leave);
+}
+
+static void lower_return(x86_ctx *ctx, insn_code_kind kind) {
+  if (kind != insn_return) {
+    mov_load(&ctx->as, true, RAX, slot(ctx, ctx->sd - 1));
+    mov_store(&ctx->as, true, at(R12, 0), RAX);
+  }
+  jump(&ctx->as, CC_ALWAYS, ctx->pop_and_leave);
+}
+
+static void lower_stack_manipulation(x86_ctx *ctx, insn_code_kind kind) {
+  // The analysis simplifies the forms acting on longs and doubles as if they took one slot. Each form takes the top
+  // `inputs` slots and replaces them with the given sequence of them (0 = the deepest input).
+  int inputs;
+  const char *outputs;
+  switch (kind) {
+  case insn_dup:
+    inputs = 1, outputs = "00";
+    break;
+  case insn_dup_x1:
+    inputs = 2, outputs = "101";
+    break;
+  case insn_dup_x2:
+    inputs = 3, outputs = "2012";
+    break;
+  case insn_dup2:
+    inputs = 2, outputs = "0101";
+    break;
+  case insn_dup2_x1:
+    inputs = 3, outputs = "12012";
+    break;
+  case insn_dup2_x2:
+    inputs = 4, outputs = "230123";
+    break;
+  case insn_swap:
+    inputs = 2, outputs = "10";
+    break;
+  default:
+    UNREACHABLE();
+  }
+
+  static const int regs[4] = {RAX, RCX, RDX, RSI};
+  int base = ctx->sd - inputs;
+  for (int i = 0; i < inputs; ++i)
+    mov_load(&ctx->as, true, regs[i], slot(ctx, base + i));
+  for (int i = 0; outputs[i]; ++i) {
+    int from = outputs[i] - '0';
+    if (i >= inputs || from != i)
+      mov_store(&ctx->as, true, slot(ctx, base + i), regs[from]);
+  }
+}
+
+// Whether the deoptimization at this instruction is worth recompiling the method for: the interpreter resolves and
+// rewrites these instructions, after which they can be compiled (except invokedynamic, whose call sites aren't)
+static bool is_unresolved(insn_code_kind kind) {
+  return (kind >= insn_anewarray && kind < insn_ldc && kind != insn_invokedynamic) || kind == insn_invokeinterface;
+}
+
+// Returns false if the rest of the basic block is left to the interpreter (a deoptimization has been emitted)
+static bool lower_instruction(x86_ctx *ctx, const bytecode_insn *insn) {
+  // Superinstructions only help the interpreter; compile the instruction each began as
+  insn_code_kind kind = unfused_insn_kind(insn->kind);
+  switch (kind) {
+  case insn_nop:
+  case insn_pop:
+  case insn_pop2:
+    return true;
+  case insn_aconst_null:
+  case insn_iconst:
+  case insn_lconst:
+  case insn_fconst:
+  case insn_dconst:
+    lower_constant(ctx, insn);
+    return true;
+  case insn_iload:
+  case insn_lload:
+  case insn_fload:
+  case insn_dload:
+  case insn_aload:
+  case insn_istore:
+  case insn_lstore:
+  case insn_fstore:
+  case insn_dstore:
+  case insn_astore:
+    lower_local_load_store(ctx, insn, kind);
+    return true;
+  case insn_iinc:
+    // Like the interpreter, only writes the low half of the local
+    alu_imm_mem(&ctx->as, false, ALU_ADD, local(ctx, insn->iinc.index), insn->iinc.const_);
+    return true;
+  case insn_iadd:
+  case insn_isub:
+  case insn_imul:
+  case insn_iand:
+  case insn_ior:
+  case insn_ixor:
+  case insn_ladd:
+  case insn_lsub:
+  case insn_lmul:
+  case insn_land:
+  case insn_lor:
+  case insn_lxor:
+    lower_int_binop(ctx, kind);
+    return true;
+  case insn_ishl:
+  case insn_ishr:
+  case insn_iushr:
+  case insn_lshl:
+  case insn_lshr:
+  case insn_lushr:
+    lower_shift(ctx, kind);
+    return true;
+  case insn_ineg:
+  case insn_lneg:
+    lower_neg(ctx, kind == insn_lneg);
+    return true;
+  case insn_idiv:
+  case insn_irem:
+  case insn_ldiv:
+  case insn_lrem:
+    lower_div_rem(ctx, kind == insn_ldiv || kind == insn_lrem, kind == insn_irem || kind == insn_lrem);
+    return true;
+  case insn_fadd:
+  case insn_fsub:
+  case insn_fmul:
+  case insn_fdiv:
+  case insn_dadd:
+  case insn_dsub:
+  case insn_dmul:
+  case insn_ddiv:
+    lower_float_binop(ctx, kind);
+    return true;
+  case insn_frem:
+  case insn_drem:
+    lower_frem_drem(ctx, kind == insn_drem);
+    return true;
+  case insn_fneg:
+  case insn_dneg:
+    lower_float_neg(ctx, kind == insn_dneg);
+    return true;
+  case insn_i2l:
+  case insn_l2i:
+  case insn_i2b:
+  case insn_i2s:
+  case insn_i2c:
+  case insn_i2f:
+  case insn_l2f:
+  case insn_i2d:
+  case insn_l2d:
+  case insn_f2d:
+  case insn_d2f:
+  case insn_f2i:
+  case insn_f2l:
+  case insn_d2i:
+  case insn_d2l:
+    lower_conversion(ctx, kind);
+    return true;
+  case insn_sqrt:
+  case insn_sin:
+  case insn_cos:
+  case insn_tan:
+  case insn_pow:
+    if (!lower_math_intrinsic(ctx, kind))
+      break;
+    return true;
+  case insn_lcmp:
+  case insn_fcmpl:
+  case insn_fcmpg:
+  case insn_dcmpl:
+  case insn_dcmpg:
+    lower_compare(ctx, kind);
+    return true;
+  case insn_goto:
+  case insn_ifeq:
+  case insn_ifne:
+  case insn_iflt:
+  case insn_ifge:
+  case insn_ifgt:
+  case insn_ifle:
+  case insn_ifnull:
+  case insn_ifnonnull:
+  case insn_if_acmpeq:
+  case insn_if_acmpne:
+  case insn_if_icmpeq:
+  case insn_if_icmpne:
+  case insn_if_icmplt:
+  case insn_if_icmpge:
+  case insn_if_icmpgt:
+  case insn_if_icmple:
+    lower_branch(ctx, insn, kind);
+    return true;
+  case insn_tableswitch:
+    lower_tableswitch(ctx, insn);
+    return true;
+  case insn_lookupswitch:
+    lower_lookupswitch(ctx, insn);
+    return true;
+  case insn_dup:
+  case insn_dup_x1:
+  case insn_dup_x2:
+  case insn_dup2:
+  case insn_dup2_x1:
+  case insn_dup2_x2:
+  case insn_swap:
+    lower_stack_manipulation(ctx, kind);
+    return true;
+  case insn_getfield_B ... insn_putstatic_L:
+  case insn_getfield_N:
+  case insn_putfield_N:
+    lower_get_put_resolved(ctx, insn, kind);
+    return true;
+  case insn_arraylength:
+    lower_arraylength(ctx);
+    return true;
+  case insn_baload:
+  case insn_caload:
+  case insn_saload:
+  case insn_iaload:
+  case insn_laload:
+  case insn_faload:
+  case insn_daload:
+  case insn_aaload:
+  case insn_bastore:
+  case insn_castore:
+  case insn_sastore:
+  case insn_iastore:
+  case insn_lastore:
+  case insn_fastore:
+  case insn_dastore:
+    lower_array_load_store(ctx, kind);
+    return true;
+  case insn_aastore:
+    lower_aastore(ctx);
+    return true;
+  case insn_new_resolved:
+    lower_new_resolved(ctx, insn);
+    return true;
+  case insn_newarray:
+  case insn_anewarray_resolved:
+    lower_newarray(ctx, insn, kind);
+    return true;
+  case insn_checkcast_resolved:
+    lower_checkcast_resolved(ctx, insn);
+    return true;
+  case insn_instanceof_resolved:
+    lower_instanceof_resolved(ctx, insn);
+    return true;
+  case insn_ldc:
+    if (!lower_ldc(ctx, insn))
+      break;
+    return true;
+  case insn_invokestatic_resolved:
+  case insn_invokespecial_resolved:
+  case insn_invokevtable_monomorphic:
+  case insn_invokevtable_polymorphic:
+  case insn_invokeitable_monomorphic:
+  case insn_invokeitable_polymorphic:
+    if (!lower_invoke(ctx, insn, kind))
+      break;
+    return true;
+  case insn_athrow:
+    lower_athrow(ctx);
+    return true;
+  case insn_return:
+  case insn_ireturn:
+  case insn_lreturn:
+  case insn_freturn:
+  case insn_dreturn:
+  case insn_areturn:
+    lower_return(ctx, kind);
+    return true;
+  default:
+    break;
+  }
+
+  // Everything else is left to the interpreter: unresolved instructions, monitors, multianewarray, invokedynamic and
+  // signature-polymorphic calls
+  jump_slow(ctx, CC_ALWAYS, is_unresolved(kind) ? ctx->deopt_counted : ctx->deopt);
+  return false;
+}
+
+// Whether execution can continue with the following instruction
+static bool falls_through(insn_code_kind kind) {
+  switch (kind) {
+  case insn_goto:
+  case insn_tableswitch:
+  case insn_lookupswitch:
+  case insn_areturn:
+  case insn_dreturn:
+  case insn_freturn:
+  case insn_ireturn:
+  case insn_lreturn:
+  case insn_return:
+  case insn_athrow:
+    return false;
+  default:
+    return true;
+  }
+}
+
+static void emit_prologue(x86_ctx *ctx) {
+  push(&ctx->as, RBP);
+  mov_rr(&ctx->as, RBP, RSP);
+  // Four pushes keep the stack 16-byte aligned for calls
+  push(&ctx->as, RBX);
+  push(&ctx->as, R12);
+  push(&ctx->as, R13);
+  push(&ctx->as, R14);
+  mov_rr(&ctx->as, RBX, RSI);
+  mov_rr(&ctx->as, R12, RCX);
+
+  mov_rr(&ctx->as, RDI, RBX);
+  mov_imm(&ctx->as, RSI, (uintptr_t)ctx->method);
+  mov_rr(&ctx->as, RDX, R12);
+  call(&ctx->as, x86_jit_runtime_push_frame);
+  test_rr(&ctx->as, true, RAX, RAX);
+  jump(&ctx->as, CC_E, ctx->leave); // StackOverflowError
+  mov_rr(&ctx->as, R13, RAX);
+  tier_up_check(ctx);
+}
+
+static void emit_slow_paths_and_tails(x86_ctx *ctx) {
+  for (int i = 0; i < arrlen(ctx->slow_paths); ++i) {
+    slow_path *path = ctx->slow_paths + i;
+    bind(&ctx->as, path->label);
+    if (path->tier_up) {
+      mov_rr(&ctx->as, RDI, RBX);
+      mov_imm(&ctx->as, RSI, (uintptr_t)ctx->method);
+      mov_imm(&ctx->as, RDX, (uintptr_t)ctx->result);
+      call(&ctx->as, x86_jit_runtime_tier_up);
+      jump(&ctx->as, CC_ALWAYS, path->resume);
+      continue;
+    }
+    store_pc(ctx, path->pc);
+    if (path->resume >= 0) { // fuel check
+      mov_rr(&ctx->as, RDI, RBX);
+      call(&ctx->as, x86_jit_runtime_out_of_fuel);
+      test_rr(&ctx->as, false, RAX, RAX);
+      jump(&ctx->as, CC_E, path->resume);
+    }
+    jump(&ctx->as, CC_ALWAYS, path->tail);
+  }
+
+  bind(&ctx->as, ctx->deopt_counted);
+  mov_rr(&ctx->as, RDI, R13);
+  mov_imm(&ctx->as, RSI, (uintptr_t)ctx->result);
+  call(&ctx->as, x86_jit_runtime_deopt);
+  jump(&ctx->as, CC_ALWAYS, ctx->leave);
+
+  bind(&ctx->as, ctx->deopt);
+  op_mem(&ctx->as, 0, false, 0xC6, 0, at(R13, offsetof(stack_frame, kind)));
+  emit8(&ctx->as, FRAME_KIND_INTERPRETER);
+  jump(&ctx->as, CC_ALWAYS, ctx->leave);
+
+  bind(&ctx->as, ctx->throw_npe);
+  mov_rr(&ctx->as, RDI, RBX);
+  call(&ctx->as, raise_null_pointer_exception);
+  jump(&ctx->as, CC_ALWAYS, ctx->pop_and_leave);
+
+  bind(&ctx->as, ctx->throw_oob);
+  mov_rr(&ctx->as, RDI, RBX);
+  op_reg(&ctx->as, 0, false, 0x8B, RSI, RCX); // mov esi, ecx; the length is already in edx
+  call(&ctx->as, raise_array_index_oob_exception);
+  jump(&ctx->as, CC_ALWAYS, ctx->pop_and_leave);
+
+  bind(&ctx->as, ctx->throw_div0);
+  mov_rr(&ctx->as, RDI, RBX);
+  call(&ctx->as, raise_div0_arithmetic_exception);
+  jump(&ctx->as, CC_ALWAYS, ctx->pop_and_leave);
+
+  bind(&ctx->as, ctx->pop_and_leave);
+  mov_load(&ctx->as, true, RAX, at(R13, offsetof(stack_frame, prev)));
+  mov_store(&ctx->as, true, at(RBX, offsetof(vm_thread, stack) + offsetof(typeof(((vm_thread *)0)->stack), top)), RAX);
+
+  bind(&ctx->as, ctx->leave);
+  pop(&ctx->as, R14);
+  pop(&ctx->as, R13);
+  pop(&ctx->as, R12);
+  pop(&ctx->as, RBX);
+  pop(&ctx->as, RBP);
+  emit8(&ctx->as, 0xC3); // ret
+}
+
+dumb_jit_result *x86_jit_compile(cp_method *method, dumb_jit_options options) {
+  return x86_jit_compile_copy(method, nullptr, options);
+}
+
+dumb_jit_result *x86_jit_compile_copy(cp_method *method, const bytecode_insn *insns, dumb_jit_options options) {
+  attribute_code *code = method->code;
+  code_analysis *analy = method->code_analysis;
+
+  // The interpreter can't pick up a compiled frame halfway through a synchronized method, and exceptions always
+  // leave compiled code, so methods which catch them aren't compiled.
+  if (!code || !analy || method->is_signature_polymorphic || (method->access_flags & ACCESS_SYNCHRONIZED) ||
+      (code->exception_table && code->exception_table->entries_count > 0))
+    return nullptr;
+  scan_basic_blocks(code, analy);
+
+  dumb_jit_result *result = calloc(1, sizeof(dumb_jit_result));
+  x86_ctx ctx_ = {.method = method,
+                  .analysis = analy,
+                  .result = result,
+                  .insns = insns ? insns : code->code,
+                  .options = options},
+          *ctx = &ctx_;
+  arrsetlen(ctx->as.labels, code->insn_count);
+  for (int i = 0; i < code->insn_count; ++i)
+    ctx->as.labels[i] = -1;
+  ctx->leave = new_label(&ctx->as);
+  ctx->pop_and_leave = new_label(&ctx->as);
+  ctx->deopt = new_label(&ctx->as);
+  ctx->deopt_counted = new_label(&ctx->as);
+  ctx->throw_npe = new_label(&ctx->as);
+  ctx->throw_oob = new_label(&ctx->as);
+  ctx->throw_div0 = new_label(&ctx->as);
+
+  emit_prologue(ctx);
+
+  // Blocks are sorted by their first instruction, and each is emitted whole unless it deoptimizes. The entry block
+  // comes first, right after the prologue.
+  for (int block_i = 0; block_i < analy->block_count; ++block_i) {
+    basic_block *bb = analy->blocks + block_i;
+    bool falls_off = true;
+    for (int i = 0; i < bb->insn_count && falls_off; ++i) {
+      ctx->pc = bb->start_index + i;
+      ctx->sd = analy->insn_index_to_sd[ctx->pc];
+      bind(&ctx->as, ctx->pc);
+      const bytecode_insn *insn = ctx->insns + ctx->pc;
+      falls_off = lower_instruction(ctx, insn) && falls_through(unfused_insn_kind(insn->kind));
+    }
+    int end = bb->start_index + bb->insn_count;
+    bool next_is_adjacent = block_i + 1 < analy->block_count && analy->blocks[block_i + 1].start_index == end;
+    if (falls_off && !next_is_adjacent) {
+      ctx->pc = end - 1;
+      jump(&ctx->as, CC_ALWAYS, end);
+    }
+  }
+
+  emit_slow_paths_and_tails(ctx);
+
+  bool ok = patch_fixups(&ctx->as);
+  if (ok) {
+    result->code_size = arrlen(ctx->as.buf);
+    result->code = jit_install_code(ctx->as.buf, result->code_size);
+    result->entry = result->code;
+    ok = result->code != nullptr;
+  }
+  x86_asm_free(&ctx->as);
+  arrfree(ctx->slow_paths);
+  if (!ok) {
+    free(result);
+    return nullptr;
+  }
+  return result;
+}
+
+#else
+
+dumb_jit_result *x86_jit_compile(cp_method *method, dumb_jit_options options) {
+  (void)method, (void)options;
+  return nullptr;
+}
+
+dumb_jit_result *x86_jit_compile_copy(cp_method *method, const bytecode_insn *insns, dumb_jit_options options) {
+  (void)method, (void)insns, (void)options;
+  return nullptr;
+}
+
+#endif
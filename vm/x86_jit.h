@@ -0,0 +1,71 @@
+//
+// Baseline JIT emitting x86-64 machine code, used instead of the WebAssembly JIT on x86-64 Linux.
+//
+
+#ifndef X86_JIT_H
+#define X86_JIT_H
+
+#include "bjvm.h"
+#include "dumb_jit.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(EMSCRIPTEN)
+#define X86_JIT_SUPPORTED
+#endif
+
+// Compiles the method into executable memory (see jit_allocator.h). The entry point has the signature of a
+// jit_trampoline, reading the arguments from `args` and writing the return value to args[0], so it is installed as
+// both the method's jit_entry and its trampoline.
+//
+// Compiled code pushes a frame of kind FRAME_KIND_COMPILED with the same layout as an interpreter frame, and keeps
+// every value in it, so that the GC and stack walks treat it like an interpreter frame once the program counter has
+// been stored. When compiled code can't go on (an instruction it doesn't compile, a failed inline cache, a call to a
+// method which hasn't been compiled, running out of fuel), it leaves the frame on the stack as an interpreter frame
+// and returns: callers notice that thread->stack.top is not their own frame, and let the interpreter run the rest of
+// the invocation. Exceptions pop the frame and are left in thread->current_exception.
+//
+// Methods with exception handlers or ACC_SYNCHRONIZED are not compiled. Returns nullptr if the method can't be
+// compiled.
+dumb_jit_result *x86_jit_compile(cp_method *method, dumb_jit_options options);
+// Like x86_jit_compile, but reads the instructions from `insns`, a copy of method->code->code, so that the interpreter
+// may go on rewriting the method's own instructions while another thread compiles it (see jit_queue.h). The method's
+// basic blocks must have been found already (scan_basic_blocks).
+dumb_jit_result *x86_jit_compile_copy(cp_method *method, const bytecode_insn *insns, dumb_jit_options options);
+
+// Count a call of a method from compiled code, compiling it once it is hot. Defined by the interpreter.
+void jit_count_call(vm_thread *thread, cp_method *method);
+// Compile the method with the optimizing tier (see x86_opt_jit.h), once its baseline code has used up its
+// tier_up_countdown. Defined by the interpreter.
+void jit_tier_up(vm_thread *thread, cp_method *method);
+
+// Runtime helpers called by the compiled code of both tiers
+
+// Push the frame of a compiled method, reading its arguments from `args`. Returns nullptr after raising a
+// StackOverflowError.
+stack_frame *x86_jit_runtime_push_frame(vm_thread *thread, cp_method *method, stack_value *args);
+// Whether the thread should yield, once it has run out of fuel. Refuels it otherwise.
+bool x86_jit_runtime_out_of_fuel(vm_thread *thread);
+// Call the method of an invoke* instruction, with the arguments in the caller's frame at `args`. Returns whether the
+// caller's frame was handed to the interpreter; otherwise the result (if any) is in args[0], or there is a pending
+// exception.
+bool x86_jit_runtime_invoke(vm_thread *thread, stack_frame *frame, const bytecode_insn *insn, stack_value *args);
+void x86_jit_runtime_write_barrier(vm_thread *thread, obj_header *holder);
+// Allocations return nullptr with a pending exception on failure
+object x86_jit_runtime_new(vm_thread *thread, classdesc *cd);
+object x86_jit_runtime_newarray(vm_thread *thread, type_kind array_type, s32 count);
+object x86_jit_runtime_anewarray(vm_thread *thread, classdesc *type, s32 count);
+bool x86_jit_runtime_instanceof(object o, classdesc *cd);
+// The index of the instruction the lookupswitch jumps to
+s32 x86_jit_runtime_lookupswitch(const struct lookupswitch_data *data, s32 key);
+// Java's conversions of doubles to int and long, for the values cvttsd2si can't convert
+s32 x86_jit_runtime_d2i(double x);
+s64 x86_jit_runtime_d2l(double x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // X86_JIT_H
@@ -0,0 +1,1571 @@
+// The optimizing JIT for x86-64 Linux.
+//
+// Methods are built into SSA form (ssa_build.c) and optimized (ssa_opt.c), then laid out in reverse postorder and
+// given registers by a linear scan over the live ranges of their values. Each value lives in one register or spill
+// slot for its whole lifetime; constants are rematerialized where they're used. Phis are resolved with parallel moves
+// at the end of predecessors, which is why critical edges are split first.
+//
+// Like baseline code, compiled code is called like a jit_trampoline and pushes a frame laid out like an interpreter
+// frame, with rbx holding the thread, r12 the arguments and r13 the frame. Unlike baseline code, values only go into
+// the frame at safepoints: before a call or allocation, the frame state of the instruction is stored into the frame,
+// and references which are still needed are reloaded from it afterwards, since the collector may have moved them.
+// Registers that calls clobber are saved around them in slots below the callee-saved registers.
+//
+// Checks jump to a stub that stores their frame state, and the states of any callees inlined at that point, into the
+// frame and the frames above it, then calls x86_opt_jit_runtime_deopt to push the inlined callees' frames and hand
+// them all to the interpreter. The prologue makes sure that there is room on the stack for the deepest such frames.
+
+#include "x86_opt_jit.h"
+
+#ifdef X86_JIT_SUPPORTED
+
+#include <analysis.h>
+#include <arrays.h>
+#include <gc.h>
+#include <jit_allocator.h>
+#include <objects.h>
+#include <ssa.h>
+#include <stddef.h>
+#include <x86_asm.h>
+
+// Registers handed out by the allocator. rax, rcx, rdx, xmm0 and xmm1 are scratch registers for each instruction.
+static const int allocatable_gprs[] = {RSI, RDI, R8, R9, R10, R11, R14, R15};
+#define FIRST_ALLOCATABLE_XMM XMM2
+
+// Where a value lives: general-purpose registers 0-15, XMM registers 16-31, then spill slots. Every location below
+// LOC_SPILL(0) has a slot too, to save the register across calls.
+#define LOC_NONE (-1)
+#define LOC_XMM(x) (16 + (x))
+#define LOC_SPILL(i) (32 + (i))
+
+static bool is_gpr(int loc) { return loc >= 0 && loc < 16; }
+static bool is_xmm(int loc) { return loc >= 16 && loc < 32; }
+static bool is_caller_saved(int loc) { return is_xmm(loc) || (is_gpr(loc) && loc != R14 && loc != R15); }
+
+// Bytes pushed by the prologue below rbp (rbx, r12, r13, r14 and r15), above the slots
+#define PUSHED_BYTES 40
+
+static mem slot_of(int loc) { return at(RBP, -(s32)(PUSHED_BYTES + 8 * (loc + 1))); }
+
+// Describes the interpreter frames written out by a deoptimization stub, outermost first. Emitted into the code after
+// the stubs.
+typedef struct {
+  cp_method *method;
+  u32 pc;
+  s32 offset; // of the frame from the compiled method's frame, in bytes
+} deopt_frame;
+
+typedef struct {
+  u64 count;
+  deopt_frame frames[];
+} deopt_descriptor;
+
+typedef struct {
+  int state;
+  bool counted; // whether the deoptimization counts towards falling back to baseline code
+  int label;
+} deopt_stub;
+
+// A move of a phi argument into the phi's location
+typedef struct {
+  int dst;
+  int src;   // a location, or LOC_NONE for the constant `value`
+  int value;
+} pending_move;
+
+typedef struct {
+  cp_method *method;
+  ssa_function *fn;
+  dumb_jit_result *result;
+  x86_asm as;
+
+  int words;         // of a bitset of values
+  int *pos;          // position of each instruction in the layout (2 * its index), or -1
+  int *block_from;   // position of each block's first instruction
+  int *block_to;     // one past the position of each block's terminator
+  u64 **live_out;    // values live at the end of each block
+  int *start, *end;  // live range of each value, or end = -1 if it is never used
+  int *loc;          // location of each value
+  int spill_count;
+  int *block_labels; // label of each block
+  int next_block;    // block laid out after the one being compiled, or -1
+  u64 *scratch;      // bitset
+
+  deopt_stub *stubs;  // stb_ds array
+  int *descriptors;   // stb_ds array: label of the deopt_descriptor of each state, or -1
+  int leave;          // return to the caller, leaving the frame as it is
+  int pop_and_leave;  // pop the frame and return
+  int deopt_on_entry; // hand the frame to the interpreter before running anything
+  bool failed;
+} opt_ctx;
+
+// Bitsets
+
+static bool has(const u64 *set, int i) { return set[i / 64] >> (i % 64) & 1; }
+static void add(u64 *set, int i) { set[i / 64] |= 1ull << (i % 64); }
+static void del(u64 *set, int i) { set[i / 64] &= ~(1ull << (i % 64)); }
+
+#define FOR_EACH_BIT(i, set, words)                                                                                    \
+  for (int w_ = 0; w_ < (words); ++w_)                                                                                 \
+    for (u64 bits_ = (set)[w_], i; bits_ && (i = w_ * 64 + __builtin_ctzll(bits_), true); bits_ &= bits_ - 1)
+
+// Preparing the function
+
+// Phis left with a single argument (after predecessors turned out to be unreachable) are replaced by it, so that every
+// block with phis has several predecessors
+static void forward_single_argument_phis(ssa_function *fn) {
+  int n = (int)arrlen(fn->insns);
+  int *forward = malloc(n * sizeof(int));
+  for (int v = 0; v < n; ++v) {
+    const ssa_insn *insn = fn->insns + v;
+    forward[v] = insn->block != -1 && insn->op == SSA_PHI && arrlen(insn->args) == 1 ? insn->args[0] : v;
+  }
+#define RESOLVE(v)                                                                                                     \
+  do {                                                                                                                 \
+    while (forward[v] != v)                                                                                            \
+      v = forward[v];                                                                                                  \
+  } while (0)
+  for (int b = 0; b < arrlen(fn->blocks); ++b) {
+    ssa_block *block = fn->blocks + b;
+    int kept = 0;
+    for (int i = 0; i < arrlen(block->insns); ++i) {
+      int v = block->insns[i];
+      if (forward[v] == v)
+        block->insns[kept++] = v;
+      else
+        fn->insns[v].block = -1;
+    }
+    arrsetlen(block->insns, kept);
+  }
+  for (int v = 0; v < n; ++v)
+    for (int j = 0; j < arrlen(fn->insns[v].args); ++j)
+      RESOLVE(fn->insns[v].args[j]);
+  for (int s = 0; s < arrlen(fn->states); ++s) {
+    ssa_frame_state *state = fn->states + s;
+    for (int j = 0; j < state->stack + state->locals; ++j)
+      if (state->values[j] != -1)
+        RESOLVE(state->values[j]);
+  }
+#undef RESOLVE
+  free(forward);
+}
+
+// Liveness
+
+static bool is_variable(const ssa_function *fn, int v) { return !ssa_is_constant(fn, v); }
+
+// Moves the live set from after the instruction to before it
+static void step_back(const ssa_function *fn, int v, u64 *live) {
+  const ssa_insn *insn = fn->insns + v;
+  del(live, v);
+  if (insn->op == SSA_PHI)
+    return; // its arguments are used at the end of the predecessors
+  for (int i = 0; i < arrlen(insn->args); ++i)
+    if (is_variable(fn, insn->args[i]))
+      add(live, insn->args[i]);
+  for (int s = insn->state; s != -1; s = fn->states[s].parent) {
+    const ssa_frame_state *state = fn->states + s;
+    for (int i = 0; i < state->stack + state->locals; ++i)
+      if (state->values[i] != -1 && is_variable(fn, state->values[i]))
+        add(live, state->values[i]);
+  }
+}
+
+// Values used by the phis of `succ` on the edge from `block`
+static void add_phi_uses(const ssa_function *fn, int block, int succ, u64 *live) {
+  const ssa_block *s = fn->blocks + succ;
+  for (int j = 0; j < arrlen(s->preds); ++j) {
+    if (s->preds[j] != block)
+      continue;
+    for (int i = 0; i < arrlen(s->insns) && fn->insns[s->insns[i]].op == SSA_PHI; ++i) {
+      int arg = fn->insns[s->insns[i]].args[j];
+      if (is_variable(fn, arg))
+        add(live, arg);
+    }
+  }
+}
+
+static void compute_liveness(opt_ctx *ctx) {
+  ssa_function *fn = ctx->fn;
+  int block_count = (int)arrlen(fn->blocks), words = ctx->words;
+  ctx->live_out = calloc(block_count, sizeof(u64 *));
+  u64 **live_in = calloc(block_count, sizeof(u64 *));
+  for (int r = 0; r < arrlen(fn->rpo); ++r) {
+    ctx->live_out[fn->rpo[r]] = calloc(words, sizeof(u64));
+    live_in[fn->rpo[r]] = calloc(words, sizeof(u64));
+  }
+
+  u64 *live = malloc(words * sizeof(u64));
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int r = (int)arrlen(fn->rpo) - 1; r >= 0; --r) {
+      int b = fn->rpo[r];
+      const ssa_block *block = fn->blocks + b;
+      memset(live, 0, words * sizeof(u64));
+      for (int i = 0; i < arrlen(block->succs); ++i) {
+        const u64 *in = live_in[block->succs[i]];
+        for (int w = 0; w < words; ++w)
+          live[w] |= in[w];
+        add_phi_uses(fn, b, block->succs[i], live);
+      }
+      if (memcmp(live, ctx->live_out[b], words * sizeof(u64))) {
+        memcpy(ctx->live_out[b], live, words * sizeof(u64));
+        changed = true;
+      }
+      for (int i = (int)arrlen(block->insns) - 1; i >= 0; --i)
+        step_back(fn, block->insns[i], live);
+      memcpy(live_in[b], live, words * sizeof(u64));
+    }
+  }
+
+  free(live);
+  for (int b = 0; b < block_count; ++b)
+    free(live_in[b]);
+  free(live_in);
+}
+
+// Register allocation
+
+static void compute_live_ranges(opt_ctx *ctx) {
+  ssa_function *fn = ctx->fn;
+  int n = (int)arrlen(fn->insns), block_count = (int)arrlen(fn->blocks);
+  ctx->pos = malloc(n * sizeof(int));
+  ctx->start = malloc(n * sizeof(int));
+  ctx->end = malloc(n * sizeof(int));
+  ctx->block_from = calloc(block_count, sizeof(int));
+  ctx->block_to = calloc(block_count, sizeof(int));
+  for (int v = 0; v < n; ++v)
+    ctx->pos[v] = ctx->start[v] = ctx->end[v] = -1;
+
+  // Values are defined just after the position of their instruction, so that they may share a register with arguments
+  // used for the last time by it. Phis are defined at the start of their block.
+  int index = 0;
+  for (int r = 0; r < arrlen(fn->rpo); ++r) {
+    int b = fn->rpo[r];
+    const ssa_block *block = fn->blocks + b;
+    ctx->block_from[b] = 2 * index;
+    for (int i = 0; i < arrlen(block->insns); ++i, ++index) {
+      int v = block->insns[i];
+      ctx->pos[v] = 2 * index;
+      ctx->start[v] = fn->insns[v].op == SSA_PHI ? ctx->block_from[b] : 2 * index + 1;
+    }
+    ctx->block_to[b] = 2 * index - 1;
+  }
+
+  u64 *uses = calloc(ctx->words, sizeof(u64));
+  for (int r = 0; r < arrlen(fn->rpo); ++r) {
+    int b = fn->rpo[r];
+    const ssa_block *block = fn->blocks + b;
+    for (int i = 0; i < arrlen(block->insns); ++i) {
+      int v = block->insns[i];
+      if (fn->insns[v].op == SSA_PHI)
+        continue;
+      memset(uses, 0, ctx->words * sizeof(u64));
+      step_back(fn, v, uses);
+      FOR_EACH_BIT(u, uses, ctx->words) {
+        if (ctx->end[u] < ctx->pos[v])
+          ctx->end[u] = ctx->pos[v];
+      }
+    }
+    FOR_EACH_BIT(u, ctx->live_out[b], ctx->words) {
+      if (ctx->end[u] < ctx->block_to[b])
+        ctx->end[u] = ctx->block_to[b];
+    }
+  }
+  free(uses);
+}
+
+typedef struct {
+  int start;
+  int value;
+} range_start;
+
+static int compare_starts(const void *a, const void *b) {
+  const range_start *x = a, *y = b;
+  return x->start != y->start ? x->start - y->start : x->value - y->value;
+}
+
+// Linear scan: values are given a free register in the order their live ranges start, and when there is none, the
+// value whose range ends last is spilled
+static void allocate_registers(opt_ctx *ctx) {
+  ssa_function *fn = ctx->fn;
+  int n = (int)arrlen(fn->insns);
+  ctx->loc = malloc(n * sizeof(int));
+  range_start *order = nullptr;
+  for (int v = 0; v < n; ++v) {
+    ctx->loc[v] = LOC_NONE;
+    if (fn->insns[v].block != -1 && fn->insns[v].type != TYPE_KIND_VOID && is_variable(fn, v) && ctx->end[v] >= 0)
+      arrput(order, ((range_start){ctx->start[v], v}));
+  }
+  if (order) // qsort's argument must not be null, even if there is nothing to sort
+    qsort(order, arrlen(order), sizeof(range_start), compare_starts);
+
+  bool used[32] = {false}; // by a live value
+  int *active = nullptr;
+  for (int i = 0; i < arrlen(order); ++i) {
+    int v = order[i].value;
+    int kept = 0;
+    for (int j = 0; j < arrlen(active); ++j) {
+      if (ctx->end[active[j]] < ctx->start[v])
+        used[ctx->loc[active[j]]] = false;
+      else
+        active[kept++] = active[j];
+    }
+    arrsetlen(active, kept);
+
+    bool floating = fn->insns[v].type == TYPE_KIND_FLOAT || fn->insns[v].type == TYPE_KIND_DOUBLE;
+    int reg = LOC_NONE;
+    if (floating) {
+      for (int x = FIRST_ALLOCATABLE_XMM; x <= XMM15 && reg == LOC_NONE; ++x)
+        if (!used[LOC_XMM(x)])
+          reg = LOC_XMM(x);
+    } else {
+      for (int j = 0; j < (int)(sizeof(allocatable_gprs) / sizeof(int)) && reg == LOC_NONE; ++j)
+        if (!used[allocatable_gprs[j]])
+          reg = allocatable_gprs[j];
+    }
+    if (reg == LOC_NONE) {
+      int victim = -1;
+      for (int j = 0; j < arrlen(active); ++j)
+        if (is_xmm(ctx->loc[active[j]]) == floating && (victim == -1 || ctx->end[active[j]] > ctx->end[active[victim]]))
+          victim = j;
+      if (victim == -1 || ctx->end[active[victim]] <= ctx->end[v]) {
+        ctx->loc[v] = LOC_SPILL(ctx->spill_count++);
+        continue;
+      }
+      reg = ctx->loc[active[victim]];
+      ctx->loc[active[victim]] = LOC_SPILL(ctx->spill_count++);
+      arrdel(active, victim);
+    }
+    ctx->loc[v] = reg;
+    used[reg] = true;
+    arrput(active, v);
+  }
+  arrfree(active);
+  arrfree(order);
+}
+
+// Moving values around
+
+static void move(opt_ctx *ctx, int dst, int src) {
+  x86_asm *as = &ctx->as;
+  if (dst == src || dst == LOC_NONE)
+    return;
+  if (is_gpr(dst)) {
+    if (is_gpr(src))
+      mov_rr(as, dst, src);
+    else if (is_xmm(src))
+      movq_from_xmm(as, dst, src - 16);
+    else
+      mov_load(as, true, dst, slot_of(src));
+  } else if (is_xmm(dst)) {
+    if (is_gpr(src))
+      movq_to_xmm(as, dst - 16, src);
+    else if (is_xmm(src))
+      op_reg(as, 0, false, 0x0F28, dst - 16, src - 16); // movaps
+    else
+      op_mem(as, SSE_DOUBLE, false, 0x0F10, dst - 16, slot_of(src)); // movsd
+  } else if (is_gpr(src)) {
+    mov_store(as, true, slot_of(dst), src);
+  } else if (is_xmm(src)) {
+    op_mem(as, SSE_DOUBLE, false, 0x0F11, src - 16, slot_of(dst));
+  } else {
+    mov_load(as, true, RDX, slot_of(src));
+    mov_store(as, true, slot_of(dst), RDX);
+  }
+}
+
+// Load the bits of the value into a general-purpose register. The upper half of an int is undefined.
+static void load_value(opt_ctx *ctx, int reg, int v) {
+  if (ssa_is_constant(ctx->fn, v))
+    mov_imm(&ctx->as, reg, (u64)ctx->fn->insns[v].imm);
+  else
+    move(ctx, reg, ctx->loc[v]);
+}
+
+// The register holding the value, loading it into `scratch` if it isn't in a general-purpose register
+static int value_reg(opt_ctx *ctx, int v, int scratch) {
+  if (!ssa_is_constant(ctx->fn, v) && is_gpr(ctx->loc[v]))
+    return ctx->loc[v];
+  load_value(ctx, scratch, v);
+  return scratch;
+}
+
+// Load an int into a register, zero-extended (as an array index)
+static void load_index(opt_ctx *ctx, int reg, int v) {
+  load_value(ctx, reg, v);
+  op_reg(&ctx->as, 0, false, 0x8B, reg, reg);
+}
+
+// Load a float or double into an XMM register. Clobbers rax.
+static void load_float(opt_ctx *ctx, int xmm, int v) {
+  if (ssa_is_constant(ctx->fn, v)) {
+    mov_imm(&ctx->as, RAX, (u64)ctx->fn->insns[v].imm);
+    movq_to_xmm(&ctx->as, xmm, RAX);
+  } else {
+    move(ctx, LOC_XMM(xmm), ctx->loc[v]);
+  }
+}
+
+static void store_value(opt_ctx *ctx, int v, int reg) { move(ctx, ctx->loc[v], reg); }
+static void store_float(opt_ctx *ctx, int v, int xmm) { move(ctx, ctx->loc[v], LOC_XMM(xmm)); }
+
+static bool is_imm32(const opt_ctx *ctx, int v, s32 *imm) {
+  const ssa_insn *insn = ctx->fn->insns + v;
+  if (insn->op != SSA_CONST || insn->imm < INT32_MIN || insn->imm > INT32_MAX)
+    return false;
+  *imm = (s32)insn->imm;
+  return true;
+}
+
+// `opcode reg, v` for an integer operand. Clobbers rcx if v is a constant.
+static void op_value(opt_ctx *ctx, bool w, u32 opcode, int reg, int v) {
+  if (ssa_is_constant(ctx->fn, v)) {
+    mov_imm(&ctx->as, RCX, (u64)ctx->fn->insns[v].imm);
+    op_reg(&ctx->as, 0, w, opcode, reg, RCX);
+  } else if (is_gpr(ctx->loc[v])) {
+    op_reg(&ctx->as, 0, w, opcode, reg, ctx->loc[v]);
+  } else {
+    op_mem(&ctx->as, 0, w, opcode, reg, slot_of(ctx->loc[v]));
+  }
+}
+
+// `opcode xmm, v` for a floating point operand. Clobbers rax and xmm1 if v is a constant.
+static void sse_value(opt_ctx *ctx, int prefix, u32 opcode, int xmm, int v) {
+  if (ssa_is_constant(ctx->fn, v)) {
+    load_float(ctx, XMM1, v);
+    op_reg(&ctx->as, prefix, false, opcode, xmm, XMM1);
+  } else if (is_xmm(ctx->loc[v])) {
+    op_reg(&ctx->as, prefix, false, opcode, xmm, ctx->loc[v] - 16);
+  } else {
+    op_mem(&ctx->as, prefix, false, opcode, xmm, slot_of(ctx->loc[v]));
+  }
+}
+
+static int sse_prefix(type_kind type) { return type == TYPE_KIND_DOUBLE ? SSE_DOUBLE : SSE_SINGLE; }
+
+// Resolve the phi arguments of an edge, as if all moves happened at once: each move waits until its destination has
+// been read by the other moves, and cycles are broken by parking a value in rax
+static void parallel_move(opt_ctx *ctx, pending_move *moves) {
+  int kept = 0;
+  for (int i = 0; i < arrlen(moves); ++i)
+    if (moves[i].dst != LOC_NONE && moves[i].dst != moves[i].src)
+      moves[kept++] = moves[i];
+  arrsetlen(moves, kept);
+
+  while (arrlen(moves)) {
+    bool progress = false;
+    for (int i = 0; i < arrlen(moves); ++i) {
+      bool blocked = false;
+      for (int j = 0; j < arrlen(moves) && !blocked; ++j)
+        blocked = j != i && moves[j].src == moves[i].dst;
+      if (blocked)
+        continue;
+      pending_move m = moves[i];
+      if (m.src != LOC_NONE) {
+        move(ctx, m.dst, m.src);
+      } else {
+        mov_imm(&ctx->as, RDX, (u64)ctx->fn->insns[m.value].imm); // rax may hold a parked value
+        move(ctx, m.dst, RDX);
+      }
+      arrdel(moves, i);
+      progress = true;
+      break;
+    }
+    if (!progress) {
+      int parked = moves[0].src;
+      move(ctx, RAX, parked);
+      for (int j = 0; j < arrlen(moves); ++j)
+        if (moves[j].src == parked)
+          moves[j].src = RAX;
+    }
+  }
+  arrfree(moves);
+}
+
+// Calls
+
+// Values that must survive a call made by the instruction: those live after it, except its own value, and for checks
+// (which may deoptimize after the call), the values in its frame state
+static u64 *live_across(opt_ctx *ctx, int v, const u64 *live_after, bool with_state) {
+  memcpy(ctx->scratch, live_after, ctx->words * sizeof(u64));
+  del(ctx->scratch, v);
+  if (with_state) {
+    const ssa_function *fn = ctx->fn;
+    for (int s = fn->insns[v].state; s != -1; s = fn->states[s].parent) {
+      const ssa_frame_state *state = fn->states + s;
+      for (int i = 0; i < state->stack + state->locals; ++i)
+        if (state->values[i] != -1 && is_variable(fn, state->values[i]))
+          add(ctx->scratch, state->values[i]);
+    }
+  }
+  return ctx->scratch;
+}
+
+// Save (or restore) the caller-saved registers holding the values, each in the slot of its register
+static void save_registers(opt_ctx *ctx, const u64 *values, bool restore) {
+  x86_asm *as = &ctx->as;
+  FOR_EACH_BIT(v, values, ctx->words) {
+    int loc = ctx->loc[v];
+    if (!is_caller_saved(loc))
+      continue;
+    if (is_gpr(loc))
+      op_mem(as, 0, true, restore ? 0x8B : 0x89, loc, slot_of(loc));
+    else
+      op_mem(as, SSE_DOUBLE, false, restore ? 0x0F10 : 0x0F11, loc - 16, slot_of(loc)); // movsd
+  }
+}
+
+// The frame
+
+static mem frame_slot(int frame_offset, int i) {
+  return at(R13, (s32)(frame_offset + offsetof(stack_frame, stack) + i * sizeof(stack_value)));
+}
+
+static mem frame_local(const cp_method *method, int frame_offset, int i) {
+  return at(R13, (s32)(frame_offset - (method->code->max_locals - i) * (int)sizeof(stack_value)));
+}
+
+// Offset from the compiled method's frame of the frame of the method whose state this is. An inlined callee's frame
+// is where the interpreter would have pushed it: right after its arguments on its caller's stack.
+static int frame_offset(const ssa_function *fn, int state) {
+  const ssa_frame_state *s = fn->states + state;
+  if (s->parent == -1)
+    return 0;
+  const ssa_frame_state *caller = fn->states + s->parent;
+  int args = caller->stack - method_argc(s->method);
+  return frame_offset(fn, s->parent) + (int)(offsetof(stack_frame, stack) + args * sizeof(stack_value)) +
+         s->method->code->max_locals * (int)sizeof(stack_value);
+}
+
+// Store a value into a stack or local slot, as the interpreter expects it (ints sign-extended). Clobbers rax.
+static void store_to_frame(opt_ctx *ctx, mem m, int v) {
+  load_value(ctx, RAX, v);
+  if (ctx->fn->insns[v].type == TYPE_KIND_INT)
+    movsxd_rr(&ctx->as, RAX, RAX);
+  mov_store(&ctx->as, true, m, RAX);
+}
+
+// Store the values of a frame state (not those of its callers) into its frame
+static void store_state(opt_ctx *ctx, int state) {
+  const ssa_frame_state *s = ctx->fn->states + state;
+  int offset = frame_offset(ctx->fn, state);
+  for (int i = 0; i < s->stack + s->locals; ++i) {
+    int v = s->values[i];
+    if (v != -1)
+      store_to_frame(ctx, i < s->stack ? frame_slot(offset, i) : frame_local(s->method, offset, i - s->stack), v);
+  }
+}
+
+static void store_pc(opt_ctx *ctx, int pc) {
+  op_mem(&ctx->as, 0x66, false, 0xC7, 0, at(R13, offsetof(stack_frame, program_counter)));
+  emit16(&ctx->as, (u16)pc);
+}
+
+// After a safepoint, reload the references that are still needed from the frame, where the collector updated them.
+// Only the first `usable_stack` stack slots of the state still hold its values. Fails the compilation if a reference
+// isn't in the frame.
+static void reload_references(opt_ctx *ctx, const u64 *values, const ssa_frame_state *state, int usable_stack) {
+  FOR_EACH_BIT(v, values, ctx->words) {
+    if (ctx->fn->insns[v].type != TYPE_KIND_REFERENCE || ctx->loc[v] == LOC_NONE)
+      continue;
+    int found = -1;
+    for (int i = 0; i < state->stack + state->locals && found == -1; ++i)
+      if (state->values[i] == (int)v && (i >= state->stack || i < usable_stack))
+        found = i;
+    if (found == -1) {
+      ctx->failed = true;
+      return;
+    }
+    mem m = found < state->stack ? frame_slot(0, found) : frame_local(state->method, 0, found - state->stack);
+    mov_load(&ctx->as, true, RDX, m);
+    store_value(ctx, v, RDX);
+  }
+}
+
+// Deoptimization
+
+static int deopt_label(opt_ctx *ctx, int state, bool counted) {
+  for (int i = 0; i < arrlen(ctx->stubs); ++i)
+    if (ctx->stubs[i].state == state && ctx->stubs[i].counted == counted)
+      return ctx->stubs[i].label;
+  deopt_stub stub = {state, counted, new_label(&ctx->as)};
+  arrput(ctx->stubs, stub);
+  if (ctx->descriptors[state] == -1)
+    ctx->descriptors[state] = new_label(&ctx->as);
+  return stub.label;
+}
+
+static void x86_opt_jit_runtime_deopt(vm_thread *thread, stack_frame *frame, const deopt_descriptor *desc,
+                                      dumb_jit_result *counted) {
+  frame->kind = FRAME_KIND_INTERPRETER;
+  frame->program_counter = desc->frames[0].pc;
+  for (u64 i = 1; i < desc->count; ++i) {
+    const deopt_frame *f = desc->frames + i;
+    cp_method *method = f->method;
+    stack_value *args = (stack_value *)((char *)frame + f->offset) - method->code->max_locals;
+    stack_frame *inlined = push_plain_frame(thread, method, args, method_argc(method));
+    DCHECK(inlined == (stack_frame *)((char *)frame + f->offset)); // the prologue made sure there is room
+    inlined->program_counter = f->pc;
+  }
+  if (counted)
+    dumb_jit_count_deopt(frame->method, counted);
+}
+
+static void emit_deopt_stubs(opt_ctx *ctx) {
+  x86_asm *as = &ctx->as;
+  for (int i = 0; i < arrlen(ctx->stubs); ++i) {
+    const deopt_stub *stub = ctx->stubs + i;
+    bind(as, stub->label);
+    // Outermost first: a callee's arguments are both its caller's stack slots and its own locals
+    int *chain = nullptr;
+    for (int s = stub->state; s != -1; s = ctx->fn->states[s].parent)
+      arrput(chain, s);
+    for (int j = (int)arrlen(chain) - 1; j >= 0; --j)
+      store_state(ctx, chain[j]);
+    arrfree(chain);
+    mov_rr(as, RDI, RBX);
+    mov_rr(as, RSI, R13);
+    lea_label(as, RDX, ctx->descriptors[stub->state]);
+    mov_imm(as, RCX, stub->counted ? (uintptr_t)ctx->result : 0);
+    call(as, x86_opt_jit_runtime_deopt);
+    jump(as, CC_ALWAYS, ctx->leave);
+  }
+}
+
+static void emit_deopt_descriptors(opt_ctx *ctx) {
+  x86_asm *as = &ctx->as;
+  while (here(as) % alignof(deopt_descriptor))
+    emit8(as, 0xCC); // int3
+  for (int state = 0; state < arrlen(ctx->fn->states); ++state) {
+    if (ctx->descriptors[state] == -1)
+      continue;
+    int *chain = nullptr;
+    for (int s = state; s != -1; s = ctx->fn->states[s].parent)
+      arrput(chain, s);
+    bind(as, ctx->descriptors[state]);
+    emit64(as, arrlen(chain));
+    for (int i = (int)arrlen(chain) - 1; i >= 0; --i) {
+      const ssa_frame_state *s = ctx->fn->states + chain[i];
+      emit64(as, (uintptr_t)s->method);
+      emit32(as, s->pc);
+      emit32(as, (u32)frame_offset(ctx->fn, chain[i]));
+    }
+    arrfree(chain);
+  }
+}
+
+// Runtime helpers
+
+static bool x86_opt_jit_runtime_can_store(obj_header *array, obj_header *value) {
+  return instanceof(obj_class(value), obj_class(array)->one_fewer_dim);
+}
+
+// Instructions
+
+static void load_typed(x86_asm *as, int reg, type_kind type, mem m) {
+  switch (type) {
+  case TYPE_KIND_BOOLEAN:
+  case TYPE_KIND_BYTE:
+    op_mem(as, 0, false, 0x0FBE, reg, m); // movsx
+    break;
+  case TYPE_KIND_CHAR:
+    op_mem(as, 0, false, 0x0FB7, reg, m); // movzx
+    break;
+  case TYPE_KIND_SHORT:
+    op_mem(as, 0, false, 0x0FBF, reg, m); // movsx
+    break;
+  case TYPE_KIND_INT:
+  case TYPE_KIND_FLOAT:
+    mov_load(as, false, reg, m);
+    break;
+  default:
+    mov_load(as, true, reg, m);
+    break;
+  }
+}
+
+static void store_typed(x86_asm *as, type_kind type, mem m, int reg) {
+  switch (type) {
+  case TYPE_KIND_BOOLEAN:
+  case TYPE_KIND_BYTE:
+    op_mem(as, 0, false, 0x88, reg, m); // only ever rcx, which needs no REX prefix
+    break;
+  case TYPE_KIND_CHAR:
+  case TYPE_KIND_SHORT:
+    op_mem(as, 0x66, false, 0x89, reg, m);
+    break;
+  case TYPE_KIND_INT:
+  case TYPE_KIND_FLOAT:
+    mov_store(as, false, m, reg);
+    break;
+  default:
+    mov_store(as, true, m, reg);
+    break;
+  }
+}
+
+// How a heap_ref (see bjvm.h) is stored once compressed
+static const type_kind heap_ref_type = sizeof(heap_ref) == 4 ? TYPE_KIND_INT : TYPE_KIND_REFERENCE;
+
+// Load a heap_ref into reg, decompressed. Clobbers rdx.
+static void load_heap_ref(x86_asm *as, int reg, mem m) {
+#if COMPRESSED_REFS
+  mov_load(as, false, reg, m);
+  decompress_ref(as, reg, RDX, compressed_heap_base);
+#else
+  mov_load(as, true, reg, m);
+#endif
+}
+
+// Compress the reference in reg to a heap_ref, to be stored as heap_ref_type. Clobbers rdx.
+static void compress_heap_ref([[maybe_unused]] x86_asm *as, [[maybe_unused]] int reg) {
+#if COMPRESSED_REFS
+  compress_ref(as, reg, RDX, compressed_heap_base);
+#endif
+}
+
+static void jump_to_block(opt_ctx *ctx, condition cc, int block) {
+  if (cc != CC_ALWAYS || block != ctx->next_block)
+    jump(&ctx->as, cc, ctx->block_labels[block]);
+}
+
+// Branch to `taken` if the condition holds, otherwise to `not_taken`
+static void branch_to(opt_ctx *ctx, condition cc, int taken, int not_taken) {
+  if (taken == ctx->next_block) {
+    jump(&ctx->as, negate(cc), ctx->block_labels[not_taken]);
+  } else {
+    jump(&ctx->as, cc, ctx->block_labels[taken]);
+    jump_to_block(ctx, CC_ALWAYS, not_taken);
+  }
+}
+
+static void lower_branch(opt_ctx *ctx, const ssa_insn *insn, const ssa_block *block) {
+  int a = insn->args[0], b = insn->args[1];
+  int taken = block->succs[0], not_taken = block->succs[1];
+  if (insn->mem_type == TYPE_KIND_FLOAT || insn->mem_type == TYPE_KIND_DOUBLE) {
+    // ucomiss/ucomisd set the flags like an unsigned comparison, and set PF if either operand is NaN
+    bool swap = insn->cond == SSA_LT || insn->cond == SSA_LE;
+    load_float(ctx, XMM0, swap ? b : a);
+    sse_value(ctx, insn->mem_type == TYPE_KIND_DOUBLE ? 0x66 : 0, 0x0F2E, XMM0, swap ? a : b);
+    static const condition ccs[] = {CC_E, CC_NE, CC_A, CC_AE, CC_A, CC_AE};
+    jump(&ctx->as, CC_P, ctx->block_labels[insn->nan_result ? taken : not_taken]);
+    branch_to(ctx, ccs[insn->cond], taken, not_taken);
+    return;
+  }
+  bool w = insn->mem_type != TYPE_KIND_INT;
+  int reg = value_reg(ctx, a, RAX);
+  s32 imm;
+  if (is_imm32(ctx, b, &imm))
+    alu_imm(&ctx->as, w, ALU_CMP, reg, imm);
+  else
+    op_value(ctx, w, 0x3B, reg, b);
+  static const condition ccs[] = {CC_E, CC_NE, CC_L, CC_GE, CC_G, CC_LE};
+  branch_to(ctx, ccs[insn->cond], taken, not_taken);
+}
+
+// The successor of a switch that a target instruction index belongs to
+static int switch_succ_label(opt_ctx *ctx, const ssa_block *block, const int *targets, int count, int target) {
+  for (int i = 0; i < count; ++i)
+    if (targets[i] == target)
+      return ctx->block_labels[block->succs[i]];
+  return ctx->block_labels[block->succs[count]];
+}
+
+static void lower_switch(opt_ctx *ctx, int v, const ssa_block *block, const u64 *live_after) {
+  const ssa_insn *insn = ctx->fn->insns + v;
+  x86_asm *as = &ctx->as;
+  int *labels = nullptr;
+  for (int i = 0; i < arrlen(block->succs); ++i)
+    arrput(labels, ctx->block_labels[block->succs[i]]);
+  int default_label = arrlast(labels);
+
+  if (insn->insn->kind == insn_tableswitch) {
+    const struct tableswitch_data *data = insn->insn->tableswitch;
+    load_value(ctx, RAX, insn->args[0]);
+    jump_table(as, data->low, data->targets_count, labels, default_label);
+    arrfree(labels);
+    return;
+  }
+
+  const struct lookupswitch_data *data = insn->insn->lookupswitch;
+  switch (data->strategy) {
+  case LOOKUPSWITCH_LINEAR:
+    load_value(ctx, RAX, insn->args[0]);
+    for (int i = 0; i < data->keys_count; ++i) {
+      alu_imm(as, false, ALU_CMP, RAX, data->keys[i]);
+      jump(as, CC_E, labels[i]);
+    }
+    break;
+  case LOOKUPSWITCH_TABLE: {
+    int *table = nullptr;
+    for (u32 i = 0; i < data->table_size; ++i)
+      arrput(table, switch_succ_label(ctx, block, data->targets, data->targets_count, data->table[i]));
+    load_value(ctx, RAX, insn->args[0]);
+    jump_table(as, data->low, (int)data->table_size, table, default_label);
+    arrfree(table);
+    arrfree(labels);
+    return;
+  }
+  default: {
+    // Find the target's instruction index, then compare against each target
+    const u64 *live = live_across(ctx, v, live_after, false);
+    load_value(ctx, RCX, insn->args[0]);
+    save_registers(ctx, live, false);
+    mov_rr(as, RSI, RCX);
+    mov_imm(as, RDI, (uintptr_t)data);
+    call(as, x86_jit_runtime_lookupswitch);
+    save_registers(ctx, live, true);
+    for (int i = 0; i < data->targets_count; ++i) {
+      alu_imm(as, false, ALU_CMP, RAX, data->targets[i]);
+      jump(as, CC_E, labels[i]);
+    }
+    break;
+  }
+  }
+  jump(as, CC_ALWAYS, default_label);
+  arrfree(labels);
+}
+
+// gc_write_barrier for the object in rax, with the common case (marking a card) inline, as in baseline code
+static void lower_write_barrier(opt_ctx *ctx, const u64 *live) {
+  x86_asm *as = &ctx->as;
+  int not_old = new_label(as), done = new_label(as);
+  mov_load(as, true, RCX, at(RBX, offsetof(vm_thread, vm)));
+  mov_rr(as, RDX, RAX);
+  op_mem(as, 0, true, 0x2B, RDX, at(RCX, offsetof(vm, heap)));
+  op_mem(as, 0, true, 0x3B, RDX, at(RCX, offsetof(vm, young_start)));
+  jump(as, CC_AE, not_old);
+  op_reg(as, 0, true, 0xC1, SHIFT_SHR, RDX);
+  emit8(as, __builtin_ctz(CARD_BYTES));
+  op_mem(as, 0, true, 0x03, RDX, at(RCX, offsetof(vm, card_table)));
+  op_mem(as, 0, false, 0xC6, 0, at(RDX, 0));
+  emit8(as, 1);
+  jump(as, CC_ALWAYS, done);
+
+  bind(as, not_old);
+  op_mem(as, 0, true, 0x3B, RDX, at(RCX, offsetof(vm, heap_capacity)));
+  jump(as, CC_B, done);
+  save_registers(ctx, live, false);
+  mov_rr(as, RSI, RAX);
+  mov_rr(as, RDI, RBX);
+  call(as, x86_jit_runtime_write_barrier);
+  save_registers(ctx, live, true);
+  bind(as, done);
+}
+
+static void lower_div_rem(opt_ctx *ctx, const ssa_insn *insn) {
+  x86_asm *as = &ctx->as;
+  bool w = insn->type == TYPE_KIND_LONG, is_rem = insn->op == SSA_REM;
+  load_value(ctx, RCX, insn->args[1]);
+  load_value(ctx, RAX, insn->args[0]);
+  // idiv faults on MIN_VALUE / -1, where Java's quotient overflows to MIN_VALUE and the remainder is 0
+  int divide = new_label(as), done = new_label(as);
+  alu_imm(as, w, ALU_CMP, RCX, -1);
+  jump(as, CC_NE, divide);
+  if (is_rem)
+    mov_imm(as, RAX, 0);
+  else
+    op_reg(as, 0, w, 0xF7, UNARY_NEG, RAX);
+  jump(as, CC_ALWAYS, done);
+  bind(as, divide);
+  if (w)
+    emit8(as, 0x48);
+  emit8(as, 0x99); // cdq/cqo
+  op_reg(as, 0, w, 0xF7, UNARY_IDIV, RCX);
+  if (is_rem)
+    mov_rr(as, RAX, RDX);
+  bind(as, done);
+}
+
+static void lower_int_op(opt_ctx *ctx, const ssa_insn *insn) {
+  x86_asm *as = &ctx->as;
+  bool w = insn->type == TYPE_KIND_LONG;
+  int a = insn->args[0], b = arrlen(insn->args) > 1 ? insn->args[1] : -1;
+  s32 imm;
+  switch (insn->op) {
+  case SSA_DIV:
+  case SSA_REM:
+    lower_div_rem(ctx, insn);
+    return;
+  case SSA_NEG:
+    load_value(ctx, RAX, a);
+    op_reg(as, 0, w, 0xF7, UNARY_NEG, RAX);
+    return;
+  case SSA_SHL:
+  case SSA_SHR:
+  case SSA_USHR: {
+    // x86 masks the shift count like Java does
+    int ext = insn->op == SSA_SHL ? SHIFT_SHL : insn->op == SSA_SHR ? SHIFT_SAR : SHIFT_SHR;
+    if (is_imm32(ctx, b, &imm)) {
+      load_value(ctx, RAX, a);
+      op_reg(as, 0, w, 0xC1, ext, RAX);
+      emit8(as, imm & (w ? 63 : 31));
+    } else {
+      load_value(ctx, RCX, b);
+      load_value(ctx, RAX, a);
+      op_reg(as, 0, w, 0xD3, ext, RAX);
+    }
+    return;
+  }
+  case SSA_MUL:
+    load_value(ctx, RAX, a);
+    if (is_imm32(ctx, b, &imm)) {
+      op_reg(as, 0, w, 0x69, RAX, RAX); // imul rax, rax, imm32
+      emit32(as, (u32)imm);
+    } else {
+      op_value(ctx, w, 0x0FAF, RAX, b);
+    }
+    return;
+  default:
+    break;
+  }
+
+  static const struct {
+    ssa_op op;
+    int ext;
+    u32 opcode;
+  } alu[] = {{SSA_ADD, ALU_ADD, 0x03}, {SSA_SUB, ALU_SUB, 0x2B}, {SSA_AND, ALU_AND, 0x23},
+             {SSA_OR, ALU_OR, 0x0B},   {SSA_XOR, ALU_XOR, 0x33}};
+  for (int i = 0; i < (int)(sizeof(alu) / sizeof(alu[0])); ++i) {
+    if (alu[i].op != insn->op)
+      continue;
+    load_value(ctx, RAX, a);
+    if (is_imm32(ctx, b, &imm))
+      alu_imm(as, w, alu[i].ext, RAX, imm);
+    else
+      op_value(ctx, w, alu[i].opcode, RAX, b);
+    return;
+  }
+  UNREACHABLE();
+}
+
+static void lower_compare(opt_ctx *ctx, const ssa_insn *insn) {
+  x86_asm *as = &ctx->as;
+  int a = insn->args[0], b = insn->args[1];
+  if (insn->op == SSA_LCMP) {
+    load_value(ctx, RAX, a);
+    op_value(ctx, true, 0x3B, RAX, b);
+    op_reg(as, 0, false, 0x0F90 | CC_G, 0, RCX); // setg cl
+    op_reg(as, 0, false, 0x0F90 | CC_L, 0, RDX); // setl dl
+    op_reg(as, 0, false, 0x0FB6, RAX, RCX);      // movzx eax, cl
+    op_reg(as, 0, false, 0x0FB6, RCX, RDX);      // movzx ecx, dl
+    op_reg(as, 0, false, 0x2B, RAX, RCX);        // sub eax, ecx
+    return;
+  }
+  bool is_double = ctx->fn->insns[a].type == TYPE_KIND_DOUBLE;
+  int done = new_label(as);
+  load_float(ctx, XMM0, a);
+  sse_value(ctx, is_double ? 0x66 : 0, 0x0F2E, XMM0, b); // ucomiss/ucomisd
+  // The moves leave the flags alone
+  mov_imm(as, RAX, (u32)insn->nan_result);
+  jump(as, CC_P, done);
+  mov_imm(as, RAX, 0);
+  op_reg(as, 0, false, 0x0F90 | CC_A, 0, RAX); // seta al: 1 if greater
+  op_reg(as, 0, false, 0x1B, RCX, RCX);        // sbb ecx, ecx: -1 if less
+  op_reg(as, 0, false, 0x0B, RAX, RCX);        // or eax, ecx
+  bind(as, done);
+}
+
+// Conversions, leaving the result in rax or xmm0
+static void lower_conversion(opt_ctx *ctx, int v, const u64 *live_after) {
+  x86_asm *as = &ctx->as;
+  const ssa_insn *insn = ctx->fn->insns + v;
+  int a = insn->args[0];
+  switch (insn->conversion) {
+  case insn_i2l:
+    load_value(ctx, RAX, a);
+    movsxd_rr(as, RAX, RAX);
+    break;
+  case insn_l2i:
+    load_value(ctx, RAX, a);
+    break;
+  case insn_i2b:
+    load_value(ctx, RAX, a);
+    op_reg(as, 0, false, 0x0FBE, RAX, RAX); // movsx eax, al
+    break;
+  case insn_i2s:
+    load_value(ctx, RAX, a);
+    op_reg(as, 0, false, 0x0FBF, RAX, RAX); // movsx eax, ax
+    break;
+  case insn_i2c:
+    load_value(ctx, RAX, a);
+    op_reg(as, 0, false, 0x0FB7, RAX, RAX); // movzx eax, ax
+    break;
+  case insn_i2f:
+  case insn_l2f:
+  case insn_i2d:
+  case insn_l2d:
+    load_value(ctx, RAX, a);
+    op_reg(as, sse_prefix(insn->type), insn->conversion == insn_l2f || insn->conversion == insn_l2d, 0x0F2A, XMM0,
+           RAX); // cvtsi2ss/cvtsi2sd
+    break;
+  case insn_f2d:
+  case insn_d2f:
+    load_float(ctx, XMM0, a);
+    op_reg(as, insn->conversion == insn_f2d ? SSE_SINGLE : SSE_DOUBLE, false, 0x0F5A, XMM0, XMM0);
+    break;
+  case insn_f2i:
+  case insn_f2l:
+  case insn_d2i:
+  case insn_d2l: {
+    bool from_double = insn->conversion == insn_d2i || insn->conversion == insn_d2l;
+    bool to_long = insn->type == TYPE_KIND_LONG;
+    load_float(ctx, XMM0, a);
+    op_reg(as, from_double ? SSE_DOUBLE : SSE_SINGLE, to_long, 0x0F2C, RAX, XMM0); // cvttss2si/cvttsd2si
+    // NaNs and values out of range give the "integer indefinite" value, MIN_VALUE
+    if (to_long) {
+      mov_imm(as, RCX, (u64)INT64_MIN);
+      op_reg(as, 0, true, 0x3B, RAX, RCX);
+    } else {
+      alu_imm(as, false, ALU_CMP, RAX, INT32_MIN);
+    }
+    int done = new_label(as);
+    jump(as, CC_NE, done);
+    if (!from_double)
+      op_reg(as, SSE_SINGLE, false, 0x0F5A, XMM0, XMM0); // cvtss2sd
+    const u64 *live = live_across(ctx, v, live_after, false);
+    save_registers(ctx, live, false);
+    call(as, to_long ? (void *)x86_jit_runtime_d2l : (void *)x86_jit_runtime_d2i);
+    save_registers(ctx, live, true);
+    bind(as, done);
+    break;
+  }
+  default:
+    UNREACHABLE();
+  }
+}
+
+// Allocations: the frame state is stored into the frame first, and references reloaded afterwards
+static void lower_allocation(opt_ctx *ctx, int v, const u64 *live_after) {
+  x86_asm *as = &ctx->as;
+  const ssa_insn *insn = ctx->fn->insns + v;
+  const ssa_frame_state *state = ctx->fn->states + insn->state;
+  store_state(ctx, insn->state);
+  store_pc(ctx, state->pc);
+  const u64 *live = live_across(ctx, v, live_after, false);
+  if (insn->op != SSA_NEW)
+    load_value(ctx, RDX, insn->args[0]);
+  save_registers(ctx, live, false);
+  mov_rr(as, RDI, RBX);
+  switch (insn->op) {
+  case SSA_NEW:
+    mov_imm(as, RSI, (uintptr_t)insn->classdesc);
+    call(as, x86_jit_runtime_new);
+    break;
+  case SSA_NEWARRAY:
+    mov_imm(as, RSI, insn->array_type);
+    call(as, x86_jit_runtime_newarray);
+    break;
+  default:
+    mov_imm(as, RSI, (uintptr_t)insn->classdesc);
+    call(as, x86_jit_runtime_anewarray);
+    break;
+  }
+  test_rr(as, true, RAX, RAX);
+  jump(as, CC_E, ctx->pop_and_leave); // OutOfMemoryError or NegativeArraySizeException
+  store_value(ctx, v, RAX);
+  save_registers(ctx, live, true);
+  reload_references(ctx, live, state, state->stack);
+}
+
+static void lower_invoke(opt_ctx *ctx, int v, const u64 *live_after) {
+  x86_asm *as = &ctx->as;
+  const ssa_insn *insn = ctx->fn->insns + v;
+  const ssa_frame_state *state = ctx->fn->states + insn->state;
+  if (state->parent != -1) { // inlined code has no safepoints
+    ctx->failed = true;
+    return;
+  }
+  int args = state->stack - insn->insn->args;
+  store_state(ctx, insn->state);
+  store_pc(ctx, state->pc);
+  const u64 *live = live_across(ctx, v, live_after, false);
+  save_registers(ctx, live, false);
+  mov_rr(as, RDI, RBX);
+  mov_rr(as, RSI, R13);
+  mov_imm(as, RDX, (uintptr_t)insn->insn);
+  op_mem(as, 0, true, 0x8D, RCX, frame_slot(0, args)); // lea
+  call(as, x86_jit_runtime_invoke);
+  op_reg(as, 0, false, 0x84, RAX, RAX); // test al, al
+  jump(as, CC_NE, ctx->leave);          // the frame was handed to the interpreter
+  alu_imm_mem(as, true, ALU_CMP, at(RBX, offsetof(vm_thread, current_exception)), 0);
+  jump(as, CC_NE, ctx->pop_and_leave);
+  save_registers(ctx, live, true);
+  reload_references(ctx, live, state, args);
+  if (insn->type != TYPE_KIND_VOID) {
+    mov_load(as, true, RAX, frame_slot(0, args));
+    store_value(ctx, v, RAX);
+  }
+}
+
+// Checks which call a helper: on failure, deoptimize to the check's state
+static void lower_helper_check(opt_ctx *ctx, int v, const u64 *live_after) {
+  x86_asm *as = &ctx->as;
+  const ssa_insn *insn = ctx->fn->insns + v;
+  const u64 *live = live_across(ctx, v, live_after, true);
+  int done = new_label(as);
+  if (insn->op == SSA_CAST_CHECK) {
+    load_value(ctx, RAX, insn->args[0]);
+    test_rr(as, true, RAX, RAX);
+    jump(as, CC_E, done); // null passes
+    save_registers(ctx, live, false);
+    mov_rr(as, RDI, RAX);
+    mov_imm(as, RSI, (uintptr_t)insn->classdesc);
+    call(as, x86_jit_runtime_instanceof);
+  } else {
+    load_value(ctx, RCX, insn->args[1]);
+    test_rr(as, true, RCX, RCX);
+    jump(as, CC_E, done); // null can be stored anywhere
+    load_value(ctx, RAX, insn->args[0]);
+    save_registers(ctx, live, false);
+    mov_rr(as, RDI, RAX);
+    mov_rr(as, RSI, RCX);
+    call(as, x86_opt_jit_runtime_can_store);
+  }
+  save_registers(ctx, live, true);
+  op_reg(as, 0, false, 0x84, RAX, RAX); // test al, al
+  jump(as, CC_E, deopt_label(ctx, insn->state, true));
+  bind(as, done);
+}
+
+// At loop headers: decrement the thread's fuel, and deoptimize if the thread should yield once it runs out
+static void lower_fuel_check(opt_ctx *ctx, int v, const u64 *live_after) {
+  x86_asm *as = &ctx->as;
+  const u64 *live = live_across(ctx, v, live_after, true);
+  int resume = new_label(as);
+  alu_imm_mem(as, false, ALU_SUB, at(RBX, offsetof(vm_thread, fuel)), 1);
+  jump(as, CC_AE, resume);
+  save_registers(ctx, live, false);
+  mov_rr(as, RDI, RBX);
+  call(as, x86_jit_runtime_out_of_fuel);
+  save_registers(ctx, live, true);
+  op_reg(as, 0, false, 0x84, RAX, RAX); // test al, al
+  jump(as, CC_NE, deopt_label(ctx, ctx->fn->insns[v].state, false));
+  bind(as, resume);
+}
+
+// Move the phi arguments of the edge into the phis, at the end of a block ending in a goto
+static void resolve_phis(opt_ctx *ctx, int block, int succ) {
+  const ssa_function *fn = ctx->fn;
+  const ssa_block *s = fn->blocks + succ;
+  int j = 0;
+  while (s->preds[j] != block)
+    ++j;
+  pending_move *moves = nullptr;
+  for (int i = 0; i < arrlen(s->insns) && fn->insns[s->insns[i]].op == SSA_PHI; ++i) {
+    int phi = s->insns[i], arg = fn->insns[phi].args[j];
+    bool constant = ssa_is_constant(fn, arg);
+    arrput(moves, ((pending_move){ctx->loc[phi], constant ? LOC_NONE : ctx->loc[arg], arg}));
+  }
+  parallel_move(ctx, moves);
+}
+
+static void lower_insn(opt_ctx *ctx, int b, int v, const u64 *live_after) {
+  x86_asm *as = &ctx->as;
+  const ssa_function *fn = ctx->fn;
+  const ssa_insn *insn = fn->insns + v;
+  const ssa_block *block = fn->blocks + b;
+  int a = arrlen(insn->args) > 0 ? insn->args[0] : -1;
+  switch (insn->op) {
+  case SSA_CONST:
+  case SSA_PHI:
+    break;
+  case SSA_PARAM:
+    mov_load(as, true, RAX, at(R12, (s32)(insn->imm * sizeof(stack_value))));
+    store_value(ctx, v, RAX);
+    break;
+  case SSA_ADD:
+  case SSA_SUB:
+  case SSA_MUL:
+  case SSA_DIV:
+  case SSA_REM:
+  case SSA_AND:
+  case SSA_OR:
+  case SSA_XOR:
+  case SSA_SHL:
+  case SSA_SHR:
+  case SSA_USHR:
+  case SSA_NEG:
+    lower_int_op(ctx, insn);
+    store_value(ctx, v, RAX);
+    break;
+  case SSA_FADD:
+  case SSA_FSUB:
+  case SSA_FMUL:
+  case SSA_FDIV: {
+    static const u32 opcodes[] = {0x0F58, 0x0F5C, 0x0F59, 0x0F5E}; // add, sub, mul, div
+    load_float(ctx, XMM0, a);
+    sse_value(ctx, sse_prefix(insn->type), opcodes[insn->op - SSA_FADD], XMM0, insn->args[1]);
+    store_float(ctx, v, XMM0);
+    break;
+  }
+  case SSA_FNEG:
+    load_float(ctx, XMM0, a);
+    movq_from_xmm(as, RAX, XMM0);
+    if (insn->type == TYPE_KIND_DOUBLE) {
+      op_reg(as, 0, true, 0x0FBA, 7, RAX); // btc rax, 63
+      emit8(as, 63);
+    } else {
+      alu_imm(as, false, ALU_XOR, RAX, INT32_MIN);
+    }
+    store_value(ctx, v, RAX);
+    break;
+  case SSA_SQRT:
+    sse_value(ctx, sse_prefix(insn->type), 0x0F51, XMM0, a);
+    store_float(ctx, v, XMM0);
+    break;
+  case SSA_MATH: {
+    const u64 *live = live_across(ctx, v, live_after, false);
+    load_float(ctx, XMM0, a);
+    if (arrlen(insn->args) > 1)
+      load_float(ctx, XMM1, insn->args[1]);
+    save_registers(ctx, live, false);
+    call(as, insn->fn);
+    store_float(ctx, v, XMM0);
+    save_registers(ctx, live, true);
+    break;
+  }
+  case SSA_CONVERT:
+    lower_conversion(ctx, v, live_after);
+    if (insn->type == TYPE_KIND_FLOAT || insn->type == TYPE_KIND_DOUBLE)
+      store_float(ctx, v, XMM0);
+    else
+      store_value(ctx, v, RAX);
+    break;
+  case SSA_LCMP:
+  case SSA_FCMP:
+    lower_compare(ctx, insn);
+    store_value(ctx, v, RAX);
+    break;
+  case SSA_LOAD_FIELD:
+    if (insn->compressed)
+      load_heap_ref(as, RCX, at(value_reg(ctx, a, RAX), insn->offset));
+    else
+      load_typed(as, RCX, insn->mem_type, at(value_reg(ctx, a, RAX), insn->offset));
+    store_value(ctx, v, RCX);
+    break;
+  case SSA_LOAD_STATIC:
+    mov_imm(as, RAX, (uintptr_t)insn->address);
+    load_typed(as, RCX, insn->mem_type, at(RAX, 0));
+    store_value(ctx, v, RCX);
+    break;
+  case SSA_LOAD_ELEMENT:
+  case SSA_STORE_ELEMENT: {
+    type_kind type = insn->mem_type;
+    int size = type == TYPE_KIND_REFERENCE ? (int)sizeof(heap_ref) : sizeof_type_kind(type);
+    if (insn->op == SSA_STORE_ELEMENT) {
+      load_value(ctx, RCX, insn->args[2]);
+      if (type == TYPE_KIND_REFERENCE)
+        compress_heap_ref(as, RCX); // before rdx holds the index
+    }
+    load_index(ctx, RDX, insn->args[1]);
+    mem element = {value_reg(ctx, a, RAX), RDX, size, kArrayDataOffset};
+    if (insn->op == SSA_LOAD_ELEMENT) {
+      if (type == TYPE_KIND_REFERENCE)
+        load_heap_ref(as, RCX, element);
+      else
+        load_typed(as, RCX, type, element);
+      store_value(ctx, v, RCX);
+    } else {
+      store_typed(as, type == TYPE_KIND_REFERENCE ? heap_ref_type : type, element, RCX);
+    }
+    break;
+  }
+  case SSA_ARRAY_LENGTH:
+    mov_load(as, false, RAX, at(value_reg(ctx, a, RAX), kArrayLengthOffset));
+    store_value(ctx, v, RAX);
+    break;
+  case SSA_INSTANCEOF: {
+    const u64 *live = live_across(ctx, v, live_after, false);
+    load_value(ctx, RAX, a);
+    save_registers(ctx, live, false);
+    mov_rr(as, RDI, RAX);
+    mov_imm(as, RSI, (uintptr_t)insn->classdesc);
+    call(as, x86_jit_runtime_instanceof);
+    op_reg(as, 0, false, 0x0FB6, RAX, RAX); // movzx eax, al
+    store_value(ctx, v, RAX);
+    save_registers(ctx, live, true);
+    break;
+  }
+  case SSA_STORE_FIELD:
+    load_value(ctx, RCX, insn->args[1]);
+    if (insn->compressed)
+      compress_heap_ref(as, RCX);
+    store_typed(as, insn->compressed ? heap_ref_type : insn->mem_type, at(value_reg(ctx, a, RAX), insn->offset), RCX);
+    break;
+  case SSA_STORE_STATIC:
+    load_value(ctx, RCX, a);
+    mov_imm(as, RAX, (uintptr_t)insn->address);
+    store_typed(as, insn->mem_type, at(RAX, 0), RCX);
+    break;
+  case SSA_WRITE_BARRIER:
+    load_value(ctx, RAX, a);
+    lower_write_barrier(ctx, live_across(ctx, v, live_after, false));
+    break;
+  case SSA_NULL_CHECK: {
+    int reg = value_reg(ctx, a, RAX);
+    test_rr(as, true, reg, reg);
+    jump(as, CC_E, deopt_label(ctx, insn->state, true));
+    break;
+  }
+  case SSA_BOUNDS_CHECK: {
+    // Unsigned, so that negative indices are out of bounds too
+    int reg = value_reg(ctx, a, RAX);
+    op_value(ctx, false, 0x3B, reg, insn->args[1]);
+    jump(as, CC_AE, deopt_label(ctx, insn->state, true));
+    break;
+  }
+  case SSA_ZERO_CHECK: {
+    int reg = value_reg(ctx, a, RAX);
+    test_rr(as, fn->insns[a].type == TYPE_KIND_LONG, reg, reg);
+    jump(as, CC_E, deopt_label(ctx, insn->state, true));
+    break;
+  }
+  case SSA_CLASS_CHECK: {
+    // Compared through memory, so that the guard can be made to fail if the class is unloaded
+    jit_class_guard *guard = &ctx->result->class_guards[ctx->result->class_guard_count++];
+    *guard = (jit_class_guard){insn->classdesc, insn->class_ref};
+    mov_load(as, false, RAX, at(value_reg(ctx, a, RAX), offsetof(obj_header, class_ref)));
+    mov_imm(as, RCX, (uintptr_t)&guard->class_ref);
+    op_mem(as, 0, false, 0x3B, RAX, at(RCX, 0)); // cmp eax, [rcx]
+    jump(as, CC_NE, deopt_label(ctx, insn->state, true));
+    break;
+  }
+  case SSA_CAST_CHECK:
+  case SSA_STORE_CHECK:
+    lower_helper_check(ctx, v, live_after);
+    break;
+  case SSA_FUEL_CHECK:
+    lower_fuel_check(ctx, v, live_after);
+    break;
+  case SSA_INVOKE:
+    lower_invoke(ctx, v, live_after);
+    break;
+  case SSA_NEW:
+  case SSA_NEWARRAY:
+  case SSA_ANEWARRAY:
+    lower_allocation(ctx, v, live_after);
+    break;
+  case SSA_GOTO:
+    resolve_phis(ctx, b, block->succs[0]);
+    jump_to_block(ctx, CC_ALWAYS, block->succs[0]);
+    break;
+  case SSA_BRANCH:
+    lower_branch(ctx, insn, block);
+    break;
+  case SSA_SWITCH:
+    lower_switch(ctx, v, block, live_after);
+    break;
+  case SSA_RETURN:
+    if (a != -1) {
+      load_value(ctx, RAX, a);
+      if (fn->insns[a].type == TYPE_KIND_INT)
+        movsxd_rr(as, RAX, RAX);
+      mov_store(as, true, at(R12, 0), RAX);
+    }
+    jump(as, CC_ALWAYS, ctx->pop_and_leave);
+    break;
+  case SSA_DEOPT:
+    jump(as, CC_ALWAYS, deopt_label(ctx, insn->state, true));
+    break;
+  }
+}
+
+static void lower_block(opt_ctx *ctx, int b) {
+  const ssa_function *fn = ctx->fn;
+  const ssa_block *block = fn->blocks + b;
+  int count = (int)arrlen(block->insns), words = ctx->words;
+
+  // The values live after each instruction, for calls
+  u64 *live_after = malloc(count * words * sizeof(u64));
+  u64 *live = malloc(words * sizeof(u64));
+  memcpy(live, ctx->live_out[b], words * sizeof(u64));
+  for (int i = count - 1; i >= 0; --i) {
+    memcpy(live_after + i * words, live, words * sizeof(u64));
+    step_back(fn, block->insns[i], live);
+  }
+
+  // Phis are resolved at the end of predecessors, which must all end in a goto
+  if (fn->insns[block->insns[0]].op == SSA_PHI)
+    for (int i = 0; i < arrlen(block->preds); ++i)
+      if (ssa_terminator(fn, block->preds[i])->op != SSA_GOTO)
+        ctx->failed = true;
+
+  bind(&ctx->as, ctx->block_labels[b]);
+  for (int i = 0; i < count && !ctx->failed; ++i)
+    lower_insn(ctx, b, block->insns[i], live_after + i * words);
+  free(live);
+  free(live_after);
+}
+
+// The offset beyond the compiled method's frame that deoptimizing may write inlined frames up to
+static int max_inlined_extent(const ssa_function *fn) {
+  int extent = 0;
+  for (int s = 0; s < arrlen(fn->states); ++s) {
+    if (fn->states[s].parent == -1)
+      continue;
+    int end = frame_offset(fn, s) + (int)fn->states[s].method->code->frame_size;
+    if (end > extent)
+      extent = end;
+  }
+  return extent;
+}
+
+static void emit_prologue(opt_ctx *ctx) {
+  x86_asm *as = &ctx->as;
+  push(as, RBP);
+  mov_rr(as, RBP, RSP);
+  push(as, RBX);
+  push(as, R12);
+  push(as, R13);
+  push(as, R14);
+  push(as, R15);
+  // The slots of the registers, then the spill slots, keeping the stack 16-byte aligned for calls
+  int slot_bytes = LOC_SPILL(ctx->spill_count) * 8;
+  alu_imm(as, true, ALU_SUB, RSP, slot_bytes % 16 ? slot_bytes : slot_bytes + 8);
+  mov_rr(as, RBX, RSI);
+  mov_rr(as, R12, RCX);
+
+  mov_rr(as, RDI, RBX);
+  mov_imm(as, RSI, (uintptr_t)ctx->method);
+  mov_rr(as, RDX, R12);
+  call(as, x86_jit_runtime_push_frame);
+  test_rr(as, true, RAX, RAX);
+  jump(as, CC_E, ctx->leave); // StackOverflowError
+  mov_rr(as, R13, RAX);
+
+  int extent = max_inlined_extent(ctx->fn);
+  if (extent > (int)ctx->method->code->frame_size) {
+    op_mem(as, 0, true, 0x8D, RAX, at(R13, extent)); // lea
+    op_mem(as, 0, true, 0x3B, RAX,
+           at(RBX, offsetof(vm_thread, stack) + offsetof(typeof(((vm_thread *)0)->stack), frame_buffer_end)));
+    jump(as, CC_A, ctx->deopt_on_entry);
+  }
+}
+
+static void emit_tails(opt_ctx *ctx) {
+  x86_asm *as = &ctx->as;
+  bind(as, ctx->deopt_on_entry);
+  op_mem(as, 0, false, 0xC6, 0, at(R13, offsetof(stack_frame, kind)));
+  emit8(as, FRAME_KIND_INTERPRETER);
+  jump(as, CC_ALWAYS, ctx->leave);
+
+  bind(as, ctx->pop_and_leave);
+  mov_load(as, true, RAX, at(R13, offsetof(stack_frame, prev)));
+  mov_store(as, true, at(RBX, offsetof(vm_thread, stack) + offsetof(typeof(((vm_thread *)0)->stack), top)), RAX);
+
+  bind(as, ctx->leave);
+  op_mem(as, 0, true, 0x8D, RSP, at(RBP, -PUSHED_BYTES)); // lea rsp, [rbp - 40]
+  pop(as, R15);
+  pop(as, R14);
+  pop(as, R13);
+  pop(as, R12);
+  pop(as, RBX);
+  pop(as, RBP);
+  emit8(as, 0xC3); // ret
+}
+
+static void free_ctx(opt_ctx *ctx) {
+  int block_count = (int)arrlen(ctx->fn->blocks);
+  if (ctx->live_out)
+    for (int b = 0; b < block_count; ++b)
+      free(ctx->live_out[b]);
+  free(ctx->live_out);
+  free(ctx->pos);
+  free(ctx->block_from);
+  free(ctx->block_to);
+  free(ctx->start);
+  free(ctx->end);
+  free(ctx->loc);
+  free(ctx->block_labels);
+  free(ctx->scratch);
+  arrfree(ctx->stubs);
+  arrfree(ctx->descriptors);
+  x86_asm_free(&ctx->as);
+  ssa_free(ctx->fn);
+}
+
+dumb_jit_result *x86_opt_jit_compile(cp_method *method) {
+  ssa_function *fn = ssa_build(method);
+  return fn ? x86_opt_jit_compile_ssa(fn) : nullptr;
+}
+
+dumb_jit_result *x86_opt_jit_compile_ssa(ssa_function *fn) {
+  cp_method *method = fn->method;
+  if (!ssa_optimize(fn)) {
+    ssa_free(fn);
+    return nullptr;
+  }
+  forward_single_argument_phis(fn);
+  ssa_split_critical_edges(fn);
+  ssa_compute_rpo(fn);
+  ssa_compute_dominators(fn);
+#if DCHECKS_ENABLED
+  const char *problem = ssa_verify(fn);
+  DCHECK(!problem, "%s", problem);
+#endif
+
+  dumb_jit_result *result = calloc(1, sizeof(dumb_jit_result));
+  result->optimized = true;
+  result->tier_up_countdown = INT_MAX;
+  int guard_count = 0;
+  for (int i = 0; i < arrlen(fn->insns); ++i)
+    guard_count += fn->insns[i].op == SSA_CLASS_CHECK && fn->insns[i].block != -1;
+  result->class_guards = calloc(guard_count, sizeof(jit_class_guard));
+  opt_ctx ctx_ = {.method = method, .fn = fn, .result = result}, *ctx = &ctx_;
+  ctx->words = ((int)arrlen(fn->insns) + 63) / 64;
+  ctx->scratch = calloc(ctx->words, sizeof(u64));
+  compute_liveness(ctx);
+  compute_live_ranges(ctx);
+  allocate_registers(ctx);
+
+  int block_count = (int)arrlen(fn->blocks);
+  ctx->block_labels = malloc(block_count * sizeof(int));
+  for (int b = 0; b < block_count; ++b)
+    ctx->block_labels[b] = new_label(&ctx->as);
+  for (int s = 0; s < arrlen(fn->states); ++s)
+    arrput(ctx->descriptors, -1);
+  ctx->leave = new_label(&ctx->as);
+  ctx->pop_and_leave = new_label(&ctx->as);
+  ctx->deopt_on_entry = new_label(&ctx->as);
+
+  emit_prologue(ctx);
+  for (int r = 0; r < arrlen(fn->rpo) && !ctx->failed; ++r) {
+    ctx->next_block = r + 1 < arrlen(fn->rpo) ? fn->rpo[r + 1] : -1;
+    lower_block(ctx, fn->rpo[r]);
+  }
+  emit_deopt_stubs(ctx);
+  emit_tails(ctx);
+  emit_deopt_descriptors(ctx);
+
+  bool ok = !ctx->failed && patch_fixups(&ctx->as);
+  if (ok) {
+    result->code_size = arrlen(ctx->as.buf);
+    result->code = jit_install_code(ctx->as.buf, result->code_size);
+    result->entry = result->code;
+    ok = result->code != nullptr;
+  }
+  free_ctx(ctx);
+  if (!ok) {
+    free(result->class_guards);
+    free(result);
+    return nullptr;
+  }
+  return result;
+}
+
+#else
+
+dumb_jit_result *x86_opt_jit_compile(cp_method *method) {
+  (void)method;
+  return nullptr;
+}
+
+dumb_jit_result *x86_opt_jit_compile_ssa(ssa_function *fn) {
+  ssa_free(fn);
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,35 @@
+//
+// Optimizing JIT for x86-64 Linux: the second tier, for methods whose baseline code (x86_jit.h) has run for long
+// enough.
+//
+
+#ifndef X86_OPT_JIT_H
+#define X86_OPT_JIT_H
+
+#include "bjvm.h"
+#include "dumb_jit.h"
+#include "ssa.h"
+#include "x86_jit.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Compiles the method from its SSA form (see ssa.h), with small monomorphic callees inlined, into executable memory.
+// The entry point is called like baseline code, and pushes the same kind of frame, but keeps values in registers:
+// the frame is only brought up to date at calls and allocations, and when the code deoptimizes, where the frames of
+// the method and of the callees inlined at that point are written out for the interpreter to carry on. Deoptimizing
+// too often falls back to baseline code (see dumb_jit_count_deopt).
+//
+// Returns nullptr if the method can't be compiled, in which case its baseline code keeps running.
+dumb_jit_result *x86_opt_jit_compile(cp_method *method);
+// The second half of x86_opt_jit_compile, taking ownership of the method's SSA form from ssa_build. Unlike ssa_build,
+// which reads the instructions and inline caches as the interpreter has left them, this only reads the SSA form, so it
+// may run on another thread than the one running the method (see jit_queue.h).
+dumb_jit_result *x86_opt_jit_compile_ssa(ssa_function *fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // X86_OPT_JIT_H